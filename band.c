@@ -0,0 +1,149 @@
+/* band.c:
+ *
+ * run an image processing step over horizontal bands of an image on
+ * several threads at once.
+ *
+ * the step is given as a function that processes rows y0 to y1 - 1.
+ * the calling thread works on bands too, so with -threads 1 (or
+ * without pthreads) the function is simply called once for the whole
+ * image.  the threads are started the first time they're needed and
+ * are kept for the rest of the run.  only one job has the threads at a
+ * time; a step started while they're busy is run on its caller's thread.
+ */
+
+#include "copyright.h"
+#include "xli.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define MIN_BAND_ROWS 16	/* don't split the work any finer than this */
+#define BANDS_PER_THREAD 4	/* so that uneven bands even out */
+
+#ifndef NO_PTHREADS
+
+static pthread_mutex_t BandLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t RunLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t BandStart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t BandDone = PTHREAD_COND_INITIALIZER;
+
+static int NWorkers = -1;	/* # of worker threads, -1 before startup */
+static unsigned long Generation;	/* bumped for every new job */
+static int Running;		/* # of workers yet to finish this job */
+
+static BandFunc JobFunc;	/* the job */
+static void *JobArg;
+static unsigned int JobHeight;
+static unsigned int JobRows;	/* rows per band */
+static unsigned int JobNext;	/* first row of next band to do */
+
+/* do bands of the current job until there are none left.  called and
+ * returns with BandLock held.
+ */
+static void doBands(void)
+{
+	unsigned int y0, y1;
+
+	while (JobNext < JobHeight) {
+		y0 = JobNext;
+		y1 = JobHeight - y0 > JobRows ? y0 + JobRows : JobHeight;
+		JobNext = y1;
+		pthread_mutex_unlock(&BandLock);
+		JobFunc(JobArg, y0, y1);
+		pthread_mutex_lock(&BandLock);
+	}
+}
+
+static void *bandWorker(void *arg)
+{
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&BandLock);
+	for (;;) {
+		while (Generation == seen)
+			pthread_cond_wait(&BandStart, &BandLock);
+		seen = Generation;
+		doBands();
+		if (--Running == 0)
+			pthread_cond_signal(&BandDone);
+	}
+	/* NOTREACHED */
+	return NULL;
+}
+
+/* the number of threads to use: -threads if given, otherwise one per
+ * processor.
+ */
+static int bandThreads(void)
+{
+	int n = globals.threads;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n > 0 ? n : 1;
+}
+
+static void startWorkers(void)
+{
+	pthread_t thread;
+	int n = bandThreads() - 1;
+
+	for (NWorkers = 0; NWorkers < n; NWorkers++) {
+		if (pthread_create(&thread, NULL, bandWorker, NULL)) {
+			perror("startWorkers");
+			break;
+		}
+		pthread_detach(thread);
+	}
+}
+
+void runBands(unsigned int height, BandFunc func, void *arg)
+{
+	unsigned int bands;
+
+	/* if another thread (eg. the prefetcher) has the workers, do the
+	 * whole job here rather than wait for them, so that the display
+	 * doesn't stall behind a background load.
+	 */
+	if (pthread_mutex_trylock(&RunLock)) {
+		func(arg, 0, height);
+		return;
+	}
+	if (NWorkers < 0)
+		startWorkers();
+	if (NWorkers == 0 || height < 2 * MIN_BAND_ROWS) {
+		pthread_mutex_unlock(&RunLock);
+		func(arg, 0, height);
+		return;
+	}
+
+	bands = (NWorkers + 1) * BANDS_PER_THREAD;
+	pthread_mutex_lock(&BandLock);
+	JobFunc = func;
+	JobArg = arg;
+	JobHeight = height;
+	JobRows = (height + bands - 1) / bands;
+	if (JobRows < MIN_BAND_ROWS)
+		JobRows = MIN_BAND_ROWS;
+	JobNext = 0;
+	Running = NWorkers;
+	Generation++;
+	pthread_cond_broadcast(&BandStart);
+	doBands();
+	while (Running > 0)
+		pthread_cond_wait(&BandDone, &BandLock);
+	pthread_mutex_unlock(&BandLock);
+	pthread_mutex_unlock(&RunLock);
+}
+
+#else /* NO_PTHREADS */
+
+void runBands(unsigned int height, BandFunc func, void *arg)
+{
+	func(arg, 0, height);
+}
+
+#endif /* NO_PTHREADS */
@@ -0,0 +1,749 @@
+/* bench.c:
+ *
+ * xli-bench: time xli's loaders, image processing steps and conversion
+ * for display, so that changes to them can be measured.
+ *
+ * synthetic test images are made at each of the given sizes and written
+ * in every format that xli-bench knows how to write.  each of those files
+ * is loaded, and the image processing steps are run on the loaded true
+ * color image.  any image files named on the command line are loaded
+ * and processed as well.  if an X display can be opened, the conversion
+ * done by imageToXImage() is timed too.
+ *
+ * every measurement is written as a line of JSON (to the standard output
+ * or the -o file), giving the wall and CPU time, the megapixels per
+ * second, the peak resident memory and what was allocated through
+ * lmalloc() and friends.  a table of the same goes to stderr.
+ */
+
+#include "copyright.h"
+#include "xli.h"
+#include <png.h>
+#include <jpeglib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+GlobalsRec globals;
+
+#define DEFAULT_SIZES "1,10,100"	/* megapixels */
+
+typedef struct {
+	char *name;		/* and file extension */
+	int kind;		/* of image it wants, see below */
+	boolean (*write)(Image *image, char *file);
+} BenchFormat;
+
+#define BENCH_TRUE 0
+#define BENCH_RGB 1		/* 256 color */
+#define BENCH_BIT 2
+
+typedef struct {
+	struct timeval wall;
+	double cpu;
+	unsigned long allocs, bytes;
+} BenchMark;
+
+static FILE *Results;
+static boolean ResetPeak;	/* /proc/self/clear_refs can reset the peak */
+static ImageOptions NoOptions;	/* for steps that want some */
+
+/* ---- measuring ---- */
+
+static double cpuSeconds(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* start the peak resident memory again from what's resident now, if
+ * the system lets us (Linux does).
+ */
+static void resetPeakRSS(void)
+{
+	FILE *f;
+
+	if (!ResetPeak)
+		return;
+	if (!(f = fopen("/proc/self/clear_refs", "w")) ||
+			fputs("5", f) == EOF || fclose(f) == EOF)
+		ResetPeak = FALSE;
+}
+
+/* peak resident memory in kilobytes, since the last resetPeakRSS() */
+static long peakRSS(void)
+{
+	struct rusage ru;
+	char line[256];
+	long kb = -1;
+	FILE *f;
+
+	if (ResetPeak && (f = fopen("/proc/self/status", "r"))) {
+		while (fgets(line, sizeof(line), f))
+			if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+				break;
+		fclose(f);
+		if (kb >= 0)
+			return kb;
+	}
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+static void startMark(BenchMark *mark)
+{
+	resetPeakRSS();
+	allocStats(&mark->allocs, &mark->bytes);
+	mark->cpu = cpuSeconds();
+	gettimeofday(&mark->wall, NULL);
+}
+
+/* record a measurement.  pixels is what the step worked on. */
+static void endMark(BenchMark *mark, char *input, char *format, char *stage,
+	Image *image, double pixels)
+{
+	struct timeval now;
+	unsigned long allocs, bytes;
+	double wall, cpu;
+	long rss;
+
+	gettimeofday(&now, NULL);
+	cpu = cpuSeconds() - mark->cpu;
+	allocStats(&allocs, &bytes);
+	rss = peakRSS();
+	wall = (now.tv_sec - mark->wall.tv_sec) +
+		(now.tv_usec - mark->wall.tv_usec) / 1e6;
+	if (wall <= 0)
+		wall = 1e-6;
+
+	/* the input is a file name, so it may need escaping */
+	fprintf(Results, "{\"input\": ");
+	jsonString(Results, input);
+	fprintf(Results, ", \"format\": \"%s\", "
+		"\"stage\": \"%s\", \"width\": %u, \"height\": %u, "
+		"\"megapixels\": %.3f, \"wall\": %.6f, \"cpu\": %.6f, "
+		"\"mp_per_sec\": %.3f, \"peak_rss_kb\": %ld, "
+		"\"allocs\": %lu, \"alloc_bytes\": %lu}\n",
+		format, stage, image ? image->width : 0,
+		image ? image->height : 0, pixels / 1e6, wall, cpu,
+		pixels / 1e6 / wall, rss, allocs - mark->allocs,
+		bytes - mark->bytes);
+	fflush(Results);
+	fprintf(stderr, "%-24.24s %-6s %-12s %8.3f %9.2f %9ld %8lu %10lu\n",
+		tail(input), format, stage, wall, pixels / 1e6 / wall,
+		rss / 1024, allocs - mark->allocs,
+		(bytes - mark->bytes) / 1024);
+}
+
+/* ---- synthetic images ---- */
+
+/* smooth gradients with a little noise, so that the image compresses
+ * about as well as a photograph does.
+ */
+static Image *syntheticImage(unsigned int width, unsigned int height)
+{
+	Image *image = newTrueImage(width, height);
+	unsigned long seed = 12345;
+	unsigned int x, y;
+	byte *dp = image->data;
+	int noise;
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++) {
+			seed = seed * 1103515245 + 12345;
+			noise = (int) ((seed >> 16) & 15) - 8;
+			*dp++ = (x * 255 / width + noise) & 0xff;
+			*dp++ = (y * 255 / height + noise) & 0xff;
+			*dp++ = (((x ^ y) & 0x3f) * 2 + x / 8 + noise) & 0xff;
+		}
+	image->title = dupString("synthetic");
+	image->gamma = globals.display_gamma;
+	return image;
+}
+
+/* ---- writing the formats ---- */
+
+static boolean putLong(FILE *f, unsigned long v, boolean msb)
+{
+	byte b[4];
+
+	if (msb) {
+		b[0] = v >> 24; b[1] = v >> 16; b[2] = v >> 8; b[3] = v;
+	} else {
+		b[3] = v >> 24; b[2] = v >> 16; b[1] = v >> 8; b[0] = v;
+	}
+	return fwrite(b, 1, 4, f) == 4;
+}
+
+static boolean putShort(FILE *f, unsigned int v)
+{
+	return putc(v & 0xff, f) != EOF && putc((v >> 8) & 0xff, f) != EOF;
+}
+
+static boolean closeFile(FILE *f, boolean ok)
+{
+	return !fclose(f) && ok;
+}
+
+static boolean writePNMFile(Image *image, char *file)
+{
+	return writeImage(image, &NoOptions, file, FALSE);
+}
+
+static boolean writeJPEG(Image *image, char *file)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	JSAMPROW row;
+	FILE *f;
+
+	if (!(f = fopen(file, "wb")))
+		return FALSE;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, f);
+	cinfo.image_width = image->width;
+	cinfo.image_height = image->height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 85, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		row = image->data + cinfo.next_scanline * image->width * 3;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	return closeFile(f, TRUE);
+}
+
+/* GIF LZW output, least significant bit first, in sub-blocks */
+typedef struct {
+	FILE *f;
+	unsigned long bits;
+	int nbits;
+	byte block[256];
+	int len;
+} GifOut;
+
+static void gifByte(GifOut *g, int b)
+{
+	g->block[1 + g->len++] = b;
+	if (g->len == 255) {
+		g->block[0] = 255;
+		fwrite(g->block, 1, 256, g->f);
+		g->len = 0;
+	}
+}
+
+static void gifCode(GifOut *g, int code, int size)
+{
+	g->bits |= (unsigned long) code << g->nbits;
+	g->nbits += size;
+	while (g->nbits >= 8) {
+		gifByte(g, g->bits & 0xff);
+		g->bits >>= 8;
+		g->nbits -= 8;
+	}
+}
+
+#define GIF_HASH 5003
+
+static boolean writeGIF(Image *image, char *file)
+{
+	GifOut g;
+	int *hashcode, *hashval;	/* (prefix << 8 | byte) -> code */
+	int clear = 256, eoi = 257, next, size, prefix, h, key;
+	unsigned long a, npixels = (unsigned long) image->width * image->height;
+	byte *sp = image->data;
+	FILE *f;
+
+	if (!(f = fopen(file, "wb")))
+		return FALSE;
+	fwrite("GIF87a", 1, 6, f);
+	putShort(f, image->width);
+	putShort(f, image->height);
+	putc(0xf7, f);		/* global colormap of 256 entries */
+	putc(0, f);
+	putc(0, f);
+	for (a = 0; a < 256; a++) {
+		putc(image->rgb.red[a] >> 8, f);
+		putc(image->rgb.green[a] >> 8, f);
+		putc(image->rgb.blue[a] >> 8, f);
+	}
+	putc(',', f);
+	putShort(f, 0);
+	putShort(f, 0);
+	putShort(f, image->width);
+	putShort(f, image->height);
+	putc(0, f);
+	putc(8, f);		/* initial code size */
+
+	hashcode = (int *) lmalloc(GIF_HASH * sizeof(int));
+	hashval = (int *) lmalloc(GIF_HASH * sizeof(int));
+	for (a = 0; a < GIF_HASH; a++)
+		hashcode[a] = -1;
+	g.f = f;
+	g.bits = 0;
+	g.nbits = 0;
+	g.len = 0;
+	size = 9;
+	next = eoi + 1;
+	gifCode(&g, clear, size);
+	prefix = *sp++;
+	for (a = 1; a < npixels; a++, sp++) {
+		key = (prefix << 8) | *sp;
+		for (h = key % GIF_HASH; hashcode[h] >= 0 && hashval[h] != key;
+				h = (h + 1) % GIF_HASH)
+			;
+		if (hashcode[h] >= 0) {
+			prefix = hashcode[h];
+			continue;
+		}
+		gifCode(&g, prefix, size);
+		prefix = *sp;
+		if (next < 4096) {
+			if (next == (1 << size))
+				size++;
+			hashcode[h] = next++;
+			hashval[h] = key;
+		} else {
+			gifCode(&g, clear, size);
+			for (h = 0; h < GIF_HASH; h++)
+				hashcode[h] = -1;
+			size = 9;
+			next = eoi + 1;
+		}
+	}
+	gifCode(&g, prefix, size);
+	if (next == (1 << size) && size < 12)
+		size++;
+	gifCode(&g, eoi, size);
+	if (g.nbits)
+		gifByte(&g, g.bits & 0xff);
+	if (g.len) {
+		g.block[0] = g.len;
+		fwrite(g.block, 1, g.len + 1, f);
+	}
+	putc(0, f);
+	putc(';', f);
+	lfree((byte *) hashcode);
+	lfree((byte *) hashval);
+	return closeFile(f, !ferror(f));
+}
+
+static boolean writeBMP(Image *image, char *file)
+{
+	unsigned int rowlen = (image->width * 3 + 3) & ~3, x;
+	int y;
+	byte *row, *sp, *dp;
+	boolean ok = TRUE;
+	FILE *f;
+
+	if (!(f = fopen(file, "wb")))
+		return FALSE;
+	fwrite("BM", 1, 2, f);
+	putLong(f, 54 + rowlen * image->height, FALSE);
+	putLong(f, 0, FALSE);
+	putLong(f, 54, FALSE);
+	putLong(f, 40, FALSE);
+	putLong(f, image->width, FALSE);
+	putLong(f, image->height, FALSE);
+	putShort(f, 1);
+	putShort(f, 24);
+	putLong(f, 0, FALSE);	/* BI_RGB */
+	putLong(f, rowlen * image->height, FALSE);
+	putLong(f, 2835, FALSE);
+	putLong(f, 2835, FALSE);
+	putLong(f, 0, FALSE);
+	putLong(f, 0, FALSE);
+	row = lcalloc(rowlen);
+	for (y = image->height - 1; y >= 0 && ok; y--) {
+		sp = image->data + y * image->width * 3;
+		for (x = 0, dp = row; x < image->width; x++, sp += 3) {
+			*dp++ = sp[2];
+			*dp++ = sp[1];
+			*dp++ = sp[0];
+		}
+		ok = fwrite(row, 1, rowlen, f) == rowlen;
+	}
+	lfree(row);
+	return closeFile(f, ok);
+}
+
+static boolean writeTGA(Image *image, char *file)
+{
+	byte header[18], *row, *sp, *dp;
+	unsigned int x, y;
+	boolean ok = TRUE;
+	FILE *f;
+
+	if (!(f = fopen(file, "wb")))
+		return FALSE;
+	memset(header, 0, sizeof(header));
+	header[2] = 2;		/* uncompressed true color */
+	header[12] = image->width & 0xff;
+	header[13] = image->width >> 8;
+	header[14] = image->height & 0xff;
+	header[15] = image->height >> 8;
+	header[16] = 24;
+	header[17] = 0x20;	/* top left origin */
+	fwrite(header, 1, sizeof(header), f);
+	row = lmalloc(image->width * 3);
+	for (y = 0; y < image->height && ok; y++) {
+		sp = image->data + y * image->width * 3;
+		for (x = 0, dp = row; x < image->width; x++, sp += 3) {
+			*dp++ = sp[2];
+			*dp++ = sp[1];
+			*dp++ = sp[0];
+		}
+		ok = fwrite(row, 1, image->width * 3, f) == image->width * 3;
+	}
+	lfree(row);
+	return closeFile(f, ok);
+}
+
+static boolean writeSunRaster(Image *image, char *file)
+{
+	unsigned int rowlen = (image->width * 3 + 1) & ~1, y;
+	boolean ok = TRUE;
+	byte *row;
+	FILE *f;
+
+	if (!(f = fopen(file, "wb")))
+		return FALSE;
+	putLong(f, 0x59a66a95, TRUE);
+	putLong(f, image->width, TRUE);
+	putLong(f, image->height, TRUE);
+	putLong(f, 24, TRUE);
+	putLong(f, rowlen * image->height, TRUE);
+	putLong(f, 3, TRUE);	/* RRGB: RGB rather than BGR order */
+	putLong(f, 0, TRUE);
+	putLong(f, 0, TRUE);
+	row = lcalloc(rowlen);
+	for (y = 0; y < image->height && ok; y++) {
+		memcpy(row, image->data + y * image->width * 3,
+			image->width * 3);
+		ok = fwrite(row, 1, rowlen, f) == rowlen;
+	}
+	lfree(row);
+	return closeFile(f, ok);
+}
+
+static boolean writePCX(Image *image, char *file)
+{
+	byte header[128], *sp;
+	unsigned int x, y, run;
+	int a;
+	FILE *f;
+
+	if (!(f = fopen(file, "wb")))
+		return FALSE;
+	memset(header, 0, sizeof(header));
+	header[0] = 10;
+	header[1] = 5;
+	header[2] = 1;		/* RLE */
+	header[3] = 8;
+	header[8] = (image->width - 1) & 0xff;
+	header[9] = (image->width - 1) >> 8;
+	header[10] = (image->height - 1) & 0xff;
+	header[11] = (image->height - 1) >> 8;
+	header[65] = 1;		/* planes */
+	header[66] = image->width & 0xff;
+	header[67] = image->width >> 8;
+	fwrite(header, 1, sizeof(header), f);
+	for (y = 0; y < image->height; y++) {
+		sp = image->data + y * image->width;
+		for (x = 0; x < image->width; x += run) {
+			for (run = 1; run < 63 && x + run < image->width &&
+					sp[x + run] == sp[x]; run++)
+				;
+			if (run > 1 || (sp[x] & 0xc0) == 0xc0)
+				putc(0xc0 | run, f);
+			putc(sp[x], f);
+		}
+	}
+	putc(12, f);
+	for (a = 0; a < 256; a++) {
+		putc(image->rgb.red[a] >> 8, f);
+		putc(image->rgb.green[a] >> 8, f);
+		putc(image->rgb.blue[a] >> 8, f);
+	}
+	return closeFile(f, !ferror(f));
+}
+
+static boolean writeXBM(Image *image, char *file)
+{
+	unsigned int linelen = (image->width + 7) / 8, a, n;
+	static byte flip[256];
+	byte b;
+	FILE *f;
+
+	/* X bitmaps have the leftmost pixel in the low bit */
+	for (a = 0; a < 256; a++) {
+		for (b = 0, n = 0; n < 8; n++)
+			if (a & (1 << n))
+				b |= 0x80 >> n;
+		flip[a] = b;
+	}
+	if (!(f = fopen(file, "w")))
+		return FALSE;
+	fprintf(f, "#define bench_width %u\n#define bench_height %u\n"
+		"static unsigned char bench_bits[] = {\n",
+		image->width, image->height);
+	n = linelen * image->height;
+	for (a = 0; a < n; a++)
+		fprintf(f, "0x%02x%s", flip[image->data[a]],
+			a + 1 == n ? "};\n" : (a % 12 == 11) ? ",\n" : ",");
+	return closeFile(f, !ferror(f));
+}
+
+static boolean writeXPM(Image *image, char *file)
+{
+	static char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEF";
+	unsigned int x, y, a;
+	byte *sp = image->data;
+	FILE *f;
+
+	if (!(f = fopen(file, "w")))
+		return FALSE;
+	fprintf(f, "/* XPM */\nstatic char *bench[] = {\n\"%u %u 256 2\",\n",
+		image->width, image->height);
+	for (a = 0; a < 256; a++)
+		fprintf(f, "\"%c%c c #%02x%02x%02x\",\n", chars[a >> 3],
+			chars[a & 7], image->rgb.red[a] >> 8,
+			image->rgb.green[a] >> 8, image->rgb.blue[a] >> 8);
+	for (y = 0; y < image->height; y++) {
+		putc('"', f);
+		for (x = 0; x < image->width; x++, sp++) {
+			putc(chars[*sp >> 3], f);
+			putc(chars[*sp & 7], f);
+		}
+		fprintf(f, "\"%s\n", y + 1 == image->height ? "};" : ",");
+	}
+	return closeFile(f, !ferror(f));
+}
+
+static BenchFormat Formats[] = {
+	{"ppm",	BENCH_TRUE,	writePNMFile},
+	{"pbm",	BENCH_BIT,	writePNMFile},
+	{"png",	BENCH_TRUE,	writePNMFile},
+	{"jpg",	BENCH_TRUE,	writeJPEG},
+	{"gif",	BENCH_RGB,	writeGIF},
+	{"bmp",	BENCH_TRUE,	writeBMP},
+	{"tga",	BENCH_TRUE,	writeTGA},
+	{"ras",	BENCH_TRUE,	writeSunRaster},
+	{"pcx",	BENCH_RGB,	writePCX},
+	{"xbm",	BENCH_BIT,	writeXBM},
+	{"xpm",	BENCH_RGB,	writeXPM},
+	{NULL,	0,		NULL}
+};
+
+/* ---- the benchmarks ---- */
+
+static Image *loadFile(char *file, char *input, char *format)
+{
+	ImageOptions io;
+	BenchMark mark;
+	Image *image;
+
+	memset(&io, 0, sizeof(io));
+	io.name = file;
+	io.loader_idx = -1;
+	io.gamma = UNSET_GAMMA;
+	startMark(&mark);
+	image = loadImage(&io, FALSE);
+	if (image)
+		endMark(&mark, input, format, "load", image,
+			(double) image->width * image->height);
+	else
+		fprintf(stderr, "xli-bench: couldn't load %s\n", file);
+	zreset(NULL);		/* the file is about to be replaced */
+	return image;
+}
+
+/* run one step.  the result is thrown away unless it was done in place. */
+#define STEP(NAME, CALL) { \
+	startMark(&mark); \
+	result = (CALL); \
+	endMark(&mark, input, format, NAME, result, pixels); \
+	if (result && result != image) \
+		freeImage(result); \
+}
+
+static void benchSteps(Image *image, char *input, char *format)
+{
+	double pixels = (double) image->width * image->height;
+	BenchMark mark;
+	Image *result, *small, *copy, *loaded = image;
+
+	if (!TRUEP(image))
+		image = expandtotrue(image);
+
+	STEP("zoom", zoom(image, 50, 50, FALSE, FALSE));
+	STEP("rotate", rotate(image, 90, FALSE));
+	STEP("smooth", smooth(image, 1, FALSE));
+	/* the same pixels may have just been reduced to make the test file */
+	flushReduceCache();
+	STEP("reduce", reduce(image, 256, FALSE, globals.display_gamma,
+		FALSE));
+	STEP("dither", dither(image, DITHER_DIFFUSION, FALSE));
+	STEP("ordered", dither(image, DITHER_ORDERED, FALSE));
+	STEP("halftone", halftone(image, FALSE));
+	/* merging pastes into the image it is given, so give it a copy
+	 * that the later steps won't see
+	 */
+	small = zoom(image, 50, 50, FALSE, FALSE);
+	copy = dupImage(image);
+	STEP("merge", merge(copy, small, image->width / 4,
+		image->height / 4, &NoOptions));
+	if (result != copy)
+		freeImage(copy);
+	freeImage(small);
+	/* normalizing may work in place, so it goes last */
+	STEP("normalize", normalize(image, FALSE));
+	if (image != loaded)
+		freeImage(image);
+}
+
+static void benchConvert(Image *image, char *input, char *format)
+{
+	Display *disp = globals.dinfo.disp;
+	int scrn = globals.dinfo.scrn;
+	BenchMark mark;
+	XImageInfo *xii;
+	Visual *visual;
+	unsigned int depth;
+
+	if (!disp)
+		return;
+	chooseVisual(disp, scrn, image, &visual, &depth, FALSE);
+	startMark(&mark);
+	xii = imageToXImage(disp, scrn, visual, depth, image, FALSE, FALSE,
+		&NoOptions, FALSE);
+	endMark(&mark, input, format, "imageToXImage", image,
+		(double) image->width * image->height);
+	if (xii)
+		freeXImage(image, xii);
+}
+
+static void benchFile(char *file, char *input, char *format,
+	boolean steps)
+{
+	Image *image;
+
+	if (!(image = loadFile(file, input, format)))
+		return;
+	benchConvert(image, input, format);
+	if (steps)
+		benchSteps(image, input, format);
+	freeImage(image);
+}
+
+static void usageExit(char *name)
+{
+	fprintf(stderr, "Usage: %s [-sizes mp[,mp...]] [-formats fmt[,fmt...]]\n"
+		"\t[-dir directory] [-o results] [-threads n] [-nodisplay] [image ...]\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	char *sizes = DEFAULT_SIZES, *formats = NULL, *dir = "/tmp";
+	char file[BUFSIZ], input[64], *s;
+	boolean nodisplay = FALSE, stepped;
+	Image *base, *kinds[3];
+	unsigned int width, height;
+	double mp;
+	int a, k;
+
+	CURRFUNC("main");
+
+	loadPathsAndExts();
+	xliDefaultDispinfo(&globals.dinfo);
+	globals.argv0 = argv[0];
+	globals.display_gamma = DEFAULT_DISPLAY_GAMMA;
+	globals.visual_class = -1;
+	Results = stdout;
+	ResetPeak = TRUE;
+
+	for (a = 1; a < argc && argv[a][0] == '-'; a++) {
+		if (!strcmp(argv[a], "-sizes") && a + 1 < argc)
+			sizes = argv[++a];
+		else if (!strcmp(argv[a], "-formats") && a + 1 < argc)
+			formats = argv[++a];
+		else if (!strcmp(argv[a], "-dir") && a + 1 < argc)
+			dir = argv[++a];
+		else if (!strcmp(argv[a], "-threads") && a + 1 < argc)
+			globals.threads = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-nodisplay"))
+			nodisplay = TRUE;
+		else if (!strcmp(argv[a], "-o") && a + 1 < argc) {
+			if (!(Results = fopen(argv[++a], "w"))) {
+				perror(argv[a]);
+				exit(1);
+			}
+		} else
+			usageExit(argv[0]);
+	}
+
+	/* the conversion for display is timed if there's a display */
+	if (nodisplay || !xliOpenDisplay(&globals.dinfo, NULL)) {
+		if (!nodisplay)
+			fprintf(stderr, "xli-bench: no display, so imageToXImage() isn't timed\n");
+		xliNullDisplay(&globals.dinfo, NULL, TrueColor);
+	}
+
+	/* writeImage() writes the test files as for a TrueColor display */
+	globals.dinfo.visual_class = TrueColor;
+	globals.dinfo.depth = 24;
+
+	fprintf(stderr, "%-24s %-6s %-12s %8s %9s %9s %8s %10s\n", "input",
+		"format", "stage", "seconds", "MP/s", "peak MB", "allocs",
+		"alloc KB");
+
+	for (s = sizes; s && *s; s = strchr(s, ',') ? strchr(s, ',') + 1 : NULL) {
+		if ((mp = atof(s)) <= 0)
+			usageExit(argv[0]);
+		width = sqrt(mp * 1e6 * 4 / 3);
+		height = mp * 1e6 / width;
+		snprintf(input, sizeof(input), "synthetic-%gmp", mp);
+		base = syntheticImage(width, height);
+		kinds[BENCH_TRUE] = base;
+		kinds[BENCH_RGB] = reduce(base, 256, FALSE,
+			globals.display_gamma, FALSE);
+		kinds[BENCH_BIT] = dither(base, DITHER_DIFFUSION, FALSE);
+		stepped = FALSE;
+
+		for (k = 0; Formats[k].name; k++) {
+			if (formats && !strstr(formats, Formats[k].name))
+				continue;
+			snprintf(file, sizeof(file), "%s/xli-bench-%d.%s",
+				dir, (int) getpid(), Formats[k].name);
+			if (!Formats[k].write(kinds[Formats[k].kind], file)) {
+				fprintf(stderr, "xli-bench: couldn't write %s: %s\n",
+					file, strerror(errno));
+				unlink(file);
+				continue;
+			}
+			/* the processing steps only need timing once */
+			benchFile(file, input, Formats[k].name, !stepped);
+			stepped = TRUE;
+			unlink(file);
+		}
+		freeImage(kinds[BENCH_BIT]);
+		freeImage(kinds[BENCH_RGB]);
+		freeImage(base);
+	}
+
+	for (; a < argc; a++)
+		benchFile(argv[a], argv[a], "file", TRUE);
+	xliCloseDisplay(&globals.dinfo);
+	return 0;
+}
@@ -11,67 +11,82 @@
 #include "copyright.h"
 #include "xli.h"
 
-/* alter an image's brightness by a given percentage
+/* map every byte of a true color image through a table, a band of rows
+ * at a time.
  */
 
-void brighten(Image *image, unsigned int percent, unsigned int verbose)
+typedef struct {
+  Image *image;
+  byte  *table;
+} TableJob;
+
+static void tableBand(void *arg, unsigned int y0, unsigned int y1)
+{ TableJob *job= (TableJob *)arg;
+  unsigned int linelen= job->image->width * 3;
+  byte *destptr= job->image->data + y0 * linelen;
+  byte *endptr= job->image->data + y1 * linelen;
+  byte *table= job->table;
+
+  while (destptr < endptr) {
+    *destptr= table[*destptr];
+    destptr++;
+  }
+}
+
+static void applyTable(Image *image, byte *table)
+{ TableJob job;
+
+  job.image= image;
+  job.table= table;
+  runBands(image->height, tableBand, &job);
+}
+
+/* make a table that brightens by a given percentage
+ */
+
+static void brightTable(unsigned int percent, byte *table)
 { int          a;
   unsigned int newrgb;
   float        fperc;
-  unsigned int size;
-  byte        *destptr;
 
-  if (BITMAPP(image))
-    return;
-
-  if(GAMMA_NOT_EQUAL(image->gamma, 1.0))
-    gammacorrect(image, 1.0, verbose);
-
-  if (verbose) {
-    printf("  Brightening colormap by %d%%...", percent);
-    fflush(stdout);
+  fperc= (float)percent / 100.0;
+  for (a= 0; a < 256; a++) {
+    newrgb= a * fperc;
+    if (newrgb > 255)
+      newrgb= 255;
+    table[a]= newrgb;
   }
+}
 
-  fperc= (float)percent / 100.0;
+/* brighten a colormap by a given percentage
+ */
 
-  switch (image->type) {
-  case IRGB:
-    for (a= 0; a < image->rgb.used; a++) {
-      newrgb= *(image->rgb.red + a) * fperc;
-      if (newrgb > 65535)
-	newrgb= 65535;
-      *(image->rgb.red + a)= newrgb;
-      newrgb= *(image->rgb.green + a) * fperc;
-      if (newrgb > 65535)
-	newrgb= 65535;
-      *(image->rgb.green + a)= newrgb;
-      newrgb= *(image->rgb.blue + a) * fperc;
-      if (newrgb > 65535)
-	newrgb= 65535;
-      *(image->rgb.blue + a)= newrgb;
-    }
-    break;
+static void brightenColormap(Image *image, unsigned int percent)
+{ int          a;
+  unsigned int newrgb;
+  float        fperc;
 
-  case ITRUE:
-    size= image->width * image->height * 3;
-    destptr= image->data;
-    for (a= 0; a < size; a++) {
-      newrgb= *destptr * fperc;
-      if (newrgb > 255)
-	newrgb= 255;
-      *(destptr++)= newrgb;
-    }
-    break;
+  fperc= (float)percent / 100.0;
+  for (a= 0; a < image->rgb.used; a++) {
+    newrgb= *(image->rgb.red + a) * fperc;
+    if (newrgb > 65535)
+      newrgb= 65535;
+    *(image->rgb.red + a)= newrgb;
+    newrgb= *(image->rgb.green + a) * fperc;
+    if (newrgb > 65535)
+      newrgb= 65535;
+    *(image->rgb.green + a)= newrgb;
+    newrgb= *(image->rgb.blue + a) * fperc;
+    if (newrgb > 65535)
+      newrgb= 65535;
+    *(image->rgb.blue + a)= newrgb;
   }
-  if (verbose)
-    printf("done\n");
 }
 
 void gammacorrect(Image *image, float target_gam, unsigned int verbose)
 { int          a;
   int gammamap[256];
-  unsigned int size;
-  byte        *destptr;
+  byte         table[256];
 
   if (BITMAPP(image)) {	/* bitmap gamma looks ok on any screen */
     image->gamma = target_gam;
@@ -95,12 +110,9 @@ void gammacorrect(Image *image, float target_gam, unsigned int verbose)
     break;
 
   case ITRUE:
-    size= image->width * image->height * 3;
-    destptr= image->data;
-    for (a= 0; a < size; a++) {
-      *destptr= gammamap[*destptr];
-      destptr++;
-    }
+    for (a= 0; a < 256; a++)
+      table[a]= gammamap[a];
+    applyTable(image, table);
     break;
   }
 
@@ -112,11 +124,11 @@ void gammacorrect(Image *image, float target_gam, unsigned int verbose)
 /* 
  * Apply default gamma values to an image
  */
-void defaultgamma(Image *image)
+void defaultgamma(Image *image, unsigned int verbose)
 {
   if (BITMAPP(image)) {  /* We can't change the gamma of a bitmap */
     image->gamma = globals.display_gamma;
-    if (globals.verbose) {
+    if (verbose) {
       printf("  Default gamma is arbitrary for bitmap\n");
       fflush(stdout);
     }
@@ -124,7 +136,7 @@ void defaultgamma(Image *image)
   }
   if (RGBP(image)) {  /* Assume 8 bit mapped images are gamma corrected */
     image->gamma = DEFAULT_IRGB_GAMMA;
-    if (globals.verbose) {
+    if (verbose) {
       printf("  Default gamma for IRGB image is  %4.2f\n",image->gamma);
       fflush(stdout);
     }
@@ -132,7 +144,7 @@ void defaultgamma(Image *image)
   }
   if (TRUEP(image)) {  /* Assume a 24 bit image is linear */
     image->gamma = 1.0;
-    if (globals.verbose) {
+    if (verbose) {
       printf("  Default gamma for ITRUE image is  %4.2f\n",image->gamma);
       fflush(stdout);
     }
@@ -158,160 +170,261 @@ static void setupNormalizationArray(unsigned int min, unsigned int max, byte *ar
   }
 }
 
-/* normalize an image.
+/* expand a normalized RGB image to true color, a band of rows at a time
  */
 
-Image *normalize(Image *image, unsigned int verbose)
-{ unsigned int  a, x, y;
-  unsigned int  min, max;
+typedef struct {
+  Image *image, *newimage;
+  byte  *array;
+} NormalizeJob;
+
+static void normalizeBand(void *arg, unsigned int y0, unsigned int y1)
+{ NormalizeJob *job= (NormalizeJob *)arg;
+  Image        *image= job->image;
+  byte         *array= job->array;
+  unsigned int  x, y;
   Pixel         pixval;
-  Image        *newimage;
   byte         *srcptr, *destptr;
-  byte          array[256];
 
-  if (BITMAPP(image))
-    return(image);
+  srcptr= image->data + y0 * image->width * image->pixlen;
+  destptr= job->newimage->data + y0 * image->width * 3;
+  for (y = y0; y < y1; y++) {
+    for (x = 0; x < image->width; x++) {
+      pixval = memToVal(srcptr, image->pixlen);
+      *destptr++ = array[image->rgb.red[pixval] >> 8];
+      *destptr++ = array[image->rgb.green[pixval] >> 8];
+      *destptr++ = array[image->rgb.blue[pixval] >> 8];
+      srcptr += image->pixlen;
+    }
+  }
+}
+
+/* convert a band of rows of a true color image to grayscale, looking
+ * each byte up in one table on the way in and each gray level up in
+ * another on the way out.
+ */
 
-  if(GAMMA_NOT_EQUAL(image->gamma, 1.0))
-    gammacorrect(image, 1.0, verbose);
+typedef struct {
+  Image *image;
+  byte  *in, *out;
+} GrayJob;
 
-  if (verbose) {
-    printf("  Normalizing...");
-    fflush(stdout);
+static void grayBand(void *arg, unsigned int y0, unsigned int y1)
+{ GrayJob *job= (GrayJob *)arg;
+  Image *image= job->image;
+  byte *in= job->in, *out= job->out;
+  unsigned int a, size;
+  Intensity intensity, red, green, blue;
+  byte *destptr;
+
+  size= image->width * (y1 - y0);
+  destptr= image->data + y0 * image->width * 3;
+  for (a= 0; a < size; a++) {
+    red= in[*destptr] << 8;
+    green= in[*(destptr + 1)] << 8;
+    blue= in[*(destptr + 2)] << 8;
+    intensity= out[((Intensity)colorIntensity(red, green, blue)) >> 8];
+    *(destptr++)= intensity; /* red */
+    *(destptr++)= intensity; /* green */
+    *(destptr++)= intensity; /* blue */
   }
-  switch (image->type) {
-  case IRGB:
-    min= 256;
-    max = 0;
-    for (a= 0; a < image->rgb.used; a++) {
-      byte red, green, blue;
-
-      red= image->rgb.red[a] >> 8;
-      green= image->rgb.green[a] >> 8;
-      blue= image->rgb.blue[a] >> 8;
-      if (red < min)
-	min= red;
-      if (red > max)
-	max= red;
-      if (green < min)
-	min= green;
-      if (green > max)
-	max= green;
-      if (blue < min)
-	min= blue;
-      if (blue > max)
-	max= blue;
+}
+
+/* convert an image to grayscale, normalize it and brighten it by a
+ * percentage, in that order, leaving out any that aren't wanted.  all
+ * of them work on linear intensities, so the image is made linear
+ * first.
+ *
+ * a true color image has all of these folded into one table that each
+ * byte is looked up in, so it's only gone over once (twice if it's
+ * normalized, since the range of values has to be found first).
+ * conversion to grayscale mixes the channels and can't go in a table,
+ * so it's done on its own pass with the tables either side of it.
+ *
+ * a colormapped image has its colormap altered, except that normalizing
+ * makes it true color, which is brightened as it's made.
+ */
+
+Image *adjustImage(Image *image, boolean dogray, boolean donormalize,
+		   unsigned int bright, unsigned int verbose)
+{ unsigned int  a, min, max;
+  int           gammamap[256];
+  byte          in[256], out[256], array[256], table[256];
+  boolean       seen[256];
+  Intensity     intensity;
+  Image        *newimage= image;
+  byte         *srcptr, *endptr;
+  GrayJob       gjob;
+  NormalizeJob  njob;
+
+  if (BITMAPP(image) || (!dogray && !donormalize && !bright))
+    return(image);
+
+  /* the table that each byte starts off through makes it linear
+   */
+
+  for (a= 0; a < 256; a++)
+    in[a]= a;
+  if (GAMMA_NOT_EQUAL(image->gamma, 1.0)) {
+    if (TRUEP(image)) {
+      if (verbose)
+	printf("  Adjusting image gamma from %4.2f to 1.00 for image processing...\n",
+	       image->gamma);
+      make_gamma(1.0 / image->gamma, gammamap);
+      for (a= 0; a < 256; a++)
+	in[a]= gammamap[a];
+      image->gamma= 1.0;
     }
-    setupNormalizationArray(min, max, array, verbose);
-
-    newimage= newTrueImage(image->width, image->height);
-    srcptr= image->data;
-    destptr= newimage->data;
-    for (y = 0; y < image->height; y++) {
-      for (x = 0; x < image->width; x++) {
-	pixval = memToVal(srcptr, image->pixlen);
-	*destptr++ = array[image->rgb.red[pixval] >> 8];
-	*destptr++ = array[image->rgb.green[pixval] >> 8];
-	*destptr++ = array[image->rgb.blue[pixval] >> 8];
-	srcptr += image->pixlen;
+    else
+      gammacorrect(image, 1.0, verbose);
+  }
+  for (a= 0; a < 256; a++)
+    out[a]= a;
+  if (bright)
+    brightTable(bright, out);
+
+  if (dogray) {
+    if (verbose) {
+      printf("  Converting image to grayscale...");
+      fflush(stdout);
+    }
+    if (RGBP(image))
+      for (a= 0; a < image->rgb.used; a++) {
+	intensity= colorIntensity(image->rgb.red[a],
+				  image->rgb.green[a],
+				  image->rgb.blue[a]);
+	image->rgb.red[a]= intensity;
+	image->rgb.green[a]= intensity;
+	image->rgb.blue[a]= intensity;
       }
+    else {
+
+      /* brightening can be done on the way out unless normalizing
+       * comes in between
+       */
+
+      for (a= 0; a < 256; a++)
+	array[a]= a;
+      gjob.image= image;
+      gjob.in= in;
+      gjob.out= (donormalize ? array : out);
+      runBands(image->height, grayBand, &gjob);
+      for (a= 0; a < 256; a++)	/* it's linear now */
+	in[a]= a;
+      if (!donormalize)
+	bright= 0;
     }
-    newimage->title= dupString(image->title);
-    newimage->gamma= image->gamma;
-    break;
+    if (verbose)
+      printf("done\n");
+  }
 
-  case ITRUE:
-    srcptr= image->data;
-    min= 255;
-    max= 0;
-    for (y= 0; y < image->height; y++)
-      for (x= 0; x < image->width; x++) {
-	if (*srcptr < min)
-	  min= *srcptr;
-	if (*srcptr > max)
-	  max= *srcptr;
-	srcptr++;
-	if (*srcptr < min)
-	  min= *srcptr;
-	if (*srcptr > max)
-	  max= *srcptr;
-	srcptr++;
-	if (*srcptr < min)
-	  min= *srcptr;
-	if (*srcptr > max)
-	  max= *srcptr;
-	srcptr++;
-      }
-    setupNormalizationArray(min, max, array, verbose);
-
-    srcptr= image->data;
-    for (y= 0; y < image->height; y++)
-      for (x= 0; x < image->width; x++) {
-	*srcptr= array[*srcptr];
-	srcptr++;
-	*srcptr= array[*srcptr];
-	srcptr++;
-	*srcptr= array[*srcptr];
-	srcptr++;
+  if (donormalize) {
+    if (verbose) {
+      printf("  Normalizing...");
+      fflush(stdout);
+    }
+    bzero(array, sizeof(array));
+    if (RGBP(image)) {
+      min= 256;
+      max = 0;
+      for (a= 0; a < image->rgb.used; a++) {
+	byte red, green, blue;
+
+	red= image->rgb.red[a] >> 8;
+	green= image->rgb.green[a] >> 8;
+	blue= image->rgb.blue[a] >> 8;
+	if (red < min)
+	  min= red;
+	if (red > max)
+	  max= red;
+	if (green < min)
+	  min= green;
+	if (green > max)
+	  max= green;
+	if (blue < min)
+	  min= blue;
+	if (blue > max)
+	  max= blue;
       }
-    newimage= image;
-    break;
-
-  default:
-    newimage= image;
-    break;
+      setupNormalizationArray(min, max, array, verbose);
+      for (a= 0; a < 256; a++)
+	table[a]= out[array[a]];
+
+      newimage= newTrueImage(image->width, image->height);
+      njob.image= image;
+      njob.newimage= newimage;
+      njob.array= table;
+      runBands(image->height, normalizeBand, &njob);
+      newimage->title= dupString(image->title);
+      newimage->gamma= image->gamma;
+    }
+    else {
+
+      /* the range is of the values the bytes will have been made
+       */
+
+      bzero(seen, sizeof(seen));
+      srcptr= image->data;
+      endptr= srcptr + image->width * image->height * 3;
+      while (srcptr < endptr)
+	seen[*srcptr++]= TRUE;
+      min= 255;
+      max= 0;
+      for (a= 0; a < 256; a++)
+	if (seen[a]) {
+	  if (in[a] < min)
+	    min= in[a];
+	  if (in[a] > max)
+	    max= in[a];
+	}
+      setupNormalizationArray(min, max, array, verbose);
+      for (a= 0; a < 256; a++)
+	table[a]= out[array[in[a]]];
+      applyTable(image, table);
+    }
+    bright= 0;
+    if (verbose)
+      printf("done\n");
   }
 
-  if (verbose)
-    printf("done\n");
+  if (bright) {
+    if (verbose) {
+      printf("  Brightening colormap by %d%%...", bright);
+      fflush(stdout);
+    }
+    if (RGBP(image))
+      brightenColormap(image, bright);
+    else {
+      for (a= 0; a < 256; a++)
+	table[a]= out[in[a]];
+      applyTable(image, table);
+    }
+    if (verbose)
+      printf("done\n");
+  }
   return(newimage);
 }
 
-/* convert to grayscale
+/* alter an image's brightness by a given percentage
  */
 
-void gray(Image *image, int verbose)
-{ int a;
-  unsigned int size;
-  Intensity intensity, red, green, blue;
-  byte *destptr;
+void brighten(Image *image, unsigned int percent, unsigned int verbose)
+{
+  adjustImage(image, FALSE, FALSE, percent, verbose);
+}
 
-  if (BITMAPP(image))
-    return;
+/* normalize an image.
+ */
 
-  if(GAMMA_NOT_EQUAL(image->gamma, 1.0))
-    gammacorrect(image, 1.0, verbose);
+Image *normalize(Image *image, unsigned int verbose)
+{
+  return(adjustImage(image, FALSE, TRUE, 0, verbose));
+}
 
-  if (verbose) {
-    printf("  Converting image to grayscale...");
-    fflush(stdout);
-  }
-  switch (image->type) {
-  case IRGB:
-    for (a= 0; a < image->rgb.used; a++) {
-      intensity= colorIntensity(image->rgb.red[a],
-				image->rgb.green[a],
-				image->rgb.blue[a]);
-      image->rgb.red[a]= intensity;
-      image->rgb.green[a]= intensity;
-      image->rgb.blue[a]= intensity;
-    }
-    break;
+/* convert to grayscale
+ */
 
-  case ITRUE:
-    size= image->width * image->height;
-    destptr= image->data;
-    for (a= 0; a < size; a++) {
-      red= *destptr << 8;
-      green= *(destptr + 1) << 8;
-      blue= *(destptr + 2) << 8;
-      intensity= ((Intensity)colorIntensity(red, green, blue)) >> 8;
-      *(destptr++)= intensity; /* red */
-      *(destptr++)= intensity; /* green */
-      *(destptr++)= intensity; /* blue */
-    }
-    break;
-  }
-  if (verbose)
-    printf("done\n");
+void gray(Image *image, int verbose)
+{
+  adjustImage(image, TRUE, FALSE, 0, verbose);
 }
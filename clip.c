@@ -14,7 +14,8 @@
 #define ABS(x)   ((x) < 0 ? -(x) : (x))
 
 Image *clip(Image *iimage, int clipx, int clipy,
-	unsigned int clipw, unsigned int cliph, ImageOptions *imgopp)
+	unsigned int clipw, unsigned int cliph, ImageOptions *imgopp,
+	unsigned int verbose)
 {
   Image *simage = iimage, *dimage;
   int  dclipx, dclipy;
@@ -28,7 +29,7 @@ Image *clip(Image *iimage, int clipx, int clipy,
   boolean       border_shows = FALSE;
   Pixel         border_pv = 0;
 
-  if (globals.verbose) {
+  if (verbose) {
     printf("  Clipping image...");
     fflush(stdout);
   }
@@ -80,7 +81,7 @@ Image *clip(Image *iimage, int clipx, int clipy,
       dcliph = cliph - dclipy;
   }
 
-  if (globals.verbose) {
+  if (verbose) {
     if (border_shows)
       printf("(Adding border)");
     printf("...");
@@ -243,7 +244,7 @@ Image *clip(Image *iimage, int clipx, int clipy,
   dimage->gamma= simage->gamma;
   if (simage != iimage)		/* free intemediate image, but preserver input */
     freeImage(simage);
-  if (globals.verbose)
+  if (verbose)
     printf("done\n");
   return(dimage);
 }
@@ -17,6 +17,43 @@ void xliDefaultDispinfo(DisplayInfo *dinfo)
 	dinfo->disp = NULL;
 	dinfo->scrn = 0;
 	dinfo->colormap = 0;
+	dinfo->direct_visual = NULL;
+	dinfo->direct_cmap = 0;
+	dinfo->direct_values = NULL;
+	dinfo->visual_class = -1;
+	dinfo->depth = 0;
+}
+
+/* set up a display that isn't there, for writing images to files rather
+ * than showing them.  size is WIDTHxHEIGHT, or NULL for the default, and
+ * the visual class is as given by -visual (TrueColor if it wasn't).
+ * Return FALSE if the size doesn't make sense.
+ */
+boolean xliNullDisplay(DisplayInfo *dinfo, char *size, int visual_class)
+{
+	int width = DEFAULT_SCREEN_WIDTH, height = DEFAULT_SCREEN_HEIGHT;
+
+	if (size && ((sscanf(size, "%dx%d", &width, &height) != 2) ||
+			width <= 0 || height <= 0))
+		return FALSE;
+	dinfo->disp = NULL;
+	dinfo->scrn = 0;
+	dinfo->colormap = 0;
+	dinfo->width = width;
+	dinfo->height = height;
+	dinfo->visual_class = visual_class == -1 ? TrueColor : visual_class;
+	switch (dinfo->visual_class) {
+	case TrueColor:
+	case DirectColor:
+		dinfo->depth = 24;
+		break;
+	case StaticGray:
+		dinfo->depth = 1;
+		break;
+	default:
+		dinfo->depth = 8;
+	}
+	return TRUE;
 }
 
 /* open up a display and screen, and stick the info away */
@@ -25,6 +62,10 @@ boolean xliOpenDisplay(DisplayInfo *dinfo, char *name)
 {
 	Display *disp;
 	int scrn;
+
+	/* prefetching images may use Xlib from a second thread */
+	if (globals.prefetch > 0)
+		XInitThreads();
 	if (!(disp = XOpenDisplay(globals.dname)))
 		return FALSE;	/* failed */
 	scrn = DefaultScreen(disp);
@@ -46,7 +87,12 @@ char *xliDisplayName(char *name)
 
 void xliCloseDisplay(DisplayInfo *dinfo)
 {
-	XCloseDisplay(dinfo->disp);
+	if (dinfo->disp)
+		XCloseDisplay(dinfo->disp);
+	if (dinfo->direct_values)
+		lfree((byte *) dinfo->direct_values);
+	dinfo->direct_visual = NULL;
+	dinfo->direct_values = NULL;
 }
 
 /*
@@ -69,12 +115,16 @@ int errorHandler(Display * disp, XErrorEvent * error)
 /* Return the default visual class */
 int xliDefaultVisual(void)
 {
+	if (!globals.dinfo.disp)
+		return (globals.dinfo.visual_class);
 	return (DefaultVisual(globals.dinfo.disp, globals.dinfo.scrn)->class);
 }
 
 /* return the default depth of the default visual */
 int xliDefaultDepth(void)
 {
+	if (!globals.dinfo.disp)
+		return (globals.dinfo.depth);
 	return DefaultDepth(globals.dinfo.disp, globals.dinfo.scrn);
 }
 
@@ -86,6 +86,11 @@ typedef struct {
 	Display *disp;
 	int scrn;
 	Colormap colormap;
+	Visual *direct_visual;	/* DirectColor visual with known pixel values */
+	Colormap direct_cmap;	/* colormap they were allocated in */
+	Pixel *direct_values;	/* red, green, blue values per intensity */
+	int visual_class;	/* visual and depth of a display that isn't */
+	int depth;		/* there (see xliNullDisplay()) */
 } DisplayInfo;
 
 /* This struct holds the X-client side bits for a rendered image. */
@@ -102,8 +107,9 @@ typedef struct {
 	Pixel background;
 	Colormap cmap;		/* colormap used for image */
 	GC gc;			/* cached gc for sending image */
-	XImage *ximage;		/* ximage structure */
+	XImage *ximage;		/* ximage structure, NULL if tiled */
 	XShmSegmentInfo shm;	/* valid if shm.shmid >= 0 */
+	struct xlitiles *tiles;	/* tiles to draw the image from, if tiled */
 } XImageInfo;
 
 /* ddxli.c */
@@ -15,6 +15,15 @@
  *			   gamma adjustment is better. Clean up values so
  * 			   that dithering mono images doesn't change them!
  *
+ * the grey levels are found a band of rows per thread, ROWS rows at a
+ * time.  the error diffusion itself can't be split up, since with
+ * serpentine rows every pixel of a row depends on the whole of the row
+ * before, so it's done in one pass per row that also packs the bits.
+ *
+ * ordered and blue noise dithering compare each pixel with a threshold
+ * from a matrix tiled over the image instead, so every row stands alone
+ * and the whole image is done a band of rows per thread.
+ *
  * Copyright 1990 Kirk L. Johnson (see the included file
  * "kljcpyrght.h" for complete copyright information)
  *
@@ -30,28 +39,148 @@
 #define Threshold     (MaxGrey/2)	/* in the dithering process */
 #define MinGrey           0
 
-static void         LeftToRight(int *curr, int *next, int width);
-static void         RightToLeft(int *curr, int *next, int width);
+#define ROWS             64         /* rows of grey levels found at once */
+
+#define MSIZE DITHER_MATRIX_SIZE
+
+typedef struct {
+  Image          *cimage;	/* source image */
+  int            *grey;		/* grey map for source image, or NULL */
+  unsigned short *levels;	/* grey levels of ROWS rows */
+  unsigned int    y;		/* first row in levels */
+  Image          *image;	/* destination image when thresholding */
+  unsigned short  threshold[MSIZE * MSIZE];
+				/* grey level each pixel must reach to be
+				 * white when thresholding */
+} GreyJob;
+
+/*
+ * a 32x32 blue noise matrix, made with the void-and-cluster method
+ * (Ulichney, 1993) using a gaussian filter with a sigma of 1.5.
+ * each entry is the rank, 0 to 1023, at which that pixel turns on.
+ */
+static unsigned short BlueNoise[MSIZE * MSIZE] =
+{
+	 474, 555,  24, 635, 835,  82, 722, 224, 869, 123, 927, 246, 503, 892,  14, 472,
+	 294,  73, 732, 212, 666, 997,  31, 604, 762, 248, 476, 799, 291, 994, 691, 349,
+	 100, 818,1007, 173, 285, 519, 350,  10, 487, 576, 768, 657, 391, 307, 821, 675,
+	1014, 622, 928, 506, 302, 389, 179, 937, 313, 557, 958, 114, 402, 528, 210, 881,
+	 624, 231, 697, 408, 921, 756, 965, 669, 822, 344, 185,  55, 979, 135, 556, 228,
+	 412, 149, 355,  43, 832, 586, 703, 464,  93, 863, 182, 602, 845,  49, 767, 422,
+	 961, 340, 502,  65, 591, 125, 435, 256, 102,1020, 457, 851, 515, 736, 923,  63,
+	 791, 871, 571, 747, 130, 904, 242, 805, 354, 678, 419, 721, 331, 949, 580, 152,
+	  11, 873, 749, 270, 803, 201, 639, 870, 559, 705, 290, 616, 217, 338, 442, 609,
+	 297, 477, 196, 992, 418, 520,  53, 975, 539,   6,1003, 225,  88, 470, 263, 707,
+	 534, 186, 631, 982, 462, 896, 335,  61, 379, 156, 812,  21, 946, 672,  98, 753,
+	 966,  18, 644, 268, 690, 328, 621, 171, 765, 288, 489, 889, 779, 640, 862, 366,
+	 790, 430, 110, 364,  36, 538, 720, 953, 782, 438, 900, 542, 396, 154, 836, 236,
+	 523, 348, 784, 916,  72, 883, 739, 387, 935, 645, 112, 567, 382, 168,  69,1019,
+	 593, 233, 912, 817, 687, 150, 275, 496, 213, 652,  90, 243, 761,1004, 570, 421,
+	 868, 106, 562, 414, 160, 499, 253,  85, 445, 203, 824, 309, 969, 743, 495, 295,
+	  45, 734, 478, 304, 578,1011, 857,   0, 589, 987, 353, 683, 482, 300,  76, 710,
+	 174, 665, 989, 241, 823, 592,1017, 789, 558, 880, 713,  26, 456, 222, 633, 894,
+	 155, 983, 654,  96, 199, 443, 377, 764, 318, 134, 800, 939,  32, 619, 908, 370,
+	 948, 301, 483,  60, 719, 342,  16, 671, 284, 140, 367, 598, 913,  97, 819, 405,
+	 560, 266, 371, 926, 837, 711,  81, 634, 882, 451, 554, 184, 427, 816, 226, 550,
+	   8, 769, 612, 867, 447, 914, 194, 411, 932, 521, 990, 251, 694, 524, 317, 706,
+	 876, 772, 535,  38, 606, 244, 504, 945, 218,  46, 718, 279, 887, 118, 726, 454,
+	 841, 208, 388, 144, 272, 642, 546, 839, 104, 725,  54, 426, 854, 178, 964,   7,
+	 220, 115, 453, 795, 324, 973, 126, 308, 754, 608, 995, 361, 646, 510, 314,1015,
+	 105, 573, 929, 695, 996,  89, 741, 325, 475, 221, 809, 660, 120, 386, 618, 484,
+	 363, 643,1005, 180, 413, 738, 552, 849, 409, 492, 147, 780,  40, 952, 191, 664,
+	 407, 752, 326,  27, 480, 383, 170, 978, 627, 901, 565, 306,1009, 777, 258, 933,
+	 842, 724, 278, 583, 898,  12, 673, 197,  71, 893, 245, 564, 437, 806, 595,  59,
+	 860, 247, 533, 820, 603, 890, 783, 259,   2, 380, 157, 466,  35, 532, 712,  74,
+	 163, 508,  51, 813, 143, 473, 356,1021, 796, 322, 655, 940, 127, 339, 240, 925,
+	 500, 117, 960, 175, 286,  68, 540, 459, 856, 709, 950, 649, 878, 192, 420, 588,
+	 986, 410, 886, 336, 636, 934, 262, 596, 514, 727,  30, 385, 834, 688, 463, 759,
+	 311, 701, 629, 444, 731, 972, 661, 131, 319, 551,  91, 273, 360, 801, 918, 320,
+	 686, 237, 744, 544, 215, 787, 696,  94, 165, 432, 984, 211, 526, 903,   4, 166,
+	1001, 393,  33, 844, 345, 219, 390, 746,1022, 216, 828, 730, 485, 121, 630,  25,
+	 488,  80, 944, 122, 448,  41, 399, 956, 872, 287, 582, 774, 107, 298, 632, 549,
+	 831, 232, 522, 922,  87, 585, 909,  29, 501, 614, 429,  47, 993, 545, 261, 786,
+	 874, 600, 365, 658, 991, 826, 566, 223, 486, 814,  78, 681, 417, 976, 750, 359,
+	  79, 610, 766, 159, 685, 467, 792, 289, 852, 162, 346, 885, 653, 198, 947, 394,
+	 303, 187, 840, 516, 292, 146, 343, 742,  17, 641, 329, 919, 249, 498, 188, 879,
+	 465, 951, 296, 375,1002, 205, 108, 416, 659, 962, 751, 129, 310, 449, 698,  99,
+	1013, 715,  20, 230, 693, 917, 623, 866, 406,1010, 176, 541, 850,  58, 663, 283,
+	 142, 682,  52, 513, 617, 859, 716, 553, 235,  42, 481, 579, 846,  13, 810, 572,
+	 479, 400, 907, 794, 431,  57, 497, 119, 260, 587, 785, 372, 133, 758, 569,1012,
+	 775, 398, 891, 798, 254,   9, 337, 985, 807, 376, 915, 181, 679, 931, 347, 141,
+	 651, 264,  95, 594, 333, 999, 214, 733, 941, 458,  44, 692, 971, 434, 316,  15,
+	 494, 234, 590, 151, 450, 905, 505, 139, 611,  92, 714, 274, 404, 518, 227, 776,
+	 864, 525, 977, 158, 770, 530, 858, 369, 676, 164, 895, 281, 512, 202, 847, 638,
+	 930, 116, 745, 968, 358, 637, 778, 276, 439, 875, 529,1006,  67, 620, 967,  56,
+	 183, 737, 440, 668, 269, 101, 615,   5, 293, 537, 829, 113, 650, 943,  84, 362,
+	 808, 277, 536,  39, 704, 200,  66, 936, 670, 204, 332, 793, 153, 728, 428, 321,
+	 910, 352,  28, 848, 395, 954, 461, 811, 980, 423, 607, 351, 760, 415, 581, 177,
+	 468, 680, 392, 853, 299,1018, 543, 397, 815,  23, 601, 469, 899, 257, 838, 561,
+	 128, 628, 942, 206, 577, 717, 148, 238, 748,  83, 207,1016,  22, 267, 833, 729,
+	1000,  75, 924, 169, 605, 436, 755, 136, 312, 970, 702, 109, 368, 527,   3, 700,
+	 460, 282, 517, 797,  62, 323, 888, 548, 374, 684, 861, 491, 677, 906, 132, 531,
+	 327, 239, 648, 511, 830,  86, 250, 897, 563, 446, 189, 773, 959, 656, 209,1023,
+	 827,  70, 674, 381, 988, 493, 662,  34, 938, 271, 568, 161, 341, 441, 626,  48,
+	 884, 455, 763,   1, 357, 955, 723, 647,  64, 825, 265, 574,  77, 305, 757, 384,
+	 597, 957, 190, 735, 124, 255, 804, 167, 471, 781,  50, 963, 802, 229, 981, 378,
+	 689, 138, 974, 280, 599, 490, 195, 330, 509,1008, 373, 902, 433, 855, 507, 145,
+	 252, 771, 334, 452, 911, 584, 401, 998, 625, 315, 424, 699, 103, 575, 740, 193,
+	 843, 547, 403, 865, 111, 788, 425, 877, 137, 667,  19, 708, 172, 613,  37, 920
+};
+
+static void         GreyLevels(Image *cimage, int *grey, unsigned int y,
+			       unsigned long n, unsigned short *level);
+static void         GreyBand(void *arg, unsigned int y0, unsigned int y1);
+static void         ThresholdBand(void *arg, unsigned int y0,
+				  unsigned int y1);
+static void         LeftToRight(unsigned short *level, int *curr, int *next,
+				int width, byte *dst);
+static void         RightToLeft(unsigned short *level, int *curr, int *next,
+				int width, byte *dst);
 
 
 /*
- * simple floyd-steinberg dither with serpentine raster processing
+ * fill in a matrix of the order, 0 to DITHER_MATRIX_SIZE squared - 1,
+ * in which its pixels turn on for an ordered or blue noise dither.  the
+ * Bayer matrix comes from interleaving the bits of x ^ y and y, the
+ * least significant first.
  */
 
-Image *dither(Image *cimage, unsigned int verbose)
+void ditherMatrix(unsigned int method, unsigned short *matrix)
+{
+  unsigned int x, y, b, rank;
+
+  if (method == DITHER_BLUENOISE)
+  {
+    bcopy((char *)BlueNoise, (char *)matrix, sizeof(BlueNoise));
+    return;
+  }
+  for (y=0; y<MSIZE; y++)
+    for (x=0; x<MSIZE; x++)
+    {
+      rank = 0;
+      for (b=1; b<MSIZE; b <<= 1)
+	rank = (rank << 2) | ((x ^ y) & b ? 2 : 0) | (y & b ? 1 : 0);
+      matrix[y * MSIZE + x] = rank;
+    }
+}
+
+
+/*
+ * simple floyd-steinberg dither with serpentine raster processing, or
+ * an ordered dither if method is DITHER_ORDERED or DITHER_BLUENOISE
+ */
+
+Image *dither(Image *cimage, unsigned int method, unsigned int verbose)
 {
   Image          *image;	/* destination image */
   int            *grey;		/* grey map for source image */
-  unsigned int    spl;		/* source pixel length in bytes */
   unsigned int    dll;		/* destination line length in bytes */
-  unsigned char  *src;		/* source data */
   unsigned char  *dst;		/* destination data */
   int            *curr;		/* current line buffer */
   int            *next;		/* next line buffer */
   int            *swap;		/* for swapping line buffers */
-  Pixel           color;	/* pixel color */
-  int             level;	/* grey level */
-  unsigned int    i, j;		/* loop counters */
+  GreyJob         job;		/* finding grey levels */
+  unsigned int    i, j, rows;	/* loop counters */
 
   CURRFUNC("dither");
   /*
@@ -99,65 +228,68 @@ Image *dither(Image *cimage, unsigned int verbose)
     grey = NULL;
   }
 
-  /*
-   * dither setup
-   */
-  spl = cimage->pixlen;
   dll = (image->width / 8) + (image->width % 8 ? 1 : 0);
-  src = cimage->data;
   dst = image->data;
 
-  curr  = (int *)lmalloc(sizeof(int) * (cimage->width + 2));
-  next  = (int *)lmalloc(sizeof(int) * (cimage->width + 2));
+  job.cimage = cimage;
+  job.grey = grey;
+
+  /*
+   * ordered dithering just compares each pixel with its threshold,
+   * which is halfway between the levels at which it turns on
+   */
+  if (method == DITHER_ORDERED || method == DITHER_BLUENOISE)
+  {
+    ditherMatrix(method, job.threshold);
+    for (i=0; i<MSIZE * MSIZE; i++)
+      job.threshold[i] = (2 * job.threshold[i] + 1) * MaxGrey /
+	(2 * MSIZE * MSIZE);
+    job.image = image;
+    runBands(cimage->height, ThresholdBand, &job);
+    if (grey != NULL)
+      lfree((byte *)grey);
+    if (verbose)
+      printf("done\n");
+    return(image);
+  }
+
+  /*
+   * dither setup.  the line buffers have an extra entry at each end to
+   * take the error that falls off the edges, and every entry of next is
+   * written as each line is dithered.
+   */
+  job.levels = (unsigned short *)lmalloc(sizeof(unsigned short) *
+					 cimage->width * ROWS);
+  curr  = (int *)lcalloc(sizeof(int) * (cimage->width + 2));
+  next  = (int *)lcalloc(sizeof(int) * (cimage->width + 2));
   curr += 1;
   next += 1;
-  bzero ((char *)curr, cimage->width * sizeof(*curr));
-  bzero ((char *)next, cimage->width * sizeof(*next));
 
   /*
    * primary dither loop
    */
-  for (i=0; i<cimage->height; i++)
+  for (i=0; i<cimage->height; i+=ROWS)
   {
-    /* copy the row into the current line */
-    for (j=0; j<cimage->width; j++)
+    rows = cimage->height - i < ROWS ? cimage->height - i : ROWS;
+    job.y = i;
+    runBands(rows, GreyBand, &job);
+
+    for (j=0; j<rows; j++)
     {
-      color = memToVal(src, spl);
-      src  += spl;
-      
-      if (RGBP(cimage)) {
-	if (grey == NULL)
-	  level = (int)colorIntensity(cimage->rgb.red[color],
-					     cimage->rgb.green[color],
-					     cimage->rgb.blue[color]);
-	else
-	  level = (int)grey[color];
-      }
-      else {
-	level = (int)colorIntensity((TRUE_RED(color) << 8),
-					   (TRUE_GREEN(color) << 8),
-					   (TRUE_BLUE(color) << 8));
-      }
-      curr[j] += level;
-    }
+      /* dither the current line into the destination image */
+      if ((i + j) & 0x01)
+	RightToLeft(job.levels + j * cimage->width, curr, next,
+		    cimage->width, dst);
+      else
+	LeftToRight(job.levels + j * cimage->width, curr, next,
+		    cimage->width, dst);
+      dst += dll;
 
-    /* dither the current line */
-    if (i & 0x01)
-      RightToLeft(curr, next, cimage->width);
-    else
-      LeftToRight(curr, next, cimage->width);
-
-    /* copy the dithered line to the destination image */
-    for (j=0; j<cimage->width; j++)
-      if (curr[j] < Threshold)
-	dst[j / 8] |= 1 << (7 - (j & 7));
-    dst += dll;
-    
-    /* circulate the line buffers */
-    swap = curr;
-    curr = next;
-    next = swap;
-    bzero ((char *)next, cimage->width * sizeof(*next));
+      /* circulate the line buffers */
+      swap = curr;
+      curr = next;
+      next = swap;
+    }
   }
 
   /*
@@ -165,6 +297,7 @@ Image *dither(Image *cimage, unsigned int verbose)
    */
   if (grey != NULL)
     lfree((byte *)grey);
+  lfree((byte *)job.levels);
   lfree((byte *)(curr-1));
   lfree((byte *)(next-1));
   if (verbose)
@@ -174,89 +307,152 @@ Image *dither(Image *cimage, unsigned int verbose)
 
 
 /*
- * dither a line from left to right
+ * find the grey levels of n pixels from the start of row y
  */
-static void LeftToRight(int *curr, int *next, int width)
+static void GreyLevels(Image *cimage, int *grey, unsigned int y,
+		       unsigned long n, unsigned short *level)
 {
-  int idx;
-  int error;
-  int output;
+  unsigned int    spl = cimage->pixlen;
+  unsigned char  *src;
+  Pixel           color;
 
-  if (0 < width)
-  {
-    output       = (curr[0] > Threshold) ? MaxGrey : MinGrey;
-    error        = curr[0] - output;
-    curr[0]    = output;
-    next[0]   += error * 5 / 16;
-    if (width > 1)
-    {
-      next[1] += error * 1 / 16;
-      curr[1] += error * 7 / 16;
+  src = cimage->data + (unsigned long)y * cimage->width * spl;
+
+  if (TRUEP(cimage) && spl == 3)	/* most common */
+    for (; n > 0; n--, src += 3)
+      *level++ = RedIntensity[src[0]] + GreenIntensity[src[1]] +
+	BlueIntensity[src[2]];
+  else if (grey != NULL && spl == 1)
+    for (; n > 0; n--)
+      *level++ = grey[*src++];
+  else
+    for (; n > 0; n--, src += spl) {
+      color = memToVal(src, spl);
+      if (!RGBP(cimage))
+	*level++ = colorIntensity((TRUE_RED(color) << 8),
+				  (TRUE_GREEN(color) << 8),
+				  (TRUE_BLUE(color) << 8));
+      else if (grey != NULL)
+	*level++ = grey[color];
+      else
+	*level++ = colorIntensity(cimage->rgb.red[color],
+				  cimage->rgb.green[color],
+				  cimage->rgb.blue[color]);
     }
-  }
+}
 
-  for (idx=1; idx<(width-1); idx++)
-  {
-    output       = (curr[idx] > Threshold) ? MaxGrey : MinGrey;
-    error        = curr[idx] - output;
-    curr[idx]    = output;
-    next[idx-1] += error * 3 / 16;
-    next[idx]   += error * 5 / 16;
-    next[idx+1] += error * 1 / 16;
-    curr[idx+1] += error * 7 / 16;
-  }
 
-  idx = width -1;
-  if (idx > 0)
+/*
+ * find the grey levels of rows y0 to y1 - 1 of the ones in levels
+ */
+static void GreyBand(void *arg, unsigned int y0, unsigned int y1)
+{
+  GreyJob        *job = (GreyJob *)arg;
+  unsigned int    width = job->cimage->width;
+
+  GreyLevels(job->cimage, job->grey, job->y + y0,
+	     (unsigned long)(y1 - y0) * width, job->levels + y0 * width);
+}
+
+
+/*
+ * ordered dither rows y0 to y1 - 1, a byte of the destination at a time
+ */
+static void ThresholdBand(void *arg, unsigned int y0, unsigned int y1)
+{
+  GreyJob        *job = (GreyJob *)arg;
+  unsigned int    width = job->cimage->width;
+  unsigned int    dll = (width / 8) + (width % 8 ? 1 : 0);
+  unsigned short *level, *threshold;
+  unsigned char  *dst;
+  unsigned int    x, y, k, end;
+  byte            bits;
+
+  level = (unsigned short *)lmalloc(sizeof(unsigned short) * width);
+  for (y=y0; y<y1; y++)
   {
-    output       = (curr[idx] > Threshold) ? MaxGrey : MinGrey;
-    error        = curr[idx] - output;
-    curr[idx]    = output;
-    next[idx-1] += error * 3 / 16;
-    next[idx]   += error * 5 / 16;
+    GreyLevels(job->cimage, job->grey, y, width, level);
+    threshold = job->threshold + (y % MSIZE) * MSIZE;
+    dst = job->image->data + (unsigned long)y * dll;
+    for (x=0; x<width; x+=8)
+    {
+      end = width - x < 8 ? width - x : 8;
+      for (bits=0, k=0; k<end; k++)
+	if (level[x + k] < threshold[(x + k) % MSIZE])
+	  bits |= 0x80 >> k;
+      *dst++ = bits;
+    }
   }
+  lfree((byte *)level);
 }
 
 
 /*
- * dither a line from right to left
+ * dither a line from left to right, setting the bits of the pixels that
+ * come out black.  the error passed on to the next line is summed up as
+ * it goes and each entry of next is stored just once, taking in the
+ * spare entry at each end for the error that falls off the edges.
  */
-static void RightToLeft(int *curr, int *next, int width)
+static void LeftToRight(unsigned short *level, int *curr, int *next,
+			int width, byte *dst)
 {
   int idx;
   int error;
-  int output;
+  int right = 0;		/* error for the next pixel on this line */
+  int below = 0;		/* error so far for next[idx] */
+  int left = 0;			/* error so far for next[idx-1] */
 
-  idx = width -1;
-  if (idx >= 0)
+  for (idx=0; idx<width; idx++)
   {
-    output       = (curr[idx] > Threshold) ? MaxGrey : MinGrey;
-    error        = curr[idx] - output;
-    curr[idx]    = output;
-    next[idx]   += error * 5 / 16;
-    if (idx > 0)
-    {
-      next[idx-1] += error * 1 / 16;
-      curr[idx-1] += error * 7 / 16;
-    }
+    error        = level[idx] + curr[idx] + right;
+    if (error > Threshold)
+      error     -= MaxGrey;
+    else
+      dst[idx >> 3] |= 0x80 >> (idx & 7);
+    next[idx-1]  = left + error * 3 / 16;
+    left         = below + error * 5 / 16;
+    below        = error * 1 / 16;
+    right        = error * 7 / 16;
   }
+  next[width-1]  = left;
+  next[width]    = below;
+}
+
 
-  for (idx=(width-2); idx>=1; idx--)
+/*
+ * dither a line from right to left.  the leftmost pixel doesn't pass
+ * any error on down and to the right.
+ */
+static void RightToLeft(unsigned short *level, int *curr, int *next,
+			int width, byte *dst)
+{
+  int idx;
+  int error;
+  int left = 0;			/* error for the next pixel on this line */
+  int below = 0;		/* error so far for next[idx] */
+  int right = 0;		/* error so far for next[idx+1] */
+
+  for (idx=(width-1); idx>0; idx--)
   {
-    output       = (curr[idx] > Threshold) ? MaxGrey : MinGrey;
-    error        = curr[idx] - output;
-    curr[idx]    = output;
-    next[idx+1] += error * 3 / 16;
-    next[idx]   += error * 5 / 16;
-    next[idx-1] += error * 1 / 16;
-    curr[idx-1] += error * 7 / 16;
+    error        = level[idx] + curr[idx] + left;
+    if (error > Threshold)
+      error     -= MaxGrey;
+    else
+      dst[idx >> 3] |= 0x80 >> (idx & 7);
+    next[idx+1]  = right + error * 3 / 16;
+    right        = below + error * 5 / 16;
+    below        = error * 1 / 16;
+    left         = error * 7 / 16;
   }
-
-  if (0 < width)
+  if (width > 0)
   {
-    output       = (curr[0] > Threshold) ? MaxGrey : MinGrey;
-    error        = curr[0] - output;
-    curr[0]    = output;
-    next[0]   += error * 5 / 16;
+    error        = level[0] + curr[0] + left;
+    if (error > Threshold)
+      error     -= MaxGrey;
+    else
+      dst[0]    |= 0x80;
+    next[1]      = right;
+    next[0]      = below + error * 5 / 16;
+    next[-1]     = 0;
   }
 }
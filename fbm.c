@@ -21,37 +21,32 @@
 # include "fbm.h"
 # include "imagetypes.h"
 
-/****
- **
- ** local variables
- **
- ****/
-
-static BYTE file_open = 0;	/* status flags */
-static BYTE image_open = 0;
-
-static ZFILE *ins;		/* input stream */
-static FBMFILEHDR phdr;		/* header structure */
-
-/****
- **
- ** global variables
- **
- ****/
-
-static int  fbmin_img_width;           /* image width */
-static int  fbmin_img_height;          /* image height */
-static int  fbmin_img_depth;	       /* Depth (1 for B+W, 3 for RGB) */
-static int  fbmin_img_bits;	       /* Bits per pixel */
-static int  fbmin_img_rowlen;	       /* length of one row of data */
-static int  fbmin_img_plnlen;	       /* length of one plane of data */
-static int  fbmin_img_clrlen;	       /* length of the colormap */
-static double  fbmin_img_aspect;       /* image aspect ratio */
-static int  fbmin_img_physbits;	       /* physical bits per pixel */
-static char *fbmin_img_title;	       /* name of image */
-static char *fbmin_img_credit;	       /* credit for image */
-
-static int fbmin_image_test(void);
+/*
+ * everything about an FBM file being read, so that more than one can
+ * be read at a time
+ */
+
+typedef struct {
+  BYTE file_open;		/* status flags */
+  BYTE image_open;
+
+  ZFILE *ins;			/* input stream */
+  FBMFILEHDR phdr;		/* header structure */
+
+  int  img_width;		/* image width */
+  int  img_height;		/* image height */
+  int  img_depth;		/* Depth (1 for B+W, 3 for RGB) */
+  int  img_bits;		/* Bits per pixel */
+  int  img_rowlen;		/* length of one row of data */
+  int  img_plnlen;		/* length of one plane of data */
+  int  img_clrlen;		/* length of the colormap */
+  double img_aspect;		/* image aspect ratio */
+  int  img_physbits;		/* physical bits per pixel */
+  char *img_title;		/* name of image */
+  char *img_credit;		/* credit for image */
+} FbmIn;
+
+static int fbmin_image_test(FbmIn *fi);
 
 static char *
 get_err_string(int errno)
@@ -69,40 +64,40 @@ get_err_string(int errno)
  * open FBM image in the input stream; returns FBMIN_SUCCESS if
  * successful. (might also return various FBMIN_ERR codes.)
  */
-static int fbmin_open_image(ZFILE *s)
+static int fbmin_open_image(FbmIn *fi, ZFILE *s)
 {
   char *hp;		/* header pointer */
 
   /* make sure there isn't already a file open */
-  if (file_open)
+  if (fi->file_open)
     return(FBMIN_ERR_FAO);
 
   /* remember that we've got this file open */
-  file_open = 1;
-  ins = s;
+  fi->file_open = 1;
+  fi->ins = s;
 
   /* read in the fbm file header */
-  hp = (char *) &phdr;
-  if (zread(ins, (byte *)hp, sizeof(phdr)) != sizeof(phdr))
+  hp = (char *) &fi->phdr;
+  if (zread(fi->ins, (byte *)hp, sizeof(fi->phdr)) != sizeof(fi->phdr))
     return FBMIN_ERR_BAD_SIG;	/* can't be FBM file */
 
-  if (strncmp(FBM_MAGIC, phdr.magic, sizeof(FBM_MAGIC)) != 0)
+  if (strncmp(FBM_MAGIC, fi->phdr.magic, sizeof(FBM_MAGIC)) != 0)
     return FBMIN_ERR_BAD_SIG;
 
   /* Now extract relevant features of FBM file header */
-  fbmin_img_width    = atoi(phdr.cols);
-  fbmin_img_height   = atoi(phdr.rows);
-  fbmin_img_depth    = atoi(phdr.planes);
-  fbmin_img_bits     = atoi(phdr.bits);
-  fbmin_img_rowlen   = atoi(phdr.rowlen);
-  fbmin_img_plnlen   = atoi(phdr.plnlen);
-  fbmin_img_clrlen   = atoi(phdr.clrlen);
-  fbmin_img_aspect   = atof(phdr.aspect);
-  fbmin_img_physbits = atoi(phdr.physbits);
-  fbmin_img_title    = phdr.title;
-  fbmin_img_credit   = phdr.credits;
-
-  if (fbmin_image_test() != FBMIN_SUCCESS)
+  fi->img_width    = atoi(fi->phdr.cols);
+  fi->img_height   = atoi(fi->phdr.rows);
+  fi->img_depth    = atoi(fi->phdr.planes);
+  fi->img_bits     = atoi(fi->phdr.bits);
+  fi->img_rowlen   = atoi(fi->phdr.rowlen);
+  fi->img_plnlen   = atoi(fi->phdr.plnlen);
+  fi->img_clrlen   = atoi(fi->phdr.clrlen);
+  fi->img_aspect   = atof(fi->phdr.aspect);
+  fi->img_physbits = atoi(fi->phdr.physbits);
+  fi->img_title    = fi->phdr.title;
+  fi->img_credit   = fi->phdr.credits;
+
+  if (fbmin_image_test(fi) != FBMIN_SUCCESS)
     return FBMIN_ERR_BAD_SD;
 
   return FBMIN_SUCCESS;
@@ -112,71 +107,71 @@ static int fbmin_open_image(ZFILE *s)
  * close an open FBM file
  */
 
-static int fbmin_close_file(void)
+static int fbmin_close_file(FbmIn *fi)
 {
   /* make sure there's a file open */
-  if (!file_open)
+  if (!fi->file_open)
     return FBMIN_ERR_NFO;
 
   /* mark file (and image) as closed */
-  file_open  = 0;
-  image_open = 0;
+  fi->file_open  = 0;
+  fi->image_open = 0;
 
   /* done! */
   return FBMIN_SUCCESS;
 }
     
-static int fbmin_image_test(void)
+static int fbmin_image_test(FbmIn *fi)
 {
-  if (fbmin_img_width < 1 || fbmin_img_width > 32767) {
-    fprintf (stderr, "Invalid width (%d) on input\n", fbmin_img_width);
+  if (fi->img_width < 1 || fi->img_width > 32767) {
+    fprintf (stderr, "Invalid width (%d) on input\n", fi->img_width);
     return FBMIN_ERR_BAD_SD;
   }
 
-  if (fbmin_img_height < 1 || fbmin_img_height > 32767) {
-    fprintf (stderr, "Invalid height (%d) on input\n", fbmin_img_height);
+  if (fi->img_height < 1 || fi->img_height > 32767) {
+    fprintf (stderr, "Invalid height (%d) on input\n", fi->img_height);
     return (0);
   }
 
-  if (fbmin_img_depth != 1 && fbmin_img_depth != 3) {
+  if (fi->img_depth != 1 && fi->img_depth != 3) {
     fprintf (stderr, "Invalid number of planes (%d) on input %s\n",
-	     fbmin_img_depth, "(must be 1 or 3)");
+	     fi->img_depth, "(must be 1 or 3)");
     return FBMIN_ERR_BAD_SD;
   }
 
-  if (fbmin_img_bits < 1 || fbmin_img_bits > 8) {
+  if (fi->img_bits < 1 || fi->img_bits > 8) {
     fprintf (stderr, "Invalid number of bits (%d) on input %s\n",
-	     fbmin_img_bits, "(must be [1..8])");
+	     fi->img_bits, "(must be [1..8])");
     return FBMIN_ERR_BAD_SD;
   }
 
-  if (fbmin_img_physbits != 1 && fbmin_img_physbits != 8) {
+  if (fi->img_physbits != 1 && fi->img_physbits != 8) {
     fprintf (stderr, "Invalid number of physbits (%d) on input %s\n",
-	     fbmin_img_physbits, "(must be 1 or 8)");
+	     fi->img_physbits, "(must be 1 or 8)");
     return FBMIN_ERR_BAD_SD;
   }
 
-  if (fbmin_img_rowlen < 1 || fbmin_img_rowlen > 32767) {
+  if (fi->img_rowlen < 1 || fi->img_rowlen > 32767) {
     fprintf (stderr, "Invalid row length (%d) on input\n",
-	     fbmin_img_rowlen);
+	     fi->img_rowlen);
     return FBMIN_ERR_BAD_SD;
   }
 
-  if (fbmin_img_depth > 1 && fbmin_img_plnlen < 1) { 
+  if (fi->img_depth > 1 && fi->img_plnlen < 1) { 
     fprintf (stderr, "Invalid plane length (%d) on input\n",
-	     fbmin_img_plnlen);
+	     fi->img_plnlen);
     return FBMIN_ERR_BAD_SD;
   }
 
-  if (fbmin_img_plnlen < (fbmin_img_height * fbmin_img_rowlen)) {
+  if (fi->img_plnlen < (fi->img_height * fi->img_rowlen)) {
     fprintf (stderr, "Invalid plane length (%d) < (%d) * (%d) on input\n",
-	     fbmin_img_plnlen,fbmin_img_height,fbmin_img_rowlen);
+	     fi->img_plnlen,fi->img_height,fi->img_rowlen);
     return FBMIN_ERR_BAD_SD;
   }
 
-  if (fbmin_img_aspect < 0.01 || fbmin_img_aspect > 100.0) {
+  if (fi->img_aspect < 0.01 || fi->img_aspect > 100.0) {
     fprintf (stderr, "Invalid aspect ratio %g on input\n",
-	     fbmin_img_aspect);
+	     fi->img_aspect);
     return FBMIN_ERR_BAD_SD;
   }
     return FBMIN_SUCCESS;
@@ -191,11 +186,11 @@ static int fbmin_image_test(void)
  * descriptive but I don't care
  */
 
-static void tellAboutImage(char *name)
+static void tellAboutImage(FbmIn *fi, char *name)
 {
   printf("%s is a %dx%d FBM image, depth %d with %d colors\n", name,
-    fbmin_img_width, fbmin_img_height, fbmin_img_bits * fbmin_img_depth,
-    fbmin_img_clrlen / 3);
+    fi->img_width, fi->img_height, fi->img_bits * fi->img_depth,
+    fi->img_clrlen / 3);
 }
 
 Image *fbmLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
@@ -207,38 +202,40 @@ Image *fbmLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
   unsigned char *pixptr, *cm;
   unsigned char *r, *g, *b;
   int retv;
+  FbmIn fbm, *fi = &fbm;
 
   CURRFUNC("fbmLoad");
   if (! (zf= zopen(fullname)))
     return(NULL);
-  if ((retv = fbmin_open_image(zf)) != FBMIN_SUCCESS) {  /* read image header */
-    fbmin_close_file();
+  bzero((char *) fi, sizeof(FbmIn));
+  if ((retv = fbmin_open_image(fi, zf)) != FBMIN_SUCCESS) {  /* read image header */
+    fbmin_close_file(fi);
     zclose(zf);
     if(retv != FBMIN_ERR_BAD_SIG)
       fprintf (stderr, "fbmLoad: %s - aborting, '%s'\n",name, get_err_string(retv));
     return(NULL);
   }
   if (verbose)
-    tellAboutImage(name);
+    tellAboutImage(fi, name);
   znocache(zf);
 
-  if(fbmin_img_depth==1)
-    if(fbmin_img_bits==1)
-      image= newBitImage(fbmin_img_width, fbmin_img_height);
+  if(fi->img_depth==1)
+    if(fi->img_bits==1)
+      image= newBitImage(fi->img_width, fi->img_height);
     else
-      image = newRGBImage(fbmin_img_width, fbmin_img_height, fbmin_img_bits);
+      image = newRGBImage(fi->img_width, fi->img_height, fi->img_bits);
   else	/* must be 3 */
-    image = newTrueImage(fbmin_img_width, fbmin_img_height);
+    image = newTrueImage(fi->img_width, fi->img_height);
   image->title= dupString(name);
 
   /* if image has a local colormap, override global colormap
    */
-  if (fbmin_img_depth==1 && fbmin_img_clrlen > 0) {
-    cm = (unsigned char *) lmalloc(fbmin_img_clrlen);
+  if (fi->img_depth==1 && fi->img_clrlen > 0) {
+    cm = (unsigned char *) lmalloc(fi->img_clrlen);
 
-    if (zread(ins, cm, fbmin_img_clrlen) != fbmin_img_clrlen) {
-      fprintf (stderr, "fbmLoad: %s - can't read colormap (%d bytes)\n", name, fbmin_img_clrlen);
-      fbmin_close_file();
+    if (zread(fi->ins, cm, fi->img_clrlen) != fi->img_clrlen) {
+      fprintf (stderr, "fbmLoad: %s - can't read colormap (%d bytes)\n", name, fi->img_clrlen);
+      fbmin_close_file(fi);
       lfree(cm);
       zclose(zf);
       freeImage(image);
@@ -248,7 +245,7 @@ Image *fbmLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
      * fbm color map is organized as
      * buf[3][16]
      */
-    y = fbmin_img_clrlen / 3;
+    y = fi->img_clrlen / 3;
     r = &cm[0], g = &cm[y], b = &cm[2 * y];
     for (x = 0; x < y; x++, r++, g++, b++) {
       image->rgb.red[x]   = *r << 8;
@@ -260,23 +257,23 @@ Image *fbmLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
   } else
     cm = NULL;
 
-  width = fbmin_img_width;
-  rowpad = fbmin_img_rowlen - width;
-  plnpad = fbmin_img_plnlen - (fbmin_img_height * fbmin_img_rowlen);
+  width = fi->img_width;
+  rowpad = fi->img_rowlen - width;
+  plnpad = fi->img_plnlen - (fi->img_height * fi->img_rowlen);
 
-  if(fbmin_img_depth == 1) {
-    if(fbmin_img_bits==1) {
+  if(fi->img_depth == 1) {
+    if(fi->img_bits==1) {
       int xx,bb;
       byte *rb;
       rb = (byte *) lmalloc(width > rowpad ? width : rowpad);
       pixptr = image->data;
-      for (j = 0; j < fbmin_img_height; j++, pixptr += ((width+7)/8)) {
-        if (zread(ins, rb, width) != width) {
+      for (j = 0; j < fi->img_height; j++, pixptr += ((width+7)/8)) {
+        if (zread(fi->ins, rb, width) != width) {
           fprintf(stderr, "fbmLoad: %s - Short read within image data\n", name);
 	  if (cm != NULL)
 	    lfree(cm);
           lfree(rb);
-	  fbmin_close_file();
+	  fbmin_close_file(fi);
 	  zclose(zf);
 	  return(image);
         }
@@ -287,12 +284,12 @@ Image *fbmLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
             bb = 0;
 		  }
         }
-        if (zread(ins, rb, rowpad) != rowpad) {
+        if (zread(fi->ins, rb, rowpad) != rowpad) {
           fprintf(stderr, "fbmLoad: %s - Short read within row padding\n", name);
 	  if (cm != NULL)
 	    lfree(cm);
 	  lfree(rb);
-	  fbmin_close_file();
+	  fbmin_close_file(fi);
 	  zclose(zf);
 	  return(image);
         }
@@ -303,22 +300,22 @@ Image *fbmLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
       byte *rb;
       rb = (byte *) lmalloc(rowpad);
       pixptr = image->data;
-      for (j = 0; j < fbmin_img_height; j++, pixptr += width) {
-        if (zread(ins, pixptr, width) != width) {
+      for (j = 0; j < fi->img_height; j++, pixptr += width) {
+        if (zread(fi->ins, pixptr, width) != width) {
           fprintf(stderr, "fbmLoad: %s - Short read within image data\n", name);
 	  if (cm != NULL)
 	    lfree(cm);
 	  lfree(rb);
-	  fbmin_close_file();
+	  fbmin_close_file(fi);
 	  zclose(zf);
 	  return(image);
         }
-        if (zread(ins, rb, rowpad) != rowpad) {
+        if (zread(fi->ins, rb, rowpad) != rowpad) {
           fprintf(stderr,"fbmLoad: %s - Short read within row padding\n", name);
 	  if (cm != NULL)
 	    lfree(cm);
 	  lfree(rb);
-	  fbmin_close_file();
+	  fbmin_close_file(fi);
 	  zclose(zf);
 	  return(image);
         }
@@ -331,37 +328,37 @@ Image *fbmLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
     byte *rb;
     rb = (byte *) lmalloc(width > rowpad ? (width > plnpad ? width : plnpad)
                                           :(rowpad > plnpad ? rowpad : plnpad));
-    for (k = 0; k < fbmin_img_depth; k++) {
+    for (k = 0; k < fi->img_depth; k++) {
       pixptr = image->data + k;
-      for (j = 0; j < fbmin_img_height; j++) {
-        if (zread(ins, rb, width) != width) {
+      for (j = 0; j < fi->img_height; j++) {
+        if (zread(fi->ins, rb, width) != width) {
           fprintf(stderr, "fbmLoad: %s - Short read within image data\n", name);
 	  if (cm != NULL)
 	    lfree(cm);
 	  lfree(rb);
-	  fbmin_close_file();
+	  fbmin_close_file(fi);
 	  zclose(zf);
 	  return(image);
         }
         for (xx = 0; xx < width; xx++,pixptr+=3) {
           *pixptr = rb[xx];
         }
-        if (zread(ins, rb, rowpad) != rowpad) {
+        if (zread(fi->ins, rb, rowpad) != rowpad) {
           fprintf(stderr,"fbmLoad: %s - Short read within row padding\n", name);
 	  if (cm != NULL)
 	    lfree(cm);
 	  lfree(rb);
-	  fbmin_close_file();
+	  fbmin_close_file(fi);
 	  zclose(zf);
 	  return(image);
         }
       }
-      if (zread(ins, rb, plnpad) != plnpad) {
+      if (zread(fi->ins, rb, plnpad) != plnpad) {
         fprintf(stderr,"fbmLoad: %s - Short read within plane padding\n", name);
 	if (cm != NULL)
 	  lfree(cm);
 	lfree(rb);
-	fbmin_close_file();
+	fbmin_close_file(fi);
 	zclose(zf);
 	return(image);
       }
@@ -371,7 +368,7 @@ Image *fbmLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 
   if (cm != NULL)
     lfree(cm);
-  fbmin_close_file();
+  fbmin_close_file(fi);
   read_trail_opt(image_ops,zf,image,verbose);
   zclose(zf);
   return(image);
@@ -382,11 +379,13 @@ int fbmIdent(char *fullname, char *name)
   ZFILE        *zf;
   unsigned int  ret;
   int retv;
+  FbmIn fbm, *fi = &fbm;
 
   if (! (zf= zopen(fullname)))
     return(0);
-  if ((retv = fbmin_open_image(zf)) == FBMIN_SUCCESS) {
-    tellAboutImage(name);
+  bzero((char *) fi, sizeof(FbmIn));
+  if ((retv = fbmin_open_image(fi, zf)) == FBMIN_SUCCESS) {
+    tellAboutImage(fi, name);
     ret = 1;
   } else {
     if (retv != FBMIN_ERR_BAD_SIG) {
@@ -396,7 +395,7 @@ int fbmIdent(char *fullname, char *name)
       ret = 0;
     }
   }
-  fbmin_close_file();
+  fbmin_close_file(fi);
   zclose(zf);
   return(ret);
 }
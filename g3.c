@@ -24,6 +24,9 @@
 #include "xli.h"
 #include <sys/types.h>
 #include <sys/file.h>
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
 #include "g3.h"
 #include "imagetypes.h"
 
@@ -45,16 +48,20 @@
  **
  ****/
 
-static int g3_eof = 0;
-static int g3_eols;
-static int g3_rawzeros;
-static int g3_Xrawzeros;
-static int	maxlinelen;
-static int	rows, cols;
-static char *g3_error = NULL;
-static int g3_verb;
-static int curbit;
-static int firstTime = 1;
+/* the state of one decode, so that several files can be read at once */
+typedef struct {
+	int eof;
+	int eols;
+	int rawzeros;
+	int Xrawzeros;
+	int maxlinelen;
+	int rows, cols;
+	char *error;
+	int verb;
+	int curbit;
+	int shdata;		/* byte bits are being taken from */
+	int bmask[8];		/* bit order of the bytes */
+} G3In;
 
 #define MAX_ERRORS	20
 
@@ -67,8 +74,14 @@ static int firstTime = 1;
 tableentry *whash[HASHSIZE];
 tableentry *bhash[HASHSIZE];
 
-static int g3_skiptoeol(ZFILE *fd);
-static int g3_rawgetbit(ZFILE *fd);
+#ifndef NO_PTHREADS
+static pthread_once_t HashOnce = PTHREAD_ONCE_INIT;
+#else
+static int firstTime = 1;
+#endif
+
+static int g3_skiptoeol(G3In *g, ZFILE *fd);
+static int g3_rawgetbit(G3In *g, ZFILE *fd);
 
 
 static int g3_addtohash(tableentry **hash, tableentry *te, int n, int a,
@@ -78,10 +91,8 @@ static int g3_addtohash(tableentry **hash, tableentry *te, int n, int a,
 
 	while (n--) {
 		pos = ((te->length+a)*(te->code+b))%HASHSIZE;
-		if (hash[pos] != 0) {
-			g3_error = "G3: Hash collision during initialization.";
-			return(-1);
-			}
+		if (hash[pos] != 0)
+			return(-1);	/* hash collision */
 		hash[pos] = te;
 		te++;
 	}
@@ -112,14 +123,14 @@ static int g3_bitson(bit *b, int c, int n)
 }
 
 
-static tableentry	*g3_hashfind(tableentry **hash, int length, int code, int a, int b)
+static tableentry	*g3_hashfind(G3In *g, tableentry **hash, int length, int code, int a, int b)
 {
 	unsigned int pos;
 	tableentry *te;
 
 	pos = ((length+a)*(code+b))%HASHSIZE;
 	if (pos >= HASHSIZE) {
-		g3_error = "G3: Bad hash position";
+		g->error = "G3: Bad hash position";
 		return(NULL);
 		}
 	te = hash[pos];
@@ -127,7 +138,7 @@ static tableentry	*g3_hashfind(tableentry **hash, int length, int code, int a, i
 }
 
 
-static int g3_getfaxrow(ZFILE *fd, byte *bitrow)
+static int g3_getfaxrow(G3In *g, ZFILE *fd, byte *bitrow)
 {
         int col;
 	int curlen, curcode, nextbit;
@@ -135,36 +146,36 @@ static int g3_getfaxrow(ZFILE *fd, byte *bitrow)
 	tableentry *te;
 
 	/* First make the whole row white... */
-	bzero((char *) bitrow, maxlinelen); /* was memset -- jimf 09.11.90 */
+	bzero((char *) bitrow, g->maxlinelen); /* was memset -- jimf 09.11.90 */
 
 	col = 0;
-	g3_rawzeros = 0;
+	g->rawzeros = 0;
 	curlen = 0;
 	curcode = 0;
 	color = 1;
 	count = 0;
-	while (!g3_eof) {
+	while (!g->eof) {
 		if (col >= MAXCOLS) {
-			g3_error = "G3: Input row is too long, skipping to EOL";
-			g3_skiptoeol(fd);
+			g->error = "G3: Input row is too long, skipping to EOL";
+			g3_skiptoeol(g, fd);
 			return (col); 
 			}
 		do {
-			if (g3_eof) return 0;
-			if (g3_rawzeros >= 11) {
-				nextbit = g3_rawgetbit(fd);
+			if (g->eof) return 0;
+			if (g->rawzeros >= 11) {
+				nextbit = g3_rawgetbit(g, fd);
 				if (nextbit==1) {
 					if ( col == 0 )
 						/* 6 consecutive EOLs mean end of document */
-						g3_eof = (++g3_eols >= 5);
+						g->eof = (++g->eols >= 5);
 					else
-						g3_eols = 0;
+						g->eols = 0;
 
 					return (col); 
 					}
 				}
 			else
-				nextbit = g3_rawgetbit(fd);
+				nextbit = g3_rawgetbit(g, fd);
 
 			curcode = (curcode<<1) + nextbit; 
 			curlen++;
@@ -172,21 +183,21 @@ static int g3_getfaxrow(ZFILE *fd, byte *bitrow)
 
 		/* No codewords are greater than 13 bytes */
 		if (curlen > 13) {
-			g3_error = "G3: Bad code word, skipping to EOL";
-			g3_skiptoeol(fd);
+			g->error = "G3: Bad code word, skipping to EOL";
+			g3_skiptoeol(g, fd);
 			return (col);
 			}
 		if (color) {
 			/* White codewords are at least 4 bits long */
 			if (curlen < 4)
 				continue;
-			te = g3_hashfind(whash, curlen, curcode, WHASHA, WHASHB);
+			te = g3_hashfind(g, whash, curlen, curcode, WHASHA, WHASHB);
 			}
 		else {
 			/* Black codewords are at least 2 bits long */
 			if (curlen < 2)
 				continue;
-			te = g3_hashfind(bhash, curlen, curcode, BHASHA, BHASHB);
+			te = g3_hashfind(g, bhash, curlen, curcode, BHASHA, BHASHB);
 		}
 		if (!te)
 			continue;
@@ -220,7 +231,7 @@ static int g3_getfaxrow(ZFILE *fd, byte *bitrow)
 				curlen = 0;
 				break;
 			default:
-				g3_error = "G3: Bad table id from table entry";
+				g->error = "G3: Bad table id from table entry";
 				return(-1);
 			}
 		}
@@ -228,51 +239,78 @@ static int g3_getfaxrow(ZFILE *fd, byte *bitrow)
 }
 
 
-static int g3_skiptoeol(ZFILE *fd)
+static int g3_skiptoeol(G3In *g, ZFILE *fd)
 {
 	int maxbits = 2 * MAXCOLS;
-	while (g3_rawzeros<11 && !g3_eof && maxbits--)
-		(void) g3_rawgetbit(fd);
+	while (g->rawzeros<11 && !g->eof && maxbits--)
+		(void) g3_rawgetbit(g, fd);
 	if(maxbits)
 	{
 		maxbits = MAXCOLS/2;
-		while(!g3_rawgetbit(fd) && !g3_eof && maxbits--);
+		while(!g3_rawgetbit(g, fd) && !g->eof && maxbits--);
 	}
 	if (!maxbits)
-		g3_error = "G3: unable to skip to eol";
+		g->error = "G3: unable to skip to eol";
 	return(0);
 }
 
 
-static int g3_rawgetbit(ZFILE *fd)
+static int g3_rawgetbit(G3In *g, ZFILE *fd)
 {
 	int	b;
-	static int	shdata;
-
-	if (curbit >= 8) {
-		shdata = zgetc(fd);
-		if (shdata == EOF) {
-			g3_eols = 5;
-			g3_eof = 1;
-			g3_error = "G3: Premature EOF";
+
+	if (g->curbit >= 8) {
+		g->shdata = zgetc(fd);
+		if (g->shdata == EOF) {
+			g->eols = 5;
+			g->eof = 1;
+			g->error = "G3: Premature EOF";
 			return(0);
 			}
-		curbit = 0;
+		g->curbit = 0;
 		}
-	if (shdata & bmask[curbit]) {
-		g3_Xrawzeros = g3_rawzeros;
-		g3_rawzeros = 0;
+	if (g->shdata & g->bmask[g->curbit]) {
+		g->Xrawzeros = g->rawzeros;
+		g->rawzeros = 0;
 		b = 1;
 		}
 	else {
-		g3_rawzeros++;
+		g->rawzeros++;
 		b = 0;
 		}
-	curbit++;
+	g->curbit++;
     return b;
 }
 
 
+/* load the hash tables, once for all files */
+static void g3_loadhash(void)
+{
+	int i;
+
+	for ( i = 0; i < HASHSIZE; ++i )
+	  whash[i] = bhash[i] = (tableentry *) 0;
+	g3_addtohash(whash, twtable, TABSIZE(twtable), WHASHA, WHASHB);
+	g3_addtohash(whash, mwtable, TABSIZE(mwtable), WHASHA, WHASHB);
+	g3_addtohash(whash, extable, TABSIZE(extable), WHASHA, WHASHB);
+	g3_addtohash(bhash, tbtable, TABSIZE(tbtable), BHASHA, BHASHB);
+	g3_addtohash(bhash, mbtable, TABSIZE(mbtable), BHASHA, BHASHB);
+	g3_addtohash(bhash, extable, TABSIZE(extable), BHASHA, BHASHB);
+}
+
+static void g3_inithash(void)
+{
+#ifndef NO_PTHREADS
+	pthread_once(&HashOnce, g3_loadhash);
+#else
+	if (firstTime) {
+	    firstTime = 0;
+	    g3_loadhash();
+	}
+#endif
+}
+
+
 /* All G3 images begin with a G3 EOL codeword which is eleven binary 0's
  * followed by one binary 1.  There could be up to 15 0' so that the image
  * starts on a char boundary.
@@ -285,19 +323,19 @@ static int g3_rawgetbit(ZFILE *fd)
  */
 
 /* Return TRUE if g3 image */
-static boolean	g3_ident(ZFILE *fd)
+static boolean	g3_ident(G3In *g, ZFILE *fd)
 {
     int		ret = FALSE, col1, col2, col3, i;
     byte	*tmpline = NULL;
     int		reverse = 0;
     
-    g3_verb = 0;
+    g->verb = 0;
     col1 = col2 = col3 = 0;
-    tmpline = (byte *) lmalloc(maxlinelen);
+    tmpline = (byte *) lmalloc(g->maxlinelen);
 
-    /* In case this got reset by a previous pass through here */
+    /* Start with the usual bit order */
     for (i = 0; i < 8; ++i) {
-	bmask[7-i] = 1 << i;
+	g->bmask[7-i] = 1 << i;
     }
 
 tryagain:
@@ -305,28 +343,28 @@ tryagain:
 		lfree(tmpline);
 		return FALSE;
     }
-    curbit = 8;
-    g3_Xrawzeros = g3_rawzeros = 0;
-    g3_error = NULL;
-    g3_eof = g3_eols = rows = cols = 0;
+    g->curbit = 8;
+    g->Xrawzeros = g->rawzeros = 0;
+    g->error = NULL;
+    g->eof = g->eols = g->rows = g->cols = 0;
     
     /* If we have the zeros we're off to a good start, otherwise,
      * skip some lines
      */
-    for (g3_rawzeros = 0; !g3_eof && !g3_rawgetbit(fd) && g3_rawzeros < 16;);
-    if (g3_eof || g3_Xrawzeros < 11 || g3_Xrawzeros > 15) {
-	if (g3_eof || !zrewind(fd)) {
+    for (g->rawzeros = 0; !g->eof && !g3_rawgetbit(g, fd) && g->rawzeros < 16;);
+    if (g->eof || g->Xrawzeros < 11 || g->Xrawzeros > 15) {
+	if (g->eof || !zrewind(fd)) {
 	    lfree(tmpline);
 	    return FALSE;
 	}
-	curbit = 8;
-	g3_Xrawzeros = g3_rawzeros = 0;
-	g3_error = NULL;
-	g3_eof = g3_eols = rows = cols = 0;
-	g3_skiptoeol(fd);
-	if (!g3_error) g3_skiptoeol(fd);
-	if (!g3_error) g3_skiptoeol(fd);
-	if (!g3_error) g3_skiptoeol(fd);
+	g->curbit = 8;
+	g->Xrawzeros = g->rawzeros = 0;
+	g->error = NULL;
+	g->eof = g->eols = g->rows = g->cols = 0;
+	g3_skiptoeol(g, fd);
+	if (!g->error) g3_skiptoeol(g, fd);
+	if (!g->error) g3_skiptoeol(g, fd);
+	if (!g->error) g3_skiptoeol(g, fd);
     }
 
     /* Now get three lines and make sure they are the same length.  If not
@@ -334,10 +372,10 @@ tryagain:
      * (value.o on a Sun IPC did) but it's unlikely enough that I think
      * we're okay.
      */
-    if (!g3_error) col1 = g3_getfaxrow(fd, tmpline);
-    if (col1 > 0 && !g3_error) col2 = g3_getfaxrow(fd, tmpline);
-    if (col1 > 0 && !g3_error) col3 = g3_getfaxrow(fd, tmpline);
-    if (!g3_error && col1 > 0 && col1 == col2 && col2 == col3) ret = TRUE;
+    if (!g->error) col1 = g3_getfaxrow(g, fd, tmpline);
+    if (col1 > 0 && !g->error) col2 = g3_getfaxrow(g, fd, tmpline);
+    if (col1 > 0 && !g->error) col3 = g3_getfaxrow(g, fd, tmpline);
+    if (!g->error && col1 > 0 && col1 == col2 && col2 == col3) ret = TRUE;
 	else ret = FALSE;
     /* if (ret) printf("%d = %d\n", col1, col2); */
 
@@ -347,7 +385,7 @@ tryagain:
      */
     if (!ret && !reverse) {
 	for (i = 0; i < 8; ++i) {
-	    bmask[i] = 1 << i;
+	    g->bmask[i] = 1 << i;
 	}
 	reverse = 1;
 	goto tryagain;
@@ -358,10 +396,10 @@ tryagain:
     if (!zrewind(fd)) {
 	return FALSE;
     }
-    curbit = 8;
-    g3_Xrawzeros = g3_rawzeros = 0;
-    g3_error = NULL;
-    g3_eof = g3_eols = rows = cols = 0;
+    g->curbit = 8;
+    g->Xrawzeros = g->rawzeros = 0;
+    g->error = NULL;
+    g->eof = g->eols = g->rows = g->cols = 0;
     
     return(ret);
 }
@@ -372,61 +410,50 @@ Image	*g3Load(char *fullname, ImageOptions *image_ops, boolean verbose)
 	ZFILE	*fd;
 	char	*name = image_ops->name;
 	Image	*image;
-	int i, col;
+	int col;
 	byte	*currline;
+	G3In	g3, *g = &g3;
 
 	if ((fd = zopen(fullname)) == NULL) {
 		perror("g3Load");
 		return(NULL);
 	}
 
-	if (firstTime) {
-	    firstTime = 0;
-	    
-	    /* Initialize and load the hash tables */
-	    for ( i = 0; i < HASHSIZE; ++i )
-	      whash[i] = bhash[i] = (tableentry *) 0;
-	    g3_addtohash(whash, twtable, TABSIZE(twtable), WHASHA, WHASHB);
-	    g3_addtohash(whash, mwtable, TABSIZE(mwtable), WHASHA, WHASHB);
-	    g3_addtohash(whash, extable, TABSIZE(extable), WHASHA, WHASHB);
-	    g3_addtohash(bhash, tbtable, TABSIZE(tbtable), BHASHA, BHASHB);
-	    g3_addtohash(bhash, mbtable, TABSIZE(mbtable), BHASHA, BHASHB);
-	    g3_addtohash(bhash, extable, TABSIZE(extable), BHASHA, BHASHB);
-	}
+	g3_inithash();
 	
 	/* Calulate the number of bytes needed for maximum number of columns 
 	 * (bits), create a temprary storage area for it.
 	 */
-	maxlinelen = BITS_TO_BYTES(MAXCOLS);
+	g->maxlinelen = BITS_TO_BYTES(MAXCOLS);
 
-	if (!g3_ident(fd)) {
+	if (!g3_ident(g, fd)) {
 	    zclose(fd);
 	    return(NULL);
 	}
-	g3_verb = verbose;
+	g->verb = verbose;
 
 	znocache(fd);
 	image = newBitImage(MAXCOLS, MAXROWS);
 
 	currline = image->data;
-	cols = 0;
-	for (rows = 0; rows < MAXROWS; ++rows) {
-		col = g3_getfaxrow(fd, currline);
+	g->cols = 0;
+	for (g->rows = 0; g->rows < MAXROWS; ++g->rows) {
+		col = g3_getfaxrow(g, fd, currline);
 		if (col < 0) {
 		  freeImage(image);
 		  zclose(fd);
 		  return(NULL);
 		}
-		if (g3_eof)
+		if (g->eof)
 			break;
-		if (col > cols)
-			cols = col;
-		currline += BITS_TO_BYTES(cols);
+		if (col > g->cols)
+			g->cols = col;
+		currline += BITS_TO_BYTES(g->cols);
 		}
 
 	image->title= dupString(name);
-	image->width = cols;
-	image->height = rows;
+	image->width = g->cols;
+	image->height = g->rows;
 	if (!image->width || !image->height) { /* sanity check */
 		zclose(fd);
 		freeImage(image);
@@ -444,32 +471,18 @@ Image	*g3Load(char *fullname, ImageOptions *image_ops, boolean verbose)
 boolean	g3Ident(char *fullname, char *name)
 {
 	ZFILE	*fd;
-	int i,retv;
+	int retv;
+	G3In	g3, *g = &g3;
 
 	if ((fd = zopen(fullname)) == NULL) {
 		perror("g3Ident");
 		return(0);
 	}
 
-	/*
-	 * Init hash table
-	 */
-	if (firstTime) {
-	    firstTime = 0;
-	    
-	    /* Initialize and load the hash tables */
-	    for ( i = 0; i < HASHSIZE; ++i )
-	      whash[i] = bhash[i] = (tableentry *) 0;
-	    g3_addtohash(whash, twtable, TABSIZE(twtable), WHASHA, WHASHB);
-	    g3_addtohash(whash, mwtable, TABSIZE(mwtable), WHASHA, WHASHB);
-	    g3_addtohash(whash, extable, TABSIZE(extable), WHASHA, WHASHB);
-	    g3_addtohash(bhash, tbtable, TABSIZE(tbtable), BHASHA, BHASHB);
-	    g3_addtohash(bhash, mbtable, TABSIZE(mbtable), BHASHA, BHASHB);
-	    g3_addtohash(bhash, extable, TABSIZE(extable), BHASHA, BHASHB);
-	}
+	g3_inithash();
 	
-	maxlinelen = BITS_TO_BYTES(MAXCOLS);
-	if((retv = g3_ident(fd)))
+	g->maxlinelen = BITS_TO_BYTES(MAXCOLS);
+	if((retv = g3_ident(g, fd)))
 		printf("%s is a G3 FAX image.\n", name);
 	zclose(fd);
 	return retv;
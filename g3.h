@@ -23,8 +23,6 @@
 
 typedef unsigned char bit;
 
-int	bmask[] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
-
 typedef struct tableentry {
     int tabid;
     int code;
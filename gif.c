@@ -25,40 +25,6 @@
  **
  ****/
 
-#define PUSH_PIXEL(p)                                       \
-{                                                           \
-  if (pstk_idx == PSTK_SIZE)                                \
-    return GIFIN_ERR_PSO;                                   \
-  else                                                      \
-    pstk[pstk_idx++] = (p);                                 \
-}
-
-/*
- * push a string (denoted by a code) onto the pixel stack
- * (returns the code of the first pixel in the string in ps_rslt)
- */
-
-int ps_rslt;	/* return result */
-
-#define GIFIN_PUSH_STRING(code)                             \
-{                                                           \
-  int ps_code;                                              \
-  ps_code = code;                                           \
-                                                            \
-  while (((unsigned int)ps_code) < STAB_SIZE && prefix[ps_code] != NULL_CODE) \
-  {                                                         \
-    PUSH_PIXEL(extnsn[ps_code]);                            \
-    ps_code = prefix[ps_code];                              \
-  }                                                         \
-                                                            \
-  if (((unsigned int)ps_code) >= STAB_SIZE)                                 \
-    return GIFIN_ERR_TAO;                                   \
-  PUSH_PIXEL(extnsn[ps_code]);                              \
-  ps_rslt = extnsn[ps_code];                                \
-  if (((unsigned int)ps_rslt) >= STAB_SIZE)                                 \
-    return GIFIN_ERR_TAO;                                   \
-}
-
 /*
  * Look up the ascii message coresponding to
  * the error number.
@@ -89,80 +55,104 @@ static int interlace_rate[4]= { /* rate at which we accelerate vertically */
   8, 8, 4, 2
 };
 
-static BYTE file_open  = 0;     /* status flags */
-static BYTE image_open = 0;
-
-static ZFILE *ins;              /* input stream */
-
-static int  root_size;          /* root code size */
-static int  clr_code;           /* clear code */
-static int  eoi_code;           /* end of information code */
-static int  code_size;          /* current code size */
-static int  code_mask;          /* current code mask */
-static int  prev_code;          /* previous code */
-
 /*
- * NOTE: a long is assumed to be at least 32 bits wide
+ * everything about a GIF file being read, so that more than one can
+ * be read at a time
  */
-static long work_data;          /* working bit buffer */
-static int  work_bits;          /* working bit count */
 
-static BYTE buf[256];           /* byte buffer */
-static int  buf_cnt;            /* byte count */
-static int  buf_idx;            /* buffer index */
+typedef struct {
+  BYTE file_open;               /* status flags */
+  BYTE image_open;
+
+  ZFILE *ins;                   /* input stream */
 
-static int table_size;          /* string table size */
-static int prefix[STAB_SIZE];   /* string table : prefixes */
-static int extnsn[STAB_SIZE];   /* string table : extensions */
+  int  root_size;               /* root code size */
+  int  clr_code;                /* clear code */
+  int  eoi_code;                /* end of information code */
+  int  code_size;               /* current code size */
+  int  code_mask;               /* current code mask */
+  int  prev_code;               /* previous code */
 
-static BYTE pstk[PSTK_SIZE];    /* pixel stack */
-static int  pstk_idx;           /* pixel stack pointer */
+  /*
+   * NOTE: a long is assumed to be at least 32 bits wide
+   */
+  long work_data;               /* working bit buffer */
+  int  work_bits;               /* working bit count */
 
+  BYTE buf[256];                /* byte buffer */
+  int  buf_cnt;                 /* byte count */
+  int  buf_idx;                 /* buffer index */
 
-/****
- **
- ** global variables
- **
- ****/
+  /*
+   * each string in the table is an earlier string plus one more pixel,
+   * so it has already been written out once, less its last pixel.  that
+   * is where it's copied from when its code comes up again.
+   */
+  int table_size;               /* string table size */
+  unsigned long where[STAB_SIZE]; /* string table : earlier copies */
+  int length[STAB_SIZE];        /* string table : lengths */
+  BYTE first[STAB_SIZE];        /* string table : first pixels */
+  BYTE extnsn[STAB_SIZE];       /* string table : extensions */
+  unsigned long prev_where;     /* where the previous code was written */
+
+  int  rast_width;              /* raster width */
+  int  rast_height;             /* raster height */
+  BYTE g_cmap_flag;             /* global colormap flag */
+  int  g_pixel_bits;            /* bits per pixel, global colormap */
+  int  g_ncolors;               /* number of colors, global colormap */
+  BYTE g_cmap[3][256];          /* global colormap */
+  BYTE g_cmap_sorted;           /* global colormap sorted (GIF89a only) */
+  int  bg_color;                /* background color index */
+  int  color_bits;              /* bits of color resolution */
+  double aspect;                /* pixel aspect ratio (width/height) */
+  int  version;                 /* gif file version */
+
+  int  img_left;                /* image position on raster */
+  int  img_top;                 /* image position on raster */
+  int  img_width;               /* image width */
+  int  img_height;              /* image height */
+  BYTE l_cmap_flag;             /* local colormap flag */
+  int  l_pixel_bits;            /* bits per pixel, local colormap */
+  int  l_ncolors;               /* number of colors, local colormap */
+  BYTE l_cmap[3][256];          /* local colormap */
+  BYTE interlace_flag;          /* interlace image format flag */
+  BYTE raster_done;             /* raster's terminating block was read */
+
+  /* from the graphic control extension before the image, if any */
+  int  disposal;                /* disposal method */
+  int  transparent;             /* transparent color index, or -1 */
+  int  delay;                   /* delay in 1/100ths of a second */
+
+  int  loops;                   /* NETSCAPE2.0 loop count, or -1 */
+} GifIn;
 
-static int  gifin_rast_width;          /* raster width */
-static int  gifin_rast_height;         /* raster height */
-static BYTE gifin_g_cmap_flag;         /* global colormap flag */
-static int  gifin_g_pixel_bits;        /* bits per pixel, global colormap */
-static int  gifin_g_ncolors;           /* number of colors, global colormap */
-static BYTE gifin_g_cmap[3][256];      /* global colormap */
-static BYTE gifin_g_cmap_sorted;       /* global colormap sorted (GIF89a only) */
-static int  gifin_bg_color;            /* background color index */
-static int  gifin_color_bits;          /* bits of color resolution */
-static double  gifin_aspect;           /* pixel aspect ratio (width/height) */
-static int  gifin_version;             /* gif file version */
-
-static int  gifin_img_left;            /* image position on raster */
-static int  gifin_img_top;             /* image position on raster */
-static int  gifin_img_width;           /* image width */
-static int  gifin_img_height;          /* image height */
-static BYTE gifin_l_cmap_flag;         /* local colormap flag */
-static int  gifin_l_pixel_bits;        /* bits per pixel, local colormap */
-static int  gifin_l_ncolors;           /* number of colors, local colormap */
-static BYTE gifin_l_cmap[3][256];      /* local colormap */
-static BYTE gifin_interlace_flag;      /* interlace image format flag */
+/*
+ * where an image is on the logical screen and how it's to be shown
+ */
+
+typedef struct {
+  int left, top, width, height;
+  int disposal;
+  int transparent;
+  int delay;
+} GifFrame;
 
 /*
  * load a colormap from the input stream
  */
 
-static int gifin_load_cmap(BYTE (*cmap)[256], int ncolors)
+static int gifin_load_cmap(GifIn *g, BYTE (*cmap)[256], int ncolors)
 {
   int i;
 
   for (i=0; i<ncolors; i++)
   {
-    if (zread(ins, buf, 3) != 3)
+    if (zread(g->ins, g->buf, 3) != 3)
       return GIFIN_ERR_EOF;
     
-    cmap[GIF_RED][i] = buf[GIF_RED];
-    cmap[GIF_GRN][i] = buf[GIF_GRN];
-    cmap[GIF_BLU][i] = buf[GIF_BLU];
+    cmap[GIF_RED][i] = g->buf[GIF_RED];
+    cmap[GIF_GRN][i] = g->buf[GIF_GRN];
+    cmap[GIF_BLU][i] = g->buf[GIF_BLU];
   }
 
   /* done! */
@@ -174,65 +164,66 @@ static int gifin_load_cmap(BYTE (*cmap)[256], int ncolors)
  * open a GIF file, using s as the input stream
  */
 
-static int gifin_open_file(ZFILE *s, boolean verbose)
+static int gifin_open_file(GifIn *g, ZFILE *s, boolean verbose)
 {
   int errno;
   /* make sure there isn't already a file open */
-  if (file_open)
+  if (g->file_open)
     return GIFIN_ERR_FAO;
 
   /* remember that we've got this file open */
-  file_open = 1;
-  ins       = s;
+  g->file_open = 1;
+  g->ins       = s;
 
   /* check GIF signature */
-  if (zread(ins, buf, GIF_SIG_LEN) != GIF_SIG_LEN)
+  if (zread(g->ins, g->buf, GIF_SIG_LEN) != GIF_SIG_LEN)
     return GIFIN_ERR_EOF;
 
-  buf[GIF_SIG_LEN] = '\0';
-  if (strcmp((char *) buf, GIF_SIG) == 0)
-    gifin_version = GIF87a;
-  else if(strcmp((char *) buf, GIF_SIG_89) == 0)
-    gifin_version = GIF89a;
+  g->buf[GIF_SIG_LEN] = '\0';
+  if (strcmp((char *) g->buf, GIF_SIG) == 0)
+    g->version = GIF87a;
+  else if(strcmp((char *) g->buf, GIF_SIG_89) == 0)
+    g->version = GIF89a;
   else
     return GIFIN_ERR_BAD_SIG;
 
   /* read screen descriptor */
-  if (zread(ins, buf, GIF_SD_SIZE) != GIF_SD_SIZE)
+  if (zread(g->ins, g->buf, GIF_SD_SIZE) != GIF_SD_SIZE)
     return GIFIN_ERR_EOF;
 
   /* decode screen descriptor */
-  gifin_rast_width   = (buf[1] << 8) + buf[0];
-  gifin_rast_height  = (buf[3] << 8) + buf[2];
-  gifin_g_cmap_flag  = (buf[4] & 0x80) ? 1 : 0;
-  gifin_color_bits   = (((int)(buf[4] & 0x70)) >> 4) + 1;
-  gifin_g_pixel_bits = (buf[4] & 0x07) + 1;
-  gifin_bg_color     = buf[5];
-  gifin_aspect = 1.0;
-
-  if (gifin_version == GIF87a) {
-    if (buf[4] & 0x08 || buf[6] != 0) {
+  g->rast_width   = (g->buf[1] << 8) + g->buf[0];
+  g->rast_height  = (g->buf[3] << 8) + g->buf[2];
+  g->g_cmap_flag  = (g->buf[4] & 0x80) ? 1 : 0;
+  g->color_bits   = (((int)(g->buf[4] & 0x70)) >> 4) + 1;
+  g->g_pixel_bits = (g->buf[4] & 0x07) + 1;
+  g->bg_color     = g->buf[5];
+  g->aspect = 1.0;
+  g->loops  = -1;
+
+  if (g->version == GIF87a) {
+    if (g->buf[4] & 0x08 || g->buf[6] != 0) {
       if (verbose) {
 	fprintf(stderr, "gifLoad: ignoring non-null screen descriptor in Gif87a image\n");
       }
     }
   } else {
-    gifin_g_cmap_sorted = ((buf[4] & 0x08) != 0);
-    if (buf[6] != 0)
-      gifin_aspect = ((double)buf[6] + 15.0) / 64.0;
+    g->g_cmap_sorted = ((g->buf[4] & 0x08) != 0);
+    if (g->buf[6] != 0)
+      g->aspect = ((double)g->buf[6] + 15.0) / 64.0;
   }
 
   /* load global colormap */
-  if (gifin_g_cmap_flag)
+  if (g->g_cmap_flag)
   {
-    gifin_g_ncolors = (1 << gifin_g_pixel_bits);
+    g->g_ncolors = (1 << g->g_pixel_bits);
 
-    if ((errno = gifin_load_cmap(gifin_g_cmap, gifin_g_ncolors)) != GIFIN_SUCCESS)
+    if ((errno = gifin_load_cmap(g, g->g_cmap, g->g_ncolors)) != GIFIN_SUCCESS)
       return errno;
   }
   else
   {
-    gifin_g_ncolors = 0;
+    g->g_ncolors = 0;
   }
 
   /* done! */
@@ -244,16 +235,17 @@ static int gifin_open_file(ZFILE *s, boolean verbose)
  * read a new data block from the input stream
  */
 
-static int gifin_read_data_block(void)
+static int gifin_read_data_block(GifIn *g)
 {
   /* read the data block header */
-  buf_cnt = zgetc(ins);
+  if ((g->buf_cnt = zgetc(g->ins)) == EOF)
+    return GIFIN_ERR_EOF;
 
   /* read the data block body */
-  if (zread(ins, buf, buf_cnt) != buf_cnt)
+  if (zread(g->ins, g->buf, g->buf_cnt) != g->buf_cnt)
     return GIFIN_ERR_EOF;
 
-  buf_idx = 0;
+  g->buf_idx = 0;
 
   /* done! */
   return GIFIN_SUCCESS;
@@ -261,23 +253,44 @@ static int gifin_read_data_block(void)
 
 
 /*
- * skip an extension block in the input stream
+ * read an extension block from the input stream, keeping what matters
+ * for animation from graphic control and NETSCAPE2.0 extensions and
+ * skipping everything else
  */
 
-static int gifin_skip_extension(void)
+static int gifin_read_extension(GifIn *g)
 {
   int errno;
+  int label;
+  int block = 0;
+  int netscape = 0;
 
   /* get the extension function byte */
-  zgetc(ins);
+  label = zgetc(g->ins);
 
-  /* skip any remaining raster data */
   do
   {
-    if ((errno = gifin_read_data_block()) != GIFIN_SUCCESS)
+    if ((errno = gifin_read_data_block(g)) != GIFIN_SUCCESS)
       return errno;
+
+    if (label == GIF_GRAPHIC_CONTROL && block == 0 &&
+        g->buf_cnt >= GIF_GCE_SIZE)
+    {
+      g->disposal    = (g->buf[0] >> 2) & 0x07;
+      g->transparent = (g->buf[0] & 0x01) ? g->buf[3] : -1;
+      g->delay       = (g->buf[2] << 8) + g->buf[1];
+    }
+    else if (label == GIF_APPLICATION && block == 0)
+    {
+      netscape = (g->buf_cnt == GIF_APP_ID_SIZE &&
+                  (!strncmp((char *) g->buf, "NETSCAPE2.0", GIF_APP_ID_SIZE) ||
+                   !strncmp((char *) g->buf, "ANIMEXTS1.0", GIF_APP_ID_SIZE)));
+    }
+    else if (netscape && g->buf_cnt >= 3 && g->buf[0] == 1)
+      g->loops = (g->buf[2] << 8) + g->buf[1];
+    block++;
   }
-  while (buf_cnt > 0);
+  while (g->buf_cnt > 0);
 
   /* done! */
   return GIFIN_SUCCESS;
@@ -290,30 +303,34 @@ static int gifin_skip_extension(void)
  * also return various GIFIN_ERR codes.)
  */
 
-static int gifin_open_image(void)
+static int gifin_open_image(GifIn *g)
 {
   int i;
   int separator;
   int errno;
 
   /* make sure there's a file open */
-  if (!file_open)
+  if (!g->file_open)
     return GIFIN_ERR_NFO;
 
   /* make sure there isn't already an image open */
-  if (image_open)
+  if (g->image_open)
     return GIFIN_ERR_IAO;
 
   /* remember that we've got this image open */
-  image_open = 1;
+  g->image_open  = 1;
+  g->raster_done = 0;
+  g->disposal    = 0;
+  g->transparent = -1;
+  g->delay       = 0;
 
-  /* skip over any extension blocks */
+  /* read any extension blocks */
   do
   {
-    separator = zgetc(ins);
+    separator = zgetc(g->ins);
     if (separator == GIF_EXTENSION)
     {
-      if ((errno = gifin_skip_extension()) != GIFIN_SUCCESS)
+      if ((errno = gifin_read_extension(g)) != GIFIN_SUCCESS)
         return errno;
     }
   }
@@ -328,51 +345,53 @@ static int gifin_open_image(void)
     return GIFIN_ERR_BAD_SEP;
 
   /* read image descriptor */
-  if (zread(ins, buf, GIF_ID_SIZE) != GIF_ID_SIZE)
+  if (zread(g->ins, g->buf, GIF_ID_SIZE) != GIF_ID_SIZE)
     return GIFIN_ERR_EOF;
 
   /* decode image descriptor */
-  gifin_img_left       = (buf[1] << 8) + buf[0];
-  gifin_img_top        = (buf[3] << 8) + buf[2];
-  gifin_img_width      = (buf[5] << 8) + buf[4];
-  gifin_img_height     = (buf[7] << 8) + buf[6];
-  gifin_l_cmap_flag    = (buf[8] & 0x80) ? 1 : 0;
-  gifin_interlace_flag = (buf[8] & 0x40) ? 1 : 0;
-  gifin_l_pixel_bits   = (buf[8] & 0x07) + 1;
+  g->img_left       = (g->buf[1] << 8) + g->buf[0];
+  g->img_top        = (g->buf[3] << 8) + g->buf[2];
+  g->img_width      = (g->buf[5] << 8) + g->buf[4];
+  g->img_height     = (g->buf[7] << 8) + g->buf[6];
+  g->l_cmap_flag    = (g->buf[8] & 0x80) ? 1 : 0;
+  g->interlace_flag = (g->buf[8] & 0x40) ? 1 : 0;
+  g->l_pixel_bits   = (g->buf[8] & 0x07) + 1;
 
   /* load local colormap */
-  if (gifin_l_cmap_flag)
+  if (g->l_cmap_flag)
   {
-    gifin_l_ncolors = (1 << gifin_l_pixel_bits);
+    g->l_ncolors = (1 << g->l_pixel_bits);
 
-    if ((errno = gifin_load_cmap(gifin_l_cmap, gifin_l_ncolors)) != GIFIN_SUCCESS)
+    if ((errno = gifin_load_cmap(g, g->l_cmap, g->l_ncolors)) != GIFIN_SUCCESS)
       return errno;
   }
   else
   {
-    gifin_l_ncolors = 0;
+    g->l_ncolors = 0;
   }
 
   /* initialize raster data stream decoder */
-  root_size = zgetc(ins);
-  clr_code  = 1 << root_size;
-  eoi_code  = clr_code + 1;
-  code_size = root_size + 1;
-  code_mask = (1 << code_size) - 1;
-  work_bits = 0;
-  work_data = 0;
-  buf_cnt   = 0;
-  buf_idx   = 0;
-
-  /* initialize string table */
-  for (i=0; i<STAB_SIZE; i++)
+  g->root_size = zgetc(g->ins);
+  if (g->root_size < 1 || g->root_size > 11)
+    return GIFIN_ERR_BAD_DES;
+  g->clr_code  = 1 << g->root_size;
+  g->eoi_code  = g->clr_code + 1;
+  g->code_size = g->root_size + 1;
+  g->code_mask = (1 << g->code_size) - 1;
+  g->work_bits = 0;
+  g->work_data = 0;
+  g->buf_cnt   = 0;
+  g->buf_idx   = 0;
+
+  /* initialize string table with the single pixel strings */
+  for (i=0; i<g->clr_code; i++)
   {
-    prefix[i] = NULL_CODE;
-    extnsn[i] = i;
+    g->extnsn[i] = i;
+    g->first[i]  = i;
+    g->length[i] = 1;
   }
-
-  /* initialize pixel stack */
-  pstk_idx = 0;
+  g->table_size = g->eoi_code + 1;
+  g->prev_code  = NULL_CODE;
 
   /* done! */
   return GIFIN_SUCCESS;
@@ -380,55 +399,51 @@ static int gifin_open_image(void)
 
 
 /*
- * add a new string to the string table
- */
-
-static int gifin_add_string(int p, int e)
-{
-  prefix[table_size] = p;
-  extnsn[table_size] = e;
-
-  if ((table_size == code_mask) && (code_size < 12))
-  {
-    code_size += 1;
-    code_mask  = (1 << code_size) - 1;
-  }
-
-  table_size += 1;
-  if (table_size > STAB_SIZE)
-    return GIFIN_ERR_TAO;
-  return GIFIN_SUCCESS;
-}
-
-
-/*
- * try to read next pixel from the raster, return result in *pel
+ * read the raster into out, which has room for size pixels, and set
+ * *done to the number of pixels read.  a code's string is copied from
+ * where it was written before, rather than being built up a pixel at a
+ * time from the string table.
+ *
+ * the decoder's state is kept in locals while it runs, since every
+ * pixel written through out could otherwise be changing it.
  */
 
-static int gifin_get_pixel(int *pel)
+static int gifin_read_raster(GifIn *g, BYTE *out, unsigned long size,
+	unsigned long *done)
 {
-  int  code;
-  int  first;
-  int  place;
-  int  errno;
-
-  /* decode until there are some pixels on the pixel stack */
-  while (pstk_idx == 0)
+  int  code, p, e;
+  int  l;
+  int  errno = GIFIN_SUCCESS;
+  unsigned long n = 0;
+  long work_data  = g->work_data;
+  int  work_bits  = g->work_bits;
+  int  code_size  = g->code_size;
+  int  code_mask  = g->code_mask;
+  int  table_size = g->table_size;
+  int  prev_code  = g->prev_code;
+  unsigned long prev_where = g->prev_where;
+  BYTE *dp, *sp;
+
+  while (n < size)
   {
     /* load bytes until we have enough bits for another code */
     while (work_bits < code_size)
     {
-      if (buf_idx == buf_cnt)
+      if (g->buf_idx == g->buf_cnt)
       {
         /* read a new data block */
-        if ((errno = gifin_read_data_block()) != GIFIN_SUCCESS)
-          return errno;
-
-        if (buf_cnt == 0)
-          return GIFIN_ERR_EOD;
+        if ((errno = gifin_read_data_block(g)) != GIFIN_SUCCESS)
+          goto stop;
+
+        if (g->buf_cnt == 0)
+        {
+          g->raster_done = 1;
+          errno = GIFIN_ERR_EOD;
+          goto stop;
+        }
       }
 
-      work_data |= ((long) buf[buf_idx++]) << work_bits;
+      work_data |= ((long) g->buf[g->buf_idx++]) << work_bits;
       work_bits += 8;
     }
 
@@ -438,48 +453,122 @@ static int gifin_get_pixel(int *pel)
     work_bits  -= code_size;
 
     /* interpret the code */
-    if (code == clr_code)
+    if (code == g->clr_code)
     {
       /* reset decoder stream */
-      code_size  = root_size + 1;
+      code_size  = g->root_size + 1;
       code_mask  = (1 << code_size) - 1;
       prev_code  = NULL_CODE;
-      table_size = eoi_code + 1;
+      table_size = g->eoi_code + 1;
+      continue;
     }
-    else if (code == eoi_code)
+    if (code == g->eoi_code)
     {
       /* Ooops! no more pixels */
-      return GIFIN_ERR_EOF;
+      errno = GIFIN_ERR_EOF;
+      break;
     }
-    else if (prev_code == NULL_CODE)
-    {
-      GIFIN_PUSH_STRING(code);
-      prev_code = code;
-    }
-    else
+
+    /* add the previous string plus the first pixel of this one (which,
+     * for the string being defined, is its own first pixel) to the
+     * table.  once the table is full the encoder should send a clear
+     * code; until it does, nothing is added.
+     */
+    if (prev_code == NULL_CODE)
     {
-      if (code < table_size)
+      if (code >= g->clr_code)
       {
-        GIFIN_PUSH_STRING(code);
-        first = ps_rslt;
+        errno = GIFIN_ERR_TAO;
+        break;
       }
-      else
+    }
+    else if (code <= table_size && table_size < STAB_SIZE)
+    {
+      p = prev_code;
+      e = (code < table_size ? g->first[code] : g->first[p]);
+      g->where[table_size]  = prev_where;
+      g->extnsn[table_size] = e;
+      g->first[table_size]  = g->first[p];
+      g->length[table_size] = g->length[p] + 1;
+
+      if ((table_size == code_mask) && (code_size < 12))
       {
-        place = pstk_idx;
-        PUSH_PIXEL(NULL_CODE);
-        GIFIN_PUSH_STRING(prev_code);
-        first = ps_rslt;
-        pstk[place] = first;
+        code_size += 1;
+        code_mask  = (1 << code_size) - 1;
       }
+      table_size += 1;
+    }
+    else if (code >= table_size)
+    {
+      errno = GIFIN_ERR_TAO;
+      break;
+    }
+    prev_code  = code;
+    prev_where = n;
 
-      if((errno = gifin_add_string(prev_code, first)) != GIFIN_SUCCESS)
-        return errno;
-      prev_code = code;
+    /* write out the string, or as much of it as there's room for */
+    l = g->length[code];
+    if (l == 1)
+    {
+      out[n++] = g->extnsn[code];
+      continue;
+    }
+    sp = out + g->where[code];
+    dp = out + n;
+    if (l > size - n)
+    {
+      bcopy(sp, dp, size - n);
+      n = size;
+      break;
+    }
+    n += l;
+    if (l <= 8)
+    {
+      while (--l)
+        *dp++ = *sp++;
     }
+    else
+    {
+      bcopy(sp, dp, l - 1);
+      dp += l - 1;
+    }
+    *dp = g->extnsn[code];
   }
 
-  /* pop a pixel off the pixel stack */
-  *pel = (int) pstk[--pstk_idx];
+stop:
+  g->work_data  = work_data;
+  g->work_bits  = work_bits;
+  g->code_size  = code_size;
+  g->code_mask  = code_mask;
+  g->table_size = table_size;
+  g->prev_code  = prev_code;
+  g->prev_where = prev_where;
+  *done = n;
+  return errno;
+}
+
+
+/*
+ * close an open image, skipping whatever is left of its raster
+ */
+
+static int gifin_close_image(GifIn *g)
+{
+  int errno;
+
+  /* make sure there's an image open */
+  if (!g->image_open)
+    return GIFIN_ERR_NIO;
+
+  g->image_open = 0;
+
+  while (!g->raster_done)
+  {
+    if ((errno = gifin_read_data_block(g)) != GIFIN_SUCCESS)
+      return errno;
+    if (g->buf_cnt == 0)
+      g->raster_done = 1;
+  }
 
   /* done! */
   return GIFIN_SUCCESS;
@@ -490,15 +579,15 @@ static int gifin_get_pixel(int *pel)
  * close an open GIF file
  */
 
-static int gifin_close_file(void)
+static int gifin_close_file(GifIn *g)
 {
   /* make sure there's a file open */
-  if (!file_open)
+  if (!g->file_open)
     return GIFIN_ERR_NFO;
 
   /* mark file (and image) as closed */
-  file_open  = 0;
-  image_open = 0;
+  g->file_open  = 0;
+  g->image_open = 0;
 
   /* done! */
   return GIFIN_SUCCESS;
@@ -512,135 +601,399 @@ static int gifin_close_file(void)
  * descriptive but I don't care
  */
 
-static void tellAboutImage(char *name)
+static void tellAboutImage(GifIn *g, char *name)
 {
   printf("%s is a %dx%d %s%s image with %d colors\n",
-	 name, gifin_img_width, gifin_img_height,
-	 (gifin_interlace_flag ? "interlaced " : ""),
-	 gif_version_name[gifin_version],
-	 (gifin_l_cmap_flag ? gifin_l_ncolors : gifin_g_ncolors));
+	 name, g->img_width, g->img_height,
+	 (g->interlace_flag ? "interlaced " : ""),
+	 gif_version_name[g->version],
+	 (g->l_cmap_flag ? g->l_ncolors : g->g_ncolors));
+}
+
+/* read the open image's pixels into pixels, which has room for all of
+ * them, from top to bottom.  if the data runs out, the rest of the image
+ * is left as pixel 0.
+ */
+
+static int readPixels(GifIn *g, BYTE *pixels, char *name)
+{
+  unsigned long size, done;
+  BYTE *raster, *pixline;
+  int y, pass;
+  int errno;
+
+  /* GIF pixels are never more than 8 bits, so the raster can be read
+   * straight into a byte per pixel.
+   */
+
+  size= (unsigned long) g->img_width * g->img_height;
+  raster= (g->interlace_flag ? lmalloc(size) : pixels);
+  if ((errno = gifin_read_raster(g, raster, size, &done)) != GIFIN_SUCCESS) {
+    fprintf(stderr, "gifLoad: %s - Short read within image data, '%s'\n", name, get_err_string(errno));
+    bzero((char *) raster + done, size - done);
+  }
+
+  /* interlaced image -- futz with the vertical trace.  i wish i knew what
+   * kind of drugs the GIF people were on when they decided that they
+   * needed to support interlacing.
+   */
+
+  if (g->interlace_flag) {
+    pixline= raster;
+
+    /* interlacing takes four passes to read, each starting at a different
+     * vertical point.
+     */
+
+    for (pass= 0; pass < 4; pass++)
+      for (y= interlace_start[pass]; y < g->img_height;
+	   y += interlace_rate[pass]) {
+	bcopy(pixline, pixels + y * g->img_width, g->img_width);
+	pixline += g->img_width;
+      }
+    lfree(raster);
+  }
+  return errno;
+}
+
+/* note where the open image goes and how it's to be shown.  like most
+ * viewers, treat a delay too short to be meant as a tenth of a second.
+ */
+
+static void getFrame(GifIn *g, GifFrame *f)
+{
+  f->left= g->img_left;
+  f->top= g->img_top;
+  f->width= g->img_width;
+  f->height= g->img_height;
+  f->disposal= g->disposal;
+  f->transparent= g->transparent;
+  f->delay= (g->delay <= 1 ? 10 : g->delay);
+}
+
+/* the frames of an animation are drawn one after another on a canvas the
+ * size of the logical screen, and each frame is a copy of the canvas once
+ * it has been drawn.  the canvas uses the first frame's colormap until a
+ * frame comes along with a different one, when it and the frames so far
+ * are turned into true color.
+ */
+
+typedef struct {
+  Image *canvas;                /* what's been drawn so far */
+  BYTE  cmap[3][256];           /* colormap of canvas if it's IRGB */
+  int   ncolors;
+  int   bg;                     /* background color index */
+  BYTE  bgrgb[3];               /* background color */
+  Image *frames;                /* frames so far */
+  Image **last;                 /* where the next frame goes */
+  int   nframes;
+} GifAnim;
+
+static boolean sameColormap(GifAnim *a, BYTE (*cmap)[256], int ncolors)
+{
+  int i, c;
+
+  if (ncolors > a->ncolors)
+    return FALSE;
+  for (c= 0; c < 3; c++)
+    for (i= 0; i < ncolors; i++)
+      if (cmap[c][i] != a->cmap[c][i])
+	return FALSE;
+  return TRUE;
+}
+
+/* turn the canvas and the frames so far into true color */
+
+static void animToTrue(GifAnim *a)
+{
+  Image *new, **fp;
+
+  new= expandtotrue(a->canvas);
+  freeImage(a->canvas);
+  a->canvas= new;
+
+  for (fp= &a->frames; *fp; fp= &(*fp)->next) {
+    new= expandtotrue(*fp);
+    new->delay= (*fp)->delay;
+    new->next= (*fp)->next;
+    (*fp)->next= NULL;
+    freeImage(*fp);
+    *fp= new;
+  }
+  a->last= fp;
+}
+
+/* fill a rectangle of the canvas with the background color */
+
+static void fillCanvas(GifAnim *a, int left, int top, int width, int height)
+{
+  Image *canvas= a->canvas;
+  BYTE *dp;
+  int x, y;
+
+  if (left >= canvas->width || top >= canvas->height)
+    return;
+  if (width > canvas->width - left)
+    width= canvas->width - left;
+  if (height > canvas->height - top)
+    height= canvas->height - top;
+
+  for (y= top; y < top + height; y++) {
+    dp= canvas->data + ((unsigned long) y * canvas->width + left) *
+	canvas->pixlen;
+    if (RGBP(canvas))
+      memset(dp, a->bg, width);
+    else
+      for (x= 0; x < width; x++) {
+	*dp++= a->bgrgb[GIF_RED];
+	*dp++= a->bgrgb[GIF_GRN];
+	*dp++= a->bgrgb[GIF_BLU];
+      }
+  }
+}
+
+/* draw a frame on the canvas, add a copy of the canvas to the frames
+ * and then dispose of the frame as it asks
+ */
+
+static void addFrame(GifAnim *a, GifFrame *f, BYTE *pixels,
+	BYTE (*cmap)[256], int ncolors)
+{
+  Image *canvas, *frame;
+  BYTE *saved= NULL;
+  BYTE *sp, *dp;
+  unsigned long datalen;
+  int x, y, width, height, pixel;
+
+  if (RGBP(a->canvas) && !sameColormap(a, cmap, ncolors))
+    animToTrue(a);
+  canvas= a->canvas;
+  datalen= (unsigned long) canvas->width * canvas->height * canvas->pixlen;
+
+  if (f->disposal == GIF_DISPOSE_PREVIOUS) {
+    saved= lmalloc(datalen);
+    bcopy(canvas->data, saved, datalen);
+  }
+
+  /* draw the part of the frame that's on the canvas, leaving anything
+   * under its transparent pixels alone
+   */
+
+  width= f->width;
+  height= f->height;
+  if (f->left >= canvas->width || f->top >= canvas->height)
+    width= height= 0;
+  if (width > canvas->width - f->left)
+    width= canvas->width - f->left;
+  if (height > canvas->height - f->top)
+    height= canvas->height - f->top;
+
+  for (y= 0; y < height; y++) {
+    sp= pixels + (unsigned long) y * f->width;
+    dp= canvas->data + ((unsigned long) (f->top + y) * canvas->width +
+	f->left) * canvas->pixlen;
+    if (RGBP(canvas)) {
+      if (f->transparent < 0)
+	bcopy(sp, dp, width);
+      else
+	for (x= 0; x < width; x++, sp++, dp++)
+	  if (*sp != f->transparent)
+	    *dp= *sp;
+    }
+    else
+      for (x= 0; x < width; x++, dp += 3) {
+	pixel= *sp++;
+	if (pixel == f->transparent)
+	  continue;
+	dp[0]= cmap[GIF_RED][pixel];
+	dp[1]= cmap[GIF_GRN][pixel];
+	dp[2]= cmap[GIF_BLU][pixel];
+      }
+  }
+
+  frame= dupImage(canvas);
+  frame->delay= f->delay;
+  *a->last= frame;
+  a->last= &frame->next;
+  a->nframes++;
+
+  if (f->disposal == GIF_DISPOSE_BACKGROUND)
+    fillCanvas(a, f->left, f->top, f->width, f->height);
+  else if (saved)
+    bcopy(saved, canvas->data, datalen);
+  if (saved)
+    lfree(saved);
+}
+
+/* read the rest of an animation, given its first frame, and return the
+ * composited frames.  reading stops at the first image that can't be
+ * read completely, keeping the frames read so far.
+ */
+
+static Image *readAnimation(GifIn *g, Image *first, GifFrame *f0,
+	char *name, boolean verbose)
+{
+  GifAnim a;
+  GifFrame f;
+  BYTE *pixels;
+  int i, width, height, errno;
+
+  /* the canvas has to be big enough for the first frame, whatever the
+   * screen descriptor says
+   */
+
+  width= g->rast_width;
+  if (width < f0->left + f0->width)
+    width= f0->left + f0->width;
+  height= g->rast_height;
+  if (height < f0->top + f0->height)
+    height= f0->top + f0->height;
+
+  bzero((char *) a.cmap, sizeof(a.cmap));
+  a.ncolors= first->rgb.used;
+  for (i= 0; i < a.ncolors; i++) {
+    a.cmap[GIF_RED][i]= first->rgb.red[i] >> 8;
+    a.cmap[GIF_GRN][i]= first->rgb.green[i] >> 8;
+    a.cmap[GIF_BLU][i]= first->rgb.blue[i] >> 8;
+  }
+  a.bg= (g->bg_color < a.ncolors ? g->bg_color : 0);
+  a.bgrgb[GIF_RED]= a.cmap[GIF_RED][a.bg];
+  a.bgrgb[GIF_GRN]= a.cmap[GIF_GRN][a.bg];
+  a.bgrgb[GIF_BLU]= a.cmap[GIF_BLU][a.bg];
+  a.canvas= newRGBImage(width, height, first->depth);
+  a.canvas->title= dupString(first->title);
+  bcopy(first->rgb.red, a.canvas->rgb.red, a.ncolors * sizeof(Intensity));
+  bcopy(first->rgb.green, a.canvas->rgb.green, a.ncolors * sizeof(Intensity));
+  bcopy(first->rgb.blue, a.canvas->rgb.blue, a.ncolors * sizeof(Intensity));
+  a.canvas->rgb.used= a.ncolors;
+  fillCanvas(&a, 0, 0, width, height);
+  a.frames= NULL;
+  a.last= &a.frames;
+  a.nframes= 0;
+
+  addFrame(&a, f0, first->data, a.cmap, a.ncolors);
+  freeImage(first);
+
+  /* the next image has already been opened */
+
+  do {
+    getFrame(g, &f);
+    pixels= lmalloc((unsigned long) f.width * f.height);
+    errno= readPixels(g, pixels, name);
+    if (g->l_cmap_flag)
+      addFrame(&a, &f, pixels, g->l_cmap, g->l_ncolors);
+    else
+      addFrame(&a, &f, pixels, g->g_cmap, g->g_ncolors);
+    lfree(pixels);
+  } while (errno == GIFIN_SUCCESS &&
+	   gifin_close_image(g) == GIFIN_SUCCESS &&
+	   gifin_open_image(g) == GIFIN_SUCCESS);
+  freeImage(a.canvas);
+
+  /* a NETSCAPE2.0 loop count is the number of times to play the frames
+   * again, with 0 meaning for ever
+   */
+
+  if (g->loops < 0)
+    a.frames->loops= 1;
+  else if (g->loops == 0)
+    a.frames->loops= 0;
+  else
+    a.frames->loops= g->loops + 1;
+
+  if (verbose) {
+    printf("  Animation of %d frames on a %dx%d screen, ", a.nframes,
+	   a.frames->width, a.frames->height);
+    if (a.frames->loops)
+      printf("played %d time%s\n", a.frames->loops,
+	     (a.frames->loops == 1 ? "" : "s"));
+    else
+      printf("played for ever\n");
+  }
+  return a.frames;
 }
 
 
 Image *gifLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 { ZFILE        *zf;
   char         *name = image_ops->name;
-  Image *image;
-  int    x, y, pixel, pass, scanlen;
-  byte  *pixptr, *pixline;
+  Image *image, *timage, **ip;
+  int    x;
   int errno;
+  double aspect;
+  GifIn *g;
+  GifFrame f;
 
   if (! (zf= zopen(fullname))) {
     perror("gifLoad");
     return(NULL);
   }
-  if ((gifin_open_file(zf, verbose) != GIFIN_SUCCESS) || /* read GIF header */
-      (gifin_open_image() != GIFIN_SUCCESS)) {  /* read image header */
-    gifin_close_file();
+  g= (GifIn *)lcalloc(sizeof(GifIn));
+  if ((gifin_open_file(g, zf, verbose) != GIFIN_SUCCESS) || /* read GIF header */
+      (gifin_open_image(g) != GIFIN_SUCCESS)) {  /* read image header */
+    gifin_close_file(g);
+    lfree((byte *)g);
     zclose(zf);
     return(NULL);
   }
   if (verbose)
-    tellAboutImage(name);
+    tellAboutImage(g, name);
   znocache(zf);
-  image= newRGBImage(gifin_img_width, gifin_img_height, (gifin_l_cmap_flag ?
-							 gifin_l_pixel_bits :
-							 gifin_g_pixel_bits));
+  image= newRGBImage(g->img_width, g->img_height, (g->l_cmap_flag ?
+							 g->l_pixel_bits :
+							 g->g_pixel_bits));
   image->title= dupString(name);
   /* if image has a local colormap, override global colormap
    */
 
-  if (gifin_l_cmap_flag) {
-    for (x= 0; x < gifin_l_ncolors; x++) {
-      image->rgb.red[x]= gifin_l_cmap[GIF_RED][x] << 8;
-      image->rgb.green[x]= gifin_l_cmap[GIF_GRN][x] << 8;
-      image->rgb.blue[x]= gifin_l_cmap[GIF_BLU][x] << 8;
+  if (g->l_cmap_flag) {
+    for (x= 0; x < g->l_ncolors; x++) {
+      image->rgb.red[x]= g->l_cmap[GIF_RED][x] << 8;
+      image->rgb.green[x]= g->l_cmap[GIF_GRN][x] << 8;
+      image->rgb.blue[x]= g->l_cmap[GIF_BLU][x] << 8;
     }
-    image->rgb.used= gifin_l_ncolors;
+    image->rgb.used= g->l_ncolors;
   } else {
-    for (x= 0; x < gifin_g_ncolors; x++) {
-      image->rgb.red[x]= gifin_g_cmap[GIF_RED][x] << 8;
-      image->rgb.green[x]= gifin_g_cmap[GIF_GRN][x] << 8;
-      image->rgb.blue[x]= gifin_g_cmap[GIF_BLU][x] << 8;
+    for (x= 0; x < g->g_ncolors; x++) {
+      image->rgb.red[x]= g->g_cmap[GIF_RED][x] << 8;
+      image->rgb.green[x]= g->g_cmap[GIF_GRN][x] << 8;
+      image->rgb.blue[x]= g->g_cmap[GIF_BLU][x] << 8;
     }
-    image->rgb.used= gifin_g_ncolors;
+    image->rgb.used= g->g_ncolors;
    }
 
-
-  /* interlaced image -- futz with the vertical trace.  i wish i knew what
-   * kind of drugs the GIF people were on when they decided that they
-   * needed to support interlacing.
+  /* if another image follows this one, they're the frames of an
+   * animation.  otherwise the image is just what it is.
    */
 
-  if (gifin_interlace_flag) {
-    scanlen= image->height * image->pixlen;
+  getFrame(g, &f);
+  errno= readPixels(g, image->data, name);
+  if (errno == GIFIN_SUCCESS &&
+      gifin_close_image(g) == GIFIN_SUCCESS &&
+      gifin_open_image(g) == GIFIN_SUCCESS)
+    image= readAnimation(g, image, &f, name, verbose);
 
-    /* interlacing takes four passes to read, each starting at a different
-     * vertical point.
-     */
-
-    for (pass= 0; pass < 4; pass++) {
-      y= interlace_start[pass];
-      scanlen= image->width * image->pixlen * interlace_rate[pass];
-      pixline= image->data + (y * image->width * image->pixlen);
-      while (y < gifin_img_height) {
-	pixptr= pixline;
-	for (x= 0; x < gifin_img_width; x++) {
-	  if ((errno = gifin_get_pixel(&pixel)) != GIFIN_SUCCESS) {
-	    fprintf(stderr, "gifLoad: %s - Short read within image data, '%s'\n", name, get_err_string(errno));
-	    y = gifin_img_height; x = gifin_img_width;
-	  }
-	  valToMem(pixel, pixptr, image->pixlen);
-	  pixptr += image->pixlen;
-	}
-	y += interlace_rate[pass];
-	pixline += scanlen;
-      }
-    }
-  }
-
-  /* not an interlaced image, just read in sequentially
-   */
-
-  else {
-    if(image->pixlen == 1) {	/* the usual case */
-      pixptr= image->data;
-      for (y= 0; y < gifin_img_height; y++)
-        for (x= 0; x < gifin_img_width; x++) {
-          if ((errno = gifin_get_pixel(&pixel)) != GIFIN_SUCCESS) {
-	    fprintf(stderr, "gifLoad: %s - Short read within image data, '%s'\n", name, get_err_string(errno));
-            y = gifin_img_height; x = gifin_img_width;
-          }
-          valToMem(pixel, pixptr, 1);
-          pixptr += 1;
-        }
-    }
-    else {	/* less ususal case */
-      pixptr= image->data;
-      for (y= 0; y < gifin_img_height; y++)
-        for (x= 0; x < gifin_img_width; x++) {
-          if ((errno = gifin_get_pixel(&pixel)) != GIFIN_SUCCESS) {
-	    fprintf(stderr, "gifLoad: %s - Short read within image data, '%s'\n", name, get_err_string(errno));
-            y = gifin_img_height; x = gifin_img_width;
-          }
-          valToMem(pixel, pixptr, image->pixlen);
-          pixptr += image->pixlen;
-        }
-     }
-  }
-  gifin_close_file();
+  gifin_close_file(g);
   read_trail_opt(image_ops,zf,image,verbose);
   zclose(zf);
-  if (gifin_aspect != 1.0) {	/* correct for GIF89a aspect ratio */
-    Image *timage;
-    printf("  Correcting for GIF89a pixel aspect ratio of %2.4f...",gifin_aspect);
-    if (gifin_aspect < 1.0)	/* tall pixels - image will look too short */
-      timage = zoom(image, 0, (int)(100.0/gifin_aspect + 0.5), FALSE, FALSE);
-    else	/* wide pixels - image will look too thin */
-      timage = zoom(image, (int)(100.0 * gifin_aspect + 0.5), 0, FALSE, FALSE);
-    if (timage != image)
-      freeImage(image);
-    image = timage;
+  aspect= g->aspect;
+  lfree((byte *)g);
+  if (aspect != 1.0) {	/* correct for GIF89a aspect ratio */
+    printf("  Correcting for GIF89a pixel aspect ratio of %2.4f...",aspect);
+    for (ip= &image; *ip; ip= &(*ip)->next) {
+      if (aspect < 1.0)	/* tall pixels - image will look too short */
+	timage = zoom(*ip, 0, (int)(100.0/aspect + 0.5), FALSE, FALSE);
+      else	/* wide pixels - image will look too thin */
+	timage = zoom(*ip, (int)(100.0 * aspect + 0.5), 0, FALSE, FALSE);
+      if (timage != *ip) {
+	timage->delay = (*ip)->delay;
+	timage->loops = (*ip)->loops;
+	timage->next = (*ip)->next;
+	(*ip)->next = NULL;
+	freeImage(*ip);
+	*ip = timage;
+      }
+    }
     printf("done\n");
   }
   return(image);
@@ -650,17 +1003,20 @@ Image *gifLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 int gifIdent(char *fullname, char *name)
 { ZFILE        *zf;
   unsigned int  ret;
+  GifIn        *g;
 
   if (! (zf= zopen(fullname)))
     return(0);
-  if ((gifin_open_file(zf, FALSE) == GIFIN_SUCCESS) &&
-      (gifin_open_image() == GIFIN_SUCCESS)) {
-    tellAboutImage(name);
+  g= (GifIn *)lcalloc(sizeof(GifIn));
+  if ((gifin_open_file(g, zf, FALSE) == GIFIN_SUCCESS) &&
+      (gifin_open_image(g) == GIFIN_SUCCESS)) {
+    tellAboutImage(g, name);
     ret= 1;
   }
   else
     ret= 0;
-  gifin_close_file();
+  gifin_close_file(g);
+  lfree((byte *)g);
   zclose(zf);
   return(ret);
 }
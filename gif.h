@@ -95,8 +95,15 @@ typedef unsigned char BYTE;
 #define GIF_EXTENSION   '!'     /* GIF extension block marker */
 #define GIF_TERMINATOR  ';'     /* GIF terminator */
 
+#define GIF_GRAPHIC_CONTROL 0xf9  /* graphic control extension label */
+#define GIF_APPLICATION     0xff  /* application extension label */
+#define GIF_GCE_SIZE        4     /* graphic control extension size */
+#define GIF_APP_ID_SIZE     11    /* application identifier size */
+
+#define GIF_DISPOSE_BACKGROUND 2  /* clear frame to background afterwards */
+#define GIF_DISPOSE_PREVIOUS   3  /* restore what was under the frame */
+
 #define STAB_SIZE  4096         /* string table size */
-#define PSTK_SIZE  4096         /* pixel stack size */
 
 #define NULL_CODE  -1           /* string table null code */
 
@@ -20,7 +20,7 @@ typedef struct rgbmap {
 
 /* image structure */
 
-typedef struct {
+typedef struct image {
 	char *title;		/* name of image */
 	unsigned int type;	/* type of image */
 	RGBMap rgb;		/* RGB map of image if IRGB type */
@@ -31,6 +31,9 @@ typedef struct {
 	byte *data;		/* data rounded to full byte for each row */
 	float gamma;		/* gamma of display the image is adjusted for */
 	unsigned long flags;	/* sundry flags */
+	unsigned int delay;	/* 1/100ths of a second to show this frame */
+	int loops;		/* times to play the frames, 0 for ever */
+	struct image *next;	/* next frame of an animation */
 } Image;
 
 #define IBITMAP 0		/* image is a bitmap */
@@ -48,6 +51,7 @@ typedef struct {
   ((((unsigned long)((R) & 0xff00)) << 8) | ((G) & 0xff00) | (((unsigned short)(B)) >> 8))
 
 #define FLAG_ISCALE 1		/* image scaled by decoder */
+#define FLAG_DIRECT 2		/* data is in an XImage, see newDirectImage() */
 
 #define UNSET_GAMMA 0.0
 
@@ -45,13 +45,133 @@ static struct {
 	{NULL,		NULL,		NULL}
 };
 
+#define NUM_IMAGETYPES (sizeof(ImageTypes) / sizeof(ImageTypes[0]) - 1)
+
+/* magic numbers of the image types that have them.  a type listed here is
+ * only tried when one of its signatures matches the start of the file;
+ * types that aren't listed are tried in ImageTypes[] order afterwards.
+ */
+
+static struct {
+	unsigned int offset;	/* where the signature starts */
+	unsigned int len;	/* length of the signature */
+	char *magic;		/* the signature itself */
+	Image *(*loader) (char *, ImageOptions *, boolean);
+} Signatures[] = {
+	{0,	7,	"%bitmap",			fbmLoad},
+	{0,	4,	"\131\246\152\225",		sunRasterLoad},
+	{0,	4,	"\361\000\100\273",		cmuwmLoad},
+	{0,	2,	"P1",				pbmLoad},
+	{0,	2,	"P2",				pbmLoad},
+	{0,	2,	"P3",				pbmLoad},
+	{0,	2,	"P4",				pbmLoad},
+	{0,	2,	"P5",				pbmLoad},
+	{0,	2,	"P6",				pbmLoad},
+	{0,	2,	"\052\027",			pbmLoad},
+	{0,	8,	"\211PNG\r\n\032\n",		pngLoad},
+	{0,	6,	"GIF87a",			gifLoad},
+	{0,	6,	"GIF89a",			gifLoad},
+	{0,	2,	"\377\330",			jpegLoad},
+	{0,	2,	"\122\314",			rleLoad},
+	{0,	2,	"BM",				bmpLoad},
+	{0x800,	7,	"PCD_IPI",			pcdLoad},
+	{4,	4,	"\000\000\000\007",		xwdLoad},
+	{4,	4,	"\007\000\000\000",		xwdLoad},
+	{0,	1,	"\012",				pcxLoad},
+	{0,	0,	NULL,				NULL}
+};
+
+/* enough of the file to see every signature */
+#define PROBE_LEN 0x808
+
+/* work out the order in which to try the image types on a file, from
+ * the magic number at its start.  returns the number of types to try.
+ */
+static int probeImage(char *fullname, int *order)
+{
+	ZFILE *zf;
+	byte buf[PROBE_LEN];
+	int len = 0, norder = 0, a, s;
+	boolean hassig[NUM_IMAGETYPES];
+
+	if ((zf = zopen(fullname))) {
+		len = zread(zf, buf, PROBE_LEN);
+		zclose(zf);
+	}
+
+	/* types whose signature matches come first */
+	for (a = 0; a < NUM_IMAGETYPES; a++) {
+		boolean match = FALSE;
+
+		hassig[a] = FALSE;
+		for (s = 0; Signatures[s].loader; s++) {
+			if (Signatures[s].loader != ImageTypes[a].loader)
+				continue;
+			hassig[a] = TRUE;
+			if (Signatures[s].offset + Signatures[s].len <= len &&
+			    !memcmp(buf + Signatures[s].offset,
+					Signatures[s].magic, Signatures[s].len))
+				match = TRUE;
+		}
+		if (match)
+			order[norder++] = a;
+	}
+
+	/* then everything that can't be recognised that way */
+	for (a = 0; a < NUM_IMAGETYPES; a++)
+		if (!hassig[a])
+			order[norder++] = a;
+
+	return (norder);
+}
+
+
+/* The decoded image most recently handed to cacheImage(), kept so that
+ * interactive re-renders (rotate, gamma, zoom) don't have to decode the
+ * file again.  It is keyed by full pathname and decoder scaling.
+ */
+static struct {
+	char *fullname;
+	int iscale;
+	Image *image;
+} ImageCache = {NULL, 0, NULL};
+
+static boolean cachedImageMatches(char *fullname, int iscale)
+{
+	return (ImageCache.image && ImageCache.iscale == iscale &&
+		!strcmp(ImageCache.fullname, fullname));
+}
+
+/* remember a pristine copy of a freshly loaded image */
+void cacheImage(ImageOptions * image_ops, Image *image)
+{
+	if (!image_ops->fullname ||
+	    cachedImageMatches(image_ops->fullname, image_ops->iscale))
+		return;
+	flushImageCache();
+	ImageCache.fullname = dupString(image_ops->fullname);
+	ImageCache.iscale = image_ops->iscale;
+	ImageCache.image = dupImage(image);
+}
+
+/* forget the cached image, eg. because the file has changed */
+void flushImageCache(void)
+{
+	if (!ImageCache.image)
+		return;
+	freeImage(ImageCache.image);
+	lfree((byte *) ImageCache.fullname);
+	ImageCache.image = NULL;
+	ImageCache.fullname = NULL;
+}
 
 /* load a named image */
 Image *loadImage(ImageOptions * image_ops, boolean verbose)
 {
 	char fullname[BUFSIZ];
 	Image *image;
-	int a;
+	int order[NUM_IMAGETYPES];
+	int norder, a;
 
 	if (findImage(image_ops->name, fullname) < 0) {
 		if (errno == ENOENT)
@@ -63,9 +183,17 @@ Image *loadImage(ImageOptions * image_ops, boolean verbose)
 		return (NULL);
 	}
 
+	if (image_ops->fullname)
+		lfree((byte *) image_ops->fullname);
 	image_ops->fullname = lmalloc(strlen(fullname) + 1);
 	strcpy(image_ops->fullname, fullname);
 
+	if (cachedImageMatches(fullname, image_ops->iscale)) {
+		if (verbose)
+			printf("%s is cached\n", fullname);
+		return (dupImage(ImageCache.image));
+	}
+
 	/* We've done this before !! */
 	if (image_ops->loader_idx != -1) {
 		image = ImageTypes[image_ops->loader_idx].loader(fullname,
@@ -75,9 +203,10 @@ Image *loadImage(ImageOptions * image_ops, boolean verbose)
 			return (image);
 		}
 	} else {
-		for (a = 0; ImageTypes[a].loader; a++) {
-			image = ImageTypes[a].loader(fullname, image_ops,
-				verbose);
+		norder = probeImage(fullname, order);
+		for (a = 0; a < norder; a++) {
+			image = ImageTypes[order[a]].loader(fullname,
+				image_ops, verbose);
 			if (image) {
 				zreset(NULL);
 				return (image);
@@ -93,7 +222,8 @@ Image *loadImage(ImageOptions * image_ops, boolean verbose)
 void identifyImage(char *name)
 {
 	char fullname[BUFSIZ];
-	int a;
+	int order[NUM_IMAGETYPES];
+	int norder, a;
 
 	if (findImage(name, fullname) < 0) {
 		if (errno == ENOENT)
@@ -104,8 +234,9 @@ void identifyImage(char *name)
 			perror(fullname);
 		return;
 	}
-	for (a = 0; ImageTypes[a].identifier; a++) {
-		if (ImageTypes[a].identifier(fullname, name)) {
+	norder = probeImage(fullname, order);
+	for (a = 0; a < norder; a++) {
+		if (ImageTypes[order[a]].identifier(fullname, name)) {
 			zreset(NULL);
 			return;
 		}
@@ -17,6 +17,7 @@
  * viewer/windowing system.  We give in to the inevitable here and use 2.2
  */
 #define RETURN_GAMMA DEFAULT_IRGB_GAMMA
+#define DIRECT_ROWS 16		/* rows decoded at a time into an XImage */
 
 #define INPUT_BUF_SIZE 4096
 
@@ -277,7 +278,11 @@ Image *jpegLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 		}
 		image->rgb.used = 256;
 	} else if (JCS_RGB == cinfo.out_color_space) {
-		image = newTrueImage(cinfo.output_width, cinfo.output_height);
+		if (!image_ops->direct || !(image = newDirectImage(
+				cinfo.output_width, cinfo.output_height,
+				RETURN_GAMMA)))
+			image = newTrueImage(cinfo.output_width,
+				cinfo.output_height);
 		image->title = dupString(image_ops->name);
 	} else {
 		fprintf(stderr, "jpegLoad: weird output color space\n");
@@ -294,13 +299,31 @@ Image *jpegLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 	rowbytes = cinfo.output_width * cinfo.output_components;
 	assert(image->pixlen * image->width == rowbytes);
 
-	rows = (byte **) lmalloc(image->height * sizeof(byte *));
-	for (i = 0; i < image->height; ++i)
-		rows[i] = image->data + i * rowbytes;
-
-	while (cinfo.output_scanline < cinfo.output_height) {
-		jpeg_read_scanlines(&cinfo, rows + cinfo.output_scanline,
-			    cinfo.output_height - cinfo.output_scanline);
+	if (image->flags & FLAG_DIRECT) {
+		/* decode a few rows at a time into a buffer that follows
+		 * the row pointers, and pass them on to the XImage
+		 */
+		rows = (byte **) lmalloc(DIRECT_ROWS *
+			(sizeof(byte *) + rowbytes));
+		for (i = 0; i < DIRECT_ROWS; ++i)
+			rows[i] = (byte *) (rows + DIRECT_ROWS) + i * rowbytes;
+
+		while (cinfo.output_scanline < cinfo.output_height) {
+			i = cinfo.output_scanline;
+			directImageRows(image, rows[0], i,
+				jpeg_read_scanlines(&cinfo, rows,
+					DIRECT_ROWS));
+		}
+	} else {
+		rows = (byte **) lmalloc(image->height * sizeof(byte *));
+		for (i = 0; i < image->height; ++i)
+			rows[i] = image->data + i * rowbytes;
+
+		while (cinfo.output_scanline < cinfo.output_height) {
+			jpeg_read_scanlines(&cinfo,
+				rows + cinfo.output_scanline,
+				cinfo.output_height - cinfo.output_scanline);
+		}
 	}
 
 	jpeg_finish_decompress(&cinfo);
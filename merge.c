@@ -245,7 +245,7 @@ Image *merge(Image *idst, Image *isrc, int atx, int aty, ImageOptions *imgopp)
     else
       clipy = 0;
     
-    tmp = clip(src, clipx, clipy, clipw, cliph, imgopp);
+    tmp = clip(src, clipx, clipy, clipw, cliph, imgopp, globals.verbose);
     if (src != tmp && src != isrc)	/* free imtermediate, but preserve input */
       freeImage(src);
     src = tmp;
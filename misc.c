@@ -107,62 +107,91 @@ char *tail(char *path)
 
 #define MIN(a,b) ( (a)<(b) ? (a) : (b))
 
-Image *processImage(DisplayInfo *dinfo, Image *iimage, ImageOptions *options)
+/* work out the zoom that fits an image of the given size on the screen */
+static void autoZoom(ImageOptions *options, unsigned int width,
+	unsigned int height)
+{
+	if (width > globals.dinfo.width * .9)
+		options->xzoom = globals.dinfo.width * 90 / width;
+	else
+		options->xzoom = 100;
+	if (height > globals.dinfo.height * .9)
+		options->yzoom = globals.dinfo.height * 90 / height;
+	else
+		options->yzoom = 100;
+	/* both dimensions should be shrunk by the same factor */
+	options->xzoom = options->yzoom =
+		MIN(options->xzoom, options->yzoom);
+}
+
+Image *processImage(DisplayInfo *dinfo, Image *iimage, ImageOptions *options,
+	boolean verbose)
 {
 	Image *image = iimage, *tmpimage;
 	XColor xcolor;
+	boolean piped = FALSE;	/* TRUE if done by pipelineImage() */
+	ProfileMark mark;
 
 	CURRFUNC("processImage");
+	profileStart(&mark, image);
 
 	/* Pre-processing */
 
+	/* clip, zoom, smooth, gray and brighten in one pass if we can */
+
+	if (canPipeline(image, options)) {
+		if (options->zoom_auto)
+			autoZoom(options,
+			    (options->clipw ? options->clipw : image->width),
+			    (options->cliph ? options->cliph : image->height));
+		image = pipelineImage(image, options, verbose);
+		piped = TRUE;
+		profileStage(&mark, "pipeline", image);
+	}
+
 	/* clip the image if requested */
 
-	if ((options->clipx != 0) || (options->clipy != 0) ||
-	    (options->clipw != 0) || (options->cliph != 0)) {
+	if (!piped && ((options->clipx != 0) || (options->clipy != 0) ||
+	    (options->clipw != 0) || (options->cliph != 0))) {
 		tmpimage = clip(image, options->clipx, options->clipy,
 			(options->clipw ? options->clipw : image->width),
 		       (options->cliph ? options->cliph : image->height),
-				options);
+				options, verbose);
 		if (tmpimage != image && iimage != image)
 			freeImage(image);
 		image = tmpimage;
+		profileStage(&mark, "clip", image);
 	}
 	if (options->rotate) {
-		tmpimage = rotate(image, options->rotate, globals.verbose);
+		tmpimage = rotate(image, options->rotate, verbose);
 		if (tmpimage != image && iimage != image)
 			freeImage(image);
 		image = tmpimage;
+		profileStage(&mark, "rotate", image);
 	}
 	/* zoom image */
-	if (options->zoom_auto) {
-		if (image->width > globals.dinfo.width * .9)
-			options->xzoom = globals.dinfo.width * 90 / image->width;
-		else
-			options->xzoom = 100;
-		if (image->height > globals.dinfo.height * .9)
-			options->yzoom = globals.dinfo.height * 90 / image->height;
-		else
-			options->yzoom = 100;
-		/* both dimensions should be shrunk by the same factor */
-		options->xzoom = options->yzoom =
-			MIN(options->xzoom, options->yzoom);
-	}
-	if (options->xzoom || options->yzoom) {
+	if (!piped && options->zoom_auto)
+		autoZoom(options, image->width, image->height);
+	if (!piped && (options->xzoom || options->yzoom)) {
 		/* if the image is to be blown up, compress before doing it */
 		if (!options->colors && RGBP(image) &&	
 		    ((!options->xzoom && (options->yzoom > 100)) ||
 		     (!options->yzoom && (options->xzoom > 100)) ||
 		     (options->xzoom + options->yzoom > 200))) {
-			compress_cmap(image, globals.verbose);
+			compress_cmap(image, verbose);
 		}
 		tmpimage = zoom(image, options->xzoom, options->yzoom,
-			globals.verbose, TRUE);
+			verbose, TRUE);
 		if (tmpimage != image && iimage != image)
 			freeImage(image);
 		image = tmpimage;
+		profileStage(&mark, "zoom", image);
 	}
 
+	/* a background load that has been called off stops here */
+	if (prefetchCancelled())
+		return (image);
+
 	/* set foreground and background colors of mono image */
 	xcolor.flags = DoRed | DoGreen | DoBlue;
 	if (image->depth == 1 && (options->fg || options->bg)) {
@@ -190,44 +219,58 @@ Image *processImage(DisplayInfo *dinfo, Image *iimage, ImageOptions *options)
 	}
 
 	/* General image processing */
-	if (options->smooth > 0) {	/* image is to be smoothed */
-		tmpimage = smooth(image, options->smooth, globals.verbose);
+	if (!piped && options->smooth > 0) {	/* image is to be smoothed */
+		tmpimage = smooth(image, options->smooth, verbose);
 		if (tmpimage != image && iimage != image)
 			freeImage(image);
 		image = tmpimage;
+		profileStage(&mark, "smooth", image);
 	}
+	if (prefetchCancelled())
+		return (image);
 
 	/* Post-processing */
-	if (options->gray)	/* convert image to grayscale */
-		gray(image, globals.verbose);
 
-	if (options->normalize) {	/* normalize image */
-		tmpimage = normalize(image, globals.verbose);
+	/* convert to grayscale, normalize and alter image brightness
+	 * together, leaving out whatever has been done already
+	 */
+	if ((!piped && options->gray) || options->normalize ||
+			(options->bright && (!piped || options->normalize))) {
+		tmpimage = adjustImage(image, !piped && options->gray,
+			options->normalize,
+			(!piped || options->normalize) ? options->bright : 0,
+			verbose);
 		if (tmpimage != image && iimage != image)
 			freeImage(image);
 		image = tmpimage;
+		profileStage(&mark, "adjust", image);
 	}
-	if (options->bright)	/* alter image brightness */
-		brighten(image, options->bright, globals.verbose);
+	if (prefetchCancelled())
+		return (image);
 
 	/* forcibly reduce colormap */
 	if (options->colors && (TRUEP(image) || (RGBP(image) && (options->colors < image->rgb.used)))) {
 		tmpimage = reduce(image, options->colors, options->colordither,
-			UNSET_GAMMA, globals.verbose);
+			UNSET_GAMMA, verbose);
 		if (tmpimage != image && iimage != image)
 			freeImage(image);
 		image = tmpimage;
+		profileStage(&mark, "reduce", image);
 	}
+	if (prefetchCancelled())
+		return (image);
 
 	if (options->dither && (image->depth > 1)) {
 		/* image is to be dithered */
-		if (options->dither == 1)
-			tmpimage = dither(image, globals.verbose);
+		if (options->dither == DITHER_HALFTONE)
+			tmpimage = halftone(image, verbose);
 		else
-			tmpimage = halftone(image, globals.verbose);
+			tmpimage = dither(image, options->dither, verbose);
 		if (tmpimage != image && iimage != image)
 			freeImage(image);
 		image = tmpimage;
+		profileStage(&mark, options->dither == DITHER_HALFTONE ?
+			"halftone" : "dither", image);
 		/* Hmmm - if foreground or -background is used, */
 		/* make sure it applies here as well */
 		if (image->depth == 1 && (options->fg || options->bg)) {
@@ -261,22 +304,147 @@ Image *processImage(DisplayInfo *dinfo, Image *iimage, ImageOptions *options)
 
 	if (options->expand && !TRUEP(image)) {
 		/* expand image to truecolor */
-		if (globals.verbose)
+		if (verbose)
 			fprintf(stderr, "  Expanding image to TRUE color\n");
 		tmpimage = expandtotrue(image);
 		if (tmpimage != image && iimage != image)
 			freeImage(image);
 		image = tmpimage;
+		profileStage(&mark, "expand", image);
 	}
 
 	if (RGBP(image) && !image->rgb.compressed) {
 		/* make sure colormap is minimized */
-		compress_cmap(image, globals.verbose);
+		compress_cmap(image, verbose);
+		profileStage(&mark, "compress", image);
 	}
 
 	return (image);
 }
 
+/* TRUE if processImage() has anything to do to a true color image */
+static boolean wantsProcessing(ImageOptions *io)
+{
+	return (io->clipx || io->clipy || io->clipw || io->cliph ||
+		io->rotate || io->xzoom || io->yzoom || io->zoom_auto ||
+		io->iscale < 0 || io->smooth || io->gray || io->normalize ||
+		io->bright || io->colors || io->dither ||
+		io->gamma != UNSET_GAMMA);
+}
+
+/* load an image and apply all the processing its options ask for.
+ * "first" is TRUE if this will be the first image successfully loaded and
+ * "cache" is TRUE if the decoded image should be kept for re-rendering.
+ * otherwise, if "decoded" isn't NULL, a copy of the decoded image is
+ * handed back through it so that it can be cached later on.
+ * an image that is to be viewed on its own without any processing may be
+ * decoded straight into the XImage it will be displayed from, in which
+ * case it isn't cached.  NULL is returned if the image can't be loaded or
+ * if it is being loaded in the background and that has been called off.
+ */
+Image *prepareImage(ImageOptions *io, boolean first, boolean cache,
+	Image **decoded, boolean verbose)
+{
+	Image *inew, *itmp, *frame, *frames, **last;
+	ProfileMark mark;
+
+	io->direct = cache && !globals.fit && !globals.fullscreen &&
+		!globals.fillscreen && !wantsProcessing(io);
+
+	if (io->iscale) {
+		io->xzoom = io->yzoom = io->iscale < 0 ? 
+			100 << -io->iscale : 100 >> io->iscale;
+	}
+
+	if (decoded)
+		*decoded = NULL;
+	profileStart(&mark, NULL);
+	inew = loadImage(io, verbose);
+	io->direct = FALSE;
+	if (!inew)
+		return (NULL);
+	profileStage(&mark, "load", inew);
+	if (prefetchCancelled()) {
+		freeImage(inew);
+		return (NULL);
+	}
+
+	if (cache && !(inew->flags & FLAG_DIRECT))
+		cacheImage(io, inew);
+	else if (!cache && decoded)
+		*decoded = dupImage(inew);
+
+	if (inew->flags & FLAG_ISCALE)
+		io->xzoom = io->yzoom = 0;
+
+	if (io->gamma != UNSET_GAMMA)
+		inew->gamma = io->gamma;
+	else if (UNSET_GAMMA == inew->gamma)
+		defaultgamma(inew, verbose);
+
+	/* Process any other options that need doing here */
+	if (io->border) {
+		xliParseXColor(&globals.dinfo, io->border, &io->bordercol);
+		xliGammaCorrectXColor(&io->bordercol, DEFAULT_DISPLAY_GAMMA);
+	}
+
+	/*
+	 * if first image and we're putting it on the root window
+	 * in fullscreen mode, set zoom factors to something reasonable
+	 */
+
+	if ( (first || globals.forall) && 
+		      ((globals.onroot && globals.fullscreen) ||
+			globals.fillscreen) && !io->xzoom &&
+			!io->yzoom && !io->center) {
+		double wr, hr;
+
+		wr = (double) globals.dinfo.width / inew->width;
+		hr = (double) globals.dinfo.height / inew->height;
+		io->xzoom = io->yzoom = (((wr < hr) ^
+			(globals.onroot && globals.fillscreen)) ?
+			wr : hr) * 100 + 0.5;
+	}
+
+	/* trailing options may have asked for processing after all */
+	if ((inew->flags & FLAG_DIRECT) && wantsProcessing(io))
+		undirectImage(inew);
+
+	/* the frames of an animation are processed one at a time, the
+	 * same way as the first
+	 */
+	frames = inew->next;
+	inew->next = NULL;
+	itmp = processImage(&globals.dinfo, inew, io, verbose);
+	itmp->delay = inew->delay;
+	itmp->loops = inew->loops;
+	for (last = &itmp->next; frames && !prefetchCancelled();
+			last = &(*last)->next) {
+		frame = frames;
+		frames = frame->next;
+		frame->next = NULL;
+		frame->gamma = inew->gamma;
+		*last = processImage(&globals.dinfo, frame, io, FALSE);
+		(*last)->delay = frame->delay;
+		if (*last != frame)
+			freeImage(frame);
+	}
+	if (itmp != inew)
+		freeImage(inew);
+
+	/* a background load that was called off part way through */
+	if (prefetchCancelled()) {
+		freeImage(frames);
+		freeImage(itmp);
+		if (decoded) {
+			freeImage(*decoded);
+			*decoded = NULL;
+		}
+		return (NULL);
+	}
+	return (itmp);
+}
+
 /* A dumb version that should work reliably
  * search for "s2" in "s1"
  */
@@ -10,6 +10,9 @@
 
 #include "copyright.h"
 #include "xli.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
 
 /* this table is useful for quick conversions between depth and ncolors */
 
@@ -116,7 +119,7 @@ static unsigned int ovmul(unsigned int a, unsigned int b)
 	return r;
 }
 
-static Image *newImage(unsigned width, unsigned height)
+Image *newImage(unsigned int width, unsigned int height)
 {
 	Image *image;
 
@@ -127,6 +130,9 @@ static Image *newImage(unsigned width, unsigned height)
 	image->height = height;
 	image->gamma = UNSET_GAMMA;
 	image->flags = 0;
+	image->delay = 0;
+	image->loops = 1;
+	image->next = NULL;
 
 	return image;
 }
@@ -191,6 +197,53 @@ Image *newTrueImage(unsigned int width, unsigned int height)
 	return image;
 }
 
+/* return a copy of an image that shares no storage with the original,
+ * along with any frames that follow it
+ */
+Image *dupImage(Image *image)
+{
+	Image *new;
+	unsigned int datalen;
+
+	CURRFUNC("dupImage");
+	switch (image->type) {
+	case IBITMAP:
+		new = newBitImage(image->width, image->height);
+		datalen = ((image->width + 7) / 8) * image->height;
+		break;
+	case IRGB:
+		new = newRGBImage(image->width, image->height, image->depth);
+		datalen = image->width * image->height * image->pixlen;
+		break;
+	default:
+		new = newTrueImage(image->width, image->height);
+		datalen = image->width * image->height * image->pixlen;
+		break;
+	}
+	if (!TRUEP(image)) {
+		if (new->rgb.size < image->rgb.size)
+			resizeRGBMapData(&(new->rgb), image->rgb.size);
+		bcopy(image->rgb.red, new->rgb.red,
+			image->rgb.size * sizeof(Intensity));
+		bcopy(image->rgb.green, new->rgb.green,
+			image->rgb.size * sizeof(Intensity));
+		bcopy(image->rgb.blue, new->rgb.blue,
+			image->rgb.size * sizeof(Intensity));
+		new->rgb.used = image->rgb.used;
+		new->rgb.compressed = image->rgb.compressed;
+	}
+	bcopy(image->data, new->data, datalen);
+	new->title = dupString(image->title);
+	new->gamma = image->gamma;
+	new->flags = image->flags;
+	new->delay = image->delay;
+	new->loops = image->loops;
+	if (image->next)
+		new->next = dupImage(image->next);
+
+	return new;
+}
+
 void freeImageData(Image *image)
 {
 	if (image->title) {
@@ -199,13 +252,58 @@ void freeImageData(Image *image)
 	}
 	if (!TRUEP(image))
 		freeRGBMapData(&(image->rgb));
+	if (image->flags & FLAG_DIRECT)
+		freeDirectImage(image);
 	lfree(image->data);
 }
 
+/* free an image and any frames that follow it */
 void freeImage(Image *image)
 {
-	freeImageData(image);
-	lfree((byte *) image);
+	Image *next;
+
+	for (; image; image = next) {
+		next = image->next;
+		freeImageData(image);
+		lfree((byte *) image);
+	}
+}
+
+/* how much has been allocated through lmalloc() and friends, for
+ * xli-bench and -profile.  every allocation is counted, so with threads
+ * the counts are bumped atomically where the compiler can, rather than
+ * under a lock.
+ */
+#if !defined(NO_PTHREADS) && !defined(__GNUC__)
+static pthread_mutex_t AllocLock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_ALLOC() pthread_mutex_lock(&AllocLock)
+#define UNLOCK_ALLOC() pthread_mutex_unlock(&AllocLock)
+#else
+#define LOCK_ALLOC()
+#define UNLOCK_ALLOC()
+#endif
+#if !defined(NO_PTHREADS) && defined(__GNUC__)
+#define ADD_ALLOC(var, n) __sync_fetch_and_add(&(var), (n))
+#else
+#define ADD_ALLOC(var, n) ((var) += (n))
+#endif
+static unsigned long AllocCount, AllocBytes;
+
+static void countAlloc(unsigned int size)
+{
+	LOCK_ALLOC();
+	ADD_ALLOC(AllocCount, 1);
+	ADD_ALLOC(AllocBytes, size);
+	UNLOCK_ALLOC();
+}
+
+/* get the number of allocations and the bytes allocated so far */
+void allocStats(unsigned long *count, unsigned long *bytes)
+{
+	LOCK_ALLOC();
+	*count = ADD_ALLOC(AllocCount, 0);
+	*bytes = ADD_ALLOC(AllocBytes, 0);
+	UNLOCK_ALLOC();
 }
 
 byte *lmalloc(unsigned int size)
@@ -221,6 +319,7 @@ byte *lmalloc(unsigned int size)
 		memoryExhausted();
 		/* NOTREACHED */
 	}
+	countAlloc(size);
 	return (area);
 }
 
@@ -237,6 +336,7 @@ byte *lcalloc(unsigned int size)
 		memoryExhausted();
 		/* NOTREACHED */
 	}
+	countAlloc(size);
 	return (area);
 }
 
@@ -253,6 +353,7 @@ byte *lrealloc(byte *old, unsigned int size)
 		memoryExhausted();
 		/* NOTREACHED */
 	}
+	countAlloc(size);
 	return (area);
 }
 
@@ -107,6 +107,31 @@ loaded from the standard input.",},
 Enable deleting images with the 'x' key.",},
 	{"focus", FOCUS, NULL, "\
 Take keyboard focus when viewing in window.",},
+	{"prefetch", PREFETCH, "count[,megabytes]", "\
+Load and process up to count images either side of the one being viewed in\n\
+the background, so that moving to the next or previous image is immediate.\n\
+Prefetching stops once the waiting images use the given amount of memory\n\
+(256 megabytes by default).",},
+	{"threads", THREADS, "n", "\
+Use n threads for image processing.  The default is one per processor.",},
+	{"output", OUTPUT, "file", "\
+Write the images to files rather than showing them, without needing an X\n\
+server.  The images are made into what a display of the size given by\n\
+-screensize, and with the visual given by -visual (TrueColor by default),\n\
+would show.  The file is PNG if its name ends in .png, otherwise PBM, PGM or\n\
+PPM.  A %d in the name is replaced by the number of the image, counting\n\
+from 1.  -o is short for -output.",},
+	{"o", OUTPUT, "file", "\
+Short for -output.",},
+	{"screensize", SCREENSIZE, "widthxheight", "\
+Give the size of the display assumed by -output, which -fullscreen,\n\
+-fillscreen, -onroot and -zoom auto use.  The default is 1920x1080.",},
+	{"profile", PROFILE, NULL, "\
+Print how long each stage of loading, processing and showing each image\n\
+takes, and how much memory it allocates.  Prefetching is turned off.",},
+	{"profilejson", PROFILEJSON, "file", "\
+Write the -profile results to the file as lines of JSON as well (\"-\" for\n\
+the standard output).  Implies -profile.",},
 
 	/* image options */
 
@@ -127,19 +152,24 @@ Center the image on the base image (if using -merge) or the root window (if\n\
 using -onroot).",},
 	{"clip", CLIP, "X,Y,W,H", "\
 Clip out the rectangle specified by X,Y,W,H and use that as the image.",},
-	{"colordither", COLORDITHER, NULL, "\
+	{"colordither", COLORDITHER, "[ordered|bluenoise]", "\
 Dither the image if the number of colors is reduced. This will be slower,\n\
-but will give a better looking result when 256 colors or less are used.",},
-	{"cdither", COLORDITHER, NULL, "\
+but will give a better looking result when 256 colors or less are used.\n\
+`ordered' or `bluenoise' use a threshold matrix instead of error diffusion,\n\
+which is much faster but shows a fine regular pattern or grain.  These\n\
+also apply if the image has to be dithered for a monochrome display.",},
+	{"cdither", COLORDITHER, "[ordered|bluenoise]", "\
 See -colordither.",},
 	{"colors", COLORS, "number_of_colors", "\
 Specify the maximum number of colors to be used in displaying the image.\n\
 Values of 1-32768 are acceptable although low values will not look good.\n\
 This is done automatically if the server cannot support the depth of the\n\
 image.",},
-	{"dither", DITHER, NULL, "\
+	{"dither", DITHER, "[ordered|bluenoise]", "\
 Dither the image into monochrome.  This happens automatically if sent to\n\
-a monochrome display.",},
+a monochrome display.  `ordered' uses a Bayer matrix and `bluenoise' a\n\
+blue noise matrix of thresholds rather than error diffusion, which is\n\
+much faster.",},
 	{"expand", EXPAND, NULL, "\
 Expand the image to TrueColor depth if it is not already of this depth.",},
 	{"foreground", FOREGROUND, "color", "\
@@ -223,6 +253,12 @@ OptionId optionNumber(char *arg)
 
 	if ((*arg) != '-')
 		return (OPT_NOTOPT);
+
+	/* an exact match wins even if it's the start of another option */
+	for (a = 0; Options[a].name; a++)
+		if (!strcmp(arg + 1, Options[a].name))
+			return (Options[a].option_id);
+
 	for (a = 0; Options[a].name; a++) {
 		if (!strncmp(arg + 1, Options[a].name, strlen(arg) - 1)) {
 			for (b = a + 1; Options[b].name; b++)
@@ -500,6 +536,56 @@ int doGeneralOption(OptionId opid, char **argv, ImageOptions *persist_ops,
 		globals.focus = TRUE;
 		break;
 
+	case PREFETCH:
+		if (!argv[++a])
+			break;
+		switch (sscanf(argv[a], "%d,%u", &globals.prefetch,
+				&globals.prefetch_memory)) {
+		case 1:
+		case 2:
+			if (globals.prefetch >= 0)
+				break;
+			/* FALLTHRU */
+		default:
+			printf("Bad argument to -prefetch\n");
+			usage(globals.argv0);
+			/* NOTREACHED */
+		}
+		break;
+
+	case THREADS:
+		if (!argv[++a])
+			break;
+		if (sscanf(argv[a], "%d", &globals.threads) != 1 ||
+				globals.threads <= 0) {
+			printf("Bad argument to -threads\n");
+			usage(globals.argv0);
+			/* NOTREACHED */
+		}
+		break;
+
+	case OUTPUT:
+		if (argv[++a])
+			globals.output = argv[a];
+		break;
+
+	case SCREENSIZE:
+		if (argv[++a])
+			globals.screen_size = argv[a];
+		break;
+
+	case PROFILE:
+		globals.profile = TRUE;
+		break;
+
+	case PROFILEJSON:
+		if (!argv[++a])
+			break;
+		if (!profileJSON(argv[a]))
+			exit(1);
+		globals.profile = TRUE;
+		break;
+
 	default:
 		fprintf(stderr, "strange global option #%d\n", opid);
 		exit(-1);
@@ -509,6 +595,20 @@ int doGeneralOption(OptionId opid, char **argv, ImageOptions *persist_ops,
 	return a;
 }
 
+/* the dithering method named by the optional argument to -dither or
+ * -colordither, or 0 if there isn't one
+ */
+static unsigned int ditherMethod(char *arg)
+{
+	if (!arg)
+		return 0;
+	if (!strcmp(arg, "ordered"))
+		return DITHER_ORDERED;
+	if (!strcmp(arg, "bluenoise"))
+		return DITHER_BLUENOISE;
+	return 0;
+}
+
 /* Do locals and return no of argv's advanced */
 int doLocalOption(OptionId opid, char **argv, boolean setpersist,
 	ImageOptions *persist_ops, ImageOptions *image_ops)
@@ -580,9 +680,12 @@ int doLocalOption(OptionId opid, char **argv, boolean setpersist,
 		break;
 
 	case COLORDITHER:
-		image_ops->colordither = 1;
+		if ((image_ops->colordither = ditherMethod(argv[a + 1])))
+			a++;
+		else
+			image_ops->colordither = DITHER_DIFFUSION;
 		if (setpersist)
-			persist_ops->colordither = 1;
+			persist_ops->colordither = image_ops->colordither;
 		break;
 
 	case COLORS:
@@ -601,9 +704,12 @@ int doLocalOption(OptionId opid, char **argv, boolean setpersist,
 		break;
 
 	case DITHER:
-		image_ops->dither = 1;
+		if ((image_ops->dither = ditherMethod(argv[a + 1])))
+			a++;
+		else
+			image_ops->dither = DITHER_DIFFUSION;
 		if (setpersist)
-			persist_ops->dither = 1;
+			persist_ops->dither = image_ops->dither;
 		break;
 
 	case EXPAND:
@@ -618,9 +724,9 @@ int doLocalOption(OptionId opid, char **argv, boolean setpersist,
 		break;
 
 	case HALFTONE:
-		image_ops->dither = 2;
+		image_ops->dither = DITHER_HALFTONE;
 		if (setpersist)
-			persist_ops->dither = 2;
+			persist_ops->dither = DITHER_HALFTONE;
 		break;
 
 	case IDELAY:
@@ -56,6 +56,12 @@ typedef enum option_id {
 	CACHE,
 	DELETE,
 	FOCUS,
+	PREFETCH,
+	THREADS,
+	OUTPUT,
+	SCREENSIZE,
+	PROFILE,
+	PROFILEJSON,
 
 	GENERAL_OPTIONS_END,	/* marker */
 
@@ -0,0 +1,236 @@
+/* output.c:
+ *
+ * write an image to a file instead of showing it.  the image is first
+ * made into what a display like the one globals.dinfo describes would
+ * show (see xliNullDisplay()): a colormapped display gets a reduced
+ * image, a monochrome one a dithered image, a gray one a gray image, and
+ * the display gamma is applied as it would be for the screen.
+ *
+ * the file is a PNG image if its name ends in .png, otherwise a PBM, PGM
+ * or PPM image.  a name of "-" writes to the standard output.
+ */
+
+#include "copyright.h"
+#include "xli.h"
+#include <png.h>
+#include <setjmp.h>
+
+#define OUT_BITS 0	/* what rows hold: 8 pixels per byte, 1 is black */
+#define OUT_GRAY 1	/* a byte per pixel */
+#define OUT_RGB 3	/* three bytes per pixel */
+
+typedef struct {
+	Image *image;
+	int kind;		/* OUT_BITS, OUT_GRAY or OUT_RGB */
+	boolean invert;		/* for OUT_BITS, image 1 bits are lighter */
+	boolean dogamma;
+	int gammamap[256];
+} OutputJob;
+
+/* make row y of the output */
+static void outputRow(OutputJob *job, unsigned int y, byte *dp)
+{
+	Image *image = job->image;
+	unsigned int x, linelen, pixlen = image->pixlen;
+	int red, green, blue;
+	byte *sp;
+	Pixel pixval;
+
+	if (job->kind == OUT_BITS) {
+		linelen = (image->width + 7) / 8;
+		sp = image->data + y * linelen;
+		for (x = 0; x < linelen; x++)
+			*dp++ = job->invert ? ~*sp++ : *sp++;
+		return;
+	}
+
+	sp = image->data + y * image->width * pixlen;
+	for (x = 0; x < image->width; x++, sp += pixlen) {
+		pixval = memToVal(sp, pixlen);
+		if (TRUEP(image)) {
+			red = TRUE_RED(pixval);
+			green = TRUE_GREEN(pixval);
+			blue = TRUE_BLUE(pixval);
+		} else {
+			red = image->rgb.red[pixval] >> 8;
+			green = image->rgb.green[pixval] >> 8;
+			blue = image->rgb.blue[pixval] >> 8;
+		}
+		if (job->dogamma) {
+			red = job->gammamap[red];
+			green = job->gammamap[green];
+			blue = job->gammamap[blue];
+		}
+		if (job->kind == OUT_GRAY)
+			*dp++ = colorIntensity(red << 8, green << 8,
+				blue << 8) >> 8;
+		else {
+			*dp++ = red;
+			*dp++ = green;
+			*dp++ = blue;
+		}
+	}
+}
+
+static boolean writePNM(OutputJob *job, FILE *f, byte *row,
+	unsigned int rowlen)
+{
+	Image *image = job->image;
+	unsigned int y;
+
+	fprintf(f, "P%c\n%u %u\n", job->kind == OUT_BITS ? '4' :
+		job->kind == OUT_GRAY ? '5' : '6', image->width, image->height);
+	if (job->kind != OUT_BITS)
+		fprintf(f, "255\n");
+	for (y = 0; y < image->height; y++) {
+		outputRow(job, y, row);
+		if (fwrite(row, 1, rowlen, f) != rowlen)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void outputPNGError(png_struct *png, const char *msg)
+{
+	fprintf(stderr, "writeImage: %s\n", msg);
+	longjmp(*((jmp_buf *) png_get_error_ptr(png)), 1);
+}
+
+static boolean writePNG(OutputJob *job, FILE *f, byte *row,
+	unsigned int rowlen)
+{
+	Image *image = job->image;
+	png_struct *png;
+	png_info *info;
+	jmp_buf jmpbuf;
+	unsigned int x, y;
+
+	if (!(png = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+			(void *) &jmpbuf, outputPNGError, NULL)))
+		return FALSE;
+	if (!(info = png_create_info_struct(png))) {
+		png_destroy_write_struct(&png, NULL);
+		return FALSE;
+	}
+	if (setjmp(jmpbuf)) {
+		png_destroy_write_struct(&png, &info);
+		return FALSE;
+	}
+
+	png_init_io(png, f);
+	png_set_IHDR(png, info, image->width, image->height,
+		job->kind == OUT_BITS ? 1 : 8,
+		job->kind == OUT_RGB ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY,
+		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+		PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+	for (y = 0; y < image->height; y++) {
+		outputRow(job, y, row);
+		if (job->kind == OUT_BITS)	/* PNG has 1 for white */
+			for (x = 0; x < rowlen; x++)
+				row[x] = ~row[x];
+		png_write_row(png, row);
+	}
+	png_write_end(png, info);
+	png_destroy_write_struct(&png, &info);
+	return TRUE;
+}
+
+static boolean isPNGName(char *name)
+{
+	int len = strlen(name);
+
+	return len >= 4 && !strcasecmp(name + len - 4, ".png");
+}
+
+/* write an image to the named file, as it would have been shown.
+ * returns FALSE if it couldn't be written.
+ */
+boolean writeImage(Image *image, ImageOptions *options, char *name,
+	boolean verbose)
+{
+	DisplayInfo *dinfo = &globals.dinfo;
+	Image *oimage = image, *dimage;
+	OutputJob job;
+	unsigned int rowlen;
+	boolean png, ok;
+	byte *row;
+	FILE *f;
+
+	CURRFUNC("writeImage");
+
+	/* do to the image what imageToXImage() would for the visual */
+	switch (dinfo->visual_class) {
+	case TrueColor:
+	case DirectColor:
+		break;
+	default:
+		if (BITMAPP(image))
+			break;
+		if (dinfo->depth == 1)
+			dimage = dither(image, options->colordither, verbose);
+		else if (TRUEP(image) || image->rgb.used > (1 << dinfo->depth))
+			dimage = reduce(image, 1 << dinfo->depth,
+				options->colordither, globals.display_gamma,
+				verbose);
+		else
+			dimage = image;
+		if (dimage != image && image != oimage)
+			freeImage(image);
+		image = dimage;
+	}
+
+	job.image = image;
+	job.invert = FALSE;
+	job.dogamma = FALSE;
+	if (BITMAPP(image)) {
+		job.kind = OUT_BITS;
+		job.invert = colorIntensity(image->rgb.red[1],
+			image->rgb.green[1], image->rgb.blue[1]) >
+			colorIntensity(image->rgb.red[0],
+			image->rgb.green[0], image->rgb.blue[0]);
+		rowlen = (image->width + 7) / 8;
+	} else {
+		if (GAMMA_NOT_EQUAL(globals.display_gamma, image->gamma)) {
+			make_gamma(globals.display_gamma / image->gamma,
+				job.gammamap);
+			job.dogamma = TRUE;
+		}
+		job.kind = (dinfo->visual_class == StaticGray ||
+			dinfo->visual_class == GrayScale) ? OUT_GRAY : OUT_RGB;
+		rowlen = image->width * job.kind;
+	}
+
+	png = isPNGName(name);
+	if (verbose) {
+		printf("  Writing %s as a %s image...", name, png ? "PNG" :
+			job.kind == OUT_BITS ? "PBM" :
+			job.kind == OUT_GRAY ? "PGM" : "PPM");
+		fflush(stdout);
+	}
+	if (!strcmp(name, "-"))
+		f = stdout;
+	else if (!(f = fopen(name, "wb"))) {
+		perror(name);
+		if (image != oimage)
+			freeImage(image);
+		return FALSE;
+	}
+
+	row = lmalloc(rowlen);
+	ok = png ? writePNG(&job, f, row, rowlen) :
+		writePNM(&job, f, row, rowlen);
+	lfree(row);
+	if (f == stdout)
+		ok = !fflush(f) && ok;
+	else
+		ok = !fclose(f) && ok;
+	if (!ok)
+		perror(name);
+	else if (verbose)
+		printf("done\n");
+
+	if (image != oimage)
+		freeImage(image);
+	return ok;
+}
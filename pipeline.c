@@ -0,0 +1,253 @@
+/* pipeline.c:
+ *
+ * clip, zoom, smooth, gray and brighten an image in a single pass.
+ *
+ * processImage() normally runs each of these steps over the whole image
+ * in turn, and most of them make a complete new image.  when several of
+ * them are wanted on a true color image (or on a colormapped image that
+ * is being smoothed, and so will end up true color anyway), they are
+ * done here instead: each row of the final image is pulled through all
+ * of the steps from the loaded image, and only the few rows that
+ * smoothing looks at are kept along the way.  the result is the same as
+ * doing the steps one after another.
+ */
+
+#include "copyright.h"
+#include "xli.h"
+
+typedef struct {
+	Image *src;		/* image being processed */
+	Image *dest;		/* final image */
+	unsigned int clipx, clipy;	/* top left of clipped area of src */
+	unsigned int *xindex, *yindex;	/* zoom tables, NULL if not zooming */
+	ZoomMap *map;		/* areas to average if shrinking, or NULL */
+	byte *gammamap;		/* gamma correction, or NULL */
+	unsigned int smooth;	/* # of smoothing passes */
+	boolean gray;		/* TRUE to convert to grayscale */
+	byte *brightmap;	/* brightening, or NULL */
+} PipeJob;
+
+/* fetch a row of the clipped and zoomed image as true color */
+static void fetchRow(void *arg, unsigned int y, byte *dp)
+{
+	PipeJob *job = (PipeJob *) arg;
+	Image *src = job->src;
+	unsigned int width = job->dest->width;
+	unsigned int x, sx;
+	byte *line, *sp, *row = dp;
+	Pixel pixval;
+
+	line = src->data + (job->clipy + (job->yindex ? job->yindex[y] : y)) *
+		src->width * src->pixlen;
+	if (job->map)
+		zoomRow(job->map, src, job->clipx, job->clipy, y, dp);
+	else if (TRUEP(src)) {
+		for (x = 0; x < width; x++) {
+			sx = job->clipx + (job->xindex ? job->xindex[x] : x);
+			sp = line + sx * 3;
+			*dp++ = sp[0];
+			*dp++ = sp[1];
+			*dp++ = sp[2];
+		}
+	} else {
+		for (x = 0; x < width; x++) {
+			sx = job->clipx + (job->xindex ? job->xindex[x] : x);
+			pixval = memToVal(line + sx * src->pixlen, src->pixlen);
+			*dp++ = src->rgb.red[pixval] >> 8;
+			*dp++ = src->rgb.green[pixval] >> 8;
+			*dp++ = src->rgb.blue[pixval] >> 8;
+		}
+	}
+	if (job->gammamap) {
+		byte *gammamap = job->gammamap;
+
+		for (x = 0; x < width * 3; x++, row++)
+			*row = gammamap[*row];
+	}
+}
+
+static void pipeBand(void *arg, unsigned int y0, unsigned int y1)
+{
+	PipeJob *job = (PipeJob *) arg;
+	unsigned int linelen = job->dest->width * 3;
+	unsigned int a, y;
+	Smoother *smoother = NULL;
+	Intensity intensity;
+	byte *dp;
+
+	if (job->smooth)
+		smoother = newSmoother(job->dest->width, job->dest->height,
+			job->smooth, fetchRow, job);
+
+	for (y = y0; y < y1; y++) {
+		dp = job->dest->data + y * linelen;
+		if (smoother)
+			smoothedRow(smoother, y, dp);
+		else
+			fetchRow(job, y, dp);
+		if (job->gray)
+			for (a = 0; a < linelen; a += 3) {
+				intensity = ((Intensity) colorIntensity(
+					dp[a] << 8, dp[a + 1] << 8,
+					dp[a + 2] << 8)) >> 8;
+				dp[a] = dp[a + 1] = dp[a + 2] = intensity;
+			}
+		if (job->brightmap)
+			for (a = 0; a < linelen; a++)
+				dp[a] = job->brightmap[dp[a]];
+	}
+
+	if (smoother)
+		freeSmoother(smoother);
+}
+
+/* TRUE if an image and its options suit pipelineImage(), and enough
+ * steps are wanted for it to be worthwhile.
+ */
+boolean canPipeline(Image *image, ImageOptions *options)
+{
+	unsigned int clipw, cliph;
+	int steps = 0;
+
+	if (TRUEP(image)) {
+		if (image->pixlen != 3)
+			return FALSE;
+	} else if (!RGBP(image) || !options->smooth ||
+			(image->depth == 1 && (options->fg || options->bg)))
+		return FALSE;
+	if (options->rotate)
+		return FALSE;
+
+	/* the clipped area has to be within the image, so that there's
+	 * no border to add
+	 */
+	if (options->clipx || options->clipy || options->clipw ||
+			options->cliph) {
+		clipw = options->clipw ? options->clipw : image->width;
+		cliph = options->cliph ? options->cliph : image->height;
+		if (options->clipx < 0 || options->clipy < 0 ||
+				options->clipx + clipw > image->width ||
+				options->clipy + cliph > image->height)
+			return FALSE;
+		steps++;
+	}
+	if (options->zoom_auto ||
+			(options->xzoom && options->xzoom != 100) ||
+			(options->yzoom && options->yzoom != 100))
+		steps++;
+	if (options->smooth)
+		steps++;
+	if (options->gray)
+		steps++;
+	if (options->bright && !options->normalize)
+		steps++;
+	return steps >= 2;
+}
+
+/* clip, zoom, smooth, gray and brighten an image as asked for in its
+ * options.  brightening is left for processImage() to do if the image
+ * is also to be normalized, since that comes in between.  the zoom
+ * must already have been worked out if it is automatic.
+ */
+Image *pipelineImage(Image *image, ImageOptions *options, boolean verbose)
+{
+	PipeJob job;
+	Image *dest;
+	unsigned int width, height, a;
+	unsigned int newrgb;
+	float fperc;
+	int gammamap[256];
+	byte gammatable[256], brighttable[256];
+	char buf[BUFSIZ], *title;
+
+	CURRFUNC("pipelineImage");
+
+	if (verbose) {
+		printf("  Processing image in one pass:\n");
+		fflush(stdout);
+	}
+
+	job.src = image;
+	job.clipx = options->clipx;
+	job.clipy = options->clipy;
+	width = options->clipw ? options->clipw : image->width;
+	height = options->cliph ? options->cliph : image->height;
+	if (verbose && (options->clipx || options->clipy ||
+			options->clipw || options->cliph))
+		printf("  Clipping image...\n");
+
+	title = dupString(image->title);
+	job.xindex = job.yindex = NULL;
+	job.map = NULL;
+	if ((options->xzoom && options->xzoom != 100) ||
+			(options->yzoom && options->yzoom != 100)) {
+		zoomTitle(buf, title, options->xzoom, options->yzoom, verbose);
+		if (verbose)
+			printf("\n");
+		lfree((byte *) title);
+		title = dupString(buf);
+		if (zoomShrinks(options->xzoom, options->yzoom)) {
+			job.map = zoomMap(width, height, options->xzoom,
+				options->yzoom);
+			width = job.map->width;
+			height = job.map->height;
+		} else {
+			job.xindex = zoomIndex(width, options->xzoom, &width);
+			job.yindex = zoomIndex(height, options->yzoom, &height);
+		}
+	}
+
+	dest = newTrueImage(width, height);
+	dest->gamma = image->gamma;
+	job.dest = dest;
+
+	job.smooth = options->smooth;
+	job.gray = options->gray;
+	job.gammamap = job.brightmap = NULL;
+	if ((job.smooth || job.gray || (options->bright && !options->normalize))
+			&& GAMMA_NOT_EQUAL(image->gamma, 1.0)) {
+		if (verbose)
+			printf("  Adjusting image gamma from %4.2f to 1.00 for image processing...\n",
+				image->gamma);
+		make_gamma(1.0 / image->gamma, gammamap);
+		for (a = 0; a < 256; a++)
+			gammatable[a] = gammamap[a];
+		job.gammamap = gammatable;
+		dest->gamma = 1.0;
+	}
+	for (a = 0; a < job.smooth; a++) {
+		if (verbose)
+			printf("  Smoothing...\n");
+		snprintf(buf, BUFSIZ, "%s (smoothed)", title);
+		lfree((byte *) title);
+		title = dupString(buf);
+	}
+	if (verbose && job.gray)
+		printf("  Converting image to grayscale...\n");
+	if (options->bright && !options->normalize) {
+		if (verbose)
+			printf("  Brightening colormap by %d%%...\n",
+				options->bright);
+		fperc = (float) options->bright / 100.0;
+		for (a = 0; a < 256; a++) {
+			newrgb = a * fperc;
+			if (newrgb > 255)
+				newrgb = 255;
+			brighttable[a] = newrgb;
+		}
+		job.brightmap = brighttable;
+	}
+	dest->title = title;
+
+	runBands(height, pipeBand, &job);
+
+	if (job.xindex) {
+		lfree((byte *) job.xindex);
+		lfree((byte *) job.yindex);
+	}
+	if (job.map)
+		freeZoomMap(job.map);
+	if (verbose)
+		printf("  done\n");
+	return dest;
+}
@@ -0,0 +1,221 @@
+/* prefetch.c:
+ *
+ * load and process the images either side of the one being viewed in a
+ * background thread, so that moving through a list of images doesn't have
+ * to wait for each one to be decoded.
+ *
+ * Not all of the loaders and image processing functions are reentrant
+ * yet (zio and the GIF, FBM, RLE and G3 loaders are), so the
+ * background thread only runs while the main thread is sitting in the
+ * event loop of imageInWindow(), and is stopped again before the main
+ * thread does any loading or processing of its own.  The background
+ * thread gives up on the image it is working on at the next step of
+ * processing once it has been asked to stop, so that the main thread
+ * isn't kept waiting for it.
+ */
+
+#include "copyright.h"
+#include "xli.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifndef NO_PTHREADS
+
+static ImageOptions *PImages;	/* list of images being viewed */
+static int PNImages;		/* # of images in list */
+static int PCurrent = -1;	/* image currently being viewed */
+static Image **Prefetched;	/* processed images, indexed as PImages */
+static Image **Decoded;		/* the images they were processed from */
+static unsigned long PBytes;	/* memory used by prefetched images */
+
+static pthread_t Worker;
+static boolean WorkerRunning = FALSE;
+static boolean WorkerCancel;
+static pthread_mutex_t WorkerLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* memory used by an image and any frames that follow it */
+static unsigned long imageBytes(Image *image)
+{
+	unsigned long bytes = 0;
+
+	for (; image; image = image->next) {
+		if (BITMAPP(image))
+			bytes += ((image->width + 7) / 8) * image->height;
+		else
+			bytes += (unsigned long) image->width *
+				image->height * image->pixlen;
+	}
+	return bytes;
+}
+
+/* TRUE if an image can be loaded without looking at any other image */
+static boolean prefetchable(int index)
+{
+	if (index < 0 || index >= PNImages)
+		return FALSE;
+	return !PImages[index].merge &&
+		!((index + 1 < PNImages) && PImages[index + 1].merge);
+}
+
+/* TRUE if the background thread has been asked to stop.  the main thread
+ * never sees this, as stopPrefetch() clears it again before returning.
+ */
+boolean prefetchCancelled(void)
+{
+	boolean c;
+
+	pthread_mutex_lock(&WorkerLock);
+	c = WorkerCancel;
+	pthread_mutex_unlock(&WorkerLock);
+	return c;
+}
+
+/* load the images nearest the current one first, looking ahead before
+ * looking back.
+ */
+static void *prefetchWorker(void *arg)
+{
+	int n, index;
+	Image *image, *decoded;
+
+	for (n = 0; n < 2 * globals.prefetch && !prefetchCancelled(); n++) {
+		index = PCurrent + ((n & 1) ? -(n / 2 + 1) : n / 2 + 1);
+		if (!prefetchable(index) || Prefetched[index])
+			continue;
+		if (PBytes >= globals.prefetch_memory * 1024UL * 1024UL)
+			break;
+		if (!(image = prepareImage(&PImages[index], FALSE, FALSE,
+				&decoded, FALSE)))
+			continue;
+		Prefetched[index] = image;
+		Decoded[index] = decoded;
+		PBytes += imageBytes(image);
+		if (decoded)
+			PBytes += imageBytes(decoded);
+	}
+	return NULL;
+}
+
+/* throw away a prefetched image */
+static void dropPrefetched(int index)
+{
+	PBytes -= imageBytes(Prefetched[index]);
+	freeImage(Prefetched[index]);
+	Prefetched[index] = NULL;
+	if (Decoded[index]) {
+		PBytes -= imageBytes(Decoded[index]);
+		freeImage(Decoded[index]);
+		Decoded[index] = NULL;
+	}
+}
+
+/* note which image is about to be viewed, and drop any prefetched
+ * images that are now too far away from it.
+ */
+void setPrefetchPosition(ImageOptions *images, int nimages, int current)
+{
+	int a;
+
+	if (globals.prefetch <= 0)
+		return;
+	if (!Prefetched || PNImages != nimages) {
+		if (Prefetched) {
+			for (a = 0; a < PNImages; a++)
+				if (Prefetched[a])
+					dropPrefetched(a);
+			lfree((byte *) Prefetched);
+			lfree((byte *) Decoded);
+		}
+		Prefetched = (Image **) lcalloc(nimages * sizeof(Image *));
+		Decoded = (Image **) lcalloc(nimages * sizeof(Image *));
+		PBytes = 0;
+	}
+	PImages = images;
+	PNImages = nimages;
+	PCurrent = current;
+	for (a = 0; a < PNImages; a++) {
+		if (Prefetched[a] && (a < current - globals.prefetch ||
+				a > current + globals.prefetch))
+			dropPrefetched(a);
+	}
+}
+
+/* start loading in the background.  this is called once the current
+ * image is on the screen.
+ */
+void startPrefetch(void)
+{
+	if (globals.prefetch <= 0 || PCurrent < 0 || WorkerRunning)
+		return;
+	WorkerCancel = FALSE;
+	if (pthread_create(&Worker, NULL, prefetchWorker, NULL)) {
+		perror("startPrefetch");
+		return;
+	}
+	WorkerRunning = TRUE;
+}
+
+/* stop loading in the background.  any image that is part way through
+ * being processed is given up at its next step and thrown away.
+ */
+void stopPrefetch(void)
+{
+	if (!WorkerRunning)
+		return;
+	pthread_mutex_lock(&WorkerLock);
+	WorkerCancel = TRUE;
+	pthread_mutex_unlock(&WorkerLock);
+	pthread_join(Worker, NULL);
+	WorkerCancel = FALSE;
+	WorkerRunning = FALSE;
+	PCurrent = -1;
+}
+
+/* hand over a prefetched image, or return NULL if there isn't one.  the
+ * image it was processed from goes into the decode cache, the same as
+ * if it had been loaded by the main thread.
+ */
+Image *prefetchedImage(int index)
+{
+	Image *image;
+
+	if (!Prefetched || index < 0 || index >= PNImages ||
+			!(image = Prefetched[index]))
+		return NULL;
+	Prefetched[index] = NULL;
+	PBytes -= imageBytes(image);
+	if (Decoded[index]) {
+		cacheImage(&PImages[index], Decoded[index]);
+		PBytes -= imageBytes(Decoded[index]);
+		freeImage(Decoded[index]);
+		Decoded[index] = NULL;
+	}
+	return image;
+}
+
+#else /* NO_PTHREADS */
+
+void setPrefetchPosition(ImageOptions *images, int nimages, int current)
+{
+}
+
+void startPrefetch(void)
+{
+}
+
+void stopPrefetch(void)
+{
+}
+
+Image *prefetchedImage(int index)
+{
+	return NULL;
+}
+
+boolean prefetchCancelled(void)
+{
+	return FALSE;
+}
+
+#endif /* NO_PTHREADS */
@@ -0,0 +1,198 @@
+/* profile.c:
+ *
+ * -profile: time each stage that an image goes through on its way to the
+ * screen (loading, each processing step, conversion to an XImage and
+ * sending it to the server) and report where the time and memory went.
+ *
+ * a stage is timed by calling profileStart() before it and profileStage()
+ * after it.  stages done more than once for an image (sending exposed
+ * areas, say) are added together.  profileReport() prints what has been
+ * recorded since the last report as a table on stderr, and as lines of
+ * JSON if -profilejson was given.
+ */
+
+#include "copyright.h"
+#include "xli.h"
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define MAX_STAGES 32
+
+typedef struct {
+	char *name;
+	unsigned int calls;
+	double wall, cpu;
+	unsigned long allocs, bytes;
+	unsigned int inwidth, inheight;		/* before the first call */
+	unsigned int outwidth, outheight;	/* after the last call */
+} ProfileStage;
+
+static ProfileStage Stages[MAX_STAGES];
+static int NStages;
+static FILE *JSONFile;
+
+static double cpuSeconds(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static double wallSeconds(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* start timing a stage that works on the given image (which may be NULL) */
+void profileStart(ProfileMark *mark, Image *image)
+{
+	if (!globals.profile)
+		return;
+	mark->width = image ? image->width : 0;
+	mark->height = image ? image->height : 0;
+	allocStats(&mark->allocs, &mark->bytes);
+	mark->cpu = cpuSeconds();
+	mark->wall = wallSeconds();
+}
+
+/* record a stage that was started with profileStart() and has made the
+ * given image, and start timing the next stage from here.
+ */
+void profileStage(ProfileMark *mark, char *name, Image *image)
+{
+	ProfileStage *stage;
+	unsigned long allocs, bytes;
+	double wall, cpu;
+	int a;
+
+	if (!globals.profile)
+		return;
+	wall = wallSeconds();
+	cpu = cpuSeconds();
+	allocStats(&allocs, &bytes);
+
+	for (a = 0; a < NStages && strcmp(Stages[a].name, name); a++)
+		;
+	if (a == NStages) {
+		if (NStages == MAX_STAGES)
+			return;
+		stage = &Stages[NStages++];
+		stage->name = name;
+		stage->calls = 0;
+		stage->wall = stage->cpu = 0;
+		stage->allocs = stage->bytes = 0;
+		stage->inwidth = mark->width;
+		stage->inheight = mark->height;
+	} else
+		stage = &Stages[a];
+	stage->calls++;
+	stage->wall += wall - mark->wall;
+	stage->cpu += cpu - mark->cpu;
+	stage->allocs += allocs - mark->allocs;
+	stage->bytes += bytes - mark->bytes;
+	if (image) {
+		stage->outwidth = image->width;
+		stage->outheight = image->height;
+	} else {
+		stage->outwidth = mark->width;
+		stage->outheight = mark->height;
+	}
+
+	/* the next stage starts where this one finished */
+	mark->width = stage->outwidth;
+	mark->height = stage->outheight;
+	mark->allocs = allocs;
+	mark->bytes = bytes;
+	mark->cpu = cpu;
+	mark->wall = wall;
+}
+
+/* write JSON lines to the named file ("-" for stdout) as well as the table */
+boolean profileJSON(char *name)
+{
+	if (!strcmp(name, "-"))
+		JSONFile = stdout;
+	else if (!(JSONFile = fopen(name, "w"))) {
+		perror(name);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* write a string as a JSON string, escaping whatever JSON needs escaped */
+void jsonString(FILE *f, char *s)
+{
+	putc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			putc('\\', f);
+		if ((unsigned char) *s < ' ')
+			fprintf(f, "\\u%04x", *s);
+		else
+			putc(*s, f);
+	}
+	putc('"', f);
+}
+
+static char *dimensions(char *buf, unsigned int width, unsigned int height)
+{
+	if (width || height)
+		sprintf(buf, "%ux%u", width, height);
+	else
+		strcpy(buf, "-");
+	return buf;
+}
+
+/* print what's been recorded for an image, and start again */
+void profileReport(char *title)
+{
+	ProfileStage *stage;
+	double wall = 0, cpu = 0;
+	unsigned long bytes = 0;
+	char before[32], after[32];
+	int a;
+
+	if (!globals.profile || !NStages)
+		return;
+	if (!title)
+		title = "(untitled)";
+
+	fflush(stdout);		/* after any -verbose output */
+	fprintf(stderr, "Profile of %s:\n", title);
+	fprintf(stderr, "  %-16s %5s %10s %10s %10s  %-11s %-11s\n", "stage",
+		"calls", "wall ms", "cpu ms", "alloc KB", "before", "after");
+	for (a = 0; a < NStages; a++) {
+		stage = &Stages[a];
+		fprintf(stderr, "  %-16s %5u %10.2f %10.2f %10lu  %-11s %-11s\n",
+			stage->name, stage->calls, stage->wall * 1000,
+			stage->cpu * 1000, stage->bytes / 1024,
+			dimensions(before, stage->inwidth, stage->inheight),
+			dimensions(after, stage->outwidth, stage->outheight));
+		wall += stage->wall;
+		cpu += stage->cpu;
+		bytes += stage->bytes;
+		if (JSONFile) {
+			fprintf(JSONFile, "{\"image\": ");
+			jsonString(JSONFile, title);
+			fprintf(JSONFile, ", \"stage\": \"%s\", "
+				"\"calls\": %u, \"wall\": %.6f, \"cpu\": %.6f, "
+				"\"allocs\": %lu, \"alloc_bytes\": %lu, "
+				"\"width_in\": %u, \"height_in\": %u, "
+				"\"width_out\": %u, \"height_out\": %u}\n",
+				stage->name, stage->calls, stage->wall,
+				stage->cpu, stage->allocs, stage->bytes,
+				stage->inwidth, stage->inheight,
+				stage->outwidth, stage->outheight);
+		}
+	}
+	fprintf(stderr, "  %-16s %5s %10.2f %10.2f %10lu\n", "total", "",
+		wall * 1000, cpu * 1000, bytes / 1024);
+	if (JSONFile)
+		fflush(JSONFile);
+	NStages = 0;
+}
@@ -21,6 +21,9 @@
  */
 
 #include "xli.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
 
 #define MAXCOLORS	32768
 #define INPUTQUANT	5
@@ -43,16 +46,39 @@ typedef struct {
 	int low[3], high[3];	/* Box extent  - within low <= col < high */
 } Box;
 
-static void QuantHistogram(Image *image, Box *box);
-static void BoxStats(Box *box);
-static void UpdateFrequencies(Box *box1, Box *box2);
+/* the histogram of the image being reduced.  this is passed around
+ * rather than kept in statics so that images can be reduced on more
+ * than one thread at once.
+ */
+typedef struct {
+	unsigned long *histogram;
+	unsigned long *volume;	/* histogram summed from the origin */
+	unsigned long npixels;	/* total # of pixels */
+} Quant;
+
+/* the volume table has an extra row of zeros at the start of each axis,
+ * so the number of pixels in the box low <= col < high on each axis is
+ * found from its eight corners.
+ */
+#define VINDEX(r,g,b) ((((r) * (ColormaxI + 1)) + (g)) * (ColormaxI + 1) + (b))
+#define VOLUME(v,r0,r1,g0,g1,b0,b1) \
+	((v)[VINDEX(r1,g1,b1)] - (v)[VINDEX(r1,g1,b0)] - \
+	 (v)[VINDEX(r1,g0,b1)] + (v)[VINDEX(r1,g0,b0)] - \
+	 (v)[VINDEX(r0,g1,b1)] + (v)[VINDEX(r0,g1,b0)] + \
+	 (v)[VINDEX(r0,g0,b1)] - (v)[VINDEX(r0,g0,b0)])
+
+static void QuantHistogram(Quant *quant, Image *image);
+static void BoxFrequencies(Quant *quant, Box *box);
+static void BoxStats(Quant *quant, Box *box);
+static void UpdateFrequencies(Quant *quant, Box *box1, Box *box2);
 static void ComputeRGBMap(Box *boxes, int colors, short unsigned int *rgbmap,
 	int ditherf);
 static void SetRGBmap(int boxnum, Box *box, short unsigned int *rgbmap);
-static boolean CutBoxes(Box *boxes, int colors);
-static int CutBox(Box *box, Box *newbox);
+static boolean CutBoxes(Quant *quant, Box *boxes, int colors);
+static int CutBox(Quant *quant, Box *box, Box *newbox);
 static int GreatestVariance(Box *boxes, int n);
-static boolean FindCutpoint(Box *box, int color, Box *newbox1, Box *newbox2);
+static boolean FindCutpoint(Quant *quant, Box *box, int color, Box *newbox1,
+	Box *newbox2);
 static void CopyToNewImage(Image *inimage, Image *outimage,
 	unsigned short *rgbmap, int ditherf, int colors, float gamma,
 	int verbose);
@@ -94,8 +120,6 @@ static void CopyToNewImage(Image *inimage, Image *outimage,
 #define GREENI		1
 #define BLUEI		2
 
-static unsigned long *Histogram,	/* image histogram */
- NPixels;			/* total # of pixels */
 #define Bits INPUTQUANT
 #define cBits (8-Bits)
 #define ColormaxI (1 << Bits)	/* 2 ^ Bits */
@@ -103,15 +127,113 @@ static unsigned long *Histogram,	/* image histogram */
 #define ColormaxcI (1 << cBits)	/* 2 ^ (8-Bits) */
 #define Colormaxc (ColormaxcI - 1)	/* quantized bits lost */
 
+/* the last image reduced, kept so that showing the same image again
+ * (eg. going back to it, or on another screen) doesn't reduce it again.
+ * a copy of what was reduced is kept too, and a new image has to be
+ * the same as it, pixel for pixel, to get the old result back.
+ */
+static struct {
+	Image *input;		/* image that was reduced */
+	Image *image;		/* reduced image */
+	unsigned int colors;
+	int ditherf;
+	float gamma;
+} ReduceCache = {NULL, NULL};
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t ReduceCacheLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* TRUE if two images have the same pixels and colormap */
+static boolean sameImage(Image *a, Image *b)
+{
+	unsigned int n = a->rgb.used * sizeof(Intensity);
+
+	if (a->type != b->type || a->width != b->width ||
+			a->height != b->height || a->pixlen != b->pixlen ||
+			GAMMA_NOT_EQUAL(a->gamma, b->gamma))
+		return FALSE;
+	if (RGBP(a) && (a->rgb.used != b->rgb.used ||
+			memcmp(a->rgb.red, b->rgb.red, n) ||
+			memcmp(a->rgb.green, b->rgb.green, n) ||
+			memcmp(a->rgb.blue, b->rgb.blue, n)))
+		return FALSE;
+	return !memcmp(a->data, b->data,
+		(unsigned long) a->width * a->height * a->pixlen);
+}
+
+/* hand back a copy of the cached reduction of an image, or NULL */
+static Image *cachedReduce(Image *image, unsigned colors, int ditherf,
+	float gamma)
+{
+	Image *new_image = NULL;
+
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&ReduceCacheLock);
+#endif
+	if (ReduceCache.image && ReduceCache.colors == colors &&
+			ReduceCache.ditherf == ditherf &&
+			ReduceCache.gamma == gamma &&
+			sameImage(ReduceCache.input, image))
+		new_image = dupImage(ReduceCache.image);
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&ReduceCacheLock);
+#endif
+	return (new_image);
+}
+
+static void cacheReduce(Image *image, unsigned colors, int ditherf,
+	float gamma, Image *new_image)
+{
+	Image *next;
+
+	flushReduceCache();
+	/* just this image, not the frames after it */
+	next = image->next;
+	image->next = NULL;
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&ReduceCacheLock);
+#endif
+	if (!ReduceCache.image) {
+		ReduceCache.input = dupImage(image);
+		ReduceCache.image = dupImage(new_image);
+		ReduceCache.colors = colors;
+		ReduceCache.ditherf = ditherf;
+		ReduceCache.gamma = gamma;
+	}
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&ReduceCacheLock);
+#endif
+	image->next = next;
+}
+
+/* forget the last reduction, eg. so that it can be timed again */
+void flushReduceCache(void)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&ReduceCacheLock);
+#endif
+	if (ReduceCache.image) {
+		freeImage(ReduceCache.input);
+		freeImage(ReduceCache.image);
+	}
+	ReduceCache.input = NULL;
+	ReduceCache.image = NULL;
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&ReduceCacheLock);
+#endif
+}
+
 /*
- * if "ditherf" is True, apply color disthering
+ * if "ditherf" is True, apply color disthering, with an ordered dither
+ * if it's DITHER_ORDERED or DITHER_BLUENOISE
  * if "Gamma" != 0.0, compensate for gamma post processing
  */
-unsigned int verbose;
 Image *reduce(Image *image, unsigned colors, int ditherf, float gamma,
 	int verbose)
 {
 	unsigned short *rgbmap;
+	Quant quant;
 	Box *Boxes;		/* Array of color boxes. */
 	int i;			/* Counter */
 	int OutColors;		/* # of entries computed */
@@ -135,9 +257,22 @@ Image *reduce(Image *image, unsigned colors, int ditherf, float gamma,
 	if (GAMMA_NOT_EQUAL(image->gamma, REDUCE_GAMMA))
 		gammacorrect(image, REDUCE_GAMMA, verbose);
 
-	NPixels = image->width * image->height;
+	if ((new_image = cachedReduce(image, colors, ditherf, gamma))) {
+		if (verbose)
+			printf("  Reusing the last reduction to %d colors\n",
+				new_image->rgb.used);
+		lfree((byte *) new_image->title);
+		snprintf(buf, BUFSIZ, "%s (%d colors)", image->title,
+			new_image->rgb.used);
+		buf[BUFSIZ-1] = '\0';
+		new_image->title = dupString(buf);
+		return (new_image);
+	}
+
+	quant.npixels = image->width * image->height;
 
-	Histogram = (unsigned long *) lcalloc(ColormaxI * ColormaxI * ColormaxI * sizeof(long));
+	quant.histogram = (unsigned long *) lcalloc(ColormaxI * ColormaxI * ColormaxI * sizeof(long));
+	quant.volume = (unsigned long *) lcalloc((ColormaxI + 1) * (ColormaxI + 1) * (ColormaxI + 1) * sizeof(long));
 	Boxes = (Box *) lmalloc(colors * sizeof(Box));
 	rgbmap = (unsigned short *) lmalloc(ColormaxI * ColormaxI * ColormaxI * sizeof(unsigned short));
 
@@ -147,7 +282,7 @@ Image *reduce(Image *image, unsigned colors, int ditherf, float gamma,
 			printf("  Reducing RGB image color usage to %d colors...", colors);
 			fflush(stdout);
 		}
-		QuantHistogram(image, &Boxes[0]);
+		QuantHistogram(&quant, image);
 		break;
 
 	case ITRUE:
@@ -156,19 +291,20 @@ Image *reduce(Image *image, unsigned colors, int ditherf, float gamma,
 			       colors);
 			fflush(stdout);
 		}
-		QuantHistogram(image, &Boxes[0]);
+		QuantHistogram(&quant, image);
 		break;
 
 	default:
 		{
-			lfree((char *) Histogram);
+			lfree((char *) quant.histogram);
+			lfree((char *) quant.volume);
 			lfree((char *) Boxes);
 			lfree((char *) rgbmap);
 			return (image);		/* not something we can reduce, thank you anyway */
 		}
 	}
 
-	OutColors = CutBoxes(Boxes, colors);
+	OutColors = CutBoxes(&quant, Boxes, colors);
 
 	/*
 	 * We now know the set of representative colors.  We now
@@ -195,7 +331,8 @@ Image *reduce(Image *image, unsigned colors, int ditherf, float gamma,
 	new_image->rgb.compressed = TRUE;
 
 	ComputeRGBMap(Boxes, OutColors, rgbmap, ditherf);
-	lfree((char *) Histogram);
+	lfree((char *) quant.histogram);
+	lfree((char *) quant.volume);
 	lfree((char *) Boxes);
 
 	/* copy old image into new image */
@@ -203,162 +340,143 @@ Image *reduce(Image *image, unsigned colors, int ditherf, float gamma,
 	CopyToNewImage(image, new_image, rgbmap, ditherf, OutColors, gamma, verbose);
 
 	lfree((char *) rgbmap);
+	cacheReduce(image, colors, ditherf, gamma, new_image);
 	if (verbose)
 		printf("done\n");
 	return (new_image);
 }
 
 /*
- * Compute the histogram of the image as well as the projected frequency
- * arrays for the first world-encompassing box.
+ * Count rows y0 to y1 - 1 of the image into a histogram.
  */
-static void QuantHistogram(Image *image, Box *box)
+static void CountPixels(Image *image, unsigned int y0, unsigned int y1,
+	unsigned long *histogram)
 {
 	register byte *pixel;
-	register unsigned long *rf, *gf, *bf;
-	int x, y;
-
-	rf = box->freq[0];
-	gf = box->freq[1];
-	bf = box->freq[2];
-
-	/*
-	 * Zero-out the projected frequency arrays of the largest box.
-	 * We compute both the histogram and the proj. frequencies of
-	 * the first box at the same time to save a pass through the
-	 * entire image. 
-	 */
-	bzero(rf, ColormaxI * sizeof(unsigned long));
-	bzero(gf, ColormaxI * sizeof(unsigned long));
-	bzero(bf, ColormaxI * sizeof(unsigned long));
+	register unsigned long x;
+	unsigned long n;
+	Pixel pixval;
 
+	pixel = image->data + (unsigned long) y0 * image->width * image->pixlen;
+	n = (unsigned long) image->width * (y1 - y0);
 	if (image->type == IRGB) {
 		Intensity *red = image->rgb.red, *green = image->rgb.green,
 		*blue = image->rgb.blue;
-		pixel = image->data;
 		if (image->pixlen == 1)		/* special case most common this for speed */
-			for (y = image->height; y > 0; y--)
-				for (x = image->width; x > 0; x--) {
-					register unsigned char r, g,
-					 b;
-					r = red[memToVal(pixel, 1)] >> (8 + cBits);
-					g = green[memToVal(pixel, 1)] >> (8 + cBits);
-					b = blue[memToVal(pixel, 1)] >> (8 + cBits);
-					rf[r]++;
-					gf[g]++;
-					bf[b]++;
-					Histogram[(((r << Bits) | g) << Bits) | b]++;
-					pixel += 1;
+			for (x = n; x > 0; x--) {
+				histogram[TLA_TO_15BIT(image->rgb, *pixel)]++;
+				pixel++;
 		} else
-			for (y = image->height; y > 0; y--)
-				for (x = image->width; x > 0; x--) {
-					register unsigned char r, g,
-					 b;
-					r = red[memToVal(pixel, image->pixlen)] >> (8 + cBits);
-					g = green[memToVal(pixel, image->pixlen)] >> (8 + cBits);
-					b = blue[memToVal(pixel, image->pixlen)] >> (8 + cBits);
-					rf[r]++;
-					gf[g]++;
-					bf[b]++;
-					Histogram[(((r << Bits) | g) << Bits) | b]++;
-					pixel += image->pixlen;
-				}
+			for (x = n; x > 0; x--) {
+				pixval = memToVal(pixel, image->pixlen);
+				histogram[(((red[pixval] >> (8 + cBits)) << Bits |
+					(green[pixval] >> (8 + cBits))) << Bits) |
+					(blue[pixval] >> (8 + cBits))]++;
+				pixel += image->pixlen;
+			}
 	} else {		/* assume ITRUE */
-		pixel = image->data;
 		if (image->pixlen == 3)		/* most common */
-			for (y = image->height; y > 0; y--)
-				for (x = image->width; x > 0; x--) {
-					register unsigned long a, b;
-					while (x > 4) {		/* Unroll 4 times */
-						a = (*pixel++) >> cBits;	/* Red */
-						rf[a]++;
-						b = a << Bits;
-						a = (*pixel++) >> cBits;	/* Green */
-						gf[a]++;
-						b = (b | a) << Bits;
-						a = (*pixel++) >> cBits;	/* Blue */
-						bf[a]++;
-						b |= a;
-						Histogram[b]++;
-						a = (*pixel++) >> cBits;	/* Red */
-						rf[a]++;
-						b = a << Bits;
-						a = (*pixel++) >> cBits;	/* Green */
-						gf[a]++;
-						b = (b | a) << Bits;
-						a = (*pixel++) >> cBits;	/* Blue */
-						bf[a]++;
-						b |= a;
-						Histogram[b]++;
-						a = (*pixel++) >> cBits;	/* Red */
-						rf[a]++;
-						b = a << Bits;
-						a = (*pixel++) >> cBits;	/* Green */
-						gf[a]++;
-						b = (b | a) << Bits;
-						a = (*pixel++) >> cBits;	/* Blue */
-						bf[a]++;
-						b |= a;
-						Histogram[b]++;
-						a = (*pixel++) >> cBits;	/* Red */
-						rf[a]++;
-						b = a << Bits;
-						a = (*pixel++) >> cBits;	/* Green */
-						gf[a]++;
-						b = (b | a) << Bits;
-						a = (*pixel++) >> cBits;	/* Blue */
-						bf[a]++;
-						b |= a;
-						Histogram[b]++;
-						x -= 4;
-					}
-					a = (*pixel++) >> cBits;	/* Red */
-					rf[a]++;
-					b = a << Bits;
-					a = (*pixel++) >> cBits;	/* Green */
-					gf[a]++;
-					b = (b | a) << Bits;
-					a = (*pixel++) >> cBits;	/* Blue */
-					bf[a]++;
-					b |= a;
-					Histogram[b]++;
+			for (x = n; x > 0; x--) {
+				histogram[((pixel[0] >> cBits) << (Bits + Bits)) |
+					((pixel[1] >> cBits) << Bits) |
+					(pixel[2] >> cBits)]++;
+				pixel += 3;
 		} else		/* less common */
-			for (y = image->height; y > 0; y--)
-				for (x = image->width; x > 0; x--) {
-					register unsigned char r, g,
-					 b;
-					r = TRUE_RED(memToVal(pixel, image->pixlen)) >> cBits;
-					rf[r]++;
-					g = TRUE_GREEN(memToVal(pixel, image->pixlen)) >> cBits;
-					gf[g]++;
-					b = TRUE_BLUE(memToVal(pixel, image->pixlen)) >> cBits;
-					bf[b]++;
-					Histogram[(((r << Bits) | g) << Bits) | b]++;
-					pixel += image->pixlen;
-				}
+			for (x = n; x > 0; x--) {
+				pixval = memToVal(pixel, image->pixlen);
+				histogram[TRUE_TO_15BIT(pixval)]++;
+				pixel += image->pixlen;
+			}
+	}
+}
+
+typedef struct {
+	Quant *quant;
+	Image *image;
+} HistogramJob;
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t HistogramLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* count a band of rows into a histogram of its own, and add that to the
+ * image's.  if the band is the whole image it's counted straight in.
+ */
+static void HistogramBand(void *arg, unsigned int y0, unsigned int y1)
+{
+	HistogramJob *job = (HistogramJob *) arg;
+	unsigned long *histogram;
+	int i;
+
+	if (y0 == 0 && y1 == job->image->height) {
+		CountPixels(job->image, y0, y1, job->quant->histogram);
+		return;
 	}
+	histogram = (unsigned long *) lcalloc(ColormaxI * ColormaxI *
+		ColormaxI * sizeof(long));
+	CountPixels(job->image, y0, y1, histogram);
+
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&HistogramLock);
+#endif
+	for (i = 0; i < ColormaxI * ColormaxI * ColormaxI; i++)
+		job->quant->histogram[i] += histogram[i];
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&HistogramLock);
+#endif
+	lfree((byte *) histogram);
+}
+
+/*
+ * Compute the histogram of the image, a band of rows per thread.  Then
+ * sum it up into the volume table, which the projected frequencies of
+ * every box are found from.
+ */
+static void QuantHistogram(Quant *quant, Image *image)
+{
+	HistogramJob job;
+	unsigned long *v = quant->volume;
+	int r, g, b;
+
+	job.quant = quant;
+	job.image = image;
+	runBands(image->height, HistogramBand, &job);
+
+	for (r = 1; r <= ColormaxI; r++)
+		for (g = 1; g <= ColormaxI; g++)
+			for (b = 1; b <= ColormaxI; b++)
+				v[VINDEX(r, g, b)] = quant->histogram[((((r - 1)
+					<< Bits) | (g - 1)) << Bits) | (b - 1)] +
+					v[VINDEX(r - 1, g, b)] +
+					v[VINDEX(r, g - 1, b)] +
+					v[VINDEX(r, g, b - 1)] -
+					v[VINDEX(r - 1, g - 1, b)] -
+					v[VINDEX(r - 1, g, b - 1)] -
+					v[VINDEX(r, g - 1, b - 1)] +
+					v[VINDEX(r - 1, g - 1, b - 1)];
 }
 
 /*
    * Interatively cut the boxes.
  */
-static int CutBoxes(Box *boxes, int colors)
+static int CutBoxes(Quant *quant, Box *boxes, int colors)
 {
 	int curbox;
 
 	boxes[0].low[REDI] = boxes[0].low[GREENI] = boxes[0].low[BLUEI] = 0;
 	boxes[0].high[REDI] = boxes[0].high[GREENI] =
 	    boxes[0].high[BLUEI] = ColormaxI;
-	boxes[0].weight = NPixels;
+	boxes[0].weight = quant->npixels;
 
-	BoxStats(&boxes[0]);
+	BoxFrequencies(quant, &boxes[0]);
+	BoxStats(quant, &boxes[0]);
 
 	for (curbox = 1; curbox < colors;) {
 		int n;
 		n = GreatestVariance(boxes, curbox);
 		if (n == curbox)
 			break;	/* all are un-cutable */
-		if (CutBox(&boxes[n], &boxes[curbox]))
+		if (CutBox(quant, &boxes[n], &boxes[curbox]))
 			curbox++;	/* cut successfully */
 	}
 
@@ -385,7 +503,7 @@ static int GreatestVariance(Box *boxes, int n)
 }
 
 /* Compute mean and weighted variance of the given box. */
-static void BoxStats(Box *box)
+static void BoxStats(Quant *quant, Box *box)
 {
 	register int i, color;
 	unsigned long *freq;
@@ -408,14 +526,14 @@ static void BoxStats(Box *box)
 		box->weightedvar += var - box->mean[color] * box->mean[color] *
 		    (float) box->weight;
 	}
-	box->weightedvar /= NPixels;
+	box->weightedvar /= quant->npixels;
 }
 
 /*
  * Cut the given box.  Returns TRUE if the box could be cut,
  * FALSE (and weightedvar == 0.0) otherwise.
  */
-static boolean CutBox(Box *box, Box *newbox)
+static boolean CutBox(Quant *quant, Box *box, Box *newbox)
 {
 	int i;
 	double totalvar[3];
@@ -435,7 +553,8 @@ static boolean CutBox(Box *box, Box *newbox)
 	 * (possible) later use.
 	 */
 	for (i = 0; i < 3; i++) {
-		if (FindCutpoint(box, i, &newboxes[i][0], &newboxes[i][1]))
+		if (FindCutpoint(quant, box, i, &newboxes[i][0],
+				&newboxes[i][1]))
 			totalvar[i] = newboxes[i][0].weightedvar +
 			    newboxes[i][1].weightedvar;
 		else
@@ -474,7 +593,8 @@ static boolean CutBox(Box *box, Box *newbox)
  * in newbox1 and newbox2.
  * If it is not possible to 
  */
-static boolean FindCutpoint(Box *box, int color, Box *newbox1, Box *newbox2)
+static boolean FindCutpoint(Quant *quant, Box *box, int color, Box *newbox1,
+	Box *newbox2)
 {
 	float u, v, max;
 	int i, maxindex, minindex, cutpoint;
@@ -515,53 +635,45 @@ static boolean FindCutpoint(Box *box, int color, Box *newbox1, Box *newbox2)
 		return FALSE;	/* Unable to cut on this axis */
 	newbox1->high[color] = cutpoint;
 	newbox2->low[color] = cutpoint;
-	UpdateFrequencies(newbox1, newbox2);
-	BoxStats(newbox1);
-	BoxStats(newbox2);
+	UpdateFrequencies(quant, newbox1, newbox2);
+	BoxStats(quant, newbox1);
+	BoxStats(quant, newbox2);
 
 	return TRUE;		/* Found cutpoint. */
 }
 
+/* fill in the projected frequency arrays of a box from the volume table
+ */
+static void BoxFrequencies(Quant *quant, Box *box)
+{
+	unsigned long *v = quant->volume;
+	int *low = box->low, *high = box->high;
+	int i;
+
+	bzero(box->freq[0], ColormaxI * sizeof(unsigned long));
+	bzero(box->freq[1], ColormaxI * sizeof(unsigned long));
+	bzero(box->freq[2], ColormaxI * sizeof(unsigned long));
+	for (i = low[REDI]; i < high[REDI]; i++)
+		box->freq[REDI][i] = VOLUME(v, i, i + 1, low[GREENI],
+			high[GREENI], low[BLUEI], high[BLUEI]);
+	for (i = low[GREENI]; i < high[GREENI]; i++)
+		box->freq[GREENI][i] = VOLUME(v, low[REDI], high[REDI], i,
+			i + 1, low[BLUEI], high[BLUEI]);
+	for (i = low[BLUEI]; i < high[BLUEI]; i++)
+		box->freq[BLUEI][i] = VOLUME(v, low[REDI], high[REDI],
+			low[GREENI], high[GREENI], i, i + 1);
+}
+
 /*
  * Update projected frequency arrays for two boxes which used to be
  * a single box. Also shrink the box sizes to fit the points.
  */
-static void UpdateFrequencies(Box *box1, Box *box2)
+static void UpdateFrequencies(Quant *quant, Box *box1, Box *box2)
 {
-	register unsigned long myfreq, *h;
-	register int b, g, r;
-	int roff;
-	register unsigned long *b1f0, *b1f1, *b1f2, *b2f0, *b2f1, *b2f2;
-
-	b1f0 = &box1->freq[0][0];
-	b1f1 = &box1->freq[1][0];
-	b1f2 = &box1->freq[2][0];
-	b2f0 = &box2->freq[0][0];
-	b2f1 = &box2->freq[1][0];
-	b2f2 = &box2->freq[2][0];
-
-	bzero(b1f0, ColormaxI * sizeof(unsigned long));
-	bzero(b1f1, ColormaxI * sizeof(unsigned long));
-	bzero(b1f2, ColormaxI * sizeof(unsigned long));
-
-	for (r = box1->low[0]; r < box1->high[0]; r++) {
-		roff = r << Bits;
-		for (g = box1->low[1]; g < box1->high[1]; g++) {
-			b = box1->low[2];
-			h = Histogram + (((roff | g) << Bits) | b);
-			for (; b < box1->high[2]; b++) {
-				myfreq = *h++;
-				if (myfreq == 0)
-					continue;
-				b1f0[r] += myfreq;
-				b1f1[g] += myfreq;
-				b1f2[b] += myfreq;
-				b2f0[r] -= myfreq;
-				b2f1[g] -= myfreq;
-				b2f2[b] -= myfreq;
-			}
-		}
-	}
+	register int g, r;
+
+	BoxFrequencies(quant, box1);
+	BoxFrequencies(quant, box2);
 
 	/* shrink the boxes to fit the new points */
 	for (r = 0; r < 3; r++) {
@@ -896,6 +1008,146 @@ static unsigned short find_nearest(int rval, int gval, int bval, NN *nna,
 #undef QERR
 }
 
+typedef struct {
+	unsigned short *rgbmap;
+	NN *nna;
+	Image *outimage;
+} NearestJob;
+
+/* fill in the entries of the rgbmap not yet mapped for red, green
+ * planes y0 to y1 - 1.  the nn cells must all exist already.
+ */
+static void NearestBand(void *arg, unsigned int y0, unsigned int y1)
+{
+	NearestJob *job = (NearestJob *) arg;
+	unsigned short *rgbmap;
+	unsigned int y;
+	int b;
+
+	for (y = y0; y < y1; y++) {
+		rgbmap = job->rgbmap + (y << Bits);
+		for (b = 0; b < ColormaxI; b++)
+			if (rgbmap[b] == 0xffff)
+				rgbmap[b] = find_nearest((y >> Bits) << cBits,
+					(y & Colormax) << cBits, b << cBits,
+					job->nna, job->outimage);
+	}
+}
+
+/*
+ * Make the rgbmap a complete inverse colormap, so that dithering only
+ * has to look each pixel up.  the nn cells are shared, so they're all
+ * made first, then the rgbmap is filled in a band of planes per thread.
+ */
+static void ComputeNearest(unsigned short *rgbmap, NN *nna, Image *outimage)
+{
+	NearestJob job;
+	int i;
+
+	for (i = 0; i < NNmaxI * NNmaxI * NNmaxI; i++)
+		find_nnearest((i >> (NNBits + NNBits)) << NNcBits,
+			((i >> NNBits) & NNmax) << NNcBits, (i & NNmax) << NNcBits,
+			nna + i, outimage);
+	job.rgbmap = rgbmap;
+	job.nna = nna;
+	job.outimage = outimage;
+	runBands(ColormaxI * ColormaxI, NearestBand, &job);
+}
+
+typedef struct {
+	Image *inimage, *outimage;
+	unsigned short *rgbmap;	/* complete inverse colormap */
+	int offset[DITHER_MATRIX_SIZE * DITHER_MATRIX_SIZE];
+				/* added to each component before mapping */
+} OrderedJob;
+
+/* map rows y0 to y1 - 1 through the rgbmap, nudging each pixel by the
+ * offset at its place in the threshold matrix first.
+ */
+static void OrderedBand(void *arg, unsigned int y0, unsigned int y1)
+{
+	OrderedJob *job = (OrderedJob *) arg;
+	Image *inimage = job->inimage, *outimage = job->outimage;
+	Intensity *red = inimage->rgb.red, *green = inimage->rgb.green,
+	*blue = inimage->rgb.blue;
+	unsigned short *rgbmap = job->rgbmap;
+	unsigned int ipixlen = inimage->pixlen, opixlen = outimage->pixlen;
+	byte *pixel, *dpixel;
+	int *offset;
+	int r, g, b, o;
+	unsigned int x, y;
+	Pixel pixval, color;
+
+#define NUDGE(v) ((v) + o < 0 ? 0 : (v) + o > 255 ? 255 : (v) + o)
+
+	for (y = y0; y < y1; y++) {
+		offset = job->offset + (y % DITHER_MATRIX_SIZE) * DITHER_MATRIX_SIZE;
+		pixel = inimage->data + (unsigned long) y * inimage->width * ipixlen;
+		dpixel = outimage->data + (unsigned long) y * outimage->width * opixlen;
+		for (x = 0; x < inimage->width; x++) {
+			if (TRUEP(inimage)) {
+				r = pixel[0];
+				g = pixel[1];
+				b = pixel[2];
+			} else {
+				pixval = memToVal(pixel, ipixlen);
+				r = red[pixval] >> 8;
+				g = green[pixval] >> 8;
+				b = blue[pixval] >> 8;
+			}
+			pixel += ipixlen;
+			o = offset[x % DITHER_MATRIX_SIZE];
+			color = rgbmap[((NUDGE(r) >> cBits) << (Bits + Bits)) |
+				((NUDGE(g) >> cBits) << Bits) | (NUDGE(b) >> cBits)];
+			if (opixlen == 1)	/* most common */
+				*dpixel++ = color;
+			else {
+				valToMem(color, dpixel, opixlen);
+				dpixel += opixlen;
+			}
+		}
+	}
+#undef NUDGE
+}
+
+/*
+ * Map the image onto the new colormap with an ordered or blue noise
+ * dither.  each pixel is nudged up or down by up to half the spacing of
+ * an evenly spread out colormap of this many colors before being
+ * mapped to the nearest color, so that rows are independent of each
+ * other and can be done a band per thread.
+ */
+static void OrderedToNewImage(Image *inimage, Image *outimage,
+	unsigned short *rgbmap, int ditherf, int colors)
+{
+	OrderedJob *job;
+	NN *nna, *nnp;
+	unsigned short matrix[DITHER_MATRIX_SIZE * DITHER_MATRIX_SIZE];
+	int i, spread;
+
+	nna = (NN *) lcalloc((NNmaxI * NNmaxI * NNmaxI) * sizeof(NN));
+	ComputeNearest(rgbmap, nna, outimage);
+
+	job = (OrderedJob *) lmalloc(sizeof(OrderedJob));
+	job->inimage = inimage;
+	job->outimage = outimage;
+	job->rgbmap = rgbmap;
+	spread = (int) (256.0 / pow((double) colors, 1.0 / 3.0));
+	ditherMatrix(ditherf, matrix);
+	for (i = 0; i < DITHER_MATRIX_SIZE * DITHER_MATRIX_SIZE; i++)
+		job->offset[i] = (2 * matrix[i] + 1) * spread /
+			(2 * DITHER_MATRIX_SIZE * DITHER_MATRIX_SIZE) - spread / 2;
+	runBands(inimage->height, OrderedBand, job);
+	lfree((byte *) job);
+
+	for (i = NNmaxI * NNmaxI * NNmaxI, nnp = nna; i > 0; i--, nnp++)
+		if (nnp->length != 0) {
+			lfree((byte *) nnp->red);
+			lfree((byte *) nnp->pixel);
+		}
+	lfree((byte *) nna);
+}
+
 /* "rgbmap" is pixel value lookup map */
 static void CopyToNewImage(Image *inimage, Image *outimage,
 	unsigned short *rgbmap, int ditherf, int colors, float gamma,
@@ -997,6 +1249,12 @@ static void CopyToNewImage(Image *inimage, Image *outimage,
 					}
 			break;
 		}
+	} else if (ditherf == DITHER_ORDERED || ditherf == DITHER_BLUENOISE) {
+		if (verbose) {
+			printf("\n  (Using %s dithering to reduce the impact of restricted colors)...",
+				ditherf == DITHER_ORDERED ? "ordered" : "blue noise");
+		}
+		OrderedToNewImage(inimage, outimage, rgbmap, ditherf, colors);
 	} else {		/* else use dithering */
 		NN *nna, *nnp;
 		Intensity *ored, *ogreen, *oblue;
@@ -1011,6 +1269,7 @@ static void CopyToNewImage(Image *inimage, Image *outimage,
 			printf("\n  (Using color dithering to reduce the impact of restricted colors)...");
 		}
 		nna = (NN *) lcalloc((NNmaxI * NNmaxI * NNmaxI) * sizeof(NN));
+		ComputeNearest(rgbmap, nna, outimage);
 
 		/* Init saturation table */
 		for (x = -256 - 10; x < (512 + 10); x++) {
@@ -1108,8 +1367,6 @@ static void CopyToNewImage(Image *inimage, Image *outimage,
 							rgbindex |= ((gval = sat[nextg]) & 0xf8) << (Bits - cBits);
 							rgbindex |= (bval = sat[nextb]) >> cBits;
 							*dpixel = color = rgbmap[rgbindex];
-							if (color == 0xffff)	/* Create nearest color mapping on demand */
-								*dpixel = color = rgbmap[rgbindex] = find_nearest(rval, gval, bval, nna, outimage);
 							dpixel++;
 							rval -= ored[color];
 							nextr = *ip++ + err7[rval];	/* this line, next pixel */
@@ -1150,8 +1407,6 @@ static void CopyToNewImage(Image *inimage, Image *outimage,
 							rgbindex |= ((gval = sat[nextg]) & 0xf8) << (Bits - cBits);
 							rgbindex |= (bval = sat[nextb]) >> cBits;
 							color = rgbmap[rgbindex];
-							if (color == 0xffff)	/* Create nearest color mapping on demand */
-								color = rgbmap[rgbindex] = find_nearest(rval, gval, bval, nna, outimage);
 							valToMem(color, dpixel, outimage->pixlen);
 							dpixel += outimage->pixlen;
 							temp = memToVal(pixel, inimage->pixlen);
@@ -1195,8 +1450,6 @@ static void CopyToNewImage(Image *inimage, Image *outimage,
 						rgbindex |= ((gval = sat[nextg]) & 0xf8) << (Bits - cBits);
 						rgbindex |= (bval = sat[nextb]) >> cBits;
 						*dpixel = color = rgbmap[rgbindex];
-						if (color == 0xffff)	/* Create nearest color mapping on demand */
-							*dpixel = color = rgbmap[rgbindex] = find_nearest(rval, gval, bval, nna, outimage);
 						dpixel++;
 						rval -= ored[color];
 						nextr = *ip++ + err7[rval];	/* this line, next pixel */
@@ -1236,8 +1489,6 @@ static void CopyToNewImage(Image *inimage, Image *outimage,
 						rgbindex |= ((gval = sat[nextg]) & 0xf8) << (Bits - cBits);
 						rgbindex |= (bval = sat[nextb]) >> cBits;
 						color = rgbmap[rgbindex];
-						if (color == 0xffff)	/* Create nearest color mapping on demand */
-							color = rgbmap[rgbindex] = find_nearest(rval, gval, bval, nna, outimage);
 						valToMem(color, dpixel, outimage->pixlen);
 						dpixel += outimage->pixlen;
 						temp = memToVal(pixel, inimage->pixlen);
@@ -1283,33 +1534,29 @@ static void CopyToNewImage(Image *inimage, Image *outimage,
 	}
 }
 
-/* expand an image into a true color image */
-Image *expandtotrue(Image *image)
+/* expand a band of rows of an image to true color */
+
+typedef struct {
+	Image *image, *new_image;
+	Pixel fg, bg;		/* bitmap colors */
+} ExpandJob;
+
+static void expandBand(void *arg, unsigned int y0, unsigned int y1)
 {
-	Pixel fg, bg;
-	Image *new_image;
+	ExpandJob *job = (ExpandJob *) arg;
+	Image *image = job->image, *new_image = job->new_image;
+	Pixel fg = job->fg, bg = job->bg;
 	int x, y;
 	byte *spixel, *dpixel, *line;
 	unsigned int linelen;
 	byte mask;
 
-	CURRFUNC("expandtotrue");
-	if TRUEP
-		(image)
-		    return (image);
-
-	new_image = newTrueImage(image->width, image->height);
-	new_image->title = dupString(image->title);
-	new_image->gamma = image->gamma;
-
 	switch (image->type) {
 	case IBITMAP:
-		fg = RGB_TO_TRUE(image->rgb.red[1], image->rgb.green[1], image->rgb.blue[1]);
-		bg = RGB_TO_TRUE(image->rgb.red[0], image->rgb.green[0], image->rgb.blue[0]);
-		line = image->data;
-		dpixel = new_image->data;
 		linelen = (image->width / 8) + (image->width % 8 ? 1 : 0);
-		for (y = 0; y < image->height; y++) {
+		line = image->data + y0 * linelen;
+		dpixel = new_image->data + y0 * image->width * new_image->pixlen;
+		for (y = y0; y < y1; y++) {
 			spixel = line;
 			mask = 0x80;
 			if (new_image->pixlen == 3)	/* most common */
@@ -1333,13 +1580,12 @@ Image *expandtotrue(Image *image)
 				}
 			line += linelen;
 		}
-		new_image->gamma = 1.0;		/* will be linear now */
 		break;
 	case IRGB:
-		spixel = image->data;
-		dpixel = new_image->data;
+		spixel = image->data + y0 * image->width * image->pixlen;
+		dpixel = new_image->data + y0 * image->width * new_image->pixlen;
 		if (image->pixlen == 1 && new_image->pixlen == 3)	/* most common */
-			for (y = 0; y < image->height; y++)
+			for (y = y0; y < y1; y++)
 				for (x = 0; x < image->width; x++) {
 					register unsigned long temp;
 					temp = memToVal(spixel, 1);
@@ -1350,7 +1596,7 @@ Image *expandtotrue(Image *image)
 					spixel += 1;
 					dpixel += 3;
 		} else		/* less common */
-			for (y = 0; y < image->height; y++)
+			for (y = y0; y < y1; y++)
 				for (x = 0; x < image->width; x++) {
 					register unsigned long temp;
 					temp = memToVal(spixel, image->pixlen);
@@ -1363,6 +1609,31 @@ Image *expandtotrue(Image *image)
 				}
 		break;
 	}
+}
+
+/* expand an image into a true color image */
+Image *expandtotrue(Image *image)
+{
+	Image *new_image;
+	ExpandJob job;
+
+	CURRFUNC("expandtotrue");
+	if TRUEP
+		(image)
+		    return (image);
+
+	new_image = newTrueImage(image->width, image->height);
+	new_image->title = dupString(image->title);
+	new_image->gamma = image->gamma;
+
+	job.image = image;
+	job.new_image = new_image;
+	if (BITMAPP(image)) {
+		job.fg = RGB_TO_TRUE(image->rgb.red[1], image->rgb.green[1], image->rgb.blue[1]);
+		job.bg = RGB_TO_TRUE(image->rgb.red[0], image->rgb.green[0], image->rgb.blue[0]);
+		new_image->gamma = 1.0;		/* will be linear now */
+	}
+	runBands(image->height, expandBand, &job);
 	return (new_image);
 }
 
@@ -15,25 +15,16 @@
 #include "imagetypes.h"
 #include "rle.h"
 
-/* input file stuff */
-static int ptype;		/* picture type : */
+/* picture types */
 #define BW_NM	0		/* black and white, no map */
 #define BW_M	1		/* black and white, and a map */
 #define SC_M	2		/* single color channel and color map */
 #define C_NM	3		/* full color, no maps */
 #define C_M		4	/* full color with color maps */
-static rle_pixel **fmaps;	/* file color maps from buildmap() */
-static unsigned char **scan;	/* buffer for input data */
-static int x_min;		/* copy of picture x_min */
-static int y_min;		/* copy of picture y_min */
-
-/* option stuff (Not functional) */
-static float img_gam = UNSET_GAMMA;	/* default image gamma (== don't know) */
-static int background[3] =
-{0, 0, 0};			/* our background color */
 
 int rleIdent(char *fullname, char *name)
 {
+	struct sv_globals sv;
 	ZFILE *rlefile;
 	int x_len, y_len;
 	int rv;
@@ -43,22 +34,23 @@ int rleIdent(char *fullname, char *name)
 		perror("rleIdent");
 		return (0);
 	}
-	sv_globals.svfb_fd = rlefile;
-	rv = rle_get_setup(&sv_globals);
+	sv = sv_globals;
+	sv.svfb_fd = rlefile;
+	rv = rle_get_setup(&sv);
 	zclose(rlefile);
-	rle_free_setup(&sv_globals);
+	rle_free_setup(&sv);
 	switch (rv) {
 	case 0:
 		/* now figure out the picture type */
-		x_len = sv_globals.sv_xmax - sv_globals.sv_xmin + 1;
-		y_len = sv_globals.sv_ymax - sv_globals.sv_ymin + 1;
+		x_len = sv.sv_xmax - sv.sv_xmin + 1;
+		y_len = sv.sv_ymax - sv.sv_ymin + 1;
 		printf("%s is a %dx%d", name, x_len, y_len);
-		switch (sv_globals.sv_ncolors) {
+		switch (sv.sv_ncolors) {
 		case 0:
 			printf(" RLE image with an no color planes\n");
 			return 0;
 		case 1:
-			switch (sv_globals.sv_ncmap) {
+			switch (sv.sv_ncmap) {
 			case 0:
 				/* black and white, no map */
 				printf(" 8 bit grey scale RLE image with no map\n");
@@ -77,7 +69,7 @@ int rleIdent(char *fullname, char *name)
 			}
 			break;
 		case 3:
-			switch (sv_globals.sv_ncmap) {
+			switch (sv.sv_ncmap) {
 			case 0:
 				printf(" 24 bit color RLE image with no map\n");
 				break;
@@ -90,7 +82,7 @@ int rleIdent(char *fullname, char *name)
 			}
 			break;
 		default:
-			printf(" RLE image with an illegal number (%d)of color planes\n", sv_globals.sv_ncolors);
+			printf(" RLE image with an illegal number (%d)of color planes\n", sv.sv_ncolors);
 			return 0;
 		}
 		return 1;
@@ -111,29 +103,35 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 	unsigned char *bufp;
 	Image *image;
 	unsigned char *buf;
+	struct sv_globals sv;	/* this file's setup, from the defaults */
+	int ptype;		/* picture type */
+	rle_pixel **fmaps;	/* file color maps from buildmap() */
+	unsigned char **scan = NULL;	/* buffer for input data */
+	float img_gam = UNSET_GAMMA;	/* image gamma (== don't know) */
 
 	CURRFUNC("rleLoad");
 	if (!(rlefile = zopen(fullname))) {
 		perror("rleLoad");
 		return (NULL);
 	}
-	sv_globals.svfb_fd = rlefile;
-	if (rle_get_setup(&sv_globals)) {
+	sv = sv_globals;
+	sv.svfb_fd = rlefile;
+	if (rle_get_setup(&sv)) {
 		zclose(rlefile);
-		rle_free_setup(&sv_globals);
+		rle_free_setup(&sv);
 		return (NULL);
 	}
 	/* Check comments in file for gamma specification */
 	{
 		char *v;
-		if ((v = rle_getcom("image_gamma", &sv_globals)) != NULL) {
+		if ((v = rle_getcom("image_gamma", &sv)) != NULL) {
 			img_gam = atof(v);
 			/* Protect against bogus information */
 			if (img_gam == UNSET_GAMMA)
 				img_gam = 1.0;
 			else
 				img_gam = 1.0 / img_gam;	/* convert to display gamma */
-		} else if ((v = rle_getcom("display_gamma", &sv_globals)) != NULL) {
+		} else if ((v = rle_getcom("display_gamma", &sv)) != NULL) {
 			img_gam = atof(v);
 			/* Protect */
 			if (UNSET_GAMMA == img_gam)
@@ -141,35 +139,32 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 		}
 	}
 
-	x_len = sv_globals.sv_xmax - sv_globals.sv_xmin + 1;
-	y_len = sv_globals.sv_ymax - sv_globals.sv_ymin + 1;
-
-	x_min = sv_globals.sv_xmin;
-	y_min = sv_globals.sv_ymin;
+	x_len = sv.sv_xmax - sv.sv_xmin + 1;
+	y_len = sv.sv_ymax - sv.sv_ymin + 1;
 
 	/* fix this so that we don't waste space */
-	sv_globals.sv_xmax -= sv_globals.sv_xmin;
-	sv_globals.sv_xmin = 0;
+	sv.sv_xmax -= sv.sv_xmin;
+	sv.sv_xmin = 0;
 
 	/* turn off the alpha channel (don't waste time and space) */
-	sv_globals.sv_alpha = 0;
-	SV_CLR_BIT(sv_globals, SV_ALPHA);
+	sv.sv_alpha = 0;
+	SV_CLR_BIT(sv, SV_ALPHA);
 
 	/* for now, force background clear */
-	if (sv_globals.sv_background == 1) {	/* danger setting */
-		sv_globals.sv_background = 2;
-		if (sv_globals.sv_bg_color == 0)	/* if none allocated */
-			sv_globals.sv_bg_color = background;	/* use this one */
+	if (sv.sv_background == 1) {	/* danger setting */
+		sv.sv_background = 2;
+		if (sv.sv_bg_color == 0)	/* if none allocated, use black */
+			sv.sv_bg_color = (int *) lcalloc(3 * sizeof(int));
 	}
 	/* now figure out the picture type */
-	switch (sv_globals.sv_ncolors) {
+	switch (sv.sv_ncolors) {
 	case 0:
 		fprintf(stderr, "rleLoad: %s - no color channels to display\n", name);
 		zclose(rlefile);
-		rle_free_setup(&sv_globals);
+		rle_free_setup(&sv);
 		return (NULL);
 	case 1:
-		switch (sv_globals.sv_ncmap) {
+		switch (sv.sv_ncmap) {
 		case 0:
 			ptype = BW_NM;	/* black and white, no map */
 			break;
@@ -182,12 +177,12 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 		default:
 			fprintf(stderr, "rleLoad: %s - Illegal number of maps for one color channel\n", name);
 			zclose(rlefile);
-			rle_free_setup(&sv_globals);
+			rle_free_setup(&sv);
 			return (NULL);
 		}
 		break;
 	case 3:
-		switch (sv_globals.sv_ncmap) {
+		switch (sv.sv_ncmap) {
 		case 0:
 			ptype = C_NM;	/* color, no map */
 			break;
@@ -197,14 +192,14 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 		default:
 			fprintf(stderr, "rleLoad: %s - Illegal number of maps for color picture\n", name);
 			zclose(rlefile);
-			rle_free_setup(&sv_globals);
+			rle_free_setup(&sv);
 			return (NULL);
 		}
 		break;
 	default:
-		fprintf(stderr, "rleLoad: %s - too many of color channels (%d)\n", name, sv_globals.sv_ncolors);
+		fprintf(stderr, "rleLoad: %s - too many of color channels (%d)\n", name, sv.sv_ncolors);
 		zclose(rlefile);
-		rle_free_setup(&sv_globals);
+		rle_free_setup(&sv);
 		return (NULL);
 	}
 
@@ -235,16 +230,16 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 	znocache(rlefile);
 
 	/* get hold of the color maps */
-	fmaps = buildmap(&sv_globals, sv_globals.sv_ncolors, 1.0);
+	fmaps = buildmap(&sv, sv.sv_ncolors, 1.0);
 
 	/* now we had better sort out the picture data */
 
 	/* rle stufff */
 	/* Get space for a full color scan line */
 	if (ptype != SC_M && ptype != BW_NM) {
-		scan = (unsigned char **) lmalloc(sv_globals.sv_ncolors *
+		scan = (unsigned char **) lmalloc(sv.sv_ncolors *
 						sizeof(unsigned char *));
-		for (i = 0; i < sv_globals.sv_ncolors; i++)
+		for (i = 0; i < sv.sv_ncolors; i++)
 			scan[i] = (unsigned char *) lmalloc(x_len);
 	}
 	if (ptype == C_NM || ptype == C_M) {	/* 24 bit color type result */
@@ -264,7 +259,7 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 	case BW_NM:
 		for (j = y_len; j > 0; j--, bufp -= (x_len * depth)) {
 			register unsigned char **bufpp = &bufp;
-			if (rle_getrow(&sv_globals, bufpp) < 0)
+			if (rle_getrow(&sv, bufpp) < 0)
 				break;
 		}
 		break;
@@ -272,7 +267,7 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 		for (j = y_len; j > 0; j--, bufp -= (x_len * depth)) {
 			register unsigned char *dp, *r;
 			register int i;
-			if (rle_getrow(&sv_globals, scan) < 0)
+			if (rle_getrow(&sv, scan) < 0)
 				break;
 			for (i = x_len, r = &scan[0][0], dp = bufp; i > 0; i--, r++, dp++)
 				*dp = fmaps[0][*r];
@@ -283,7 +278,7 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 			register unsigned char *dp;
 			register unsigned char *r, *g, *b;
 			register int i;
-			if (rle_getrow(&sv_globals, scan) < 0)
+			if (rle_getrow(&sv, scan) < 0)
 				break;
 			for (i = x_len, dp = bufp, r = &scan[0][0], g = &scan[1][0], b = &scan[2][0];
 			     i > 0; i--, r++, g++, b++) {
@@ -298,7 +293,7 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 			register unsigned char *dp;
 			register unsigned char *r, *g, *b;
 			register int i;
-			if (rle_getrow(&sv_globals, scan) < 0)
+			if (rle_getrow(&sv, scan) < 0)
 				break;
 			for (i = x_len, dp = bufp, r = &scan[0][0], g = &scan[1][0], b = &scan[2][0];
 			     i > 0; i--, r++, g++, b++) {
@@ -310,7 +305,7 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 	}
 	if (ptype != SC_M && ptype != BW_NM) {
 		/* Free line buffer */
-		for (i = 0; i < sv_globals.sv_ncolors; i++)
+		for (i = 0; i < sv.sv_ncolors; i++)
 			lfree(scan[i]);
 		lfree((byte *) scan);
 	}
@@ -318,7 +313,7 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 	/* now load an appropriate color map */
 	if (ptype == SC_M) {
 		/* use their maps */
-		ncol = 1 << sv_globals.sv_cmaplen;	/* number of entries */
+		ncol = 1 << sv.sv_cmaplen;	/* number of entries */
 		for (i = 0; i < ncol; i++) {
 			*(image->rgb.red + i) = fmaps[0][i] << 8;
 			*(image->rgb.green + i) = fmaps[1][i] << 8;
@@ -340,6 +335,6 @@ Image *rleLoad(char *fullname, ImageOptions *image_ops, boolean verbose)
 	read_trail_opt(image_ops, rlefile, image, verbose);
 	zclose(rlefile);
 	freemap(fmaps);
-	rle_free_setup(&sv_globals);
+	rle_free_setup(&sv);
 	return (image);
 }
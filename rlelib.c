@@ -739,7 +739,6 @@ int rle_get_setup(struct sv_globals *globals)
     globals->sv_private.get.vert_skip = 0;
     globals->sv_private.get.is_eof = 0;
     globals->sv_private.get.is_seek = 0;	/* Can't do seek on zfile */
-    debug_f = 0;
 
     if ( !zeof( infile ) )
 	return 0;			/* success! */
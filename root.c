@@ -130,6 +130,7 @@ void imageOnRoot(DisplayInfo * dinfo, Image * image, ImageOptions * options)
 	int scrn = dinfo->scrn;
 	Pixmap pixmap;
 	XImageInfo *ximageinfo;
+	ProfileMark mark;
 	Atom __SWM_VROOT = None;
 	Window root, rootReturn, parentReturn, *children;
 	unsigned int numChildren;
@@ -178,13 +179,15 @@ void imageOnRoot(DisplayInfo * dinfo, Image * image, ImageOptions * options)
 	}
 	freePrevious(disp, root);
 
+	profileStart(&mark, image);
 	if (!(ximageinfo = imageToXImage(disp, scrn,
 			DefaultVisual(disp, scrn),
 			DefaultDepth(disp, scrn),
-			image, FALSE, TRUE, options))) {
+			image, FALSE, TRUE, options, FALSE))) {
 		fprintf(stderr, "Cannot convert Image to XImage\n");
 		exit(1);
 	}
+	profileStage(&mark, "imageToXImage", image);
 	if ((pixmap = ximageToPixmap(disp, root, ximageinfo)) == None) {
 		printf("Cannot create background (not enough resources, sorry)\n");
 		exit(1);
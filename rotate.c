@@ -3,30 +3,225 @@
  * rotate an image
  *
  * Contributed by Tom Tatlow (tatlow@dash.enet.dec.com)
+ *
+ * each rotation is done in a single pass straight into the rotated
+ * image.  90 and 270 degree rotations read the source down its columns,
+ * so they work through the destination in TILE x TILE pixel blocks that
+ * stay in the cache.  bitmaps are rotated 8x8 bits at a time.
  */
 
 #include "copyright.h"
 #include "xli.h"
 
-/* rotate_bitmap()
- * converts an old bitmap bit position into a new one
+#define TILE 64			/* pixels on a side of a block */
+
+typedef struct {
+	Image *simage;		/* source image */
+	Image *dimage;		/* destination image */
+	int rotate;		/* 90, 180 or 270 degrees clockwise */
+} RotateJob;
+
+/* rotate destination rows y0 to y1 - 1 of a byte per pixel or more
+ * image.  the source pixel for destination pixel x, y is at
+ * base + x * xstep + y * ystep.
  */
-static void rotate_bitmap(int num, int pos, int width, int height,
-	int *new_num, int *new_pos)
+static void rotateBytes(RotateJob *job, unsigned int y0, unsigned int y1)
 {
-	int slen;		/* Length of source line      */
-	int dlen;		/* Length of destination line */
-	int sx, sy;
-	int dx, dy;
-
-	slen = (width / 8) + (width % 8 ? 1 : 0);
-	dlen = (height / 8) + (height % 8 ? 1 : 0);
-	sy = num / slen;
-	sx = ((num - (sy * slen)) * 8) + pos;
-	dx = (height - sy) - 1;
-	dy = sx;
-	*new_num = (dx / 8) + (dy * dlen);
-	*new_pos = dx % 8;
+	Image *simage = job->simage, *dimage = job->dimage;
+	unsigned int pixlen = simage->pixlen;
+	long slinelen = (long) simage->width * pixlen;
+	long xstep, ystep;
+	byte *base, *sp, *dp;
+	unsigned int x, y, tx, ty, xend, yend;
+
+	switch (job->rotate) {
+	case 90:
+		base = simage->data + (simage->height - 1) * slinelen;
+		xstep = -slinelen;
+		ystep = pixlen;
+		break;
+	case 180:
+		base = simage->data + simage->height * slinelen - pixlen;
+		xstep = -(long) pixlen;
+		ystep = -slinelen;
+		break;
+	default:
+		base = simage->data + slinelen - pixlen;
+		xstep = slinelen;
+		ystep = -(long) pixlen;
+		break;
+	}
+
+	for (ty = y0; ty < y1; ty += TILE) {
+		yend = (y1 - ty > TILE ? ty + TILE : y1);
+		for (tx = 0; tx < dimage->width; tx += TILE) {
+			xend = (dimage->width - tx > TILE ? tx + TILE :
+				dimage->width);
+			for (y = ty; y < yend; y++) {
+				sp = base + (long) y * ystep + (long) tx * xstep;
+				dp = dimage->data +
+					((unsigned long) y * dimage->width + tx) *
+					pixlen;
+				switch (pixlen) {
+				case 1:		/* most common */
+					for (x = tx; x < xend; x++) {
+						*dp++ = *sp;
+						sp += xstep;
+					}
+					break;
+				case 3:
+					for (x = tx; x < xend; x++) {
+						*dp++ = sp[0];
+						*dp++ = sp[1];
+						*dp++ = sp[2];
+						sp += xstep;
+					}
+					break;
+				default:	/* less common */
+					for (x = tx; x < xend; x++) {
+						bcopy(sp, dp, pixlen);
+						dp += pixlen;
+						sp += xstep;
+					}
+					break;
+				}
+			}
+		}
+	}
+}
+
+/* transpose an 8x8 bit matrix held a row to a byte, most significant
+ * bit first, so that out[j] is column j of in.  (from Hacker's Delight)
+ */
+static void transpose8(byte *in, byte *out)
+{
+	unsigned long x, y, t;
+
+	x = ((unsigned long) in[0] << 24) | (in[1] << 16) | (in[2] << 8) |
+		in[3];
+	y = ((unsigned long) in[4] << 24) | (in[5] << 16) | (in[6] << 8) |
+		in[7];
+
+	t = (x ^ (x >> 7)) & 0x00AA00AA;
+	x = x ^ t ^ (t << 7);
+	t = (y ^ (y >> 7)) & 0x00AA00AA;
+	y = y ^ t ^ (t << 7);
+
+	t = (x ^ (x >> 14)) & 0x0000CCCC;
+	x = x ^ t ^ (t << 14);
+	t = (y ^ (y >> 14)) & 0x0000CCCC;
+	y = y ^ t ^ (t << 14);
+
+	t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+	y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+	x = t;
+
+	out[0] = x >> 24;
+	out[1] = x >> 16;
+	out[2] = x >> 8;
+	out[3] = x;
+	out[4] = y >> 24;
+	out[5] = y >> 16;
+	out[6] = y >> 8;
+	out[7] = y;
+}
+
+/* rotate destination rows y0 to y1 - 1 of a bitmap by 90 or 270
+ * degrees.  each destination byte holds 8 source rows of one source
+ * column, so 8 source bytes stacked up make 8 destination bytes stacked
+ * up when transposed.
+ */
+static void rotateBitsQuarter(RotateJob *job, unsigned int y0,
+	unsigned int y1)
+{
+	Image *simage = job->simage, *dimage = job->dimage;
+	unsigned int slinelen = (simage->width + 7) / 8;
+	unsigned int dlinelen = (dimage->width + 7) / 8;
+	unsigned int sbx, sbx0, sbx1, bx, tbx, bxend;
+	int k, j, sy, dy;
+	byte in[8], out[8];
+
+	/* the source byte columns that make these destination rows */
+	if (job->rotate == 90) {
+		sbx0 = y0 / 8;
+		sbx1 = (y1 + 7) / 8;
+	} else {
+		sbx0 = (simage->width - y1) / 8;
+		sbx1 = (simage->width - y0 + 7) / 8;
+	}
+
+	for (tbx = 0; tbx < dlinelen; tbx += TILE / 8) {
+		bxend = (dlinelen - tbx > TILE / 8 ? tbx + TILE / 8 : dlinelen);
+		for (sbx = sbx0; sbx < sbx1; sbx++)
+			for (bx = tbx; bx < bxend; bx++) {
+				for (k = 0; k < 8; k++) {
+					sy = (job->rotate == 90 ?
+						(int) simage->height - 1 - (int) (bx * 8) - k :
+						(int) (bx * 8) + k);
+					in[k] = (sy >= 0 && sy < simage->height ?
+						simage->data[(unsigned long) sy *
+							slinelen + sbx] : 0);
+				}
+				transpose8(in, out);
+				for (j = 0; j < 8; j++) {
+					dy = (job->rotate == 90 ?
+						(int) (sbx * 8) + j :
+						(int) simage->width - 1 - (int) (sbx * 8) - j);
+					if (dy >= (int) y0 && dy < (int) y1)
+						dimage->data[(unsigned long) dy *
+							dlinelen + bx] = out[j];
+				}
+			}
+	}
+}
+
+static byte reverseBits(byte b)
+{
+	b = ((b & 0xF0) >> 4) | ((b & 0x0F) << 4);
+	b = ((b & 0xCC) >> 2) | ((b & 0x33) << 2);
+	b = ((b & 0xAA) >> 1) | ((b & 0x55) << 1);
+	return b;
+}
+
+/* rotate destination rows y0 to y1 - 1 of a bitmap by 180 degrees.
+ * reversing the bytes of a row and the bits in each leaves the row's
+ * padding at the start, so it's shifted back out again.
+ */
+static void rotateBitsHalf(RotateJob *job, unsigned int y0, unsigned int y1)
+{
+	Image *simage = job->simage, *dimage = job->dimage;
+	unsigned int linelen = (simage->width + 7) / 8;
+	unsigned int pad = linelen * 8 - simage->width;
+	unsigned int i, y;
+	byte *sp, *dp, *row;
+
+	row = lmalloc(linelen + 1);
+	row[linelen] = 0;
+	for (y = y0; y < y1; y++) {
+		sp = simage->data + (unsigned long) (simage->height - 1 - y) *
+			linelen;
+		dp = dimage->data + (unsigned long) y * linelen;
+		for (i = 0; i < linelen; i++)
+			row[i] = reverseBits(sp[linelen - 1 - i]);
+		if (!pad)
+			bcopy(row, dp, linelen);
+		else
+			for (i = 0; i < linelen; i++)
+				dp[i] = (row[i] << pad) | (row[i + 1] >> (8 - pad));
+	}
+	lfree(row);
+}
+
+static void rotateBand(void *arg, unsigned int y0, unsigned int y1)
+{
+	RotateJob *job = (RotateJob *) arg;
+
+	if (!BITMAPP(job->simage))
+		rotateBytes(job, y0, y1);
+	else if (job->rotate == 180)
+		rotateBitsHalf(job, y0, y1);
+	else
+		rotateBitsQuarter(job, y0, y1);
 }
 
 /* rotate()
@@ -34,142 +229,65 @@ static void rotate_bitmap(int num, int pos, int width, int height,
  */
 Image *rotate(Image * iimage, int rotate, int verbose)
 {
-	int rot;		/* Actual rotation             */
-	Image *simage;		/* Source image                */
 	Image *dimage;		/* Destination image           */
-	byte *sp;		/* Pointer to source data      */
-	byte *dp;		/* Pointer to destination data */
-	int slinelen;		/* Length of source line       */
-	int dlinelen;		/* Length of destination line  */
-	int bit[8];		/* Array of hex values         */
-	int x, y;
-	int i, b;
-	int newi, newb;
-	byte **yptr;
-
-	bit[0] = 128;
-	bit[1] = 64;
-	bit[2] = 32;
-	bit[3] = 16;
-	bit[4] = 8;
-	bit[5] = 4;
-	bit[6] = 2;
-	bit[7] = 1;
+	unsigned int width, height;
+	RotateJob job;
+	int x;
 
 	CURRFUNC("rotate");
 
+	job.rotate = rotate % 360;
+	if (!job.rotate)
+		return (iimage);
+
 	if (verbose) {
 		printf("  Rotating image by %d degrees...", rotate);
 		fflush(stdout);
 	}
-	simage = iimage;
-	dimage = 0;
-	for (rot = 0; rot < rotate; rot += 90) {
-		switch (simage->type) {
-		case IBITMAP:
-			dimage = newBitImage(simage->height, simage->width);
-			for (x = 0; x < simage->rgb.used; x++) {
-				*(dimage->rgb.red + x) = *(simage->rgb.red + x);
-				*(dimage->rgb.green + x) = *(simage->rgb.green + x);
-				*(dimage->rgb.blue + x) = *(simage->rgb.blue + x);
-			}
-			slinelen = (simage->width / 8) + (simage->width % 8 ? 1 : 0);
-			sp = simage->data;
-			dp = dimage->data;
-			for (i = 0; i < (slinelen * simage->height); i++)
-				for (b = 0; b < 8; b++)
-					if (sp[i] & bit[b]) {
-						rotate_bitmap(i, b, simage->width, simage->height, &newi, &newb);
-						dp[newi] |= bit[newb];
-					}
-			break;
-
-		case IRGB:
-			dimage = newRGBImage(simage->height, simage->width, simage->depth);
-			for (x = 0; x < simage->rgb.used; x++) {
-				*(dimage->rgb.red + x) = *(simage->rgb.red + x);
-				*(dimage->rgb.green + x) = *(simage->rgb.green + x);
-				*(dimage->rgb.blue + x) = *(simage->rgb.blue + x);
-			}
-			dimage->rgb.used = simage->rgb.used;
-
-			/* build array of y axis ptrs into destination image
-			 */
-
-			yptr = (byte **) lmalloc(simage->width * sizeof(char *));
-			dlinelen = simage->height * dimage->pixlen;
-			for (y = 0; y < simage->width; y++)
-				yptr[y] = dimage->data + (y * dlinelen);
-
-			/* rotate
-			 */
-
-			sp = simage->data;
-			if (simage->pixlen == 1 && dimage->pixlen == 1)		/* most common */
-				for (y = 0; y < simage->height; y++)
-					for (x = 0; x < simage->width; x++) {
-						register unsigned long temp;
-						temp = memToVal(sp, 1);
-						valToMem(temp, yptr[x] + (simage->height - y - 1), 1);
-						sp += 1;
-			} else	/* less common */
-				for (y = 0; y < simage->height; y++)
-					for (x = 0; x < simage->width; x++) {
-						register unsigned long temp;
-						temp = memToVal(sp, simage->pixlen);
-						valToMem(temp,
-							 yptr[x] + ((simage->height - y - 1) * dimage->pixlen),
-							 dimage->pixlen);
-						sp += simage->pixlen;
-					}
-			lfree((byte *) yptr);
-			break;
-
-		case ITRUE:
-			if (TRUEP(simage))
-				dimage = newTrueImage(simage->height, simage->width);
-
-			/* build array of y axis ptrs into destination image
-			 */
-
-			yptr = (byte **) lmalloc(simage->width * sizeof(char *));
-			dlinelen = simage->height * dimage->pixlen;
-			for (y = 0; y < simage->width; y++)
-				yptr[y] = dimage->data + (y * dlinelen);
-
-			/* rotate
-			 */
-
-			sp = simage->data;
-			if (simage->pixlen == 3 && dimage->pixlen == 3)		/* most common */
-				for (y = 0; y < simage->height; y++)
-					for (x = 0; x < simage->width; x++) {
-						register unsigned long temp;
-						temp = memToVal(sp, 3);
-						valToMem(temp, yptr[x] + ((simage->height - y - 1) * 3), 3);
-						sp += 3;
-			} else	/* less common */
-				for (y = 0; y < simage->height; y++)
-					for (x = 0; x < simage->width; x++) {
-						register unsigned long temp;
-						temp = memToVal(sp, simage->pixlen);
-						valToMem(temp,
-							 yptr[x] + ((simage->height - y - 1) * dimage->pixlen),
-							 dimage->pixlen);
-						sp += simage->pixlen;
-					}
-			lfree((byte *) yptr);
-			break;
-		default:
-			printf("rotate: Unsupported image type\n");
-			exit(1);
+	if (job.rotate == 180) {
+		width = iimage->width;
+		height = iimage->height;
+	} else {
+		width = iimage->height;
+		height = iimage->width;
+	}
+
+	switch (iimage->type) {
+	case IBITMAP:
+		dimage = newBitImage(width, height);
+		for (x = 0; x < iimage->rgb.used; x++) {
+			*(dimage->rgb.red + x) = *(iimage->rgb.red + x);
+			*(dimage->rgb.green + x) = *(iimage->rgb.green + x);
+			*(dimage->rgb.blue + x) = *(iimage->rgb.blue + x);
+		}
+		break;
+
+	case IRGB:
+		dimage = newRGBImage(width, height, iimage->depth);
+		for (x = 0; x < iimage->rgb.used; x++) {
+			*(dimage->rgb.red + x) = *(iimage->rgb.red + x);
+			*(dimage->rgb.green + x) = *(iimage->rgb.green + x);
+			*(dimage->rgb.blue + x) = *(iimage->rgb.blue + x);
 		}
-		if (simage != iimage)
-			freeImage(simage);
-		simage = dimage;
+		dimage->rgb.used = iimage->rgb.used;
+		break;
+
+	case ITRUE:
+		dimage = newTrueImage(width, height);
+		break;
+
+	default:
+		printf("rotate: Unsupported image type\n");
+		exit(1);
 	}
+
+	job.simage = iimage;
+	job.dimage = dimage;
+	runBands(height, rotateBand, &job);
+
 	dimage->title = (char *) lmalloc(strlen(iimage->title) + 40);
-	sprintf(dimage->title, "%s (rotated by %d degrees)", iimage->title, rot);
+	sprintf(dimage->title, "%s (rotated by %d degrees)", iimage->title,
+		rotate);
 	dimage->gamma = iimage->gamma;
 	if (verbose)
 		printf("done\n");
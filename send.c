@@ -12,11 +12,20 @@
 #include "copyright.h"
 #include "xli.h"
 #include <assert.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 /* extra colors to try allocating in private color maps to minimise flashing */
 #define NOFLASH_COLORS 256
 /* number of colors to allow in the default colormap */
 #define DEFAULT_COLORS 16
+/* width and height of the tiles a big image is drawn in */
+#define TILE_SIZE 256
+/* draw images in tiles if they're bigger than this many screens, and keep
+ * about this many screens' worth of tiles
+ */
+#define TILE_SCREENS 4
 
 static int GotError;
 
@@ -37,7 +46,9 @@ Pixmap ximageToPixmap(Display *disp, Window parent, XImageInfo *xii)
 {
   int         (*old_handler)();
   Pixmap        pixmap;
+  ProfileMark   mark;
 
+  profileStart(&mark, NULL);
   GotError = 0;
   old_handler = XSetErrorHandler(pixmapErrorTrap);
   XSync(disp, False);
@@ -47,6 +58,8 @@ Pixmap ximageToPixmap(Display *disp, Window parent, XImageInfo *xii)
   if (GotError)
     return(None);
   xii->drawable= pixmap;
+  /* the image itself is counted by sendXImage() */
+  profileStage(&mark, "ximageToPixmap", NULL);
   sendXImage(xii, 0, 0, 0, 0, xii->ximage->width, xii->ximage->height);
   return(pixmap);
 }
@@ -140,20 +153,320 @@ static void createImage(XImageInfo *xii, Image *image, Visual *visual,
 		lmalloc(image->height * xii->ximage->bytes_per_line);
 }
 
+/* converting all or part of an image into an XImage.  for a TrueColor or
+ * DirectColor visual, red, green and blue give the pixel value for each
+ * 8 bit intensity, with any gamma correction already folded in, and cmap
+ * gives the pixel value for each colormap entry of an RGB image.  for
+ * other visuals, index gives the pixel value for each colormap entry.
+ */
+typedef struct {
+	Image *image;
+	XImage *ximage;		/* where to put the converted pixels */
+	unsigned int x, y;	/* part of image that goes at 0,0 of ximage */
+	int depth, format;	/* of the XImage */
+	boolean truecolor;	/* TrueColor or DirectColor visual */
+	Pixel red[256], green[256], blue[256];
+	Pixel *cmap;
+	Pixel *index;
+	unsigned int dbits, dpixlen;
+	boolean plain;		/* pixel values are simply 0x00RRGGBB */
+} ConvertJob;
+
+/* 24 bit RGB to 32 bit 0x00RRGGBB with LSBFirst byte order, ie B G R 0
+ * in memory.  this is by far the most common case, and is a straight
+ * byte shuffle.
+ */
+static void plainRow(byte *sp, byte *dp, unsigned int width)
+{
+	unsigned int x = 0;
+
+#ifdef __SSSE3__
+	__m128i shuffle = _mm_setr_epi8(2, 1, 0, -128, 5, 4, 3, -128,
+		8, 7, 6, -128, 11, 10, 9, -128);
+
+	/* four pixels at a time, but each load reads 16 bytes */
+	for (; x + 6 <= width; x += 4, sp += 12, dp += 16)
+		_mm_storeu_si128((__m128i *) dp, _mm_shuffle_epi8(
+			_mm_loadu_si128((__m128i *) sp), shuffle));
+#endif
+	for (; x < width; x++, sp += 3, dp += 4) {
+		dp[0] = sp[2];
+		dp[1] = sp[1];
+		dp[2] = sp[0];
+		dp[3] = 0;
+	}
+}
+
+/* convert rows y0 to y1 - 1 of the XImage */
+static void convertBand(void *arg, unsigned int y0, unsigned int y1)
+{
+	ConvertJob *job = (ConvertJob *) arg;
+	Image *image = job->image;
+	XImage *ximage = job->ximage;
+	unsigned int pixlen = image->pixlen, dpixlen = job->dpixlen;
+	unsigned int width = ximage->width;
+	boolean lsb = ximage->byte_order == LSBFirst;
+	Pixel *red = job->red, *green = job->green, *blue = job->blue;
+	Pixel pixval;
+	unsigned int x, y, rowbytes;
+	byte *sp, *dp;
+
+	if (BITMAPP(image)) {
+		/* tiles always start on a byte boundary */
+		rowbytes = (image->width + 7) / 8;
+		for (y = y0; y < y1; y++) {
+			sp = image->data + (job->y + y) * rowbytes + job->x / 8;
+			dp = (byte *) ximage->data + y * ximage->bytes_per_line;
+			memcpy(dp, sp, (width + 7) / 8);
+			if (LSBFirst == ximage->bitmap_bit_order)
+				flipBits(dp, (width + 7) / 8);
+		}
+		return;
+	}
+
+	for (y = y0; y < y1; y++) {
+		sp = image->data +
+			((job->y + y) * image->width + job->x) * pixlen;
+		dp = (byte *) ximage->data + y * ximage->bytes_per_line;
+		if (!job->truecolor) {
+			/* if our XImage doesn't have modulus 8 bits per
+			 * pixel, it's unclear how to pack bits so we use
+			 * XPutPixel.  this is slower.
+			 */
+			if (job->dbits % 8) {
+				for (x = 0; x < width; x++, sp += pixlen)
+					XPutPixel(ximage, x, y,
+					    job->index[memToVal(sp, pixlen)]);
+				continue;
+			}
+			for (x = width; x--; sp += pixlen, dp += dpixlen) {
+				pixval = job->index[memToVal(sp, pixlen)];
+				if (lsb)
+					valToMemLSB(pixval, dp, dpixlen);
+				else
+					valToMem(pixval, dp, dpixlen);
+			}
+			continue;
+		}
+		if (job->plain) {
+			plainRow(sp, dp, width);
+			continue;
+		}
+		if (TRUEP(image) && dpixlen == 4) {
+			/* the other common case, kept apart so that the
+			 * pixel length is a constant
+			 */
+			for (x = width; x--; sp += 3, dp += 4) {
+				pixval = red[sp[0]] | green[sp[1]] | blue[sp[2]];
+				if (lsb)
+					valToMemLSB(pixval, dp, 4);
+				else
+					valToMem(pixval, dp, 4);
+			}
+			continue;
+		}
+		for (x = width; x--; sp += pixlen, dp += dpixlen) {
+			if (TRUEP(image))
+				pixval = red[sp[0]] | green[sp[1]] | blue[sp[2]];
+			else
+				pixval = job->cmap[memToVal(sp, pixlen)];
+			if (lsb)
+				valToMemLSB(pixval, dp, dpixlen);
+			else
+				valToMem(pixval, dp, dpixlen);
+		}
+	}
+}
+
+static void newTiles(XImageInfo *xii, ConvertJob *job, Visual *visual,
+	boolean ownimage);
+
+static XImageInfo *newXImageInfo(Display *disp, int scrn)
+{
+	XImageInfo *xii;
+
+	xii = (XImageInfo *) lmalloc(sizeof(XImageInfo));
+	xii->disp = disp;
+	xii->scrn = scrn;
+	xii->depth = 0;
+	xii->drawable = None;
+	xii->index = NULL;
+	xii->no = 0;
+	xii->rootimage = FALSE;	/* assume not */
+	xii->foreground = xii->background = 0;
+	xii->gc = NULL;
+	xii->ximage = NULL;
+	xii->shm.shmid = -1;
+	xii->tiles = NULL;
+	return xii;
+}
+
+/* an image that is being decoded straight into the XImage it will be
+ * displayed from, which saves building the image and then converting
+ * all of it.  this is only done when the image will be shown as it is
+ * on a plain 0x00RRGGBB visual, so the loader's rows just need their
+ * bytes shuffling.  there's only ever one such image at a time.
+ */
+static Image *DirectImage;
+static XImageInfo *DirectXii;
+static Visual *DirectVisual;
+
+/* make a true color image that has no data of its own, for a loader to
+ * hand its rows to directImageRows().  returns NULL if the display isn't
+ * suitable, in which case the loader should make an ordinary image.
+ */
+Image *newDirectImage(unsigned int width, unsigned int height, float gamma)
+{
+	Display *disp = globals.dinfo.disp;
+	int scrn = globals.dinfo.scrn;
+	Visual *visual;
+	unsigned int depth;
+	Image *image;
+
+	CURRFUNC("newDirectImage");
+
+	if (DirectImage || !disp || globals.visual_class != -1 ||
+			GAMMA_NOT_EQUAL(globals.display_gamma, gamma) ||
+			ImageByteOrder(disp) != LSBFirst ||
+			wantTiles(disp, scrn, width, height))
+		return NULL;
+
+	image = newImage(width, height);
+	image->type = ITRUE;
+	image->rgb.used = image->rgb.size = 0;
+	image->depth = 24;
+	image->pixlen = 3;
+	image->data = NULL;
+	image->gamma = gamma;
+
+	chooseVisual(disp, scrn, image, &visual, &depth, FALSE);
+	if (visual->class != TrueColor || visual->red_mask != 0xff0000 ||
+			visual->green_mask != 0xff00 ||
+			visual->blue_mask != 0xff ||
+			bitsPerPixelAtDepth(disp, scrn, depth) != 32) {
+		lfree((byte *) image);
+		return NULL;
+	}
+
+	DirectXii = newXImageInfo(disp, scrn);
+	DirectXii->depth = depth;
+	createImage(DirectXii, image, visual, depth, ZPixmap);
+	DirectVisual = visual;
+	DirectImage = image;
+	image->flags |= FLAG_DIRECT;
+	return image;
+}
+
+/* convert rows of 24 bit RGB into a direct image, starting at row y */
+void directImageRows(Image *image, byte *rows, unsigned int y,
+	unsigned int nrows)
+{
+	XImage *ximage = DirectXii->ximage;
+
+	for (; nrows--; y++, rows += image->width * 3)
+		plainRow(rows, (byte *) ximage->data +
+			y * ximage->bytes_per_line, image->width);
+}
+
+/* give a direct image ordinary data again, when it turns out that it
+ * can't be displayed as it is after all.
+ */
+void undirectImage(Image *image)
+{
+	XImage *ximage = DirectXii->ximage;
+	unsigned int x, y;
+	byte *sp, *dp;
+
+	image->data = lmalloc(image->width * image->height * 3);
+	dp = image->data;
+	for (y = 0; y < image->height; y++) {
+		sp = (byte *) ximage->data + y * ximage->bytes_per_line;
+		for (x = image->width; x--; sp += 4, dp += 3) {
+			dp[0] = sp[2];
+			dp[1] = sp[1];
+			dp[2] = sp[0];
+		}
+	}
+	freeDirectImage(image);
+}
+
+/* drop the XImage of a direct image */
+void freeDirectImage(Image *image)
+{
+	freeXImage(image, DirectXii);
+	DirectImage = NULL;
+	DirectXii = NULL;
+	image->flags &= ~FLAG_DIRECT;
+}
+
+
+/* work out the pixel value of each 8 bit intensity in one band of a
+ * TrueColor visual.  the intensity is scaled to the width of the band
+ * and rounded, the way the server does it for XAllocColor(), so 255 is
+ * always the top of the band and there's no need for a round trip per
+ * color to find them.
+ */
+static void trueBandValues(Pixel mask, Pixel *value)
+{
+  unsigned int shift, bits, a;
+
+  for (shift= 0; mask && !(mask & 1); shift++)
+    mask >>= 1;
+  for (bits= 0; mask & 1; bits++)
+    mask >>= 1;
+  for (a= 0; a < 256; a++)
+    value[a]= (((Pixel)a * ((1 << bits) - 1) + 127) / 255) << shift;
+}
+
+/* the pixel values allocated for a DirectColor visual are kept for the
+ * display, so that they only have to be asked for once.  they're only
+ * good for the colormap they were allocated in, so that is kept too,
+ * and used for every image shown with the visual.
+ */
+static boolean cachedDirectValues(Display *disp, Visual *visual,
+	XImageInfo *xii, Pixel *redvalue, Pixel *greenvalue, Pixel *bluevalue)
+{
+  DisplayInfo *dinfo= &globals.dinfo;
+
+  if ((disp != dinfo->disp) || (visual != dinfo->direct_visual))
+    return(FALSE);
+  bcopy(dinfo->direct_values, redvalue, 256 * sizeof(Pixel));
+  bcopy(dinfo->direct_values + 256, greenvalue, 256 * sizeof(Pixel));
+  bcopy(dinfo->direct_values + 512, bluevalue, 256 * sizeof(Pixel));
+  xii->cmap= dinfo->direct_cmap;
+  return(TRUE);
+}
+
+static void cacheDirectValues(Display *disp, Visual *visual,
+	XImageInfo *xii, Pixel *redvalue, Pixel *greenvalue, Pixel *bluevalue)
+{
+  DisplayInfo *dinfo= &globals.dinfo;
+
+  if ((disp != dinfo->disp) || (visual->class != DirectColor))
+    return;
+  if (!dinfo->direct_values)
+    dinfo->direct_values= (Pixel *)lmalloc(3 * 256 * sizeof(Pixel));
+  bcopy(redvalue, dinfo->direct_values, 256 * sizeof(Pixel));
+  bcopy(greenvalue, dinfo->direct_values + 256, 256 * sizeof(Pixel));
+  bcopy(bluevalue, dinfo->direct_values + 512, 256 * sizeof(Pixel));
+  dinfo->direct_visual= visual;
+  dinfo->direct_cmap= xii->cmap;
+}
 
 XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
 	unsigned int ddepth, Image *image, unsigned int private_cmap,
-	unsigned int fit, ImageOptions *options)
+	unsigned int fit, ImageOptions *options, boolean tiled)
 {
   float        display_gamma = globals.display_gamma;
   unsigned int  verbose = globals.verbose;
   Pixel        *redvalue, *greenvalue, *bluevalue;
-  unsigned int  a, b, c=0, newmap, x, y, dpixlen, dbits;
+  unsigned int  a, b, c=0, newmap, dpixlen, dbits;
   XColor        xcolor;
   XImageInfo   *xii;
   Image        *orig_image;
   boolean	dogamma=FALSE;
   int           gammamap[256];
+  ConvertJob    job;
 
   CURRFUNC("imageToXImage");
 
@@ -166,17 +479,31 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
   xcolor.flags= DoRed | DoGreen | DoBlue;
   redvalue= greenvalue= bluevalue= NULL;
   orig_image= image;
-  xii= (XImageInfo *)lmalloc(sizeof(XImageInfo));
-  xii->disp= disp;
-  xii->scrn= scrn;
-  xii->depth= 0;
-  xii->drawable= None;
-  xii->index= NULL;
-  xii->rootimage= FALSE;	/* assume not */
-  xii->foreground= xii->background= 0;
-  xii->gc= NULL;
-  xii->ximage= NULL;
-  xii->shm.shmid = -1;
+
+  /* an image that was decoded straight into an XImage just needs a
+   * colormap, provided it's going where newDirectImage() expected.
+   */
+
+  if (image->flags & FLAG_DIRECT) {
+    if (!tiled && (visual == DirectVisual) &&
+	(ddepth == DirectXii->depth)) {
+      xii= DirectXii;
+      DirectImage= NULL;
+      DirectXii= NULL;
+      image->flags &= ~FLAG_DIRECT;
+      if (visual == DefaultVisual(disp, scrn))
+	xii->cmap= DefaultColormap(disp, scrn);
+      else
+	xii->cmap= XCreateColormap(disp, RootWindow(disp, scrn),
+					  visual, AllocNone);
+      if (verbose)
+	printf("  Image was decoded for display\n");
+      return(xii);
+    }
+    undirectImage(image);
+  }
+
+  xii= newXImageInfo(disp, scrn);
 
   /* process image based on type of visual we're sending to */
 
@@ -204,7 +531,7 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
       }
       else {	/* it must be monochrome */
         Image *dimage;
-        dimage= dither(image, verbose);
+        dimage= dither(image, options->colordither, verbose);
         if(dimage != image && orig_image != image)
           freeImage(image);
         image = dimage;
@@ -221,7 +548,7 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
     default:
       if (visual->map_entries <= 2) {	/* monochrome */
         Image *dimage;
-	dimage= dither(image, verbose);
+	dimage= dither(image, options->colordither, verbose);
         if(dimage != image && orig_image != image)
           freeImage(image);
         image = dimage;
@@ -250,6 +577,26 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
       greenvalue= (Pixel *)lmalloc(sizeof(Pixel) * 256);
       bluevalue= (Pixel *)lmalloc(sizeof(Pixel) * 256);
 
+      /* the pixel values of a TrueColor visual follow from its masks,
+       * and those of a DirectColor one may have been found already.
+       * either way there's no need to ask the server for them.
+       */
+
+      if (visual->class == TrueColor) {
+	if (visual == DefaultVisual(disp, scrn))
+	  xii->cmap= DefaultColormap(disp, scrn);
+	else
+	  xii->cmap= XCreateColormap(disp, RootWindow(disp, scrn),
+					    visual, AllocNone);
+	trueBandValues(visual->red_mask, redvalue);
+	trueBandValues(visual->green_mask, greenvalue);
+	trueBandValues(visual->blue_mask, bluevalue);
+	break;
+      }
+      if (cachedDirectValues(disp, visual, xii, redvalue, greenvalue,
+			     bluevalue))
+	break;
+
       if (visual == DefaultVisual(disp, scrn))
 	xii->cmap= DefaultColormap(disp, scrn);
       else
@@ -281,12 +628,15 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
 	fprintf(stderr, "Warning: inconsistency in color information (this may be ugly)\n");
       }
 
-      redstep = 256 / redcolors;
-      greenstep = 256 / greencolors;
-      bluestep = 256 / bluecolors;
+      /* bands of more than 8 bits just get every 8 bit intensity
+       */
+
+      redstep = redcolors < 256 ? 256 / redcolors : 1;
+      greenstep = greencolors < 256 ? 256 / greencolors : 1;
+      bluestep = bluecolors < 256 ? 256 / bluecolors : 1;
       redbottom = greenbottom = bluebottom = 0;
       redtop = greentop = bluetop = 0;
-      for (a = 0; a < visual->map_entries; a++) {
+      for (a = 0; a < visual->map_entries && a < 256; a++) {
 	if (redbottom < 256)
 	  redtop= redbottom + redstep;
 	if (greenbottom < 256)
@@ -304,7 +654,8 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
 	   */
 
 	  if ((visual->class == DirectColor) &&
-	      (visual == DefaultVisual(disp, scrn))) {
+	      (visual == DefaultVisual(disp, scrn)) &&
+	      (xii->cmap == DefaultColormap(disp, scrn))) {
 	    xii->cmap= XCreateColormap(disp, RootWindow(disp, scrn),
 					      visual, AllocNone);
 	    goto retry_direct;
@@ -331,6 +682,7 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
 	while ((bluebottom < 256) && (bluebottom < bluetop))
 	  bluevalue[bluebottom++]= xcolor.pixel & visual->blue_mask;
       }
+      cacheDirectValues(disp, visual, xii, redvalue, greenvalue, bluevalue);
     }
     break;
 
@@ -440,7 +792,7 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
 	    printf("  Cannot fit into default colormap, dithering...");
 	    fflush(stdout);
 	  }
-	  dimage= dither(image, 0);
+	  dimage= dither(image, options->colordither, 0);
           if(dimage != image && orig_image != image)
             freeImage(image);
           image = dimage;
@@ -579,149 +931,93 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
   }
 
 
+  job.image= image;
+  job.cmap= NULL;
+  job.index= NULL;
+  job.truecolor= (visual->class == TrueColor) || (visual->class == DirectColor);
+  job.plain= FALSE;
+  xii->depth= ddepth;
+  dbits= bitsPerPixelAtDepth(disp, scrn, ddepth);	/* bits per pixel */
+  dpixlen= (dbits + 7) / 8;	/* bytes per pixel */
+  job.dbits= dbits;
+  job.dpixlen= dpixlen;
+
   switch (image->type) {
   case IBITMAP:
-    {
-      byte *dst, *src;
-      int rowbytes;
-
-      createImage(xii, image, visual, 1, XYBitmap);
-      dst = xii->ximage->data;
-      src = image->data;
-      rowbytes = (image->width + 7) / 8;
-      assert(rowbytes <= xii->ximage->bytes_per_line);
-      for (y = image->height; y--;) {
-	memcpy(dst, src, rowbytes);
-	if (LSBFirst == xii->ximage->bitmap_bit_order)
-	   flipBits(dst, rowbytes);
-	dst += xii->ximage->bytes_per_line;
-	src += rowbytes;
-      }
-      
-      xii->depth= ddepth;
-      if(visual->class == DirectColor || visual->class == TrueColor) {
-        Pixel pixval;
-        dbits= bitsPerPixelAtDepth(disp, scrn, ddepth);
-        dpixlen= (dbits + 7) / 8;
-        pixval= redvalue[image->rgb.red[0] >> 8] |
-                greenvalue[image->rgb.green[0] >> 8] |
-                bluevalue[image->rgb.blue[0] >> 8];
-        xii->background = pixval;
-        pixval= redvalue[image->rgb.red[1] >> 8] |
-                greenvalue[image->rgb.green[1] >> 8] |
-                bluevalue[image->rgb.blue[1] >> 8];
-        xii->foreground = pixval;
-      }
-      else {	/* Not Direct or True Color */
-        xii->foreground= *((xii->index + c) + 1);
-        xii->background= *(xii->index + c);
-      }
-      break;
+    job.depth= 1;
+    job.format= XYBitmap;
+    if (job.truecolor) {
+      Pixel pixval;
+      pixval= redvalue[image->rgb.red[0] >> 8] |
+              greenvalue[image->rgb.green[0] >> 8] |
+              bluevalue[image->rgb.blue[0] >> 8];
+      xii->background = pixval;
+      pixval= redvalue[image->rgb.red[1] >> 8] |
+              greenvalue[image->rgb.green[1] >> 8] |
+              bluevalue[image->rgb.blue[1] >> 8];
+      xii->foreground = pixval;
+    }
+    else {	/* Not Direct or True Color */
+      xii->foreground= *((xii->index + c) + 1);
+      xii->background= *(xii->index + c);
     }
+    break;
 
   case IRGB:
   case ITRUE:
 
-    /* modify image data to match visual and colormap
+    /* work out how to turn image data into pixels for the visual
+     * and colormap
      */
 
-    dbits= bitsPerPixelAtDepth(disp, scrn, ddepth);	/* bits per pixel */
-    xii->depth= ddepth;
-    dpixlen= (dbits + 7) / 8;	/* bytes per pixel */
-
-    switch (visual->class) {
-    case DirectColor:
-    case TrueColor:
-      { byte *data, *dst, *src;
-	Pixel *pixels, *p;
-
-	createImage(xii, image, visual, ddepth, ZPixmap);
-	pixels = (Pixel *) lmalloc(image->width * sizeof(Pixel));
-
-	src = image->data;
-	data = xii->ximage->data;
-	for (y = image->height; y--;) {
-	  for (p = pixels, x = image->width; x--; src += image->pixlen, ++p)
-	    *p = memToVal(src, image->pixlen);
-	  if (IRGB == image->type) {
-	    for (p = pixels, x = image->width; x--; ++p) {
-              *p = RGB_TO_TRUE(image->rgb.red[*p], image->rgb.green[*p],
-		image->rgb.blue[*p]);
-	    }
-	  }
-	  if (dogamma) {
-	    for (p = pixels, x = image->width; x--; ++p) {
-	      *p = RGB_TO_TRUE(GAMMA8(TRUE_RED(*p)) << 8,
-		GAMMA8(TRUE_GREEN(*p)) << 8, GAMMA8(TRUE_BLUE(*p)) << 8);
-	    }
-	  }
-	  for (p = pixels, x = image->width; x--; ++p) {
-	    *p = redvalue[TRUE_RED(*p)] | greenvalue[TRUE_GREEN(*p)] |
-              bluevalue[TRUE_BLUE(*p)];
-	  }
-	  dst = data;
-	  if (MSBFirst == xii->ximage->byte_order) {
-	    for (p = pixels, x = image->width; x--; ++p, dst += dpixlen)
-	      valToMem(*p, dst, dpixlen);
-	  } else {
-	    for (p = pixels, x = image->width; x--; ++p, dst += dpixlen)
-	      valToMemLSB(*p, dst, dpixlen);
-	  }
-	  data += xii->ximage->bytes_per_line;
-	}
-	lfree((byte *) pixels);
-        break;
-      }
-
-    default:
-
-      /* only IRGB images make it this far.
-       */
-
-      createImage(xii, image, visual, ddepth, ZPixmap);
+    job.depth= ddepth;
+    job.format= ZPixmap;
+    if (job.truecolor) {
 
-      /* if our XImage doesn't have modulus 8 bits per pixel, it's unclear
-       * how to pack bits so we use XPutPixel.  this is slower.
+      /* fold the gamma correction into the pixel values
        */
 
-      if (dbits % 8) {
-	byte *src;
-
-	src = image->data;
-        for (y = 0; y < image->height; ++x) {
-	  for (x = 0; x < image->width; ++x) {
-	    XPutPixel(xii->ximage, x, y,
-	      xii->index[c + memToVal(src, image->pixlen)]);
-	    src += image->pixlen;
-	  }
-	}
-      } else {
-	byte *data, *src, *dst;
-
-        data = xii->ximage->data;
-	src = image->data;
-	for (y = image->height; y--;) {
-	  dst = data;
-	  if (MSBFirst == xii->ximage->byte_order) {
-            for (x = image->width; x--; src += image->pixlen, dst += dpixlen) {
-	      valToMem(xii->index[c + memToVal(src, image->pixlen)], dst,
-		dpixlen);
-            }
-	  } else {
-            for (x = image->width; x--; src += image->pixlen, dst += dpixlen) {
-	      valToMemLSB(xii->index[c + memToVal(src, image->pixlen)], dst,
-		dpixlen);
-            }
-	  }
-	  data += xii->ximage->bytes_per_line;
-	}
+      job.plain = (dbits == 32) && (ImageByteOrder(disp) == LSBFirst) &&
+	TRUEP(image);
+      for (a = 0; a < 256; a++) {
+	b = dogamma ? GAMMA8(a) : a;
+	job.red[a] = redvalue[b];
+	job.green[a] = greenvalue[b];
+	job.blue[a] = bluevalue[b];
+	if ((job.red[a] != a << 16) || (job.green[a] != a << 8) ||
+	    (job.blue[a] != a))
+	  job.plain = FALSE;
+      }
+      if (RGBP(image)) {
+	job.cmap = (Pixel *) lmalloc(image->rgb.size * sizeof(Pixel));
+	for (a = 0; a < image->rgb.size; a++)
+	  job.cmap[a] = job.red[image->rgb.red[a] >> 8] |
+	    job.green[image->rgb.green[a] >> 8] |
+	    job.blue[image->rgb.blue[a] >> 8];
       }
-      break;
     }
+    else	/* only IRGB images make it this far */
+      job.index= xii->index + c;
+    break;
   }
 
-  if (verbose)
-    printf("done\n");
+  if (tiled) {
+    /* tiles are converted as they are needed, from an image that
+     * the tiles now look after if it's one we made.
+     */
+    newTiles(xii, &job, visual, image != orig_image);
+    if (verbose)
+      printf("drawing in %dx%d tiles\n", TILE_SIZE, TILE_SIZE);
+  } else {
+    createImage(xii, image, visual, job.depth, job.format);
+    job.ximage= xii->ximage;
+    job.x= job.y= 0;
+    runBands(image->height, convertBand, &job);
+    if (job.cmap)
+      lfree((byte *) job.cmap);
+    if (verbose)
+      printf("done\n");
+  }
 
   if (redvalue) {
     lfree((byte *)redvalue);
@@ -730,25 +1026,23 @@ XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
   }
   if (verbose && dogamma)
     printf("  Have adjusted image from %4.2f to display gamma of %4.2f\n",image->gamma,display_gamma);
-  if (image != orig_image)
+  if (image != orig_image && !tiled)
     freeImage(image);
   return(xii);
 }
 
-/* Given an XImage and a drawable, move a rectangle from the Ximage
- * to the drawable.
+/* build and cache the GC for sending images of the given depth.  this
+ * only depends on the depth when sending a bitmap, and a bitmap is all
+ * sent at the same depth.
  */
 
-void sendXImage(XImageInfo *xii, int src_x, int src_y, int dst_x, int dst_y,
-	unsigned w, unsigned h)
+static GC imageGC(XImageInfo *xii, int depth)
 {
   XGCValues gcv;
 
-  /* build and cache the GC */
-
   if (!xii->gc) {
     gcv.function= GXcopy;
-    if (xii->ximage->depth == 1) {
+    if (depth == 1) {
       gcv.foreground= xii->foreground;
       gcv.background= xii->background;
       xii->gc= XCreateGC(xii->disp, xii->drawable,
@@ -757,11 +1051,26 @@ void sendXImage(XImageInfo *xii, int src_x, int src_y, int dst_x, int dst_y,
     else
       xii->gc= XCreateGC(xii->disp, xii->drawable, GCFunction, &gcv);
   }
+  return(xii->gc);
+}
+
+/* Given an XImage and a drawable, move a rectangle from the Ximage
+ * to the drawable.
+ */
+
+void sendXImage(XImageInfo *xii, int src_x, int src_y, int dst_x, int dst_y,
+	unsigned w, unsigned h)
+{
+  ProfileMark mark;
+
+  imageGC(xii, xii->ximage->depth);
 
   if (src_x < 0 || src_y < 0 ||
       src_x + w > xii->ximage->width || src_y + h > xii->ximage->height)
     return;
 
+  profileStart(&mark, NULL);
+
   if (xii->shm.shmid >= 0) {
     XShmPutImage(xii->disp, xii->drawable, xii->gc,
       xii->ximage, src_x, src_y, dst_x, dst_y, w, h, False);
@@ -770,6 +1079,172 @@ void sendXImage(XImageInfo *xii, int src_x, int src_y, int dst_x, int dst_y,
     XPutImage(xii->disp, xii->drawable, xii->gc,
       xii->ximage, src_x, src_y, dst_x, dst_y, w, h);
   }
+  if (globals.profile) {
+    /* wait for the server, so that the upload is what's timed */
+    XSync(xii->disp, False);
+    profileStage(&mark, "sendXImage", NULL);
+  }
+}
+
+/* a tiled XImageInfo has no XImage for the whole image.  instead, tiles of
+ * the image are converted and sent to pixmaps in the server as they come
+ * into view, and the least recently drawn ones are thrown away when there
+ * are more than a few screens' worth.  this is used for images that are
+ * much bigger than the screen, where converting the whole image would take
+ * a great deal of memory (if the server would take it at all) just to
+ * show the part of it that fits in the window.
+ */
+
+typedef struct {
+	int tx, ty;		/* tile column and row */
+	Pixmap pixmap;
+	unsigned long used;	/* when it was last drawn */
+} Tile;
+
+struct xlitiles {
+	ConvertJob job;		/* how to convert the image */
+	Visual *visual;
+	boolean ownimage;	/* TRUE if the image is ours to free */
+	Tile *tile;
+	int ntiles, maxtiles;
+	unsigned long clock;	/* bumped each time a tile is drawn */
+};
+
+/* TRUE if an image is big enough that it should be shown in tiles */
+boolean wantTiles(Display *disp, int scrn, unsigned int width,
+	unsigned int height)
+{
+	return width > 32767 || height > 32767 ||
+		(double) width * height > (double) TILE_SCREENS *
+		DisplayWidth(disp, scrn) * DisplayHeight(disp, scrn);
+}
+
+static void newTiles(XImageInfo *xii, ConvertJob *job, Visual *visual,
+	boolean ownimage)
+{
+	struct xlitiles *tiles;
+
+	tiles = (struct xlitiles *) lmalloc(sizeof(struct xlitiles));
+	tiles->job = *job;
+	tiles->visual = visual;
+	tiles->ownimage = ownimage;
+	tiles->maxtiles = TILE_SCREENS *
+		(DisplayWidth(xii->disp, xii->scrn) / TILE_SIZE + 2) *
+		(DisplayHeight(xii->disp, xii->scrn) / TILE_SIZE + 2);
+	tiles->tile = (Tile *) lmalloc(tiles->maxtiles * sizeof(Tile));
+	tiles->ntiles = 0;
+	tiles->clock = 0;
+	xii->tiles = tiles;
+}
+
+static void freeTiles(XImageInfo *xii)
+{
+	struct xlitiles *tiles = xii->tiles;
+	int a;
+
+	for (a = 0; a < tiles->ntiles; a++)
+		XFreePixmap(xii->disp, tiles->tile[a].pixmap);
+	lfree((byte *) tiles->tile);
+	if (tiles->job.cmap)
+		lfree((byte *) tiles->job.cmap);
+	if (tiles->ownimage)
+		freeImage(tiles->job.image);
+	lfree((byte *) tiles);
+	xii->tiles = NULL;
+}
+
+/* get the pixmap holding a tile, making it if need be */
+static Pixmap tilePixmap(XImageInfo *xii, int tx, int ty)
+{
+	struct xlitiles *tiles = xii->tiles;
+	Image *image = tiles->job.image;
+	ConvertJob job;
+	Tile *tile;
+	unsigned int w, h;
+	int a;
+
+	tiles->clock++;
+	for (a = 0; a < tiles->ntiles; a++) {
+		tile = &tiles->tile[a];
+		if (tile->tx == tx && tile->ty == ty) {
+			tile->used = tiles->clock;
+			return tile->pixmap;
+		}
+	}
+
+	/* use a new slot if there is one, else the least recently used */
+	if (tiles->ntiles < tiles->maxtiles)
+		tile = &tiles->tile[tiles->ntiles++];
+	else {
+		tile = &tiles->tile[0];
+		for (a = 1; a < tiles->ntiles; a++)
+			if (tiles->tile[a].used < tile->used)
+				tile = &tiles->tile[a];
+		XFreePixmap(xii->disp, tile->pixmap);
+	}
+
+	job = tiles->job;
+	job.x = tx * TILE_SIZE;
+	job.y = ty * TILE_SIZE;
+	w = image->width - job.x < TILE_SIZE ? image->width - job.x : TILE_SIZE;
+	h = image->height - job.y < TILE_SIZE ?
+		image->height - job.y : TILE_SIZE;
+	job.ximage = XCreateImage(xii->disp, tiles->visual, job.depth,
+		job.format, 0, NULL, w, h, 8, 0);
+	job.ximage->data = lmalloc(h * job.ximage->bytes_per_line);
+	runBands(h, convertBand, &job);
+
+	tile->tx = tx;
+	tile->ty = ty;
+	tile->used = tiles->clock;
+	tile->pixmap = XCreatePixmap(xii->disp, xii->drawable, w, h,
+		xii->depth);
+	XPutImage(xii->disp, tile->pixmap, imageGC(xii, job.depth), job.ximage,
+		0, 0, 0, 0, w, h);
+	lfree((byte *) job.ximage->data);
+	job.ximage->data = NULL;
+	XDestroyImage(job.ximage);
+	return tile->pixmap;
+}
+
+/* draw a rectangle of a tiled image to the drawable, as sendXImage() does
+ * for an ordinary one.
+ */
+void sendTiles(XImageInfo *xii, int src_x, int src_y, int dst_x, int dst_y,
+	unsigned w, unsigned h)
+{
+	Image *image = xii->tiles->job.image;
+	int tx, ty, x0, y0, x1, y1;
+	ProfileMark mark;
+
+	/* the GC has to be made with the bitmap colors, if any */
+	imageGC(xii, xii->tiles->job.depth);
+
+	if (src_x < 0 || src_y < 0 ||
+	    src_x + w > image->width || src_y + h > image->height)
+		return;
+
+	profileStart(&mark, NULL);
+
+	for (ty = src_y / TILE_SIZE; ty * TILE_SIZE < src_y + h; ty++) {
+		y0 = ty * TILE_SIZE > src_y ? ty * TILE_SIZE : src_y;
+		y1 = (ty + 1) * TILE_SIZE < src_y + h ?
+			(ty + 1) * TILE_SIZE : src_y + h;
+		for (tx = src_x / TILE_SIZE; tx * TILE_SIZE < src_x + w; tx++) {
+			x0 = tx * TILE_SIZE > src_x ? tx * TILE_SIZE : src_x;
+			x1 = (tx + 1) * TILE_SIZE < src_x + w ?
+				(tx + 1) * TILE_SIZE : src_x + w;
+			XCopyArea(xii->disp, tilePixmap(xii, tx, ty),
+				xii->drawable, xii->gc,
+				x0 - tx * TILE_SIZE, y0 - ty * TILE_SIZE,
+				x1 - x0, y1 - y0,
+				dst_x + x0 - src_x, dst_y + y0 - src_y);
+		}
+	}
+	if (globals.profile) {
+		XSync(xii->disp, False);
+		profileStage(&mark, "sendTiles", NULL);
+	}
 }
 
 /* free up anything cached in the local Ximage structure.
@@ -784,15 +1259,19 @@ void freeXImage(Image *image, XImageInfo *xii)
   }
   if (xii->gc)
     XFreeGC(xii->disp, xii->gc);
-  if (xii->shm.shmid >= 0) {
-    XShmDetach(xii->disp, &xii->shm);
-    shmdt(xii->shm.shmaddr);
-    shmctl(xii->shm.shmid, IPC_RMID, 0);
-  } else {
-    lfree((byte *) xii->ximage->data);
+  if (xii->tiles)
+    freeTiles(xii);
+  if (xii->ximage) {
+    if (xii->shm.shmid >= 0) {
+      XShmDetach(xii->disp, &xii->shm);
+      shmdt(xii->shm.shmaddr);
+      shmctl(xii->shm.shmid, IPC_RMID, 0);
+    } else {
+      lfree((byte *) xii->ximage->data);
+    }
+    xii->ximage->data= NULL;
+    XDestroyImage(xii->ximage);
   }
-  xii->ximage->data= NULL;
-  XDestroyImage(xii->ximage);
   lfree((byte *) xii);
   /* should we free private color map to ??? */
 }
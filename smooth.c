@@ -12,100 +12,175 @@
 #include "copyright.h"
 #include "xli.h"
 
-static Image *doSmooth(Image *isrc)
-{ Image *src = isrc, *dest, *tmp;
-  int    x, y, x1, y1, linelen;
-  int    xindex[3];
-  byte  *yindex[3];
-  byte  *srcptr, *destptr;
-  unsigned long avgred, avggreen, avgblue;
+/* each pass averages every pixel with its eight neighbours, which is
+ * done as a sum of three pixels across each row followed by a sum of
+ * three of those down each column.  all of the passes are made together
+ * a row at a time: only the row sums of the last three rows of each
+ * pass are kept, so a pass never needs an image of its own.
+ */
 
-  /* build true color image from old image and allocate new image
-   */
+struct smoother {
+  unsigned int    width, height;
+  unsigned int    passes;
+  RowFunc         fetch;	/* gets the rows of the unsmoothed image */
+  void           *arg;
+  unsigned short *sums;		/* row sums of 3 rows of each pass */
+  int            *y;		/* which row each holds, -1 for none */
+  byte           *row;		/* row being summed */
+};
 
-  tmp= expandtotrue(src);
-  if (src != tmp && src != isrc)
-    freeImage(src);
-  src = tmp;
+Smoother *newSmoother(unsigned int width, unsigned int height,
+		      unsigned int passes, RowFunc fetch, void *arg)
+{ Smoother     *s;
+  unsigned int  a;
 
-  dest= newTrueImage(src->width, src->height);
-  dest->title= (char *)lmalloc(strlen(src->title) + 12);
-  sprintf(dest->title, "%s (smoothed)", src->title);
-  dest->gamma= src->gamma;
+  s= (Smoother *)lmalloc(sizeof(Smoother));
+  s->width= width;
+  s->height= height;
+  s->passes= passes;
+  s->fetch= fetch;
+  s->arg= arg;
+  s->sums= (unsigned short *)lmalloc(passes * 3 * width * 3 *
+				     sizeof(unsigned short));
+  s->y= (int *)lmalloc(passes * 3 * sizeof(int));
+  for (a= 0; a < passes * 3; a++)
+    s->y[a]= -1;
+  s->row= lmalloc(width * 3);
+  return(s);
+}
 
-  /* run through src and take a guess as to what the color should
-   * actually be.
+void freeSmoother(Smoother *s)
+{
+  lfree((byte *)s->sums);
+  lfree((byte *)s->y);
+  lfree(s->row);
+  lfree((byte *)s);
+}
+
+/* average three rows of row sums into a row of pixels
+ */
+
+static void sumColumns(unsigned short *prev, unsigned short *cur,
+		       unsigned short *next, byte *dp, unsigned int n)
+{ unsigned int x;
+
+  for (x= 0; x < n; x++)
+    dp[x]= (prev[x] + cur[x] + next[x] + 8) / 9;
+}
+
+static unsigned short *passSums(Smoother *s, unsigned int pass,
+				unsigned int y);
+
+/* make row y after the given number of passes
+ */
+
+static void passRow(Smoother *s, unsigned int pass, unsigned int y, byte *dp)
+{ unsigned short *prev, *cur, *next;
+
+  if (!pass) {
+    s->fetch(s->arg, y, dp);
+    return;
+  }
+
+  /* rows y - 1 .. y + 1 are all in different slots, so getting one
+   * doesn't lose another
    */
 
-  destptr= dest->data;
-  linelen= src->pixlen * src->width;
-  if(dest->pixlen == 3 && src->pixlen == 3) {	/* usual case */
-    for (y= 0; y < src->height; y++) {
-      yindex[1]= src->data + (y * linelen);
-      yindex[0]= yindex[1] - (y > 0 ? linelen : 0);
-      yindex[2]= yindex[1] + (y < src->height - 1 ? linelen : 0);
-      for (x= 0; x < src->width; x++) {
-        avgred= avggreen= avgblue= 0;
-        xindex[1]= x * 3;
-        xindex[0]= xindex[1] - (x > 0 ? 3 : 0);
-        xindex[2]= xindex[1] + (x < src->width - 1 ? 3 : 0);
-        for (y1= 0; y1 < 3; y1++) {
-          for (x1= 0; x1 < 3; x1++) {
-            srcptr = yindex[y1] + xindex[x1];
-            avgred += *srcptr;
-            avggreen += *(srcptr + 1);
-            avgblue += *(srcptr + 2);
-          }
-        }
-  
-        /* average the pixel values
-         */
-  
-        *destptr++ = ((avgred + 8) / 9);
-        *destptr++ = ((avggreen + 8) / 9);
-        *destptr++ = ((avgblue + 8) / 9);
-      }
-    }
-  } else {	/* less usual */
-    Pixel  pixval;
-    for (y= 0; y < src->height; y++) {
-      yindex[1]= src->data + (y * linelen);
-      yindex[0]= yindex[1] - (y > 0 ? linelen : 0);
-      yindex[2]= yindex[1] + (y < src->height - 1 ? linelen : 0);
-      for (x= 0; x < src->width; x++) {
-        avgred= avggreen= avgblue= 0;
-        xindex[1]= x * src->pixlen;
-        xindex[0]= xindex[1] - (x > 0 ? src->pixlen : 0);
-        xindex[2]= xindex[1] + (x < src->width - 1 ? src->pixlen : 0);
-        for (y1= 0; y1 < 3; y1++) {
-          for (x1= 0; x1 < 3; x1++) {
-            pixval= memToVal(yindex[y1] + xindex[x1], src->pixlen);
-            avgred += TRUE_RED(pixval);
-            avggreen += TRUE_GREEN(pixval);
-            avgblue += TRUE_BLUE(pixval);
-          }
-        }
-  
-        /* average the pixel values
-         */
-  
-        avgred= ((avgred + 8) / 9);
-        avggreen= ((avggreen + 8) / 9);
-        avgblue= ((avgblue + 8) / 9);
-        pixval= (avgred << 16) | (avggreen << 8) | avgblue;
-        valToMem(pixval, destptr, dest->pixlen);
-        destptr += dest->pixlen;
-      }
+  prev= passSums(s, pass - 1, y > 0 ? y - 1 : y);
+  cur= passSums(s, pass - 1, y);
+  next= passSums(s, pass - 1, y < s->height - 1 ? y + 1 : y);
+  sumColumns(prev, cur, next, dp, s->width * 3);
+}
+
+/* get the row sums of row y after the given number of passes, making
+ * them (and the rows they need) if they aren't already to hand.  each
+ * pixel's sum is of it and the pixels either side, the edge pixels
+ * standing in for the ones beyond the edges.
+ */
+
+static unsigned short *passSums(Smoother *s, unsigned int pass,
+				unsigned int y)
+{ unsigned int    slot= pass * 3 + y % 3;
+  unsigned int    n= s->width * 3, x;
+  unsigned short *sums= s->sums + slot * n;
+  byte           *row= s->row;
+
+  if (s->y[slot] == y)
+    return(sums);
+  passRow(s, pass, y, row);
+  if (s->width == 1)
+    for (x= 0; x < 3; x++)
+      sums[x]= row[x] * 3;
+  else {
+    for (x= 0; x < 3; x++) {
+      sums[x]= row[x] * 2 + row[x + 3];
+      sums[n - 3 + x]= row[n - 6 + x] + row[n - 3 + x] * 2;
     }
+    for (x= 3; x < n - 3; x++)
+      sums[x]= row[x - 3] + row[x] + row[x + 3];
   }
-  if (src != isrc)	/* Free possible intermediate image */
-    freeImage(src);
-  return(dest);
+  s->y[slot]= y;
+  return(sums);
+}
+
+/* make row y of the smoothed image as true color
+ */
+
+void smoothedRow(Smoother *s, unsigned int y, byte *dp)
+{
+  passRow(s, s->passes, y, dp);
+}
+
+/* smooth a band of rows of src into dest
+ */
+
+typedef struct {
+  Image        *src, *dest;
+  unsigned int  passes;
+} SmoothJob;
+
+/* get a row of the source image as true color
+ */
+
+static void fetchTrueRow(void *arg, unsigned int y, byte *dp)
+{ Image        *src= ((SmoothJob *)arg)->src;
+  unsigned int  x;
+  byte         *srcptr;
+  Pixel         pixval;
+
+  srcptr= src->data + y * src->width * src->pixlen;
+  if (src->pixlen == 3)	/* usual case */
+    bcopy(srcptr, dp, src->width * 3);
+  else	/* less usual */
+    for (x= 0; x < src->width; x++) {
+      pixval= memToVal(srcptr, src->pixlen);
+      *dp++= TRUE_RED(pixval);
+      *dp++= TRUE_GREEN(pixval);
+      *dp++= TRUE_BLUE(pixval);
+      srcptr += src->pixlen;
+    }
+}
+
+static void smoothBand(void *arg, unsigned int ystart, unsigned int yend)
+{ SmoothJob *job= (SmoothJob *)arg;
+  Image     *dest= job->dest;
+  Smoother  *s;
+  unsigned int y;
+
+  s= newSmoother(dest->width, dest->height, job->passes, fetchTrueRow, job);
+  for (y= ystart; y < yend; y++)
+    smoothedRow(s, y, dest->data + y * dest->width * 3);
+  freeSmoother(s);
 }
 
 Image *smooth(Image *isrc, int iterations, int verbose)
-{ int a;
-  Image *src=isrc,*tmp;
+{ Image *src=isrc, *dest;
+  SmoothJob job;
+  char  *title;
+  int    a;
+
+  if (iterations <= 0)
+    return(src);
 
   if(GAMMA_NOT_EQUAL(src->gamma, 1.0))
     gammacorrect(src, 1.0, verbose);
@@ -115,15 +190,34 @@ Image *smooth(Image *isrc, int iterations, int verbose)
     fflush(stdout);
   }
 
+  /* build true color image from old image and allocate new image
+   */
+
+  src= expandtotrue(isrc);
+  dest= newTrueImage(src->width, src->height);
+  title= dupString(src->title);
   for (a= 0; a < iterations; a++) {
-    tmp= doSmooth(src);
-    if(src != tmp && src != isrc)	/* free imtermediate image */
-      freeImage(src);
-    src= tmp;
+    dest->title= (char *)lmalloc(strlen(title) + 12);
+    sprintf(dest->title, "%s (smoothed)", title);
+    lfree((byte *)title);
+    title= dest->title;
   }
+  dest->gamma= src->gamma;
+
+  /* run through src and take a guess as to what the color should
+   * actually be.
+   */
+
+  job.src= src;
+  job.dest= dest;
+  job.passes= iterations;
+  runBands(dest->height, smoothBand, &job);
+
+  if (src != isrc)	/* Free possible intermediate image */
+    freeImage(src);
 
   if (verbose)
     printf("done\n");
 
-  return(src);
+  return(dest);
 }
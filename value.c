@@ -14,27 +14,18 @@
 #include "copyright.h"
 #include "xli.h"
 
-/* this flips all the bits in a byte array at byte intervals
+/* this flips all the bits in a byte array at byte intervals.  the table
+ * is built by the compiler so that it's ready to use from any thread.
  */
 
-void flipBits(byte *p, unsigned int len)
-{ static int init= 0;
-  static byte flipped[256];
-
-  if (!init) {
-    int a, b;
-    byte norm;
+#define FLIP2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define FLIP4(n) FLIP2(n), FLIP2(n + 2 * 16), FLIP2(n + 1 * 16), FLIP2(n + 3 * 16)
+#define FLIP6(n) FLIP4(n), FLIP4(n + 2 * 4), FLIP4(n + 1 * 4), FLIP4(n + 3 * 4)
 
-    for (a= 0; a < 256; a++) {
-      flipped[a]= 0;
-      norm= a;
-      for (b= 0; b < 8; b++) {
-	flipped[a]= (flipped[a] << 1) | (norm & 1);
-	norm >>= 1;
-      }
-    }
-  }
+static byte flipped[256]= { FLIP6(0), FLIP6(2), FLIP6(1), FLIP6(3) };
 
+void flipBits(byte *p, unsigned int len)
+{
   while (len--)
     p[len]= flipped[p[len]];
 }
@@ -16,9 +16,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <sys/types.h>
-#if defined(linux)
 #include <sys/time.h>
-#endif
 #if (defined(SYSV) || defined(SVR4)) && !defined(__hpux) && !defined(_CRAY)
 #include <stropts.h>
 #include <poll.h>
@@ -30,9 +28,25 @@
 static Window ImageWindow = 0;
 static Window ViewportWin = 0;
 static Colormap ImageColormap;
+static XImageInfo *Tiled = NULL;	/* image being drawn in tiles, if any */
 
 static int AlarmWentOff = 0;
 
+/* an animation being played in the image window.  each frame is sent to
+ * the server once, as a pixmap, and playing it is just a matter of making
+ * each one the window's background in turn.
+ */
+
+static struct {
+	int count;		/* # of frames, 0 if not animating */
+	Pixmap *pixmaps;	/* frames */
+	unsigned int *delays;	/* how long to show each, in 1/100ths sec */
+	int current;		/* frame being shown */
+	int plays;		/* plays left, including this one; 0 for ever */
+	boolean playing;	/* FALSE once the last play is over */
+	struct timeval next;	/* when the next frame is due */
+} Anim;
+
 static void delayAlarmHandler(int sig_no)
 {
 	AlarmWentOff = 1;
@@ -44,10 +58,16 @@ static void delayAlarmHandler(int sig_no)
  * of pictures. The amount of wait time is specified using the -delay
  * option, which is the number of seconds to pause between pictures.
  * - mfc 90/10/08
+ *
+ * if deadline isn't NULL, this also gives up waiting once that time is
+ * reached.  returns 1 if there's an event, 0 if the alarm went off and
+ * -1 if the deadline passed.
  */
 
-static int getNextEventWithTimeout(Display *disp, XEvent *event)
+static int getNextEventWithTimeout(Display *disp, XEvent *event,
+	struct timeval *deadline)
 {
+	struct timeval now, left;
 
 #if (defined(SYSV) || defined(SVR4)) && !defined(__hpux) && !defined(_CRAY)
 	struct pollfd pfd[1];
@@ -69,16 +89,30 @@ static int getNextEventWithTimeout(Display *disp, XEvent *event)
 			XNextEvent(disp, event);
 			return (1);
 		}
+		if (deadline) {
+			gettimeofday(&now, NULL);
+			left.tv_sec = deadline->tv_sec - now.tv_sec;
+			left.tv_usec = deadline->tv_usec - now.tv_usec;
+			if (left.tv_usec < 0) {
+				left.tv_sec--;
+				left.tv_usec += 1000000;
+			}
+			if (left.tv_sec < 0 ||
+			    (left.tv_sec == 0 && left.tv_usec == 0))
+				return (-1);
+		}
 #if (defined(SYSV) || defined(SVR4)) && !defined(__hpux) && !defined(_CRAY)
 		pfd[0].fd = ConnectionNumber(disp);
 		pfd[0].events = POLLIN;
-		poll(pfd, 1, -1L);	/* use very long timeout */
+		/* use very long timeout unless there's a deadline */
+		poll(pfd, 1, deadline ? left.tv_sec * 1000 +
+			(left.tv_usec + 999) / 1000 : -1L);
 		switch (pfd[0].revents) {
 #else
 		FD_ZERO(&rmask);
 		FD_SET(ConnectionNumber(disp), &rmask);
 		nfound = select(ConnectionNumber(disp) + 1, &rmask,
-		  (fd_set *) 0, (fd_set *) 0, /*(struct timeval *) */ 0);
+		  (fd_set *) 0, (fd_set *) 0, deadline ? &left : 0);
 		switch (nfound) {
 #endif
 		case -1:
@@ -93,6 +127,125 @@ static int getNextEventWithTimeout(Display *disp, XEvent *event)
 	return (0);
 }
 
+/* add 1/100ths of a second to a time */
+static void addDelay(struct timeval *tv, unsigned int delay)
+{
+	tv->tv_sec += delay / 100;
+	tv->tv_usec += (delay % 100) * 10000;
+	if (tv->tv_usec >= 1000000) {
+		tv->tv_sec++;
+		tv->tv_usec -= 1000000;
+	}
+}
+
+static void stopAnimation(Display *disp)
+{
+	int a;
+
+	for (a = 0; a < Anim.count; a++)
+		if (Anim.pixmaps[a] != None)
+			XFreePixmap(disp, Anim.pixmaps[a]);
+	if (Anim.pixmaps) {
+		lfree((byte *) Anim.pixmaps);
+		lfree((byte *) Anim.delays);
+	}
+	Anim.pixmaps = NULL;
+	Anim.delays = NULL;
+	Anim.count = 0;
+	Anim.playing = FALSE;
+}
+
+/* send every frame of an animation to the server as a pixmap, the first
+ * from the XImage that's already been made of it.  returns the first
+ * frame's pixmap, or None if they can't all be made, in which case the
+ * animation is shown as a still of its first frame.
+ */
+
+static Pixmap startAnimation(Display *disp, int scrn, Visual *visual,
+	unsigned int depth, Image *image, unsigned int private_cmap,
+	ImageOptions *options, XImageInfo *xii)
+{
+	Image *frame;
+	XImageInfo *fxii;
+	ProfileMark mark;
+	int a;
+
+	for (a = 0, frame = image; frame; frame = frame->next, a++)
+		if (frame->width != image->width ||
+		    frame->height != image->height)
+			return (None);
+	Anim.count = a;
+	Anim.pixmaps = (Pixmap *) lmalloc(a * sizeof(Pixmap));
+	Anim.delays = (unsigned int *) lmalloc(a * sizeof(unsigned int));
+	for (a = 0; a < Anim.count; a++)
+		Anim.pixmaps[a] = None;
+
+	for (a = 0, frame = image; frame; frame = frame->next, a++) {
+		Anim.delays[a] = frame->delay;
+		if (!a) {
+			Anim.pixmaps[a] = ximageToPixmap(disp, ImageWindow, xii);
+		} else {
+			profileStart(&mark, frame);
+			if (!(fxii = imageToXImage(disp, scrn, visual, depth,
+					frame, private_cmap, globals.fit,
+					options, FALSE)))
+				break;
+			profileStage(&mark, "imageToXImage", frame);
+			Anim.pixmaps[a] = ximageToPixmap(disp, ImageWindow,
+				fxii);
+			if (fxii->cmap != xii->cmap &&
+			    fxii->cmap != DefaultColormap(disp, scrn) &&
+			    fxii->cmap != globals.dinfo.direct_cmap)
+				XFreeColormap(disp, fxii->cmap);
+			freeXImage(frame, fxii);
+		}
+		if (Anim.pixmaps[a] == None)
+			break;
+	}
+	if (a < Anim.count) {
+		stopAnimation(disp);
+		xii->drawable = ImageWindow;
+		return (None);
+	}
+	if (globals.verbose)
+		printf("  Playing %d frames\n", Anim.count);
+	Anim.current = 0;
+	Anim.plays = image->loops;
+	Anim.playing = TRUE;
+	return (Anim.pixmaps[0]);
+}
+
+/* show the next frame of the animation and work out when the one after
+ * it is due.  if the frames have fallen behind, the timing starts again
+ * from now rather than hurrying to catch up.
+ */
+
+static void nextFrame(Display *disp)
+{
+	struct timeval now;
+
+	if (++Anim.current == Anim.count) {
+		Anim.current = 0;
+		if (Anim.plays > 0)
+			Anim.plays--;
+	}
+	XSetWindowBackgroundPixmap(disp, ImageWindow,
+		Anim.pixmaps[Anim.current]);
+	XClearWindow(disp, ImageWindow);
+	if (Anim.current == Anim.count - 1 && Anim.plays == 1) {
+		Anim.playing = FALSE;
+		return;
+	}
+
+	addDelay(&Anim.next, Anim.delays[Anim.current]);
+	gettimeofday(&now, NULL);
+	if (Anim.next.tv_sec < now.tv_sec || (Anim.next.tv_sec ==
+	    now.tv_sec && Anim.next.tv_usec < now.tv_usec)) {
+		Anim.next = now;
+		addDelay(&Anim.next, Anim.delays[Anim.current]);
+	}
+}
+
 static void setCursor(Display *disp, Window window, unsigned int iw, unsigned int ih, unsigned int ww, unsigned int wh, Cursor *cursor)
 {
 	XSetWindowAttributes swa;
@@ -110,9 +263,13 @@ static void setCursor(Display *disp, Window window, unsigned int iw, unsigned in
 	*cursor = swa.cursor;
 }
 
+static void blitTiles(XImageInfo *ximageinfo, unsigned int width, unsigned int height, int pixx, int pixy, int x, int y, int w, int h);
+
 /*
  * place an image - ie. constain it to be as
  * visible as possible in the window, then move it there.
+ * a tiled image doesn't have a window of its own to move,
+ * so it's redrawn in its new place instead.
  */
 
 static void placeImage(Display *disp, int width, int height, int winwidth, int winheight, int *rx, int *ry)
@@ -141,9 +298,14 @@ static void placeImage(Display *disp, int width, int height, int winwidth, int w
 		if (pixy > 0)
 			pixy = 0;
 	}
+	if (Tiled) {
+		if (pixx != *rx || pixy != *ry)
+			blitTiles(Tiled, width, height, pixx, pixy,
+				0, 0, winwidth, winheight);
+	} else
+		XMoveWindow(disp, ImageWindow, pixx, pixy);
 	*rx = pixx;
 	*ry = pixy;
-	XMoveWindow(disp, ImageWindow, pixx, pixy);
 }
 
 /* blit an image
@@ -178,6 +340,28 @@ static void blitImage(XImageInfo *ximageinfo, unsigned int width, unsigned int h
 	sendXImage(ximageinfo, x, y, x, y, w, h);
 }
 
+/* blit part of the window showing a tiled image, which has its top left
+ * corner at pixx, pixy in the window.
+ */
+
+static void blitTiles(XImageInfo *ximageinfo, unsigned int width, unsigned int height, int pixx, int pixy, int x, int y, int w, int h)
+{
+	int x0, y0, x1, y1;
+
+	/* the part of the area that the image covers */
+	x0 = x > pixx ? x : pixx;
+	y0 = y > pixy ? y : pixy;
+	x1 = x + w < pixx + (int) width ? x + w : pixx + (int) width;
+	y1 = y + h < pixy + (int) height ? y + h : pixy + (int) height;
+	if (x0 >= x1 || y0 >= y1) {
+		XClearArea(ximageinfo->disp, ximageinfo->drawable, x, y, w, h, FALSE);
+		return;
+	}
+	if (x0 > x || y0 > y || x1 < x + w || y1 < y + h)
+		XClearArea(ximageinfo->disp, ximageinfo->drawable, x, y, w, h, FALSE);
+	sendTiles(ximageinfo, x0 - pixx, y0 - pixy, x0, y0, x1 - x0, y1 - y0);
+}
+
 /* clean up static window if we're through with it
  */
 
@@ -198,9 +382,12 @@ void cleanUpWindow(DisplayInfo *dinfo)
 static void cleanUpImage(Display *disp, int scrn, Cursor cursor, Pixmap pixmap, Image *image, XImageInfo *ximageinfo)
 {
 	XFreeCursor(disp, cursor);
-	if (pixmap != None)
+	if (Anim.count)
+		stopAnimation(disp);	/* pixmap is its first frame */
+	else if (pixmap != None)
 		XFreePixmap(disp, pixmap);
 	freeXImage(image, ximageinfo);
+	Tiled = NULL;
 }
 
 /* this sets the colormap and WM_COLORMAP_WINDOWS properly for the
@@ -439,6 +626,50 @@ static void bestVisualOfClass(Display *disp, int scrn, Image *image, int visual_
 	*rdepth = depth;
 }
 
+/* pick the visual an image will be displayed with.  this is also used
+ * by newDirectImage(), which has to know the visual before the image is
+ * loaded.
+ */
+
+void chooseVisual(Display *disp, int scrn, Image *image, Visual **rvisual,
+	unsigned int *rdepth, boolean verbose)
+{
+	Visual *visual;
+	unsigned int depth;
+
+	/* if the user told us to fit the colormap, we must use the default
+	 * visual.
+	 */
+
+	if (globals.fit) {
+		visual = DefaultVisual(disp, scrn);
+		depth = DefaultDepth(disp, scrn);
+	} else {
+
+		visual = (Visual *) 0;
+		if (globals.visual_class == -1) {
+			/* try to pick the best visual for the image. */
+
+			bestVisual(disp, scrn, image, &visual, &depth);
+			if (verbose && (visual != DefaultVisual(disp, scrn)))
+				printf("  Using %s visual\n", nameOfVisualClass(visual->class));
+		} else {
+			/* try to find a visual of the specified class */
+
+			bestVisualOfClass(disp, scrn, image,
+				globals.visual_class, &visual, &depth);
+			if (!visual) {
+				bestVisual(disp, scrn, image, &visual, &depth);
+				fprintf(stderr, "Server does not support %s visual, using %s\n",
+				 nameOfVisualClass(globals.visual_class),
+					nameOfVisualClass(visual->class));
+			}
+		}
+	}
+	*rvisual = visual;
+	*rdepth = depth;
+}
+
 char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int argc, char **argv)
 {
 	Display *disp = dinfo->disp;
@@ -475,6 +706,8 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 	} event;
 	int winx, winy, winwidth, winheight;
 	int user_geometry;
+	boolean tiled;
+	ProfileMark mark;
 
 	oldimagewindow = None;
 	oldcmap = None;
@@ -510,36 +743,7 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 		}
 	}
 
-	/* if the user told us to fit the colormap, we must use the default
-	 * visual.
-	 */
-
-	if (globals.fit) {
-		visual = DefaultVisual(disp, scrn);
-		depth = DefaultDepth(disp, scrn);
-	} else {
-
-		visual = (Visual *) 0;
-		if (globals.visual_class == -1) {
-			/* try to pick the best visual for the image. */
-
-			bestVisual(disp, scrn, image, &visual, &depth);
-			if (globals.verbose && (visual != DefaultVisual(disp,
-					scrn)))
-				printf("  Using %s visual\n", nameOfVisualClass(visual->class));
-		} else {
-			/* try to find a visual of the specified class */
-
-			bestVisualOfClass(disp, scrn, image,
-				globals.visual_class, &visual, &depth);
-			if (!visual) {
-				bestVisual(disp, scrn, image, &visual, &depth);
-				fprintf(stderr, "Server does not support %s visual, using %s\n",
-				 nameOfVisualClass(globals.visual_class),
-					nameOfVisualClass(visual->class));
-			}
-		}
-	}
+	chooseVisual(disp, scrn, image, &visual, &depth, globals.verbose);
 
 	/* if we're in slideshow mode and the user told us to fit the colormap,
 	 * free it here.
@@ -560,11 +764,15 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 		else if (!options->gray && !BITMAPP(image))
 			private_cmap = 1;
 	}
+	/* a huge image is drawn in tiles, as they come into view */
+	tiled = wantTiles(disp, scrn, image->width, image->height);
+	profileStart(&mark, image);
 	if (!(xii = imageToXImage(disp, scrn, visual, depth, image,
-			private_cmap, globals.fit, options))) {
+			private_cmap, globals.fit, options, tiled))) {
 		fprintf(stderr, "Cannot convert Image to XImage\n");
 		exit(1);
 	}
+	profileStage(&mark, "imageToXImage", image);
 	swa_view.background_pixel = WhitePixel(disp, scrn);
 	swa_view.backing_store = NotUseful;
 	swa_view.cursor = XCreateFontCursor(disp, XC_watch);
@@ -603,15 +811,20 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 		paint = 1;
 	}
 
-	/* create image window */
+	/* create image window.  if the image is tiled, the window just
+	 * covers the viewport and the image is drawn into it at pixx, pixy.
+	 */
 
 	swa_img.bit_gravity = NorthWestGravity;
 	swa_img.save_under = FALSE;
 	swa_img.colormap = xii->cmap;
 	swa_img.border_pixel = 0;
 	swa_img.event_mask = KeyPressMask;	/* (Some systems need this) */
-	ImageWindow = XCreateWindow(disp, ViewportWin, winx, winy,
-		image->width, image->height, 0, xii->depth, InputOutput, visual,
+	ImageWindow = XCreateWindow(disp, ViewportWin,
+		tiled ? 0 : winx, tiled ? 0 : winy,
+		tiled ? winwidth : image->width,
+		tiled ? winheight : image->height,
+		0, xii->depth, InputOutput, visual,
 		CWBitGravity | CWColormap | CWSaveUnder | CWBorderPixel
 		| CWEventMask, &swa_img);
 	ImageColormap = xii->cmap;
@@ -627,12 +840,20 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 	 * exposures to blit the image (which is ugly but it works).
 	 *
 	 * the "use_pixmap" flag forces background pixmap mode, which may
-	 * improve performance.
+	 * improve performance.  an animation always uses background pixmaps,
+	 * one for each frame, if the visual can show all the frames at once.
 	 */
 
 	xii->drawable = ImageWindow;
-	if ((DoesBackingStore(ScreenOfDisplay(disp, scrn)) == NotUseful &&
-	     xii->shm.shmid < 0) || globals.use_pixmap) {
+	if (tiled)
+		Tiled = xii;
+	else if (image->next && (visual->class == TrueColor ||
+			visual->class == DirectColor))
+		pixmap = startAnimation(disp, scrn, visual, depth, image,
+			private_cmap, options, xii);
+	if (!tiled && pixmap == None &&
+	    ((DoesBackingStore(ScreenOfDisplay(disp, scrn)) == NotUseful &&
+	     xii->shm.shmid < 0) || globals.use_pixmap)) {
 		if (((pixmap = ximageToPixmap(disp, ImageWindow, xii)) ==
 		     None) && globals.verbose)
 			printf("  Cannot create image in server, repaints will be ugly!\n");
@@ -725,7 +946,8 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 	XMapWindow(disp, ImageWindow);
 	XMapWindow(disp, ViewportWin);
 	if (oldimagewindow) {
-		if (oldcmap && (oldcmap != DefaultColormap(disp, scrn)))
+		if (oldcmap && (oldcmap != DefaultColormap(disp, scrn)) &&
+				(oldcmap != dinfo->direct_cmap))
 			XFreeColormap(disp, oldcmap);
 		XDestroyWindow(disp, oldimagewindow);
 	}
@@ -737,7 +959,10 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 		if ((winwidth != old_width) || (winheight != old_height)) {
 			XResizeWindow(disp, ViewportWin, winwidth, winheight);
 		}
-		XResizeWindow(disp, ImageWindow, image->width, image->height);
+		if (tiled)
+			XResizeWindow(disp, ImageWindow, winwidth, winheight);
+		else
+			XResizeWindow(disp, ImageWindow, image->width, image->height);
 		/* Clear the image window.  Ask for exposure if there is no tile. */
 		XClearArea(disp, ImageWindow, 0, 0, 0, 0, (pixmap == None));
 	}
@@ -752,15 +977,31 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 	setCursor(disp, ViewportWin, image->width, image->height,
 		  winwidth, winheight, &(swa_view.cursor));
 	lastx = lasty = -1;
+
+	/* the image is up, so get on with loading the next ones */
+	startPrefetch();
+
 	if (delay > 0) {
 		/* reset alarm to -delay seconds after every event */
 		AlarmWentOff = 0;
 		signal(SIGALRM, delayAlarmHandler);
 		alarm(delay);
 	}
+	if (Anim.count) {
+		AlarmWentOff = 0;
+		gettimeofday(&Anim.next, NULL);
+		addDelay(&Anim.next, Anim.delays[0]);
+	}
 	for (;;) {
-		if (delay > 0) {
-			if (!getNextEventWithTimeout(disp, &event.event)) {
+		if (delay > 0 || (delay < 0 && Anim.playing)) {
+			int got = getNextEventWithTimeout(disp, &event.event,
+				Anim.playing ? &Anim.next : NULL);
+
+			if (got < 0) {
+				nextFrame(disp);
+				continue;
+			}
+			if (!got) {
 				Cursor cursor = swa_view.cursor;
 
 				/* timeout expired.  clean up and exit.
@@ -898,6 +1139,8 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 		case ConfigureNotify:
 			winwidth = old_width = event.configure.width;
 			winheight = old_height = event.configure.height;
+			if (tiled)
+				XResizeWindow(disp, ImageWindow, winwidth, winheight);
 
 			placeImage(disp, image->width, image->height, winwidth, winheight,
 				   &pixx, &pixy);
@@ -914,9 +1157,14 @@ char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options, int
 			return ('\0');
 
 		case Expose:
-			blitImage(xii, image->width, image->height,
-				  event.expose.x, event.expose.y,
-				event.expose.width, event.expose.height);
+			if (tiled)
+				blitTiles(xii, image->width, image->height,
+					pixx, pixy, event.expose.x, event.expose.y,
+					event.expose.width, event.expose.height);
+			else
+				blitImage(xii, image->width, image->height,
+					event.expose.x, event.expose.y,
+					event.expose.width, event.expose.height);
 			break;
 
 		case EnterNotify:
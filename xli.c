@@ -52,6 +52,7 @@ static byte root_weave_bits[] =
     istr.gray = FALSE;		\
     istr.iscale = 0;		\
     istr.iscale_auto = FALSE;	\
+    istr.direct = FALSE;	\
     istr.merge = FALSE;		\
     istr.normalize = FALSE;	\
     istr.rotate = 0;		\
@@ -70,11 +71,44 @@ static int scentre(unsigned tspan, unsigned sspan)
 	return ((int) tspan - (int) sspan) / 2;
 }
 
+/* write an image to the -output file, putting its number in place of any
+ * %d in the name.  gives up if it can't be written.
+ */
+static void outputImage(Image *image, ImageOptions *io, int n)
+{
+	char name[BUFSIZ], *d;
+	ProfileMark mark;
+
+	if ((d = strstr(globals.output, "%d")))
+		snprintf(name, sizeof(name), "%.*s%d%s",
+			(int) (d - globals.output), globals.output, n, d + 2);
+	else
+		snprintf(name, sizeof(name), "%s", globals.output);
+	profileStart(&mark, image);
+	if (!writeImage(image, io, name, globals.verbose))
+		exit(1);
+	profileStage(&mark, "writeImage", image);
+	profileReport(image->title);
+}
+
+/* a plain image that was decoded straight into its XImage wasn't cached
+ * when it was loaded.  get its pixels back out of the XImage, which gives
+ * exactly what was decoded, and cache them so that re-rendering it after
+ * a gamma or rotate key doesn't decode the file again.
+ */
+static void cacheDirectImage(ImageOptions *io, Image *image)
+{
+	if (!(image->flags & FLAG_DIRECT))
+		return;
+	undirectImage(image);
+	cacheImage(io, image);
+}
+
 int main(int argc, char *argv[])
 {
 	Image *idisp;
 	ImageOptions *images;
-	int maximages, nimages, i, first, dir;
+	int maximages, nimages, i, first, dir, noutput = 0;
 	unsigned int winwidth, winheight;
 	ImageOptions persist_ops;
 	char switchval;
@@ -167,6 +201,12 @@ int main(int argc, char *argv[])
 	globals.set_default = FALSE;
 	globals.user_geometry = NULL;
 	globals.visual_class = -1;
+	globals.prefetch = 0;
+	globals.prefetch_memory = DEFAULT_PREFETCH_MEMORY;
+	globals.threads = 0;
+	globals.output = NULL;
+	globals.screen_size = NULL;
+	globals.profile = FALSE;
 	winwidth = winheight = 0;
 
 	nimages = 0;
@@ -240,14 +280,31 @@ int main(int argc, char *argv[])
 	if (!nimages && !globals.set_default)
 		exit(0);
 
+	/* images loaded in the background would muddle the timings */
+	if (globals.profile)
+		globals.prefetch = 0;
+
 	if (globals.identify) {	/* identify the named image(s) */
 		for (i = 0; i < nimages; i++)
 			identifyImage(images[i].name);
 		exit(0);
 	}
 
-	/* start talking to the display */
-	if (!xliOpenDisplay(&globals.dinfo, globals.dname)) {
+	/* start talking to the display, or make one up if the images are
+	 * going to files
+	 */
+	if (globals.output) {
+		if (!xliNullDisplay(&globals.dinfo, globals.screen_size,
+				globals.visual_class)) {
+			printf("Bad argument to -screensize\n");
+			usage(argv[0]);
+		}
+		if (globals.set_default) {
+			fprintf(stderr, "%s: -default needs a display (ignored)\n",
+				globals.argv0);
+			globals.set_default = FALSE;
+		}
+	} else if (!xliOpenDisplay(&globals.dinfo, globals.dname)) {
 		fprintf(stderr, "%s: Cannot open display '%s'\n",
 			globals.argv0, xliDisplayName(globals.dname));
 		exit(1);
@@ -296,6 +353,8 @@ int main(int argc, char *argv[])
 	for (i = 0; i < nimages; i += dir) {
 		ImageOptions *io;
 		Image *inew, *itmp;
+		boolean cache;
+		ProfileMark mark;
 
 		if (i < 0) {
 			dir = 1;
@@ -303,56 +362,24 @@ int main(int argc, char *argv[])
 		}
 
 		io = &images[i];
-		if (io->iscale) {
-			io->xzoom = io->yzoom = io->iscale < 0 ? 
-				100 << -io->iscale : 100 >> io->iscale;
-		}
-
-		if (!(inew = loadImage(io, globals.verbose)))
+		if (!(inew = prefetchedImage(i))) {
+			/* keep the decoded image around if it is going
+			 * to be viewed on its own, so that re-rendering
+			 * it after a rotate, gamma or scale change
+			 * doesn't have to decode it all over again.
+			 */
+			cache = !globals.onroot && !globals.output &&
+				!io->merge &&
+				!((i + 1 < nimages) && images[i + 1].merge);
+			inew = prepareImage(io, first < 0, cache, NULL,
+				globals.verbose);
+		} else if (globals.verbose)
+			printf("%s is prefetched\n", io->fullname);
+		if (!inew)
 			continue;
 
 		first = (first < 0);
 
-		if (inew->flags & FLAG_ISCALE)
-			io->xzoom = io->yzoom = 0;
-
-		if (io->gamma != UNSET_GAMMA)
-			inew->gamma = io->gamma;
-		else if (UNSET_GAMMA == inew->gamma)
-			defaultgamma(inew);
-
-		/* Process any other options that need doing here */
-		if (io->border) {
-			xliParseXColor(&globals.dinfo, io->border,
-				&io->bordercol);
-			xliGammaCorrectXColor(&io->bordercol,
-				DEFAULT_DISPLAY_GAMMA);
-		}
-
-		/*
-		 * if first image and we're putting it on the root window
-		 * in fullscreen mode, set zoom factors to something reasonable
-		 */
-
-		if ( (first || globals.forall) && 
-			      ((globals.onroot && globals.fullscreen) ||
-				globals.fillscreen) && !io->xzoom &&
-				!io->yzoom && !io->center) {
-			double wr, hr;
-
-			wr = (double) globals.dinfo.width / inew->width;
-			hr = (double) globals.dinfo.height / inew->height;
-			io->xzoom = io->yzoom = (((wr < hr) ^
-				(globals.onroot && globals.fillscreen)) ?
-				wr : hr) * 100 + 0.5;
-		}
-
-		itmp = processImage(&globals.dinfo, inew, io);
-		if (itmp != inew)
-			freeImage(inew);
-
-		inew = itmp;
-
 		if (idisp) {
 			if (io->center) {
 				io->atx = scentre(idisp->width, inew->width);
@@ -362,11 +389,18 @@ int main(int argc, char *argv[])
 				idisp->title = dupString(inew->title);
 				idisp->gamma = inew->gamma;
 			}
+			/* only the first frames of animations are merged */
+			freeImage(idisp->next);
+			idisp->next = NULL;
+			freeImage(inew->next);
+			inew->next = NULL;
+			profileStart(&mark, inew);
 			itmp = merge(idisp, inew, io->atx, io->aty, io);
 			if (idisp != itmp) {
 				freeImage(idisp);
 				idisp = itmp;
 			}
+			profileStage(&mark, "merge", idisp);
 			freeImage(inew);
 			inew = idisp;
 		}
@@ -391,7 +425,8 @@ int main(int argc, char *argv[])
 				aty = scentre(winheight, inew->height);
 			}
 			/* use clip to put border around image */
-			itmp = clip(inew, -atx, -aty, winwidth, winheight, io);
+			itmp = clip(inew, -atx, -aty, winwidth, winheight, io,
+				globals.verbose);
 			if (itmp != inew) {
 				freeImage(inew);
 				inew = itmp;
@@ -409,9 +444,19 @@ int main(int argc, char *argv[])
 				(images[i + 1].merge)))
 			continue;
 
+		if (globals.output) {
+			outputImage(idisp, io, ++noutput);
+			freeImage(idisp);
+			idisp = 0;
+			continue;
+		}
+
 		dir = 1;
+		setPrefetchPosition(images, nimages, i);
 		switchval = imageInWindow(&globals.dinfo, idisp, io,
 			argc, argv);
+		stopPrefetch();
+		profileReport(idisp->title);
 
 		switch (switchval) {
 		/* window got nuked by someone */
@@ -433,6 +478,7 @@ int main(int argc, char *argv[])
 				if (unlink(io->fullname) < 0) {
 					perror(io->fullname);
 				} else {
+					flushImageCache();
 					fprintf(stderr, "Deleted %s\n",
 						io->fullname);
 				}
@@ -467,6 +513,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case '.':	/* re-load current image */
+			flushImageCache();
 			i--;
 			break;
 
@@ -483,6 +530,7 @@ int main(int argc, char *argv[])
 			/* change gamma same way as a command line option */
 			if (UNSET_GAMMA == io->gamma)
 				io->gamma = idisp->gamma;
+			cacheDirectImage(io, idisp);
 
 			switch (switchval) {
 				int l;
@@ -521,6 +569,7 @@ int main(int argc, char *argv[])
 		/* rotations */
 		case 'l':
 		case 'r':
+			cacheDirectImage(io, idisp);
 			switch (switchval) {
 			case 'l':
 				io->rotate -= 90;
@@ -580,8 +629,15 @@ int main(int argc, char *argv[])
 		idisp = 0;
 	}
 
-	if (idisp && globals.onroot)
-		imageOnRoot(&globals.dinfo, idisp, &images[nimages - 1]);
+	if (idisp && globals.onroot) {
+		if (globals.output)
+			outputImage(idisp, &images[nimages - 1], ++noutput);
+		else {
+			imageOnRoot(&globals.dinfo, idisp,
+				&images[nimages - 1]);
+			profileReport(idisp->title);
+		}
+	}
 	xliCloseDisplay(&globals.dinfo);
 	exit(0);
 }
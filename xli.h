@@ -38,11 +38,15 @@ typedef struct {
 	unsigned int clipw, cliph;
 	char *border;		/* Border colour used in clipping */
 	XColor bordercol;	/* X RGB of above */
-	boolean colordither;
-				/* true if color reduction is to dither image */
+	unsigned int colordither;
+				/* how color reduction is to dither image,
+				 * 0 or a DITHER_ method
+				 */
 	unsigned int colors;	/* max # of colors to use for this image */
 	int delay;		/* # of seconds delay before auto pic advance */
-	unsigned int dither;	/* true if image is to be dithered */
+	unsigned int dither;	/* how image is to be dithered to monochrome,
+				 * 0 or a DITHER_ method
+				 */
 	boolean expand;		/* true if image should be forced to
 				 * TrueColor depth
 				 */
@@ -67,6 +71,9 @@ typedef struct {
 				 * pixmaps */
 	int iscale;		/* image-dependent scaling factor */
 	boolean iscale_auto;	/* automatically iscale to fit on screen */
+	boolean direct;		/* TRUE if the loader may decode straight into
+				 * an XImage (see newDirectImage())
+				 */
 } ImageOptions;
 
 /* globals and global options
@@ -100,6 +107,15 @@ typedef struct {
 				/* window id to put image onto */
 	boolean delete;		/* enable deleting current image with 'x' */
 	boolean focus;		/* take keyboard focus when viewing in window */
+	int prefetch;		/* # of images either side to load ahead */
+	unsigned int prefetch_memory;
+				/* megabytes prefetched images may use */
+	int threads;		/* # of threads for image processing, 0 = auto */
+	char *output;		/* file to write images to instead of showing
+				 * them, NULL to show them */
+	char *screen_size;	/* -screensize of the display when writing to
+				 * a file */
+	boolean profile;	/* report the time each stage takes */
 } GlobalsRec;
 
 /* Global declarations */
@@ -108,6 +124,22 @@ extern GlobalsRec globals;
 
 #define CURRFUNC(aa) (globals.lastfunc = (aa))
 
+/* the default amount of memory that prefetched images may occupy,
+ * in megabytes.
+ */
+#define DEFAULT_PREFETCH_MEMORY 256
+
+/* ways of dithering an image, for the dither and colordither options.
+ * halftoning only makes monochrome images.
+ */
+#define DITHER_DIFFUSION 1	/* Floyd-Steinberg error diffusion */
+#define DITHER_HALFTONE 2	/* 4x4 halftone, blowing the image up */
+#define DITHER_ORDERED 3	/* thresholds from a Bayer matrix */
+#define DITHER_BLUENOISE 4	/* thresholds from a blue noise matrix */
+
+/* threshold matrices are this many pixels on a side */
+#define DITHER_MATRIX_SIZE 32
+
 /* Gamma correction stuff */
 
 /* the default target display gamma. This can be overridden on the
@@ -115,6 +147,10 @@ extern GlobalsRec globals;
  */
 #define DEFAULT_DISPLAY_GAMMA 2.2
 
+/* size of the display assumed when writing images to files */
+#define DEFAULT_SCREEN_WIDTH 1920
+#define DEFAULT_SCREEN_HEIGHT 1080
+
 /* the default IRGB image gamma. This can be overridden on the
  * command line.
  */
@@ -125,13 +161,6 @@ extern GlobalsRec globals;
 
 /* Cached/uudecoded/uncompressed file I/O structures. */
 
-struct cache {
-	byte *end;
-	byte buf[BUFSIZ];
-	struct cache *next;
-	boolean eof;
-};
-
 #define UULEN 128		/* uudecode buffer length */
 #define UUBODY 1		/* uudecode state - reading body of file */
 #define UUSKIP 2		/* uudecode state - skipping garbage */
@@ -142,10 +171,20 @@ typedef struct {
 	boolean nocache;	/* TRUE if caching has been disabled */
 	FILE *stream;		/* file input stream */
 	char *filename;		/* filename */
-	struct cache *data;	/* data cache */
-	struct cache *dataptr;	/* ptr to current cache block */
-	byte *bufptr;		/* ptr within current cache block */
-	byte *endptr;		/* ptr to end of current cache block */
+	byte *data;		/* data cache, contiguous */
+	unsigned long datalen;	/* # of bytes in data cache */
+	unsigned long datasize;	/* # of bytes allocated for data cache */
+	boolean mapped;		/* TRUE if data cache is the mmap()ed file */
+	boolean dataeof;	/* TRUE if data cache holds the whole file */
+	boolean direct;		/* TRUE if reading past the cache, uncached */
+	boolean opened;		/* TRUE between zopen() and zclose() */
+	struct zcodec *codec;	/* decompressor for the stream, or NULL */
+	void *cstate;		/* decompressor state */
+	byte *cbuf;		/* raw stream data read ahead */
+	byte *cnext;		/* next unused byte in cbuf */
+	unsigned long cavail;	/* # of unused bytes at cnext */
+	byte *bufptr;		/* ptr within current buffer */
+	byte *endptr;		/* ptr to end of current buffer */
 	byte *auxb;		/* non NULL if auxiliary buffer in use */
 	byte *oldbufptr;	/* save bufptr here when aux buffer is in use */
 	byte *oldendptr;	/* save endptr here when aux buffer is in use */
@@ -210,12 +249,15 @@ char *getenv(const char *);
 void supportedImageTypes(void);
 
 /* misc.c */
+Image *prepareImage(ImageOptions *io, boolean first, boolean cache,
+	Image **decoded, boolean verbose);
 char *tail(char *path);
 void memoryExhausted(void);
 void internalError(int sig);
 void version(void);
 void usage(char *name);
-Image *processImage(DisplayInfo *dinfo, Image *iimage, ImageOptions *options);
+Image *processImage(DisplayInfo *dinfo, Image *iimage, ImageOptions *options,
+	boolean verbose);
 int errorHandler(Display *disp, XErrorEvent *error);
 extern short LEHexTable[];	/* Little Endian conversion value */
 extern short BEHexTable[];	/* Big Endian conversion value */
@@ -243,6 +285,8 @@ void imageOnRoot(DisplayInfo *dinfo, Image *image, ImageOptions *options);
 void cleanUpWindow(DisplayInfo *dinfo);
 char imageInWindow(DisplayInfo *dinfo, Image *image, ImageOptions *options,
 	int argc, char **argv);
+void chooseVisual(Display *disp, int scrn, Image *image, Visual **rvisual,
+	unsigned int *rdepth, boolean verbose);
 
 /* options.c */
 int visualClassFromName(char *name);
@@ -250,24 +294,31 @@ char *nameOfVisualClass(int class);
 
 /* clip.c */
 Image *clip(Image *iimage, int clipx, int clipy, unsigned int clipw,
-	unsigned int cliph, ImageOptions *imgopp);
+	unsigned int cliph, ImageOptions *imgopp, unsigned int verbose);
+
+/* band.c */
+typedef void (*BandFunc) (void *arg, unsigned int y0, unsigned int y1);
+void runBands(unsigned int height, BandFunc func, void *arg);
 
 /* bright.c */
 void brighten(Image *image, unsigned int percent, unsigned int verbose);
 void gray(Image *image, int verbose);
 Image *normalize(Image *image, unsigned int verbose);
+Image *adjustImage(Image *image, boolean dogray, boolean donormalize,
+	unsigned int bright, unsigned int verbose);
 void gammacorrect(Image *image, float target_gam, unsigned int verbose);
 extern int gammamap[256];
 #define GAMMA16(color16) (gammamap[(color16)>>8]<<8)
 #define GAMMA8(color8) (gammamap[(color8)])
 #define GAMMA16to8(color16) (gammamap[(color16)>>8])
-void defaultgamma(Image *image);
+void defaultgamma(Image *image, unsigned int verbose);
 
 /* compress.c */
 void compress_cmap(Image *image, unsigned int verbose);
 
 /* dither.c */
-Image *dither(Image *cimage, unsigned int verbose);
+Image *dither(Image *cimage, unsigned int method, unsigned int verbose);
+void ditherMatrix(unsigned int method, unsigned short *matrix);
 
 /* fill.c */
 void fill(Image *image, unsigned int fx, unsigned int fy, unsigned int fw, unsigned int fh, Pixel pixval);
@@ -278,6 +329,8 @@ Image *halftone(Image *cimage, unsigned int verbose);
 /* imagetypes.c */
 Image *loadImage(ImageOptions *image_ops, boolean verbose);
 void identifyImage(char *name);
+void cacheImage(ImageOptions *image_ops, Image *image);
+void flushImageCache(void);
 
 /* merge.c */
 Image *merge(Image *idst, Image *isrc, int atx, int aty, ImageOptions *imgopp);
@@ -286,9 +339,11 @@ Image *merge(Image *idst, Image *isrc, int atx, int aty, ImageOptions *imgopp);
 extern unsigned long DepthToColorsTable[];
 unsigned long colorsToDepth(long unsigned int ncolors);
 char *dupString(char *s);
+Image *newImage(unsigned int width, unsigned int height);
 Image *newBitImage(unsigned int width, unsigned int height);
 Image *newRGBImage(unsigned int width, unsigned int height, unsigned int depth);
 Image *newTrueImage(unsigned int width, unsigned int height);
+Image *dupImage(Image *image);
 void freeImage(Image *image);
 void freeImageData(Image *image);
 void newRGBMapData(RGBMap *rgb, unsigned int size);
@@ -298,6 +353,7 @@ byte *lcalloc(unsigned int size);
 byte *lmalloc(unsigned int size);
 byte *lrealloc(byte *old, unsigned int size);
 void lfree(byte *area);
+void allocStats(unsigned long *count, unsigned long *bytes);
 
 /* options.c */
 void help(char *option);
@@ -311,9 +367,37 @@ void read_trail_opt(ImageOptions *image_ops, ZFILE *file, Image *image,
 /* rlelib.c */
 void make_gamma(double gamma, int *gammamap);
 
+/* output.c */
+boolean writeImage(Image *image, ImageOptions *options, char *name,
+	boolean verbose);
+
+/* pipeline.c */
+boolean canPipeline(Image *image, ImageOptions *options);
+Image *pipelineImage(Image *image, ImageOptions *options, boolean verbose);
+
+/* profile.c */
+typedef struct {
+	double wall, cpu;	/* when the stage started */
+	unsigned long allocs, bytes;
+	unsigned int width, height;	/* of the image it started with */
+} ProfileMark;
+void profileStart(ProfileMark *mark, Image *image);
+void profileStage(ProfileMark *mark, char *name, Image *image);
+boolean profileJSON(char *name);
+void profileReport(char *title);
+void jsonString(FILE *f, char *s);
+
+/* prefetch.c */
+void setPrefetchPosition(ImageOptions *images, int nimages, int current);
+void startPrefetch(void);
+void stopPrefetch(void);
+Image *prefetchedImage(int index);
+boolean prefetchCancelled(void);
+
 /* reduce.c */
 Image *reduce(Image *image, unsigned colors, int ditherf, float gamma,
 	int verbose);
+void flushReduceCache(void);
 Image *expandtotrue(Image *image);
 Image *expandbittoirgb(Image *image, int depth);
 Image *expandirgbdepth(Image *image, int depth);
@@ -326,11 +410,26 @@ void sendXImage(XImageInfo *xii, int src_x, int src_y, int dst_x, int dst_y,
 	unsigned int w, unsigned int h);
 XImageInfo *imageToXImage(Display *disp, int scrn, Visual *visual,
 	unsigned int ddepth, Image *image, unsigned int private_cmap,
-	unsigned int fit, ImageOptions *options);
+	unsigned int fit, ImageOptions *options, boolean tiled);
+boolean wantTiles(Display *disp, int scrn, unsigned int width,
+	unsigned int height);
+void sendTiles(XImageInfo *xii, int src_x, int src_y, int dst_x, int dst_y,
+	unsigned w, unsigned h);
 Pixmap ximageToPixmap(Display *disp, Window parent, XImageInfo *xii);
 void freeXImage(Image *image, XImageInfo *xii);
+Image *newDirectImage(unsigned int width, unsigned int height, float gamma);
+void directImageRows(Image *image, byte *rows, unsigned int y,
+	unsigned int nrows);
+void undirectImage(Image *image);
+void freeDirectImage(Image *image);
 
 /* smooth.c */
+typedef void (*RowFunc) (void *arg, unsigned int y, byte *row);
+typedef struct smoother Smoother;
+Smoother *newSmoother(unsigned int width, unsigned int height,
+	unsigned int passes, RowFunc fetch, void *arg);
+void smoothedRow(Smoother *s, unsigned int y, byte *dp);
+void freeSmoother(Smoother *s);
 Image *smooth(Image *isrc, int iterations, int verbose);
 
 /* value.c */
@@ -360,11 +459,34 @@ boolean _zreopen(ZFILE *zf);
 #define zgetc(zf) (((zf)->bufptr < (zf)->endptr) ? *(zf)->bufptr++ : _zgetc(zf))
 
 /* zoom.c */
+
+/* the source pixels that each pixel of a shrunk image is the average of:
+ * columns x0[x] up to x1[x] of rows y0[y] up to y1[y].  an axis that
+ * isn't being shrunk has one source column (or row) for each.
+ */
+typedef struct {
+	unsigned int width, height;	/* size of the zoomed image */
+	unsigned int *x0, *x1;
+	unsigned int *y0, *y1;
+	unsigned int xspan, yspan;	/* size of every span, 0 if they vary */
+} ZoomMap;
+
+unsigned int *zoomIndex(unsigned int width, unsigned int zoom,
+	unsigned int *rwidth);
+boolean zoomShrinks(unsigned int xzoom, unsigned int yzoom);
+ZoomMap *zoomMap(unsigned int width, unsigned int height,
+	unsigned int xzoom, unsigned int yzoom);
+void freeZoomMap(ZoomMap *map);
+void zoomRow(ZoomMap *map, Image *src, unsigned int clipx,
+	unsigned int clipy, unsigned int y, byte *dp);
+void zoomTitle(char *buf, char *title, unsigned int xzoom, unsigned int yzoom,
+	boolean verbose);
 Image *zoom(Image *oimage, unsigned int xzoom, unsigned int yzoom,
 	boolean verbose, boolean changetitle);
 
 /* ddxli.c */
 boolean xliOpenDisplay(DisplayInfo *dinfo, char *name);
+boolean xliNullDisplay(DisplayInfo *dinfo, char *size, int visual_class);
 void xliCloseDisplay(DisplayInfo *dinfo);
 void xliDefaultDispinfo(DisplayInfo *dinfo);
 int xliDefaultDepth(void);
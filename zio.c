@@ -22,9 +22,29 @@
 #include "xli.h"
 #include <ctype.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
 
 #ifdef VMS
 #define NO_UNCOMPRESS		/* VMS doesn't have uncompress */
+#define NO_MMAP			/* nor mmap() */
+#endif
+
+#ifndef NO_MMAP
+#include <sys/mman.h>
+#endif
+#include <zlib.h>
+#ifdef HAVE_BZLIB
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
 #endif
 
 /* ANSI C doesn't declare popen in stdio.h ! */
@@ -32,6 +52,8 @@ FILE *popen(const char *, const char *);
 
 #define MAX_ZFILES 32
 #define UUSTARTLEN 100		/* Lines to look though before assuming not uuencoded */
+#define ZMAGICLEN 6		/* longest compressed file magic number */
+#define ZCBUFSIZ 16384		/* compressed input buffer size */
 
 static int uuread(ZFILE *zf, byte *buf, int len);
 static int uugetline(ZFILE *zf, byte *obuf);
@@ -42,13 +64,57 @@ static int buflen(byte *buf, int len);
 static ZFILE ZFileTable[MAX_ZFILES];
 static boolean ZForceCache = FALSE;
 
+/* ZFileTable is shared by loaders running on different threads, so
+ * finding, claiming and freeing its entries is done under a lock.
+ */
+#ifndef NO_PTHREADS
+static pthread_mutex_t ZTableLock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_ZTABLE() pthread_mutex_lock(&ZTableLock)
+#define UNLOCK_ZTABLE() pthread_mutex_unlock(&ZTableLock)
+#else
+#define LOCK_ZTABLE()
+#define UNLOCK_ZTABLE()
+#endif
+
+/* make room in the data cache for at least len more bytes.  the cache
+ * grows geometrically so that caching a file is linear in its size.
+ */
+static void _zgrowcache(ZFILE *zf, unsigned long len)
+{
+	unsigned long size = zf->datasize ? zf->datasize : BUFSIZ;
+
+	if (zf->datalen + len <= zf->datasize)
+		return;
+	while (size < zf->datalen + len)
+		size *= 2;
+	zf->data = lrealloc(zf->data, size);
+	zf->datasize = size;
+}
+
+/* read another block of the file onto the end of the data cache and
+ * point the read buffer at it.  the block size grows with the cache.
+ */
+static void _zfillcache(ZFILE *zf)
+{
+	unsigned long len;
+	int got;
+
+	_zgrowcache(zf, BUFSIZ);
+	len = zf->datasize - zf->datalen;
+	got = uuread(zf, zf->data + zf->datalen, len);
+	zf->bufptr = zf->data + zf->datalen;
+	zf->datalen += got;
+	zf->endptr = zf->data + zf->datalen;
+	if (got < len)
+		zf->dataeof = TRUE;
+}
+
 int zread(ZFILE *zf, byte *buf, int len)
 {
 	int lentoread = len;
-	struct cache *dataptr = zf->dataptr;
 
 	while (len > 0 && !zf->eof) {
-		/* Read any data in cache buffers or aux buffer */
+		/* Read any data in cache buffer or aux buffer */
 		if (zf->bufptr < zf->endptr) {
 			int readlen = zf->endptr - zf->bufptr;
 			if (readlen > len)
@@ -71,71 +137,46 @@ int zread(ZFILE *zf, byte *buf, int len)
 			zf->endptr = zf->oldendptr;
 			continue;
 		}
-		/* If this is a newly opened file or we are */
-		/* no longer reading previously cached data */
-		if (dataptr == NULL) {
-			if (zf->nocache) {	/* If the cache is turned off, read directly */
-				if (len > 1) {	/* more than a byte being read */
-					len -= uuread(zf, buf, len);
-					if (len > 0)
-						zf->eof = TRUE;
-					continue;
-				}
-				/* else we are reading one byte directly - this is a little */
-				/* inefficient :-). Buffer it instead. */
-				zf->bufptr = zf->buf;
-				zf->endptr = zf->bufptr + uuread(zf, zf->bufptr, BUFSIZ);
-				if (zf->endptr == zf->bufptr)
-					zf->eof = TRUE;
-				continue;
-			}
-			/* else fall through to deal with first cached buffered read */
-		} else {	/* we must move on to the next cache buffer */
-			if (zf->bufptr == NULL) {	/* If this is a first re-read of the cache */
-				zf->bufptr = dataptr->buf;	/* init the pointers */
-				zf->endptr = dataptr->end;
+
+		if (!zf->direct) {
+			/* If this is a first re-read of the cache, */
+			/* start from its beginning */
+			if (zf->bufptr == NULL && zf->datalen > 0) {
+				zf->bufptr = zf->data;
+				zf->endptr = zf->data + zf->datalen;
 				continue;
 			}
-			/* If there are more buffers, then advance */
-			/* to the next one */
-			if (dataptr->next != NULL) {
-				/* advance to the next buffer */
-				dataptr = zf->dataptr = dataptr->next;
-				zf->bufptr = dataptr->buf;
-				zf->endptr = dataptr->end;
+			/* We have come to the end of the cache */
+			if (zf->dataeof) {
+				zf->eof = TRUE;
 				continue;
 			}
-			/* There are no more buffers */
-			if (dataptr->eof) {
-				zf->eof = TRUE;		/* we know that was the last one */
+			/* If the cache is off, switch it fully */
+			/* out of the picture from now on */
+			if (zf->nocache) {
+				zf->direct = TRUE;
+				zf->bufptr = NULL;
+				zf->endptr = NULL;
 				continue;
 			}
+			/* We are caching and have to read more */
+			_zfillcache(zf);
+			continue;
 		}
 
-		/* We have come to the end of the cache buffers or */
-		/* we are doing the first cached read. */
-
-		/* If the cache is off, switch it fully */
-		/* out of the picture from now on */
-		if (zf->nocache) {	/* read directly */
-			zf->dataptr = dataptr = NULL;
-			zf->bufptr = NULL;
-			zf->endptr = NULL;
+		/* The cache is turned off, read directly */
+		if (len > 1) {	/* more than a byte being read */
+			len -= uuread(zf, buf, len);
+			if (len > 0)
+				zf->eof = TRUE;
 			continue;
 		}
-		/* We are caching and have to read another buffer or maybe we have */
-		/* to read the very first buffer (zf->data and dataptr == NULL) */
-		zf->dataptr = (struct cache *) lmalloc(sizeof(struct cache));
-		zf->dataptr->next = NULL;
-		zf->dataptr->eof = FALSE;
-		if (zf->data == NULL)	/* If very first read */
-			zf->data = zf->dataptr;		/* set to first allocated buffer */
-		else		/* link buffer into chain */
-			dataptr->next = zf->dataptr;
-		dataptr = zf->dataptr;
-		zf->bufptr = dataptr->buf;
-		zf->endptr = dataptr->end = zf->bufptr + uuread(zf, zf->bufptr, BUFSIZ);
-		dataptr->eof = ((zf->endptr - zf->bufptr) < BUFSIZ);
+		/* else we are reading one byte directly - this is a little */
+		/* inefficient :-). Buffer it instead. */
+		zf->bufptr = zf->buf;
+		zf->endptr = zf->bufptr + uuread(zf, zf->bufptr, BUFSIZ);
+		if (zf->endptr == zf->bufptr)
+			zf->eof = TRUE;
 	}
 	return (lentoread - len);
 }
@@ -146,32 +187,482 @@ int zread(ZFILE *zf, byte *buf, int len)
 /*  maintaining cache data) */
 static void _zaptocache(ZFILE *zf, char *cbuf, int blen)
 {
-	struct cache *newdat, *dat;
-	int len;
-	while (blen > 0) {	/* until we've stashed all of input */
-		len = blen;
-		if (len > BUFSIZ)
-			len = BUFSIZ;
-
-		/* create new cache data block */
-		newdat = (struct cache *) lmalloc(sizeof(struct cache));
-		bcopy(cbuf, newdat->buf, len);
-		newdat->end = newdat->buf + len;
-		newdat->next = NULL;
-		newdat->eof = FALSE;
-
-		/* append it to cache buffers */
-		if (zf->data == NULL) {		/* nothing read yet */
-			zf->data = newdat;
-			zf->dataptr = zf->data;
+	_zgrowcache(zf, blen);
+	bcopy(cbuf, zf->data + zf->datalen, blen);
+	zf->datalen += blen;
+}
+
+/* throw away the data cache */
+static void _zfreecache(ZFILE *zf)
+{
+#ifndef NO_MMAP
+	if (zf->mapped)
+		munmap((void *) zf->data, zf->datasize);
+	else
+#endif
+	if (zf->data)
+		lfree(zf->data);
+	zf->data = NULL;
+	zf->datalen = zf->datasize = 0;
+	zf->mapped = FALSE;
+	zf->dataeof = FALSE;
+}
+
+#ifndef NO_MMAP
+/* map a regular file into memory to use as its data cache */
+static void _zmapcache(ZFILE *zf)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(fileno(zf->stream), &st) < 0 || !S_ISREG(st.st_mode) ||
+			st.st_size <= 0 || st.st_size != (size_t) st.st_size)
+		return;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		fileno(zf->stream), 0);
+	if (map == MAP_FAILED)
+		return;
+	zf->data = (byte *) map;
+	zf->datalen = zf->datasize = st.st_size;
+	zf->mapped = TRUE;
+	zf->dataeof = TRUE;
+}
+#endif
+
+/* Compressed files.
+ *
+ * compressed files are recognised by their magic number rather than by
+ * their name, and are decompressed as they are read, so the data cache
+ * holds the uncompressed data.  formats we can't decompress ourselves
+ * are handed to an external program through a pipe.
+ */
+
+struct zcodec {
+	char *name;		/* name of compression format */
+	char *magic;		/* magic number at start of file */
+	int magiclen;		/* # of bytes in magic number */
+	boolean (*init) (ZFILE *zf);
+	int (*read) (ZFILE *zf, byte *buf, int len);
+	void (*end) (ZFILE *zf);
+	char *cmd;		/* pipe through this if there's no init */
+};
+
+/* read from the stream, starting with any data that has been read ahead */
+static int _zrawread(ZFILE *zf, byte *buf, int len)
+{
+	int cl, ld = 0;
+
+	if (zf->cavail > 0) {
+		ld = zf->cavail < len ? zf->cavail : len;
+		bcopy(zf->cnext, buf, ld);
+		zf->cnext += ld;
+		zf->cavail -= ld;
+	}
+	if (zf->type == ZSTANDARD)
+		return ld + fread(buf + ld, 1, len - ld, zf->stream);
+
+	/* Work around for SVR4 fread() bug */
+	while (ld < len) {
+		ld += cl = fread(buf + ld, 1, len - ld, zf->stream);
+		if (feof(zf->stream) || ferror(zf->stream))
+			break;
+	}
+	return ld;
+}
+
+/* make sure there is some compressed data ready for the decompressor.
+ * return FALSE at the end of the stream.
+ */
+static boolean _zrawfill(ZFILE *zf)
+{
+	if (zf->cavail == 0) {
+		zf->cavail = _zrawread(zf, zf->cbuf, ZCBUFSIZ);
+		zf->cnext = zf->cbuf;
+	}
+	return zf->cavail > 0;
+}
+
+static void _zcodecerror(ZFILE *zf, char *msg)
+{
+	fprintf(stderr, "zread: %s: %s data: %s\n", zf->filename,
+		zf->codec->name, msg);
+}
+
+/* gzip, using zlib */
+
+typedef struct {
+	z_stream zs;
+	boolean done;
+} GzState;
+
+static boolean gzInit(ZFILE *zf)
+{
+	GzState *gz = (GzState *) lcalloc(sizeof(GzState));
+
+	if (inflateInit2(&gz->zs, 15 + 32) != Z_OK) {
+		lfree((byte *) gz);
+		return FALSE;
+	}
+	zf->cstate = (void *) gz;
+	return TRUE;
+}
+
+static int gzRead(ZFILE *zf, byte *buf, int len)
+{
+	GzState *gz = (GzState *) zf->cstate;
+	boolean more;
+	int got = 0, ret;
+
+	while (got < len && !gz->done) {
+		more = _zrawfill(zf);
+		gz->zs.next_in = zf->cnext;
+		gz->zs.avail_in = zf->cavail;
+		gz->zs.next_out = buf + got;
+		gz->zs.avail_out = len - got;
+		ret = inflate(&gz->zs, Z_NO_FLUSH);
+		zf->cnext = gz->zs.next_in;
+		zf->cavail = gz->zs.avail_in;
+		got = len - gz->zs.avail_out;
+		if (ret == Z_STREAM_END) {
+			/* a gzip file may be several members end to end */
+			if (_zrawfill(zf) && zf->cnext[0] == 0x1f)
+				inflateReset(&gz->zs);
+			else
+				gz->done = TRUE;
+		} else if (ret != Z_OK) {
+			_zcodecerror(zf, (ret == Z_BUF_ERROR && !more) ?
+				"unexpected EOF" : gz->zs.msg ? gz->zs.msg :
+				"corrupt");
+			gz->done = TRUE;
+		}
+	}
+	return got;
+}
+
+static void gzEnd(ZFILE *zf)
+{
+	GzState *gz = (GzState *) zf->cstate;
+
+	inflateEnd(&gz->zs);
+	lfree((byte *) gz);
+}
+
+#ifdef HAVE_BZLIB
+/* bzip2, using libbz2 */
+
+typedef struct {
+	bz_stream bs;
+	boolean live;		/* TRUE if bs needs ending */
+	boolean done;
+} BzState;
+
+static boolean bzInit(ZFILE *zf)
+{
+	BzState *bz = (BzState *) lcalloc(sizeof(BzState));
+
+	if (BZ2_bzDecompressInit(&bz->bs, 0, 0) != BZ_OK) {
+		lfree((byte *) bz);
+		return FALSE;
+	}
+	bz->live = TRUE;
+	zf->cstate = (void *) bz;
+	return TRUE;
+}
+
+static int bzRead(ZFILE *zf, byte *buf, int len)
+{
+	BzState *bz = (BzState *) zf->cstate;
+	boolean more;
+	int got = 0, ret;
+
+	while (got < len && !bz->done) {
+		more = _zrawfill(zf);
+		bz->bs.next_in = (char *) zf->cnext;
+		bz->bs.avail_in = zf->cavail;
+		bz->bs.next_out = (char *) buf + got;
+		bz->bs.avail_out = len - got;
+		ret = BZ2_bzDecompress(&bz->bs);
+		zf->cnext = (byte *) bz->bs.next_in;
+		zf->cavail = bz->bs.avail_in;
+		if (ret == BZ_STREAM_END) {
+			/* a bzip2 file may be several streams end to end */
+			BZ2_bzDecompressEnd(&bz->bs);
+			bz->live = FALSE;
+			if (_zrawfill(zf) && zf->cnext[0] == 'B' &&
+					BZ2_bzDecompressInit(&bz->bs, 0, 0) == BZ_OK)
+				bz->live = TRUE;
+			else
+				bz->done = TRUE;
+		} else if (ret != BZ_OK) {
+			_zcodecerror(zf, "corrupt");
+			bz->done = TRUE;
+		} else if (!more && (len - got) == bz->bs.avail_out) {
+			_zcodecerror(zf, "unexpected EOF");
+			bz->done = TRUE;
+		}
+		got = len - bz->bs.avail_out;
+	}
+	return got;
+}
+
+static void bzEnd(ZFILE *zf)
+{
+	BzState *bz = (BzState *) zf->cstate;
+
+	if (bz->live)
+		BZ2_bzDecompressEnd(&bz->bs);
+	lfree((byte *) bz);
+}
+#endif /* HAVE_BZLIB */
+
+#ifdef HAVE_LZMA
+/* xz, using liblzma */
+
+typedef struct {
+	lzma_stream ls;
+	boolean done;
+} XzState;
+
+static boolean xzInit(ZFILE *zf)
+{
+	XzState *xz = (XzState *) lcalloc(sizeof(XzState));
+	lzma_stream init = LZMA_STREAM_INIT;
+
+	xz->ls = init;
+	if (lzma_stream_decoder(&xz->ls, UINT64_MAX, LZMA_CONCATENATED) !=
+			LZMA_OK) {
+		lfree((byte *) xz);
+		return FALSE;
+	}
+	zf->cstate = (void *) xz;
+	return TRUE;
+}
+
+static int xzRead(ZFILE *zf, byte *buf, int len)
+{
+	XzState *xz = (XzState *) zf->cstate;
+	lzma_ret ret;
+	int got = 0;
+
+	while (got < len && !xz->done) {
+		lzma_action action = _zrawfill(zf) ? LZMA_RUN : LZMA_FINISH;
+
+		xz->ls.next_in = zf->cnext;
+		xz->ls.avail_in = zf->cavail;
+		xz->ls.next_out = buf + got;
+		xz->ls.avail_out = len - got;
+		ret = lzma_code(&xz->ls, action);
+		zf->cnext = (byte *) xz->ls.next_in;
+		zf->cavail = xz->ls.avail_in;
+		got = len - xz->ls.avail_out;
+		if (ret == LZMA_STREAM_END)
+			xz->done = TRUE;
+		else if (ret != LZMA_OK) {
+			_zcodecerror(zf, ret == LZMA_BUF_ERROR ?
+				"unexpected EOF" : "corrupt");
+			xz->done = TRUE;
+		}
+	}
+	return got;
+}
+
+static void xzEnd(ZFILE *zf)
+{
+	XzState *xz = (XzState *) zf->cstate;
+
+	lzma_end(&xz->ls);
+	lfree((byte *) xz);
+}
+#endif /* HAVE_LZMA */
+
+#ifdef HAVE_ZSTD
+/* zstd, using libzstd */
+
+typedef struct {
+	ZSTD_DStream *ds;
+	boolean framed;		/* TRUE at the end of a frame */
+	boolean done;
+} ZstdState;
+
+static boolean zstdInit(ZFILE *zf)
+{
+	ZstdState *zs = (ZstdState *) lcalloc(sizeof(ZstdState));
+
+	if (!(zs->ds = ZSTD_createDStream()) ||
+			ZSTD_isError(ZSTD_initDStream(zs->ds))) {
+		if (zs->ds)
+			ZSTD_freeDStream(zs->ds);
+		lfree((byte *) zs);
+		return FALSE;
+	}
+	zf->cstate = (void *) zs;
+	return TRUE;
+}
+
+static int zstdRead(ZFILE *zf, byte *buf, int len)
+{
+	ZstdState *zs = (ZstdState *) zf->cstate;
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	boolean more;
+	size_t ret;
+
+	out.dst = buf;
+	out.size = len;
+	out.pos = 0;
+	while (out.pos < out.size && !zs->done) {
+		size_t pos = out.pos;
+
+		more = _zrawfill(zf);
+		in.src = zf->cnext;
+		in.size = zf->cavail;
+		in.pos = 0;
+		ret = ZSTD_decompressStream(zs->ds, &out, &in);
+		zf->cnext += in.pos;
+		zf->cavail -= in.pos;
+		if (ZSTD_isError(ret)) {
+			_zcodecerror(zf, (char *) ZSTD_getErrorName(ret));
+			zs->done = TRUE;
+		} else if (in.pos > 0 || out.pos > pos)
+			zs->framed = (ret == 0);
+		else if (!more) {
+			if (!zs->framed)
+				_zcodecerror(zf, "unexpected EOF");
+			zs->done = TRUE;
+		}
+	}
+	return out.pos;
+}
+
+static void zstdEnd(ZFILE *zf)
+{
+	ZstdState *zs = (ZstdState *) zf->cstate;
+
+	ZSTD_freeDStream(zs->ds);
+	lfree((byte *) zs);
+}
+#endif /* HAVE_ZSTD */
+
+static struct zcodec ZCodecs[] = {
+	{"gzip", "\037\213", 2, gzInit, gzRead, gzEnd, NULL},
+#ifdef HAVE_BZLIB
+	{"bzip2", "BZh", 3, bzInit, bzRead, bzEnd, NULL},
+#else
+#if defined(HAVE_BUNZIP2) && !defined(NO_UNCOMPRESS)
+	{"bzip2", "BZh", 3, NULL, NULL, NULL, "bunzip2 -c "},
+#endif
+#endif /* HAVE_BZLIB */
+#ifdef HAVE_LZMA
+	{"xz", "\3757zXZ", 6, xzInit, xzRead, xzEnd, NULL},
+#endif
+#ifdef HAVE_ZSTD
+	{"zstd", "\050\265\057\375", 4, zstdInit, zstdRead, zstdEnd, NULL},
+#endif
+#ifndef NO_UNCOMPRESS
+	/* if your system doesn't have uncompress you can define
+	 * NO_UNCOMPRESS and it just won't check for this.
+	 */
+#ifdef HAVE_GUNZIP
+	{"compress", "\037\235", 2, NULL, NULL, NULL, "gunzip -c "},
+#else
+	{"compress", "\037\235", 2, NULL, NULL, NULL, "uncompress -c "},
+#endif
+#endif /* NO_UNCOMPRESS */
+	{NULL}
+};
+
+#ifndef NO_UNCOMPRESS
+/* replace the stream with a pipe from cmd run on the file */
+static boolean _zpopen(ZFILE *zf, char const *cmd)
+{
+	char *name = zf->filename;
+	char *buf, *s, *t;
+
+	/* protect in single quotes, replacing single quotes
+	 * with '"'"', so worst-case expansion is 5x
+	 */
+	buf = (char *) lmalloc(
+		strlen(cmd) + 1 + 5 * strlen(name) + 1 + 1);
+	strcpy(buf, cmd);
+	s = buf + strlen(buf);
+	*s++ = '\'';
+	for (t = name; *t; ++t) {
+		if ('\'' == *t) {
+			strcpy(s, "'\"'\"'");
+			s += strlen(s);
 		} else {
-			for (dat = zf->data; dat->next != NULL; dat = dat->next);	/* go to end of chain */
-			dat->next = newdat;
-			dat->eof = FALSE;
+			*s++ = *t;
 		}
-		cbuf += len;
-		blen -= len;
 	}
+	*s++ = '\'';
+	*s = '\0';
+
+	fclose(zf->stream);
+	zf->type = ZPIPE;
+	zf->stream = popen(buf, "r");
+	lfree(buf);
+	return zf->stream != NULL;
+}
+#endif /* NO_UNCOMPRESS */
+
+/* see if a newly opened file is compressed, and if so arrange for it
+ * to be decompressed.  return FALSE if the file can no longer be read.
+ */
+static boolean _zcompressed(ZFILE *zf)
+{
+	byte magic[ZMAGICLEN];
+	int len;
+	struct zcodec *codec;
+
+	/* take a look at the start of the file.  if it isn't mapped, keep
+	 * what we read for whoever reads the stream next.
+	 */
+	if (zf->mapped) {
+		len = zf->datalen < ZMAGICLEN ? zf->datalen : ZMAGICLEN;
+		bcopy(zf->data, magic, len);
+	} else {
+		zf->cbuf = lmalloc(ZCBUFSIZ);
+		zf->cnext = zf->cbuf;
+		zf->cavail = len = _zrawread(zf, zf->cbuf, ZMAGICLEN);
+		bcopy(zf->cbuf, magic, len);
+	}
+	for (codec = ZCodecs; codec->name; codec++)
+		if (len >= codec->magiclen &&
+				!memcmp(magic, codec->magic, codec->magiclen))
+			break;
+	if (!codec->name)
+		return TRUE;
+
+	if (!codec->init) {
+#ifndef NO_UNCOMPRESS
+		if (zf->type == ZSTANDARD) {
+			_zfreecache(zf);
+			zf->cavail = 0;
+			return _zpopen(zf, codec->cmd);
+		}
+#endif
+		fprintf(stderr, "zopen: %s: can't decompress %s data\n",
+			zf->filename, codec->name);
+		return TRUE;
+	}
+	zf->codec = codec;
+	if (!codec->init(zf)) {
+		fprintf(stderr, "zopen: %s: can't start %s decompression\n",
+			zf->filename, codec->name);
+		zf->codec = NULL;
+		return TRUE;
+	}
+
+	/* decompress from the stream rather than from the map, so that the
+	 * cache can hold the decompressed data.
+	 */
+	if (zf->mapped) {
+		_zfreecache(zf);
+		zf->cbuf = lmalloc(ZCBUFSIZ);
+		zf->cnext = zf->cbuf;
+		zf->cavail = 0;
+	}
+	return TRUE;
 }
 
 /* Return the files EOF status */
@@ -193,47 +684,56 @@ void zclearerr(ZFILE *zf)
 
 void zreset(char *filename)
 {
-	int a;
 	ZFILE *zf;
 
 	if (TRUE == ZForceCache)
 		return;
 
-	/* if NULL filename, reset the entire table
+	LOCK_ZTABLE();
+
+	/* if NULL filename, reset the entire table.  files that are still
+	 * open may be being read by another thread, so they're left alone.
 	 */
 	if (!filename) {
-		for (a = 0; a < MAX_ZFILES; a++)
-			if (ZFileTable[a].filename)
-				zreset(ZFileTable[a].filename);
+		for (zf = ZFileTable; zf < (ZFileTable + MAX_ZFILES); zf++)
+			if (zf->filename
+#ifndef NO_PTHREADS
+			    && !zf->opened
+#endif
+			    )
+				_zreset(zf);
+		UNLOCK_ZTABLE();
 		return;
 	}
 	for (zf = ZFileTable; zf < (ZFileTable + MAX_ZFILES); zf++)
 		if (zf->filename && !strcmp(filename, zf->filename))
 			break;
 
-	if (zf == (ZFileTable + MAX_ZFILES))	/* no go joe */
-		return;
-
-	_zreset(zf);
+	if (zf != (ZFileTable + MAX_ZFILES))	/* else no go joe */
+		_zreset(zf);
+	UNLOCK_ZTABLE();
 }
 
 /* reset by file descriptor */
 void _zreset(ZFILE *zf)
 {
-	struct cache *old;
-	if (zf->dataptr != zf->data)
+	if (zf->opened)
 		fprintf(stderr, "zreset: warning: ZFILE for %s was not closed properly\n",
 			zf->filename);
-	while (zf->data) {
-		old = zf->data;
-		zf->data = zf->data->next;
-		lfree((byte *) old);
-	}
+	_zfreecache(zf);
+	if (zf->codec)
+		zf->codec->end(zf);
+	zf->codec = NULL;
+	zf->cstate = NULL;
+	if (zf->cbuf)
+		lfree(zf->cbuf);
+	zf->cbuf = NULL;
+	zf->cavail = 0;
 	lfree((byte *) zf->filename);
 	zf->filename = NULL;
-	zf->data = NULL;
-	zf->dataptr = NULL;
 	zf->nocache = FALSE;
+	zf->direct = FALSE;
+	zf->opened = FALSE;
 	if (zf->auxb != NULL && zf->auxb != zf->buf)
 		lfree((byte *) zf->auxb);
 	zf->auxb = NULL;
@@ -261,58 +761,67 @@ void _zreset(ZFILE *zf)
 /* discard all data that has been read. Return to state just after file was opened */
 void _zclear(ZFILE *zf)
 {
-	struct cache *old;
-
 	if (zf->auxb != NULL && zf->auxb != zf->buf)
 		lfree(zf->auxb);
-
-	while (zf->data) {
-		old = zf->data;
-		zf->data = zf->data->next;
-		free(old);
-	}
+	_zfreecache(zf);
 	zf->auxb = NULL;
 	zf->bufptr = NULL;
 	zf->endptr = NULL;
 	zf->eof = FALSE;
-	zf->data = NULL;
-	zf->dataptr = NULL;
 	zf->nocache = FALSE;
+	zf->direct = FALSE;
 }
 
 ZFILE *zopen(char *name)
 {
 	ZFILE *zf;
 
-	/* look for filename in open file table
+	/* look for filename in open file table.  the table is locked while
+	 * an entry is found and marked as opened, so two threads can't claim
+	 * the same one, but not while a new file is being opened.
 	 */
 
+	LOCK_ZTABLE();
+
 	for (zf = ZFileTable; zf < (ZFileTable + MAX_ZFILES); zf++)
 		if (zf->filename && !strcmp(name, zf->filename)) {
 
+#ifndef NO_PTHREADS
+			/* a file that's open may be being read by another
+			 * thread, which needs it to itself.
+			 */
+			if (zf->opened)
+				continue;
+#endif
+
 			/* if we try to reopen a file whose caching was
 			 * disabled, warn the user and try to recover.
 			 * we cannot recover if it was stdin.
 			 */
 
-			if (zf->nocache) {
+			if (zf->nocache && !zf->dataeof) {
 				if (zf->type == ZSTDIN) {
 					fprintf(stderr, "zopen: caching was disabled by previous caller; can't reopen stdin\n");
+					UNLOCK_ZTABLE();
 					return (NULL);
 				}
 				fprintf(stderr, "zopen: warning: caching was disabled by previous caller\n");
-				zreset(zf->filename);	/* remove entry and treat like new open */
+				_zreset(zf);	/* remove entry and treat like new open */
 				break;
 			}
-			if (zf->dataptr != zf->data)
+#ifdef NO_PTHREADS
+			if (zf->opened)
 				fprintf(stderr, "zopen: warning: file doubly opened\n");
-			zf->dataptr = zf->data;		/* re-start with cache if it exists */
+#endif
+			zf->opened = TRUE;	/* re-start with cache if it exists */
+			zf->direct = FALSE;
 			if (zf->auxb != NULL && zf->auxb != zf->buf)
 				lfree((byte *) zf->auxb);
 			zf->auxb = NULL;
 			zf->bufptr = NULL;
 			zf->endptr = NULL;
 			zf->eof = FALSE;
+			UNLOCK_ZTABLE();
 			return (zf);
 		}
 	/* find unused ZFileTable entry
@@ -327,9 +836,14 @@ ZFILE *zopen(char *name)
 		exit(1);
 	}
 	zf->filename = dupString(name);
+	zf->opened = TRUE;	/* no-one else can have it now */
+	UNLOCK_ZTABLE();
 	if (!_zopen(zf)) {	/* failed */
+		LOCK_ZTABLE();
 		lfree(zf->filename);
 		zf->filename = NULL;
+		zf->opened = FALSE;
+		UNLOCK_ZTABLE();
 		return (NULL);
 	}
 	return (zf);
@@ -345,7 +859,14 @@ _zopen(ZFILE *zf)
 	int uumode, uutry = UUSTARTLEN;
 
 	zf->data = NULL;
-	zf->dataptr = NULL;
+	zf->datalen = zf->datasize = 0;
+	zf->mapped = FALSE;
+	zf->dataeof = FALSE;
+	zf->direct = FALSE;
+	zf->codec = NULL;
+	zf->cstate = NULL;
+	zf->cbuf = NULL;
+	zf->cavail = 0;
 	zf->auxb = NULL;
 	zf->bufptr = NULL;
 	zf->endptr = NULL;
@@ -360,85 +881,48 @@ _zopen(ZFILE *zf)
 		zf->type = ZSTDIN;
 		zf->stream = stdin;
 	} else {
-		char const *cmd = 0;
-
-#ifndef NO_UNCOMPRESS
-		/* if filename ends in `.Z' then open pipe to uncompress.  if
-		 * your system doesn't have uncompress you can define
-		 * NO_UNCOMPRESS and it just won't check for this.
-		 */
-
-#ifdef HAVE_GUNZIP
-		if (
-			(strlen(name) > 3 &&
-			!strcasecmp(".gz", name + strlen(name) - 3)) ||
-			(strlen(name) > 2 &&
-			!strcasecmp(".Z", name + strlen(name) - 2))
-		) {
-			cmd = "gunzip -c ";
-		}
-#else
-		/* it's a unix compressed file, so use uncompress */
-		if ((strlen(name) > (unsigned) 2) &&
-				!strcmp(".Z", name + (strlen(name) - 2))) {
-			cmd = "uncompress -c ";
-		}
-#endif /* HAVE_GUNZIP */
-#ifdef HAVE_BUNZIP2
-		if (strlen(name) > 4 &&
-				!strcasecmp(".bz2", name + strlen(name) - 4)) {
-			cmd = "bunzip2 -c ";
-		}
-#endif /* HAVE_BUNZIP2 */
-#endif /* NO_UNCOMPRESS */
-
-		if (cmd) {
-			char *buf, *s, *t;
-
-			/* protect in single quotes, replacing single quotes
-			 * with '"'"', so worst-case expansion is 5x
-	  		 */
-			buf = (char *) lmalloc(
-				strlen(cmd) + 1 + 5 * strlen(name) + 1 + 1);
-			strcpy(buf, cmd);
-			s = buf + strlen(buf);
-			*s++ = '\'';
-			for (t = name; *t; ++t) {
-				if ('\'' == *t) {
-					strcpy(s, "'\"'\"'");
-					s += strlen(s);
-				} else {
-					*s++ = *t;
-				}
-			}
-			*s++ = '\'';
-			*s = '\0';
-
-			zf->type = ZPIPE;
-			zf->stream = popen(buf, "r");
-			lfree(buf);
-		} else {
-			/* default to normal stream
-			 */
-			zf->type = ZSTANDARD;
+		zf->type = ZSTANDARD;
 #ifdef VMS
-			zf->stream = fopen(name, "r", "ctx=bin", "ctx=stm",
-				"rfm=stmlf");
+		zf->stream = fopen(name, "r", "ctx=bin", "ctx=stm",
+			"rfm=stmlf");
 #else
-			zf->stream = fopen(name, "r");
+		zf->stream = fopen(name, "r");
 #endif
-		}
 	}
 
 	if (!zf->stream) {
 		return (FALSE);
 	}
 
+#ifndef NO_MMAP
+	/* regular files are read straight out of memory */
+	if (zf->type == ZSTANDARD)
+		_zmapcache(zf);
+#endif
+
+	if (!_zcompressed(zf)) {
+		lfree(zf->cbuf);
+		zf->cbuf = NULL;
+		return (FALSE);
+	}
+	if (zf->codec || zf->type == ZPIPE)
+		return (TRUE);	/* don't look for uuencoding inside compression */
+
 	/* File is now open, so see if it is a uuencoded file */
 	while (uutry-- > 0) {
 		int blen;
-		if ((blen = fread(uuibuf, 1, UULEN, zf->stream)) > 0) {
+		if (zf->mapped) {
+			unsigned long uupos = (UUSTARTLEN - 1 - uutry) * UULEN;
+
+			blen = uupos < zf->datalen ? zf->datalen - uupos : 0;
+			if (blen > UULEN)
+				blen = UULEN;
+			bcopy(zf->data + uupos, uuibuf, blen);
+			if (blen > 0 && !strncmp(uuibuf, "begin ", 6))
+				fseek(zf->stream, uupos + blen, SEEK_SET);
+		} else if ((blen = _zrawread(zf, (byte *) uuibuf, UULEN)) > 0)
 			_zaptocache(zf, uuibuf, blen);	/* keep zfile data cached */
+		if (blen > 0) {
 			if (!strncmp(uuibuf, "begin ", 6)
 			    && isdigit(uuibuf[6])
 			    && isdigit(uuibuf[7])
@@ -579,13 +1063,16 @@ void zforcecache(boolean v)
 
 void zclose(ZFILE *zf)
 {
-	zf->dataptr = zf->data;
+	zf->direct = FALSE;
 	if (zf->auxb != NULL && zf->auxb != zf->buf)
 		lfree(zf->auxb);
 	zf->auxb = NULL;
 	zf->bufptr = NULL;
 	zf->endptr = NULL;
 	zf->eof = FALSE;
+	LOCK_ZTABLE();
+	zf->opened = FALSE;	/* another thread may have it now */
+	UNLOCK_ZTABLE();
 }
 
 /* close the file and then re-open it. */
@@ -595,11 +1082,18 @@ _zreopen(ZFILE *zf)
 {
 	char *tname;
 	tname = dupString(zf->filename);
+	LOCK_ZTABLE();
+	zf->opened = FALSE;
 	_zreset(zf);
 	zf->filename = tname;
+	zf->opened = TRUE;
+	UNLOCK_ZTABLE();
 	if (!_zopen(zf)) {	/* failed */
+		LOCK_ZTABLE();
 		lfree(zf->filename);
 		zf->filename = NULL;
+		zf->opened = FALSE;
+		UNLOCK_ZTABLE();
 		return (FALSE);
 	}
 	return (TRUE);
@@ -613,7 +1107,7 @@ _zreopen(ZFILE *zf)
 boolean
 zrewind(ZFILE *zf)
 {
-	if (zf->nocache) {
+	if (zf->nocache && !zf->dataeof) {
 		if (zf->type == ZSTDIN) {
 			fprintf(stderr, "zrewind: caching was disabled by previous caller; can't rewind\n");
 			return (FALSE);
@@ -621,7 +1115,7 @@ zrewind(ZFILE *zf)
 		fprintf(stderr, "zrewind: warning: caching was disabled by previous caller\n");
 		return !_zreopen(zf);
 	}
-	zf->dataptr = zf->data;
+	zf->direct = FALSE;
 	if (zf->auxb != NULL && zf->auxb != zf->buf)
 		lfree(zf->auxb);
 	zf->auxb = NULL;
@@ -636,19 +1130,9 @@ int uuread(ZFILE *zf, byte *buf, int len)
 {
 	int cl, ld = 0;
 	if (!zf->uudecode) {
-		if (zf->type == ZSTANDARD)
-			return fread(buf, 1, len, zf->stream);
-
-		/* Work around for SVR4 fread() bug */
-		for (;;) {
-			ld += cl = fread(buf, 1, len - ld, zf->stream);
-			if (ld == len)
-				break;
-			buf += cl;
-			if (feof(zf->stream))
-				break;
-		}
-		return ld;
+		if (zf->codec)
+			return zf->codec->read(zf, buf, len);
+		return _zrawread(zf, buf, len);
 	}
 	for (;;) {
 		if (zf->uunext >= zf->uuend) {	/* if buffer empty */
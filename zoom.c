@@ -11,98 +11,343 @@
 #include "copyright.h"
 #include "xli.h"
 
-static unsigned int *buildIndex(unsigned int width, unsigned int zoom, unsigned int *rwidth)
+/* if a zoom makes an image a whole number of times bigger or smaller,
+ * say how many times in *up or *down (the other one is 1)
+ */
+
+static boolean zoomFactor(unsigned int zoom, unsigned int *up,
+			  unsigned int *down)
+{
+  *up= *down= 1;
+  if (!zoom || zoom % 100 == 0)
+    *up= zoom ? zoom / 100 : 1;
+  else if (100 % zoom == 0)
+    *down= 100 / zoom;
+  else
+    return(FALSE);
+  return(TRUE);
+}
+
+/* build a table of which source column (or row) each column (or row)
+ * of the zoomed image comes from.  a zoom by a whole number of times
+ * repeats each source one that many times, or takes every so many.
+ */
+
+unsigned int *zoomIndex(unsigned int width, unsigned int zoom, unsigned int *rwidth)
 {
 	unsigned int *index;
-	unsigned int	a;
+	unsigned int	a, up, down;
 
 	if (!zoom) {
 		zoom = 100;
 	}
 	*rwidth = width * zoom / 100;
 	index= (unsigned int *)lmalloc(sizeof(unsigned int) * *rwidth);
-	for (a = 0; a < *rwidth; a++)
-		*(index + a) = a * (width - 1) / (*rwidth - 1);
+	if (zoomFactor(zoom, &up, &down))
+		for (a = 0; a < *rwidth; a++)
+			*(index + a) = a / up * down;
+	else
+		for (a = 0; a < *rwidth; a++)
+			*(index + a) = a * (width - 1) / (*rwidth - 1);
 		
 	return(index);
 }
 
-Image *zoom(Image *oimage, unsigned int xzoom, unsigned int yzoom, boolean verbose, boolean changetitle)
-{ char          buf[BUFSIZ];
-  float         gamma;
-  Image        *image;
-  unsigned int *xindex, *yindex;
-  unsigned int  xwidth, ywidth;
-  unsigned int  x, y, xsrc, ysrc;
-  unsigned int  pixlen;
-  unsigned int  srclinelen;
-  unsigned int  destlinelen;
-  byte         *srcline, *srcptr;
-  byte         *destline, *destptr;
-  byte          srcmask, destmask, bit;
-  Pixel         value;
+/* TRUE if either axis of an image is being shrunk
+ */
 
-  CURRFUNC("zoom");
+boolean zoomShrinks(unsigned int xzoom, unsigned int yzoom)
+{
+  return((xzoom && xzoom < 100) || (yzoom && yzoom < 100));
+}
 
-  image = 0;
-  if ((!xzoom || xzoom==100) && (!yzoom || yzoom==100)) 
-    return(oimage);
+/* work out which source columns (or rows) each column (or row) of the
+ * zoomed image comes from.  when shrinking they're split up evenly
+ * between the zoomed ones, and when not each zoomed one has one source
+ * one, as zoomIndex() picks.
+ */
 
-  if (!xzoom) {
-    if (verbose)
-      printf("  Zooming image Y axis by %d%%...", yzoom);
-    if (changetitle)
-      snprintf(buf, BUFSIZ, "%s (Y zoom %d%%)", oimage->title, yzoom);
+static void zoomAxis(unsigned int width, unsigned int zoom,
+		     unsigned int *rwidth, unsigned int **start,
+		     unsigned int **end, unsigned int *span)
+{ unsigned int a;
+
+  if (zoom && zoom < 100 && width * zoom / 100) {
+    *rwidth= width * zoom / 100;
+    *start= (unsigned int *)lmalloc(sizeof(unsigned int) * *rwidth);
+    *end= (unsigned int *)lmalloc(sizeof(unsigned int) * *rwidth);
+    for (a= 0; a < *rwidth; a++) {
+      (*start)[a]= (unsigned long)a * width / *rwidth;
+      (*end)[a]= (unsigned long)(a + 1) * width / *rwidth;
+    }
+    *span= (width % *rwidth ? 0 : width / *rwidth);
   }
-  else if (!yzoom) {
-    if (verbose)
-      printf("  Zooming image X axis by %d%%...", xzoom);
-    if (changetitle)
-      snprintf(buf, BUFSIZ, "%s (X zoom %d%%)", oimage->title, xzoom);
+  else {
+    *start= zoomIndex(width, zoom, rwidth);
+    *end= (unsigned int *)lmalloc(sizeof(unsigned int) * *rwidth);
+    for (a= 0; a < *rwidth; a++)
+      (*end)[a]= (*start)[a] + 1;
+    *span= 1;
   }
-  else if (xzoom == yzoom) {
-    if (verbose)
-      printf("  Zooming image by %d%%...", xzoom);
-    if (changetitle)
-      snprintf(buf, BUFSIZ, "%s (%d%% zoom)", oimage->title, xzoom);
+}
+
+ZoomMap *zoomMap(unsigned int width, unsigned int height,
+		 unsigned int xzoom, unsigned int yzoom)
+{ ZoomMap *map;
+
+  map= (ZoomMap *)lmalloc(sizeof(ZoomMap));
+  zoomAxis(width, xzoom, &map->width, &map->x0, &map->x1, &map->xspan);
+  zoomAxis(height, yzoom, &map->height, &map->y0, &map->y1, &map->yspan);
+  return(map);
+}
+
+void freeZoomMap(ZoomMap *map)
+{
+  lfree((byte *)map->x0);
+  lfree((byte *)map->x1);
+  lfree((byte *)map->y0);
+  lfree((byte *)map->y1);
+  lfree((byte *)map);
+}
+
+/* make row y of a shrunk image as true color, each pixel the average of
+ * the source pixels under it.  the source area starts at clipx, clipy.
+ */
+
+void zoomRow(ZoomMap *map, Image *src, unsigned int clipx,
+	     unsigned int clipy, unsigned int y, byte *dp)
+{ unsigned int  x, sx, sy, n, count;
+  unsigned int  pixlen= src->pixlen;
+  unsigned long linelen= (unsigned long)src->width * pixlen;
+  unsigned long red, green, blue;
+  byte         *line, *srcptr, *nextptr;
+  Pixel         pixval;
+
+  line= src->data + (clipy + map->y0[y]) * linelen;
+
+  /* halving both ways is the most common, so it's done on its own
+   */
+
+  if (TRUEP(src) && pixlen == 3 && map->xspan == 2 && map->yspan == 2) {
+    srcptr= line + clipx * 3;
+    nextptr= srcptr + linelen;
+    for (x= 0; x < map->width; x++) {
+      *dp++= (srcptr[0] + srcptr[3] + nextptr[0] + nextptr[3] + 2) >> 2;
+      *dp++= (srcptr[1] + srcptr[4] + nextptr[1] + nextptr[4] + 2) >> 2;
+      *dp++= (srcptr[2] + srcptr[5] + nextptr[2] + nextptr[5] + 2) >> 2;
+      srcptr += 6;
+      nextptr += 6;
+    }
+    return;
+  }
+
+  for (x= 0; x < map->width; x++) {
+    red= green= blue= 0;
+    n= map->x1[x] - map->x0[x];
+    for (sy= map->y0[y]; sy < map->y1[y]; sy++) {
+      srcptr= line + (sy - map->y0[y]) * linelen +
+	(clipx + map->x0[x]) * pixlen;
+      if (TRUEP(src) && pixlen == 3)	/* common */
+	for (sx= 0; sx < n; sx++) {
+	  red += srcptr[0];
+	  green += srcptr[1];
+	  blue += srcptr[2];
+	  srcptr += 3;
+	}
+      else if (pixlen == 1)
+	for (sx= 0; sx < n; sx++) {
+	  red += src->rgb.red[*srcptr] >> 8;
+	  green += src->rgb.green[*srcptr] >> 8;
+	  blue += src->rgb.blue[*srcptr] >> 8;
+	  srcptr++;
+	}
+      else	/* less common */
+	for (sx= 0; sx < n; sx++) {
+	  pixval= memToVal(srcptr, pixlen);
+	  if (TRUEP(src)) {
+	    red += TRUE_RED(pixval);
+	    green += TRUE_GREEN(pixval);
+	    blue += TRUE_BLUE(pixval);
+	  }
+	  else {
+	    red += src->rgb.red[pixval] >> 8;
+	    green += src->rgb.green[pixval] >> 8;
+	    blue += src->rgb.blue[pixval] >> 8;
+	  }
+	  srcptr += pixlen;
+	}
+    }
+    count= n * (map->y1[y] - map->y0[y]);
+    *dp++= (red + count / 2) / count;
+    *dp++= (green + count / 2) / count;
+    *dp++= (blue + count / 2) / count;
+  }
+}
+
+/* zoom a band of rows of oimage into image
+ */
+
+typedef struct {
+  Image        *oimage, *image;
+  unsigned int *xindex, *yindex;
+  ZoomMap      *map;		/* if shrinking */
+  unsigned int  xup, xdown;	/* whole number zoom factors, if they are */
+  unsigned int  yup;
+  byte         *table;		/* bitmap byte expansion or decimation */
+} ZoomJob;
+
+static void shrinkBand(void *arg, unsigned int y0, unsigned int y1)
+{ ZoomJob      *job= (ZoomJob *)arg;
+  unsigned int  y;
+
+  for (y= y0; y < y1; y++)
+    zoomRow(job->map, job->oimage, 0, 0, y,
+	    job->image->data + (unsigned long)y * job->image->width * 3);
+}
+
+/* make a table for zooming a bitmap by a whole number of times across,
+ * which turns each source byte into xup destination bytes or into 8 /
+ * xdown destination bits.
+ */
+
+static byte *bitZoomTable(unsigned int xup, unsigned int xdown)
+{ byte         *table;
+  unsigned int  v, i, bits;
+
+  if (xup > 1) {
+    table= (byte *)lcalloc(256 * xup);
+    for (v= 0; v < 256; v++)
+      for (i= 0; i < 8 * xup; i++)
+	if (v & (0x80 >> (i / xup)))
+	  table[v * xup + i / 8] |= 0x80 >> (i % 8);
   }
   else {
-    if (verbose)
-      printf("  Zooming image X axis by %d%% and Y axis by %d%%...",
-	     xzoom, yzoom);
-    if (changetitle)
-      snprintf(buf, BUFSIZ, "%s (X zoom %d%% Y zoom %d%%)", oimage->title,
-	    xzoom, yzoom);
+    table= (byte *)lmalloc(256);
+    bits= 8 / xdown;
+    for (v= 0; v < 256; v++) {
+      table[v]= 0;
+      for (i= 0; i < bits; i++)
+	table[v]= (table[v] << 1) | ((v >> (7 - i * xdown)) & 1);
+    }
   }
-  buf[BUFSIZ-1] = '\0';
-  if (!changetitle)
-    strcpy(buf,oimage->title);
+  return(table);
+}
 
-  if (verbose)
-    fflush(stdout);
-  gamma= oimage->gamma;
+/* zoom a band of rows of a bitmap by whole numbers of times, a byte at
+ * a time.  a row that repeats the one above is copied from it.
+ */
+
+static void bitFactorBand(void *arg, unsigned int y0, unsigned int y1)
+{ ZoomJob      *job= (ZoomJob *)arg;
+  Image        *oimage= job->oimage, *image= job->image;
+  unsigned int  xup= job->xup, xdown= job->xdown;
+  unsigned int  srclinelen= (oimage->width + 7) / 8;
+  unsigned int  destlinelen= (image->width + 7) / 8;
+  unsigned int  x, y, i, sx, bits= 8 / xdown;
+  byte         *srcline, *destline, *destend, *expand, b;
 
-  xindex= buildIndex(oimage->width, xzoom, &xwidth);
-  yindex= buildIndex(oimage->height, yzoom, &ywidth);
+  for (y= y0; y < y1; y++) {
+    destline= image->data + (unsigned long)y * destlinelen;
+    if (y > y0 && y % job->yup) {
+      bcopy(destline - destlinelen, destline, destlinelen);
+      continue;
+    }
+    srcline= oimage->data + (unsigned long)job->yindex[y] * srclinelen;
+    if (xup > 1) {
+      destend= destline + destlinelen;
+      for (x= 0; x < srclinelen; x++) {
+	expand= job->table + srcline[x] * xup;
+	for (i= 0; i < xup && destline < destend; i++)
+	  *destline++= expand[i];
+      }
+      destline= destend - destlinelen;
+    }
+    else if (xdown > 1)
+      for (x= 0; x < destlinelen; x++) {
+	b= 0;
+	for (i= 0; i < xdown; i++) {
+	  sx= x * xdown + i;
+	  b= (b << bits) | (sx < srclinelen ? job->table[srcline[sx]] : 0);
+	}
+	destline[x]= b;
+      }
+    else
+      bcopy(srcline, destline, destlinelen);
+    if (image->width % 8)	/* clear the padding */
+      destline[destlinelen - 1] &= 0xff << (8 - image->width % 8);
+  }
+}
+
+/* enlarge a band of rows of a color image by whole numbers of times,
+ * repeating each pixel across and copying each row down.
+ */
+
+static void factorBand(void *arg, unsigned int y0, unsigned int y1)
+{ ZoomJob      *job= (ZoomJob *)arg;
+  Image        *oimage= job->oimage, *image= job->image;
+  unsigned int  xup= job->xup, pixlen= image->pixlen;
+  unsigned long linelen= (unsigned long)image->width * pixlen;
+  unsigned int  x, y, i;
+  byte         *srcptr, *destptr, value;
+
+  for (y= y0; y < y1; y++) {
+    destptr= image->data + y * linelen;
+    if (y > y0 && y % job->yup) {
+      bcopy(destptr - linelen, destptr, linelen);
+      continue;
+    }
+    srcptr= oimage->data +
+      (unsigned long)job->yindex[y] * oimage->width * pixlen;
+    if (xup == 1)
+      bcopy(srcptr, destptr, linelen);
+    else if (pixlen == 1)	/* common */
+      for (x= 0; x < oimage->width; x++) {
+	value= *srcptr++;
+	for (i= 0; i < xup; i++)
+	  *destptr++= value;
+      }
+    else if (pixlen == 3)
+      for (x= 0; x < oimage->width; x++) {
+	for (i= 0; i < xup; i++) {
+	  destptr[0]= srcptr[0];
+	  destptr[1]= srcptr[1];
+	  destptr[2]= srcptr[2];
+	  destptr += 3;
+	}
+	srcptr += 3;
+      }
+    else	/* less common */
+      for (x= 0; x < oimage->width; x++) {
+	for (i= 0; i < xup; i++) {
+	  bcopy(srcptr, destptr, pixlen);
+	  destptr += pixlen;
+	}
+	srcptr += pixlen;
+      }
+  }
+}
+
+static void zoomBand(void *arg, unsigned int y0, unsigned int y1)
+{ ZoomJob      *job= (ZoomJob *)arg;
+  Image        *oimage= job->oimage, *image= job->image;
+  unsigned int *xindex= job->xindex, *yindex= job->yindex;
+  unsigned int  xwidth= image->width;
+  unsigned int  x, y, xsrc;
+  unsigned int  pixlen;
+  unsigned int  srclinelen;
+  unsigned int  destlinelen;
+  byte         *srcline, *srcptr;
+  byte         *destline, *destptr;
+  byte          srcmask, destmask, bit;
+  Pixel         value;
 
   switch (oimage->type) {
   case IBITMAP:
-    image= newBitImage(xwidth, ywidth);
-    for (x= 0; x < oimage->rgb.used; x++) {
-      *(image->rgb.red + x)= *(oimage->rgb.red + x);
-      *(image->rgb.green + x)= *(oimage->rgb.green + x);
-      *(image->rgb.blue + x)= *(oimage->rgb.blue + x);
-    }
-    image->rgb.used= oimage->rgb.used;
-    destline= image->data;
     destlinelen= (xwidth / 8) + (xwidth % 8 ? 1 : 0);
-    srcline= oimage->data;
     srclinelen= (oimage->width / 8) + (oimage->width % 8 ? 1 : 0);
-    for (y= 0, ysrc= *(yindex + y); y < ywidth; y++) {
-      while (ysrc != *(yindex + y)) {
-	ysrc++;
-	srcline += srclinelen;
-      }
+    destline= image->data + y0 * destlinelen;
+    for (y= y0; y < y1; y++) {
+      srcline= oimage->data + *(yindex + y) * srclinelen;
       srcptr= srcline;
       destptr= destline;
       srcmask= 0x80;
@@ -131,23 +376,11 @@ Image *zoom(Image *oimage, unsigned int xzoom, unsigned int yzoom, boolean verbo
     break;
 
   case IRGB:
-    image= newRGBImage(xwidth, ywidth, oimage->depth);
-    for (x= 0; x < oimage->rgb.used; x++) {
-      *(image->rgb.red + x)= *(oimage->rgb.red + x);
-      *(image->rgb.green + x)= *(oimage->rgb.green + x);
-      *(image->rgb.blue + x)= *(oimage->rgb.blue + x);
-    }
-    image->rgb.used= oimage->rgb.used;
-
     pixlen= oimage->pixlen;
-    destptr= image->data;
-    srcline= oimage->data;
+    destptr= image->data + y0 * xwidth * image->pixlen;
     srclinelen= oimage->width * pixlen;
-    for (y= 0, ysrc= *(yindex + y); y < ywidth; y++) {
-      while (ysrc != *(yindex + y)) {
-	ysrc++;
-	srcline += srclinelen;
-      }
+    for (y= y0; y < y1; y++) {
+      srcline= oimage->data + *(yindex + y) * srclinelen;
 
       srcptr= srcline;
       value= memToVal(srcptr, image->pixlen);
@@ -179,17 +412,11 @@ Image *zoom(Image *oimage, unsigned int xzoom, unsigned int yzoom, boolean verbo
     break;
 
   case ITRUE:
-    if (!RGBP(oimage))
-      image= newTrueImage(xwidth, ywidth);
     pixlen= oimage->pixlen;
-    destptr= image->data;
-    srcline= oimage->data;
+    destptr= image->data + y0 * xwidth * image->pixlen;
     srclinelen= oimage->width * pixlen;
-    for (y= 0, ysrc= *(yindex + y); y < ywidth; y++) {
-      while (ysrc != *(yindex + y)) {
-	ysrc++;
-	srcline += srclinelen;
-      }
+    for (y= y0; y < y1; y++) {
+      srcline= oimage->data + *(yindex + y) * srclinelen;
 
       srcptr= srcline;
       value= memToVal(srcptr, image->pixlen);
@@ -220,6 +447,134 @@ Image *zoom(Image *oimage, unsigned int xzoom, unsigned int yzoom, boolean verbo
     }
     break;
   }
+}
+
+/* make the title of a zoomed image, and tell the user about the zoom
+ */
+
+void zoomTitle(char *buf, char *title, unsigned int xzoom, unsigned int yzoom,
+	       boolean verbose)
+{
+  if (!xzoom) {
+    if (verbose)
+      printf("  Zooming image Y axis by %d%%...", yzoom);
+    snprintf(buf, BUFSIZ, "%s (Y zoom %d%%)", title, yzoom);
+  }
+  else if (!yzoom) {
+    if (verbose)
+      printf("  Zooming image X axis by %d%%...", xzoom);
+    snprintf(buf, BUFSIZ, "%s (X zoom %d%%)", title, xzoom);
+  }
+  else if (xzoom == yzoom) {
+    if (verbose)
+      printf("  Zooming image by %d%%...", xzoom);
+    snprintf(buf, BUFSIZ, "%s (%d%% zoom)", title, xzoom);
+  }
+  else {
+    if (verbose)
+      printf("  Zooming image X axis by %d%% and Y axis by %d%%...",
+	     xzoom, yzoom);
+    snprintf(buf, BUFSIZ, "%s (X zoom %d%% Y zoom %d%%)", title,
+	    xzoom, yzoom);
+  }
+  buf[BUFSIZ-1] = '\0';
+}
+
+Image *zoom(Image *oimage, unsigned int xzoom, unsigned int yzoom, boolean verbose, boolean changetitle)
+{ char          buf[BUFSIZ];
+  float         gamma;
+  Image        *image;
+  unsigned int *xindex, *yindex;
+  unsigned int  xwidth, ywidth;
+  unsigned int  x, ydown;
+  ZoomJob       job;
+
+  CURRFUNC("zoom");
+
+  image = 0;
+  if ((!xzoom || xzoom==100) && (!yzoom || yzoom==100)) 
+    return(oimage);
+
+  zoomTitle(buf, oimage->title, xzoom, yzoom, verbose);
+  if (!changetitle)
+    strcpy(buf,oimage->title);
+
+  if (verbose)
+    fflush(stdout);
+  gamma= oimage->gamma;
+
+  /* a color image that's being shrunk has each of its pixels averaged
+   * from all the pixels under it, which makes it true color.
+   */
+
+  if (!BITMAPP(oimage) && zoomShrinks(xzoom, yzoom)) {
+    job.oimage= oimage;
+    job.map= zoomMap(oimage->width, oimage->height, xzoom, yzoom);
+    job.image= image= newTrueImage(job.map->width, job.map->height);
+    runBands(image->height, shrinkBand, &job);
+    freeZoomMap(job.map);
+    image->title= dupString(buf);
+    image->gamma= gamma;
+    if (verbose)
+      printf("done\n");
+    return(image);
+  }
+
+  xindex= zoomIndex(oimage->width, xzoom, &xwidth);
+  yindex= zoomIndex(oimage->height, yzoom, &ywidth);
+
+  switch (oimage->type) {
+  case IBITMAP:
+    image= newBitImage(xwidth, ywidth);
+    for (x= 0; x < oimage->rgb.used; x++) {
+      *(image->rgb.red + x)= *(oimage->rgb.red + x);
+      *(image->rgb.green + x)= *(oimage->rgb.green + x);
+      *(image->rgb.blue + x)= *(oimage->rgb.blue + x);
+    }
+    image->rgb.used= oimage->rgb.used;
+    break;
+
+  case IRGB:
+    image= newRGBImage(xwidth, ywidth, oimage->depth);
+    for (x= 0; x < oimage->rgb.used; x++) {
+      *(image->rgb.red + x)= *(oimage->rgb.red + x);
+      *(image->rgb.green + x)= *(oimage->rgb.green + x);
+      *(image->rgb.blue + x)= *(oimage->rgb.blue + x);
+    }
+    image->rgb.used= oimage->rgb.used;
+    break;
+
+  case ITRUE:
+    if (!RGBP(oimage))
+      image= newTrueImage(xwidth, ywidth);
+    break;
+  }
+
+  job.oimage= oimage;
+  job.image= image;
+  job.xindex= xindex;
+  job.yindex= yindex;
+
+  /* zooms by whole numbers of times are common (the zoom keys make
+   * them) and can be done without looking at each pixel.
+   */
+
+  if (zoomFactor(xzoom, &job.xup, &job.xdown) &&
+      zoomFactor(yzoom, &job.yup, &ydown)) {
+    if (BITMAPP(oimage) && 8 % job.xdown == 0) {
+      job.table= (job.xup > 1 || job.xdown > 1 ?
+		  bitZoomTable(job.xup, job.xdown) : NULL);
+      runBands(ywidth, bitFactorBand, &job);
+      if (job.table)
+	lfree(job.table);
+    }
+    else if (!BITMAPP(oimage) && oimage->pixlen == image->pixlen)
+      runBands(ywidth, factorBand, &job);
+    else
+      runBands(ywidth, zoomBand, &job);
+  }
+  else
+    runBands(ywidth, zoomBand, &job);
 
   image->title = dupString(buf);
   image->gamma= gamma;